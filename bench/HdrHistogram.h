@@ -0,0 +1,113 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+/**
+ * High dynamic range histogram of non-negative integer values (nanoseconds).
+ *
+ * Values are grouped into power-of-two buckets, each split into SUB_BUCKETS
+ * linear sub-buckets, so every recorded value keeps about three significant
+ * digits whether it is 800 ns or 8 s. Values past HIGHEST_TRACKABLE are
+ * clamped. Recording is a few shifts and an increment, and histograms from
+ * different processes merge by adding counts.
+ */
+class HdrHistogram {
+public:
+    static const int SUB_BUCKET_BITS = 11;                        // 2048 sub-buckets, < 0.1% error
+    static const uint64_t SUB_BUCKETS = (uint64_t)1 << SUB_BUCKET_BITS;
+    static const uint64_t HALF_SUB_BUCKETS = SUB_BUCKETS / 2;
+    static const int HIGHEST_BIT = 40;                            // about 18 minutes in ns
+    static const uint64_t HIGHEST_TRACKABLE = ((uint64_t)1 << HIGHEST_BIT) - 1;
+    static const size_t COUNTS_LEN = SUB_BUCKETS + (HIGHEST_BIT - SUB_BUCKET_BITS) * HALF_SUB_BUCKETS;
+
+    HdrHistogram() : counts_(COUNTS_LEN, 0), total_(0), min_(UINT64_MAX), max_(0), sum_(0) {}
+
+    void record(uint64_t value) {
+        if (value > HIGHEST_TRACKABLE) {
+            value = HIGHEST_TRACKABLE;
+        }
+        counts_[indexOf(value)]++;
+        total_++;
+        sum_ += value;
+        if (value < min_) min_ = value;
+        if (value > max_) max_ = value;
+    }
+
+    void merge(const HdrHistogram& other) {
+        for (size_t i = 0; i < COUNTS_LEN; ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        sum_ += other.sum_;
+        if (other.min_ < min_) min_ = other.min_;
+        if (other.max_ > max_) max_ = other.max_;
+    }
+
+    // Highest value equivalent to the one at the given percentile (0-100)
+    uint64_t valueAtPercentile(double percentile) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        uint64_t target = (uint64_t)(percentile / 100.0 * total_ + 0.5);
+        if (target < 1) target = 1;
+        if (target > total_) target = total_;
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < COUNTS_LEN; ++i) {
+            seen += counts_[i];
+            if (seen >= target) {
+                uint64_t high = highestEquivalent(i);
+                return high < max_ ? high : max_;
+            }
+        }
+        return max_;
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t min() const { return total_ ? min_ : 0; }
+    uint64_t max() const { return max_; }
+    double mean() const { return total_ ? (double)sum_ / total_ : 0.0; }
+
+    // Raw state, for shipping a histogram between processes
+    std::vector<uint64_t>& counts() { return counts_; }
+    uint64_t& total() { return total_; }
+    uint64_t& minValue() { return min_; }
+    uint64_t& maxValue() { return max_; }
+    uint64_t& sum() { return sum_; }
+
+private:
+    static int highestSetBit(uint64_t value) {
+        int bit = 0;
+        while (value >>= 1) {
+            ++bit;
+        }
+        return bit;
+    }
+
+    // Bucket 0 covers [0, SUB_BUCKETS) one by one, bucket b >= 1 covers
+    // [2^(b+10), 2^(b+11)) in steps of 2^b using the upper half of its sub-buckets
+    static size_t indexOf(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return (size_t)value;
+        }
+        int bucket = highestSetBit(value) - (SUB_BUCKET_BITS - 1);
+        uint64_t sub = value >> bucket;
+        return (size_t)(SUB_BUCKETS + (bucket - 1) * HALF_SUB_BUCKETS + (sub - HALF_SUB_BUCKETS));
+    }
+
+    static uint64_t highestEquivalent(size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        uint64_t offset = index - SUB_BUCKETS;
+        int bucket = (int)(offset / HALF_SUB_BUCKETS) + 1;
+        uint64_t sub = offset % HALF_SUB_BUCKETS + HALF_SUB_BUCKETS;
+        return ((sub + 1) << bucket) - 1;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_;
+    uint64_t min_;
+    uint64_t max_;
+    uint64_t sum_;
+};
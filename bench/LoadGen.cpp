@@ -0,0 +1,667 @@
+// Connection-scaling load generator and soak test (Linux).
+//
+// Holds thousands of publisher and subscriber connections to one broker from
+// a single epoll loop, speaking the wire protocol directly so connection
+// count is not bounded by the client library's one-subscriber-per-topic
+// model. On top of steady traffic it can churn connections (connect,
+// register, unregister, close) at a fixed rate.
+//
+// Every report interval it prints connection counts, connect and register
+// latency, delivery latency, and the broker's CPU, RSS and thread count read
+// from /proc, so scaling problems show up as a trend rather than a crash.
+//
+//   mmw_loadgen --subscribers 2000 --publishers 200 --topics 50 --rate 20000 --churn 100 --duration 60
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "IMmwMessageSerializer.h"
+#include "SerializerAbstraction.h"
+#include "MmwRegistration.h"
+#include "HdrHistogram.h"
+#include "LocalBroker.h"
+
+struct Options {
+    std::string broker;           // broker executable, empty to use an already running one
+    int brokerPid = -1;           // sampled for CPU/RSS/threads when the broker is not ours
+    int port = 5800;
+    int publishers = 100;
+    int subscribers = 1000;
+    int topics = 10;
+    size_t payload = 64;
+    long rate = 1000;             // publishes per second across all publishers
+    double churn = 0;             // connections replaced per second
+    long connectRate = 0;         // new connections opened per second, 0 for as fast as possible
+    double duration = 30.0;
+    double interval = 1.0;        // seconds between reports
+    bool reliable = false;
+    std::string serializer;
+    std::string output = "text";
+};
+
+enum ConnState {
+    CONN_CONNECTING,
+    CONN_REGISTERING,
+    CONN_ACTIVE
+};
+
+struct Conn {
+    int fd;
+    bool publisher;
+    int topic;
+    ConnState state;
+    uint32_t topicId;
+    uint64_t connectStartNs;
+    uint64_t lastHeartbeatNs;
+    size_t slot;                  // index in the connection list
+    std::string out;              // queued frames not yet accepted by the socket
+    size_t outPos;
+    std::string in;               // received bytes not yet parsed into frames
+};
+
+// Counters for one report interval, the totals use the same structure
+struct Stats {
+    uint64_t connected = 0;
+    uint64_t connectFailures = 0;
+    uint64_t rejected = 0;
+    uint64_t dropped = 0;         // closed by the broker or the network
+    uint64_t churned = 0;
+    uint64_t sent = 0;
+    uint64_t skipped = 0;         // not sent because the publisher's socket was backed up
+    uint64_t delivered = 0;
+    HdrHistogram connectLatency;  // connect() until the "registered" reply
+    HdrHistogram deliveryLatency;
+};
+
+struct ProcSample {
+    bool valid = false;
+    uint64_t cpuTicks = 0;
+    uint64_t rssKb = 0;
+    uint64_t threads = 0;
+};
+
+static const size_t MAX_QUEUED_BYTES = 1 << 20;
+static const uint64_t HEARTBEAT_INTERVAL_NS = 1000000000ull;
+
+static Options options;
+static IMmwMessageSerializer* serializer = nullptr;
+static int epollFd = -1;
+static std::vector<Conn*> conns;
+static std::unordered_map<int, Conn*> connsByFd;
+static std::vector<std::pair<bool, int>> pendingOpens;   // role and topic waiting to connect
+static Stats interval;
+static Stats total;
+static std::mt19937 rng(12345);
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static std::string topicName(int topic) {
+    return "load/" + std::to_string(topic);
+}
+
+static ProcSample sampleProcess(int pid) {
+    ProcSample sample;
+    if (pid <= 0) {
+        return sample;
+    }
+
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line)) {
+        return sample;
+    }
+    // Fields after the parenthesised command name, utime and stime are the 12th and 13th of them
+    size_t close = line.rfind(')');
+    if (close == std::string::npos) {
+        return sample;
+    }
+    char state;
+    unsigned long long fields[13] = {};
+    if (sscanf(line.c_str() + close + 1, " %c %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+               &state, &fields[0], &fields[1], &fields[2], &fields[3], &fields[4], &fields[5], &fields[6],
+               &fields[7], &fields[8], &fields[9], &fields[10], &fields[11]) != 13) {
+        return sample;
+    }
+    sample.cpuTicks = fields[10] + fields[11];
+
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) sample.rssKb = strtoull(line.c_str() + 6, nullptr, 10);
+        if (line.compare(0, 8, "Threads:") == 0) sample.threads = strtoull(line.c_str() + 8, nullptr, 10);
+    }
+    sample.valid = true;
+    return sample;
+}
+
+static void updateEvents(Conn* conn) {
+    epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    if (conn->state == CONN_CONNECTING || conn->outPos < conn->out.size()) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.ptr = conn;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->fd, &ev);
+}
+
+static void removeConn(Conn* conn) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+    close(conn->fd);
+    connsByFd.erase(conn->fd);
+
+    Conn* last = conns.back();
+    conns[conn->slot] = last;
+    last->slot = conn->slot;
+    conns.pop_back();
+    delete conn;
+}
+
+// Replace a connection that went away so the population stays at its target size
+static void replaceConn(Conn* conn) {
+    pendingOpens.push_back(std::make_pair(conn->publisher, conn->topic));
+    removeConn(conn);
+}
+
+// Returns false if the connection failed and was replaced
+static bool flush(Conn* conn) {
+    bool hadBacklog = conn->outPos < conn->out.size();
+    while (conn->outPos < conn->out.size()) {
+        ssize_t n = send(conn->fd, conn->out.data() + conn->outPos, conn->out.size() - conn->outPos,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) {
+            interval.dropped++;
+            replaceConn(conn);
+            return false;
+        }
+        conn->outPos += (size_t)n;
+    }
+
+    if (conn->outPos == conn->out.size()) {
+        conn->out.clear();
+        conn->outPos = 0;
+    }
+    if (hadBacklog != (conn->outPos < conn->out.size())) {
+        updateEvents(conn);
+    }
+    return true;
+}
+
+static bool sendFrame(Conn* conn, const MmwMessage& msg) {
+    std::string body = serializer->serialize(msg);
+    uint32_t len = htonl((uint32_t)body.size());
+    conn->out.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    conn->out.append(body);
+    return flush(conn);
+}
+
+static void openConn(bool publisher, int topic) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        interval.connectFailures++;
+        pendingOpens.push_back(std::make_pair(publisher, topic));
+        return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    Conn* conn = new Conn();
+    conn->fd = fd;
+    conn->publisher = publisher;
+    conn->topic = topic;
+    conn->state = CONN_CONNECTING;
+    conn->topicId = 0;
+    conn->connectStartNs = nowNs();
+    conn->lastHeartbeatNs = conn->connectStartNs;
+    conn->slot = conns.size();
+    conn->outPos = 0;
+    conns.push_back(conn);
+    connsByFd[fd] = conn;
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.ptr = conn;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)options.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        interval.connectFailures++;
+        replaceConn(conn);
+    }
+}
+
+static void onConnected(Conn* conn) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0) {
+        interval.connectFailures++;
+        replaceConn(conn);
+        return;
+    }
+
+    conn->state = CONN_REGISTERING;
+    updateEvents(conn);
+
+    MmwRegistration reg;
+    reg.role = conn->publisher ? "publisher" : "subscriber";
+    MmwMessage msg{0, "register", topicName(conn->topic), reg.encode()};
+    sendFrame(conn, msg);
+}
+
+// Returns false if the connection was replaced
+static bool onFrame(Conn* conn, const char* data, size_t len) {
+    MmwMessageView view;
+    MmwMessage backing{};
+    try {
+        serializer->deserialize_view(data, len, false, view, backing);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Bad frame on fd=%d: %s\n", conn->fd, e.what());
+        return true;
+    }
+
+    if (view.isType("registered")) {
+        conn->state = CONN_ACTIVE;
+        conn->topicId = view.topicId;
+        interval.connected++;
+        interval.connectLatency.record(nowNs() - conn->connectStartNs);
+    } else if (view.isType("rejected")) {
+        interval.rejected++;
+        replaceConn(conn);
+        return false;
+    } else if (view.isType("publish")) {
+        if (view.size >= sizeof(uint64_t)) {
+            uint64_t sentNs;
+            memcpy(&sentNs, view.payload, sizeof(sentNs));
+            uint64_t now = nowNs();
+            interval.deliveryLatency.record(now > sentNs ? now - sentNs : 0);
+            interval.delivered++;
+        }
+        if (view.reliability) {
+            MmwMessage ack{view.messageId, "ack", topicName(conn->topic), ""};
+            return sendFrame(conn, ack);
+        }
+    }
+    return true;
+}
+
+static void onReadable(Conn* conn) {
+    char buf[64 * 1024];
+    for (;;) {
+        ssize_t n = recv(conn->fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) {
+            interval.dropped++;
+            replaceConn(conn);
+            return;
+        }
+        conn->in.append(buf, (size_t)n);
+    }
+
+    size_t pos = 0;
+    while (conn->in.size() - pos >= sizeof(uint32_t)) {
+        uint32_t len;
+        memcpy(&len, conn->in.data() + pos, sizeof(len));
+        len = ntohl(len);
+        if (conn->in.size() - pos - sizeof(len) < len) {
+            break;
+        }
+        if (!onFrame(conn, conn->in.data() + pos + sizeof(len), len)) {
+            return;
+        }
+        pos += sizeof(len) + len;
+    }
+    conn->in.erase(0, pos);
+}
+
+// Close a random registered connection the polite way and open its replacement
+static void churnOne() {
+    for (int attempt = 0; attempt < 16 && !conns.empty(); ++attempt) {
+        Conn* conn = conns[rng() % conns.size()];
+        if (conn->state != CONN_ACTIVE) {
+            continue;
+        }
+        MmwMessage msg{0, "unregister", topicName(conn->topic), ""};
+        if (sendFrame(conn, msg)) {
+            replaceConn(conn);
+        }
+        interval.churned++;
+        return;
+    }
+}
+
+static void publishOne(size_t& cursor, std::string& payload) {
+    // Round-robin over publishers, skipping ones that are not registered or are backed up
+    for (size_t tried = 0; tried < conns.size(); ++tried) {
+        Conn* conn = conns[cursor++ % conns.size()];
+        if (!conn->publisher || conn->state != CONN_ACTIVE) {
+            continue;
+        }
+        if (conn->out.size() - conn->outPos > MAX_QUEUED_BYTES) {
+            interval.skipped++;
+            return;
+        }
+
+        uint64_t now = nowNs();
+        memcpy(&payload[0], &now, sizeof(now));
+        MmwMessage msg{0, "publish", "", payload};
+        msg.size = payload.size();
+        msg.reliability = options.reliable;
+        msg.topicId = conn->topicId;
+        msg.rawPayload = true;
+        interval.sent++;
+        sendFrame(conn, msg);
+        return;
+    }
+    interval.skipped++;
+}
+
+static void sendHeartbeats(uint64_t now) {
+    MmwMessage hb{};
+    hb.type = "heartbeat";
+    for (size_t i = 0; i < conns.size();) {
+        Conn* conn = conns[i];
+        if (!conn->publisher && conn->state == CONN_ACTIVE && now - conn->lastHeartbeatNs >= HEARTBEAT_INTERVAL_NS) {
+            conn->lastHeartbeatNs = now;
+            if (!sendFrame(conn, hb)) {
+                continue; // the slot now holds another connection
+            }
+        }
+        ++i;
+    }
+}
+
+static void mergeStats(Stats& into, const Stats& from) {
+    into.connected += from.connected;
+    into.connectFailures += from.connectFailures;
+    into.rejected += from.rejected;
+    into.dropped += from.dropped;
+    into.churned += from.churned;
+    into.sent += from.sent;
+    into.skipped += from.skipped;
+    into.delivered += from.delivered;
+    into.connectLatency.merge(from.connectLatency);
+    into.deliveryLatency.merge(from.deliveryLatency);
+}
+
+static void report(double elapsed, double seconds, const ProcSample& before, const ProcSample& after) {
+    size_t active = 0;
+    size_t connecting = 0;
+    for (Conn* conn : conns) {
+        if (conn->state == CONN_ACTIVE) active++;
+        else connecting++;
+    }
+
+    double cpu = -1;
+    if (before.valid && after.valid && seconds > 0) {
+        cpu = 100.0 * (after.cpuTicks - before.cpuTicks) / sysconf(_SC_CLK_TCK) / seconds;
+    }
+
+    if (options.output == "csv") {
+        printf("%.1f,%zu,%zu,%zu,%llu,%llu,%llu,%llu,%llu,%.0f,%.0f,%llu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%llu\n",
+               elapsed, active, connecting, pendingOpens.size(),
+               (unsigned long long)interval.connected, (unsigned long long)interval.connectFailures,
+               (unsigned long long)interval.rejected, (unsigned long long)interval.dropped,
+               (unsigned long long)interval.churned, interval.sent / seconds, interval.delivered / seconds,
+               (unsigned long long)interval.skipped,
+               interval.connectLatency.valueAtPercentile(50) / 1e3, interval.connectLatency.valueAtPercentile(99) / 1e3,
+               interval.connectLatency.max() / 1e3,
+               interval.deliveryLatency.valueAtPercentile(50) / 1e3, interval.deliveryLatency.valueAtPercentile(99) / 1e3,
+               interval.deliveryLatency.max() / 1e3,
+               cpu, after.rssKb / 1024.0, (unsigned long long)after.threads);
+    } else {
+        printf("%6.1fs conns %6zu (+%zu connecting, %zu waiting) | new %5llu fail %3llu rej %3llu drop %3llu churn %4llu"
+               " | connect ms p50 %7.2f p99 %7.2f max %7.2f | msg/s out %7.0f in %8.0f skip %5llu"
+               " | deliver ms p50 %7.2f p99 %7.2f max %8.2f | broker cpu %5.1f%% rss %6.1f MB threads %4llu\n",
+               elapsed, active, connecting, pendingOpens.size(),
+               (unsigned long long)interval.connected, (unsigned long long)interval.connectFailures,
+               (unsigned long long)interval.rejected, (unsigned long long)interval.dropped,
+               (unsigned long long)interval.churned,
+               interval.connectLatency.valueAtPercentile(50) / 1e6, interval.connectLatency.valueAtPercentile(99) / 1e6,
+               interval.connectLatency.max() / 1e6,
+               interval.sent / seconds, interval.delivered / seconds, (unsigned long long)interval.skipped,
+               interval.deliveryLatency.valueAtPercentile(50) / 1e6, interval.deliveryLatency.valueAtPercentile(99) / 1e6,
+               interval.deliveryLatency.max() / 1e6,
+               cpu, after.rssKb / 1024.0, (unsigned long long)after.threads);
+    }
+    fflush(stdout);
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --broker PATH        broker executable (default: next to this tool), 'none' to use a running broker\n"
+        "  --broker-pid PID     process to sample for CPU/RSS/threads when using a running broker\n"
+        "  --port N             broker port (default 5800)\n"
+        "  --publishers N       publisher connections (default 100)\n"
+        "  --subscribers N      subscriber connections (default 1000)\n"
+        "  --topics N           topics the connections are spread over (default 10)\n"
+        "  --payload BYTES      payload size, at least 8 (default 64)\n"
+        "  --rate N             publishes/s across all publishers (default 1000)\n"
+        "  --churn N            connections unregistered, closed and replaced per second (default 0)\n"
+        "  --connect-rate N     cap on new connections per second, 0 for no cap (default 0)\n"
+        "  --duration SECONDS   run time (default 30)\n"
+        "  --interval SECONDS   report interval (default 1)\n"
+        "  --reliable           publish with reliability set, subscribers ack\n"
+        "  --serializer NAME    cereal, json or binary (default: build default)\n"
+        "  --output text|csv\n",
+        argv0);
+}
+
+static bool parseOptions(int argc, char* argv[]) {
+    options.broker = defaultBrokerPath();
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--reliable") {
+            options.reliable = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--broker") options.broker = strcmp(value, "none") == 0 ? "" : value;
+        else if (arg == "--broker-pid") options.brokerPid = atoi(value);
+        else if (arg == "--port") options.port = atoi(value);
+        else if (arg == "--publishers") options.publishers = atoi(value);
+        else if (arg == "--subscribers") options.subscribers = atoi(value);
+        else if (arg == "--topics") options.topics = atoi(value);
+        else if (arg == "--payload") options.payload = (size_t)atol(value);
+        else if (arg == "--rate") options.rate = atol(value);
+        else if (arg == "--churn") options.churn = atof(value);
+        else if (arg == "--connect-rate") options.connectRate = atol(value);
+        else if (arg == "--duration") options.duration = atof(value);
+        else if (arg == "--interval") options.interval = atof(value);
+        else if (arg == "--serializer") options.serializer = value;
+        else if (arg == "--output") options.output = value;
+        else return false;
+    }
+    return options.publishers >= 0 && options.subscribers >= 0 && options.topics > 0 &&
+           options.payload >= sizeof(uint64_t) && options.rate >= 0 && options.churn >= 0 &&
+           options.duration > 0 && options.interval > 0 &&
+           (options.output == "text" || options.output == "csv");
+}
+
+int main(int argc, char* argv[]) {
+    if (!parseOptions(argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    MmwSerializerFormat format = DefaultSerializerFormat();
+    if (options.serializer == "cereal") format = MMW_SERIALIZER_CEREAL;
+    if (options.serializer == "json") format = MMW_SERIALIZER_JSON;
+    if (options.serializer == "binary") format = MMW_SERIALIZER_BINARY;
+    serializer = CreateSerializer(format);
+
+    // Raise the fd limit before the broker is started so it inherits it too
+    size_t wanted = (size_t)options.publishers + options.subscribers + 64;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < wanted) {
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, wanted * 2);
+        setrlimit(RLIMIT_NOFILE, &limit);
+        getrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur < wanted) {
+            fprintf(stderr, "Warning: fd limit %llu is below the %zu connections requested\n",
+                    (unsigned long long)limit.rlim_cur, wanted);
+        }
+    }
+
+    LocalBroker broker;
+    if (!options.broker.empty()) {
+        if (!startLocalBroker(options.broker, options.port, broker)) {
+            return 1;
+        }
+        options.brokerPid = broker.pid;
+    }
+
+    epollFd = epoll_create1(0);
+    for (int i = 0; i < options.subscribers; ++i) {
+        pendingOpens.push_back(std::make_pair(false, i % options.topics));
+    }
+    for (int i = 0; i < options.publishers; ++i) {
+        pendingOpens.push_back(std::make_pair(true, i % options.topics));
+    }
+    std::shuffle(pendingOpens.begin(), pendingOpens.end(), rng);
+
+    if (options.output == "csv") {
+        printf("elapsed_s,active,connecting,waiting,connected,connect_failures,rejected,dropped,churned,"
+               "sent_per_s,delivered_per_s,skipped,connect_p50_us,connect_p99_us,connect_max_us,"
+               "deliver_p50_us,deliver_p99_us,deliver_max_us,broker_cpu_pct,broker_rss_mb,broker_threads\n");
+    }
+
+    std::string payload(options.payload, 'x');
+    size_t cursor = 0;
+    uint64_t start = nowNs();
+    uint64_t end = start + (uint64_t)(options.duration * 1e9);
+    uint64_t intervalNs = (uint64_t)(options.interval * 1e9);
+    uint64_t nextReport = start + intervalNs;
+    uint64_t lastReport = start;
+    uint64_t published = 0;
+    double churnDue = 0;
+    double opensDue = 0;
+    uint64_t lastTick = start;
+    ProcSample lastSample = sampleProcess(options.brokerPid);
+    ProcSample peak;
+    std::vector<epoll_event> events(1024);
+
+    for (;;) {
+        uint64_t now = nowNs();
+        if (now >= end) {
+            break;
+        }
+        double dt = (now - lastTick) / 1e9;
+        lastTick = now;
+
+        // Open queued connections, all at once unless capped
+        size_t opens = pendingOpens.size();
+        if (options.connectRate > 0) {
+            opensDue = std::min(opensDue + dt * options.connectRate, (double)options.connectRate);
+            opens = std::min(opens, (size_t)opensDue);
+            opensDue -= opens;
+        }
+        for (size_t i = 0; i < opens; ++i) {
+            std::pair<bool, int> next = pendingOpens.back();
+            pendingOpens.pop_back();
+            openConn(next.first, next.second);
+        }
+
+        churnDue += dt * options.churn;
+        while (churnDue >= 1.0) {
+            churnOne();
+            churnDue -= 1.0;
+        }
+
+        // Publish what the schedule says is due by now
+        uint64_t due = (uint64_t)((now - start) / 1e9 * options.rate);
+        while (published < due && options.publishers > 0) {
+            publishOne(cursor, payload);
+            published++;
+        }
+
+        sendHeartbeats(now);
+
+        int n = epoll_wait(epollFd, events.data(), (int)events.size(), 1);
+        for (int i = 0; i < n; ++i) {
+            Conn* conn = static_cast<Conn*>(events[i].data.ptr);
+            // A connection replaced earlier in this batch may have been freed
+            auto it = connsByFd.find(conn->fd);
+            if (it == connsByFd.end() || it->second != conn) {
+                continue;
+            }
+            if (conn->state == CONN_CONNECTING && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                onConnected(conn);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                onReadable(conn);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                flush(conn);
+            }
+        }
+
+        now = nowNs();
+        if (now >= nextReport) {
+            ProcSample sample = sampleProcess(options.brokerPid);
+            report((now - start) / 1e9, (now - lastReport) / 1e9, lastSample, sample);
+            peak.rssKb = std::max(peak.rssKb, sample.rssKb);
+            peak.threads = std::max(peak.threads, sample.threads);
+            lastSample = sample;
+            mergeStats(total, interval);
+            interval = Stats();
+            lastReport = now;
+            nextReport += intervalNs;
+        }
+    }
+    mergeStats(total, interval);
+
+    double seconds = (nowNs() - start) / 1e9;
+    fprintf(stderr,
+            "\nSummary over %.1f s: %llu registrations, %llu connect failures, %llu rejected, %llu dropped, %llu churned\n"
+            "  connect ms p50 %.2f p99 %.2f p99.9 %.2f max %.2f\n"
+            "  messages sent %llu (%.0f/s), delivered %llu (%.0f/s), skipped %llu\n"
+            "  deliver ms p50 %.2f p99 %.2f p99.9 %.2f max %.2f\n"
+            "  broker peak rss %.1f MB, peak threads %llu\n",
+            seconds, (unsigned long long)total.connected, (unsigned long long)total.connectFailures,
+            (unsigned long long)total.rejected, (unsigned long long)total.dropped, (unsigned long long)total.churned,
+            total.connectLatency.valueAtPercentile(50) / 1e6, total.connectLatency.valueAtPercentile(99) / 1e6,
+            total.connectLatency.valueAtPercentile(99.9) / 1e6, total.connectLatency.max() / 1e6,
+            (unsigned long long)total.sent, total.sent / seconds, (unsigned long long)total.delivered,
+            total.delivered / seconds, (unsigned long long)total.skipped,
+            total.deliveryLatency.valueAtPercentile(50) / 1e6, total.deliveryLatency.valueAtPercentile(99) / 1e6,
+            total.deliveryLatency.valueAtPercentile(99.9) / 1e6, total.deliveryLatency.max() / 1e6,
+            peak.rssKb / 1024.0, (unsigned long long)peak.threads);
+
+    while (!conns.empty()) {
+        removeConn(conns.back());
+    }
+    close(epollFd);
+    stopLocalBroker(broker);
+    delete serializer;
+    return 0;
+}
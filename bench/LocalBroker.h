@@ -0,0 +1,105 @@
+#pragma once
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Broker process owned by a benchmark tool (Linux).
+ *
+ * The broker runs in a scratch directory so its database and log stay out of
+ * the way, and is stopped with SIGTERM like an operator would.
+ */
+struct LocalBroker {
+    pid_t pid = -1;
+    std::string workDir;
+};
+
+inline bool brokerAccepting(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bool ok = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    close(fd);
+    return ok;
+}
+
+// The broker target is built into the same directory as the benchmark tools
+inline std::string defaultBrokerPath() {
+    char self[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n <= 0) {
+        return "broker";
+    }
+    self[n] = '\0';
+    std::string path(self);
+    return path.substr(0, path.rfind('/') + 1) + "broker";
+}
+
+// Start the broker and wait until it accepts connections, false if it never does
+inline bool startLocalBroker(const std::string& executable, int port, LocalBroker& broker) {
+    char resolved[PATH_MAX];
+    if (!realpath(executable.c_str(), resolved)) {
+        fprintf(stderr, "Broker executable %s not found\n", executable.c_str());
+        return false;
+    }
+
+    char dirTemplate[] = "/tmp/mmw_bench.XXXXXX";
+    if (!mkdtemp(dirTemplate)) {
+        perror("mkdtemp");
+        return false;
+    }
+    broker.workDir = dirTemplate;
+
+    broker.pid = fork();
+    if (broker.pid < 0) {
+        perror("fork");
+        return false;
+    }
+    if (broker.pid == 0) {
+        if (chdir(broker.workDir.c_str()) != 0) {
+            _exit(1);
+        }
+        int log = open("broker.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        dup2(log, STDOUT_FILENO);
+        dup2(log, STDERR_FILENO);
+        std::string portArg = std::to_string(port);
+        execl(resolved, resolved, portArg.c_str(), (char*)nullptr);
+        _exit(127);
+    }
+
+    for (int i = 0; i < 100; ++i) {
+        if (brokerAccepting(port)) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    fprintf(stderr, "Broker did not start listening on port %d, see %s/broker.log\n", port, broker.workDir.c_str());
+    kill(broker.pid, SIGTERM);
+    waitpid(broker.pid, nullptr, 0);
+    broker.pid = -1;
+    return false;
+}
+
+inline void stopLocalBroker(LocalBroker& broker) {
+    if (broker.pid > 0) {
+        kill(broker.pid, SIGTERM);
+        waitpid(broker.pid, nullptr, 0);
+        broker.pid = -1;
+    }
+    if (!broker.workDir.empty()) {
+        fprintf(stderr, "Broker log and database in %s\n", broker.workDir.c_str());
+    }
+}
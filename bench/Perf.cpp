@@ -0,0 +1,471 @@
+// End-to-end latency and throughput benchmark (Linux).
+//
+// Starts a broker on a local port, forks one process per subscriber and per
+// publisher (the client library keeps one subscriber per topic per process),
+// and has publishers stamp each message with CLOCK_MONOTONIC, which is shared
+// by every process on the host. Subscribers record one-way latency into HDR
+// histograms that the parent merges and reports.
+//
+// With a fixed rate the stamp is the time the message was scheduled to go
+// out, not when the send call ran, so stalls in the publisher or the broker
+// show up as latency instead of silently lowering the rate.
+//
+//   mmw_perf --publishers 2 --subscribers 2 --topics 1 --payload 256 --rate 10000 --duration 10
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+
+#include "MMW.h"
+#include "HdrHistogram.h"
+#include "LocalBroker.h"
+
+struct Options {
+    std::string broker;           // broker executable, empty to use an already running one
+    int port = 5700;
+    int publishers = 1;
+    int subscribers = 1;          // per topic
+    int topics = 1;
+    size_t payload = 64;
+    long rate = 1000;             // messages per second per publisher, 0 for as fast as possible
+    double duration = 5.0;        // seconds measured
+    double warmup = 1.0;          // seconds sent before measuring, not recorded
+    long drainMs = 1000;          // wait for in-flight messages after the publishers stop
+    bool reliable = false;
+    std::string serializer;       // empty for the build default
+    std::string output = "text";
+};
+
+// Leads every payload, the rest is filler up to the configured size
+struct PerfHeader {
+    uint64_t sendNs;
+    uint32_t publisher;
+    uint32_t flags;
+};
+
+static const uint32_t PERF_FLAG_WARMUP = 1;
+
+struct PublisherResult {
+    uint64_t sent;
+    uint64_t errors;
+    uint64_t elapsedNs;
+};
+
+struct SubscriberState {
+    HdrHistogram latency;
+    uint64_t received = 0;
+    uint64_t warmup = 0;
+};
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static bool writeAll(int fd, const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* data, size_t len) {
+    char* p = static_cast<char*>(data);
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool writeHistogram(int fd, HdrHistogram& h) {
+    return writeAll(fd, &h.total(), sizeof(uint64_t)) &&
+           writeAll(fd, &h.minValue(), sizeof(uint64_t)) &&
+           writeAll(fd, &h.maxValue(), sizeof(uint64_t)) &&
+           writeAll(fd, &h.sum(), sizeof(uint64_t)) &&
+           writeAll(fd, h.counts().data(), h.counts().size() * sizeof(uint64_t));
+}
+
+static bool readHistogram(int fd, HdrHistogram& h) {
+    return readAll(fd, &h.total(), sizeof(uint64_t)) &&
+           readAll(fd, &h.minValue(), sizeof(uint64_t)) &&
+           readAll(fd, &h.maxValue(), sizeof(uint64_t)) &&
+           readAll(fd, &h.sum(), sizeof(uint64_t)) &&
+           readAll(fd, h.counts().data(), h.counts().size() * sizeof(uint64_t));
+}
+
+// A forked publisher or subscriber, talking to the parent over two pipes
+struct Child {
+    pid_t pid;
+    int control;   // parent writes, EOF tells a subscriber to stop
+    int results;   // child writes readiness and then its results
+};
+
+// Parent ends of every pipe created so far, closed in each new child so EOFs arrive
+static std::vector<int> parentFds;
+
+static std::string topicName(int topic) {
+    return "perf/" + std::to_string(topic);
+}
+
+static void setupClient(const Options& options) {
+    mmw_set_log_level(MMW_LOG_LEVEL_OFF);
+    if (options.serializer == "cereal") mmw_set_serializer(MMW_SERIALIZER_CEREAL);
+    if (options.serializer == "json") mmw_set_serializer(MMW_SERIALIZER_JSON);
+    if (options.serializer == "binary") mmw_set_serializer(MMW_SERIALIZER_BINARY);
+    if (mmw_initialize("127.0.0.1", (unsigned short)options.port) != MMW_OK) {
+        fprintf(stderr, "mmw_initialize failed\n");
+        _exit(1);
+    }
+}
+
+static void onMessage(const char* topic, const void* message, size_t size, void* userData) {
+    uint64_t now = nowNs();
+    if (size < sizeof(PerfHeader)) {
+        return;
+    }
+    PerfHeader header;
+    memcpy(&header, message, sizeof(header));
+
+    SubscriberState* state = static_cast<SubscriberState*>(userData);
+    if (header.flags & PERF_FLAG_WARMUP) {
+        state->warmup++;
+        return;
+    }
+    state->latency.record(now > header.sendNs ? now - header.sendNs : 0);
+    state->received++;
+}
+
+static void runSubscriber(const Options& options, int topic, int control, int results) {
+    setupClient(options);
+
+    SubscriberState* state = new SubscriberState();
+    MmwSubscriberOptions subOptions = {};
+    subOptions.userData = state;
+    if (mmw_create_subscriber_sized(topicName(topic).c_str(), onMessage, &subOptions) != MMW_OK) {
+        fprintf(stderr, "Subscriber failed to register on %s\n", topicName(topic).c_str());
+        _exit(1);
+    }
+    char ready = 'R';
+    writeAll(results, &ready, 1);
+
+    // Runs until the parent closes the control pipe
+    char c;
+    while (read(control, &c, 1) > 0) {
+    }
+
+    mmw_cleanup();
+    writeAll(results, &state->received, sizeof(uint64_t));
+    writeAll(results, &state->warmup, sizeof(uint64_t));
+    writeHistogram(results, state->latency);
+    _exit(0);
+}
+
+static void runPublisher(const Options& options, int id, int control, int results) {
+    setupClient(options);
+
+    mmw_publisher_t publisher;
+    if (mmw_create_publisher_handle(topicName(id % options.topics).c_str(), &publisher) != MMW_OK) {
+        fprintf(stderr, "Publisher %d failed to register\n", id);
+        _exit(1);
+    }
+    char ready = 'R';
+    writeAll(results, &ready, 1);
+
+    char go;
+    if (!readAll(control, &go, 1)) {
+        _exit(1);
+    }
+
+    std::vector<char> payload(std::max(options.payload, sizeof(PerfHeader)), 'x');
+    PerfHeader header = {};
+    header.publisher = (uint32_t)id;
+    MmwReliability reliability = options.reliable ? MMW_RELIABLE : MMW_BEST_EFFORT;
+
+    uint64_t interval = options.rate > 0 ? 1000000000ull / (uint64_t)options.rate : 0;
+    uint64_t start = nowNs();
+    uint64_t measureStart = start + (uint64_t)(options.warmup * 1e9);
+    uint64_t end = measureStart + (uint64_t)(options.duration * 1e9);
+    uint64_t next = start;
+    PublisherResult result = {};
+
+    for (;;) {
+        uint64_t now = nowNs();
+        if (interval > 0) {
+            // Sleep most of the gap and spin the rest, sleeps alone overshoot by tens of microseconds
+            while (now < next) {
+                if (next - now > 200000) {
+                    std::this_thread::sleep_for(std::chrono::nanoseconds(next - now - 100000));
+                }
+                now = nowNs();
+            }
+        }
+        if (now >= end) {
+            break;
+        }
+
+        header.sendNs = interval > 0 ? next : now;
+        header.flags = header.sendNs < measureStart ? PERF_FLAG_WARMUP : 0;
+        memcpy(payload.data(), &header, sizeof(header));
+
+        if (mmw_publish_raw_handle(publisher, payload.data(), payload.size(), reliability) != MMW_OK) {
+            result.errors++;
+        } else if (!(header.flags & PERF_FLAG_WARMUP)) {
+            result.sent++;
+        }
+        next += interval;
+    }
+    result.elapsedNs = nowNs() - measureStart;
+
+    mmw_cleanup();
+    writeAll(results, &result, sizeof(result));
+    _exit(0);
+}
+
+template <typename Body>
+static Child forkChild(Body body) {
+    int control[2];
+    int results[2];
+    if (pipe(control) != 0 || pipe(results) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        for (int fd : parentFds) {
+            close(fd);
+        }
+        close(control[1]);
+        close(results[0]);
+        body(control[0], results[1]);
+        _exit(0);
+    }
+
+    close(control[0]);
+    close(results[1]);
+    parentFds.push_back(control[1]);
+    parentFds.push_back(results[0]);
+    Child child = { pid, control[1], results[0] };
+    return child;
+}
+
+static bool waitReady(const Child& child) {
+    char ready;
+    return readAll(child.results, &ready, 1) && ready == 'R';
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  --broker PATH        broker executable (default: next to this tool), 'none' to use a running broker\n"
+        "  --port N             broker port (default 5700)\n"
+        "  --publishers N       publisher processes (default 1)\n"
+        "  --subscribers N      subscriber processes per topic (default 1)\n"
+        "  --topics N           topics, publishers are spread across them (default 1)\n"
+        "  --payload BYTES      payload size, at least %zu (default 64)\n"
+        "  --rate N             messages/s per publisher, 0 for unlimited (default 1000)\n"
+        "  --duration SECONDS   measured time (default 5)\n"
+        "  --warmup SECONDS     unmeasured time before that (default 1)\n"
+        "  --drain-ms N         wait for in-flight messages (default 1000)\n"
+        "  --reliable           publish with MMW_RELIABLE\n"
+        "  --serializer NAME    cereal, json or binary (default: build default)\n"
+        "  --output text|json\n",
+        argv0, sizeof(PerfHeader));
+}
+
+static bool parseOptions(int argc, char* argv[], Options& options) {
+    options.broker = defaultBrokerPath();
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--reliable") {
+            options.reliable = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (arg == "--broker") options.broker = strcmp(value, "none") == 0 ? "" : value;
+        else if (arg == "--port") options.port = atoi(value);
+        else if (arg == "--publishers") options.publishers = atoi(value);
+        else if (arg == "--subscribers") options.subscribers = atoi(value);
+        else if (arg == "--topics") options.topics = atoi(value);
+        else if (arg == "--payload") options.payload = (size_t)atol(value);
+        else if (arg == "--rate") options.rate = atol(value);
+        else if (arg == "--duration") options.duration = atof(value);
+        else if (arg == "--warmup") options.warmup = atof(value);
+        else if (arg == "--drain-ms") options.drainMs = atol(value);
+        else if (arg == "--serializer") options.serializer = value;
+        else if (arg == "--output") options.output = value;
+        else return false;
+    }
+    return options.publishers > 0 && options.subscribers >= 0 && options.topics > 0 &&
+           options.payload >= sizeof(PerfHeader) && options.rate >= 0 && options.duration > 0 &&
+           (options.output == "text" || options.output == "json");
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    LocalBroker broker;
+    if (!options.broker.empty() && !startLocalBroker(options.broker, options.port, broker)) {
+        return 1;
+    }
+
+    std::vector<Child> subscribers;
+    for (int t = 0; t < options.topics; ++t) {
+        for (int s = 0; s < options.subscribers; ++s) {
+            subscribers.push_back(forkChild([&](int control, int results) {
+                runSubscriber(options, t, control, results);
+            }));
+        }
+    }
+    for (const Child& child : subscribers) {
+        if (!waitReady(child)) {
+            fprintf(stderr, "A subscriber failed to start\n");
+            return 1;
+        }
+    }
+
+    std::vector<Child> publishers;
+    for (int p = 0; p < options.publishers; ++p) {
+        publishers.push_back(forkChild([&](int control, int results) {
+            runPublisher(options, p, control, results);
+        }));
+    }
+    for (const Child& child : publishers) {
+        if (!waitReady(child)) {
+            fprintf(stderr, "A publisher failed to start\n");
+            return 1;
+        }
+    }
+
+    char go = 'G';
+    for (const Child& child : publishers) {
+        writeAll(child.control, &go, 1);
+    }
+
+    // Publishers report when their run is over
+    std::vector<uint64_t> sentPerTopic(options.topics, 0);
+    uint64_t sent = 0;
+    uint64_t errors = 0;
+    uint64_t elapsedNs = 0;
+    for (int p = 0; p < options.publishers; ++p) {
+        PublisherResult result = {};
+        if (!readAll(publishers[p].results, &result, sizeof(result))) {
+            fprintf(stderr, "Publisher %d exited without results\n", p);
+            continue;
+        }
+        sent += result.sent;
+        errors += result.errors;
+        sentPerTopic[p % options.topics] += result.sent;
+        elapsedNs = std::max(elapsedNs, result.elapsedNs);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.drainMs));
+
+    HdrHistogram latency;
+    uint64_t received = 0;
+    for (const Child& child : subscribers) {
+        close(child.control);
+    }
+    for (const Child& child : subscribers) {
+        uint64_t childReceived = 0;
+        uint64_t childWarmup = 0;
+        HdrHistogram childLatency;
+        if (readAll(child.results, &childReceived, sizeof(uint64_t)) &&
+            readAll(child.results, &childWarmup, sizeof(uint64_t)) &&
+            readHistogram(child.results, childLatency)) {
+            received += childReceived;
+            latency.merge(childLatency);
+        } else {
+            fprintf(stderr, "A subscriber exited without results\n");
+        }
+    }
+
+    for (const Child& child : publishers) waitpid(child.pid, nullptr, 0);
+    for (const Child& child : subscribers) waitpid(child.pid, nullptr, 0);
+    stopLocalBroker(broker);
+
+    uint64_t expected = 0;
+    for (uint64_t topicSent : sentPerTopic) {
+        expected += topicSent * (uint64_t)options.subscribers;
+    }
+    double seconds = elapsedNs / 1e9;
+    const double percentiles[] = { 50.0, 90.0, 99.0, 99.9, 99.99 };
+    const char* names[] = { "p50", "p90", "p99", "p99.9", "p99.99" };
+
+    if (options.output == "json") {
+        nlohmann::json out;
+        out["publishers"] = options.publishers;
+        out["subscribers_per_topic"] = options.subscribers;
+        out["topics"] = options.topics;
+        out["payload_bytes"] = options.payload;
+        out["rate_per_publisher"] = options.rate;
+        out["reliable"] = options.reliable;
+        out["serializer"] = options.serializer.empty() ? "default" : options.serializer;
+        out["duration_s"] = seconds;
+        out["sent"] = sent;
+        out["publish_errors"] = errors;
+        out["expected_deliveries"] = expected;
+        out["delivered"] = received;
+        out["publish_msgs_per_s"] = seconds > 0 ? sent / seconds : 0;
+        out["delivered_msgs_per_s"] = seconds > 0 ? received / seconds : 0;
+        nlohmann::json lat;
+        lat["min_ns"] = latency.min();
+        lat["mean_ns"] = latency.mean();
+        for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); ++i) {
+            lat[std::string(names[i]) + "_ns"] = latency.valueAtPercentile(percentiles[i]);
+        }
+        lat["max_ns"] = latency.max();
+        out["latency"] = lat;
+        printf("%s\n", out.dump(2).c_str());
+    } else {
+        printf("publishers %d, subscribers %d per topic, topics %d, payload %zu B, rate %ld/s per publisher%s\n",
+               options.publishers, options.subscribers, options.topics, options.payload, options.rate,
+               options.reliable ? ", reliable" : "");
+        printf("sent       %llu in %.2f s (%.0f msg/s), %llu publish errors\n",
+               (unsigned long long)sent, seconds, seconds > 0 ? sent / seconds : 0.0, (unsigned long long)errors);
+        printf("delivered  %llu of %llu (%.2f%%), %.0f msg/s\n", (unsigned long long)received,
+               (unsigned long long)expected, expected ? 100.0 * received / expected : 0.0,
+               seconds > 0 ? received / seconds : 0.0);
+        printf("latency us min %.1f mean %.1f", latency.min() / 1e3, latency.mean() / 1e3);
+        for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); ++i) {
+            printf(" %s %.1f", names[i], latency.valueAtPercentile(percentiles[i]) / 1e3);
+        }
+        printf(" max %.1f\n", latency.max() / 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,242 @@
+// Serializer microbenchmarks: throughput and heap allocations of every
+// IMmwMessageSerializer operation across payload sizes.
+//
+//   mmw_serializer_bench [--output csv|json] [--min-time-ms N] [--serializer name] [--max-size bytes]
+//
+// Results go to stdout so runs on different commits can be diffed or plotted.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "IMmwMessageSerializer.h"
+#include "SerializerAbstraction.h"
+
+// Every allocation in the process goes through these, the benchmark is single threaded
+static std::atomic<uint64_t> allocCount(0);
+static std::atomic<uint64_t> allocBytes(0);
+
+static void* countedAlloc(size_t size) {
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    allocBytes.fetch_add(size, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size) { return countedAlloc(size); }
+void* operator new[](size_t size) { return countedAlloc(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try { return countedAlloc(size); } catch (...) { return nullptr; }
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try { return countedAlloc(size); } catch (...) { return nullptr; }
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+
+struct Options {
+    std::string output = "csv";
+    std::string serializer;       // empty runs all of them
+    long minTimeMs = 200;         // per measurement
+    size_t maxSize = 1024 * 1024;
+};
+
+struct Result {
+    std::string serializer;
+    std::string operation;
+    size_t payloadBytes;
+    size_t encodedBytes;
+    uint64_t iterations;
+    double nsPerOp;
+    double mbPerSec;
+    double allocsPerOp;
+    double allocBytesPerOp;
+};
+
+// Keeps the optimizer from discarding results
+static volatile size_t sink;
+
+typedef std::chrono::steady_clock Clock;
+
+// Run op in growing batches until minTimeMs has passed, after a short warm-up
+template <typename Op>
+static Result measure(const Options& options, Op op) {
+    for (int i = 0; i < 3; ++i) {
+        sink = op();
+    }
+
+    Result result = {};
+    uint64_t batch = 1;
+    uint64_t iterations = 0;
+    uint64_t allocsBefore = allocCount.load();
+    uint64_t bytesBefore = allocBytes.load();
+    Clock::time_point start = Clock::now();
+    Clock::duration budget = std::chrono::milliseconds(options.minTimeMs);
+    Clock::duration elapsed;
+
+    do {
+        for (uint64_t i = 0; i < batch; ++i) {
+            sink = op();
+        }
+        iterations += batch;
+        batch *= 2;
+        elapsed = Clock::now() - start;
+    } while (elapsed < budget);
+
+    double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    result.iterations = iterations;
+    result.nsPerOp = ns / iterations;
+    result.allocsPerOp = (double)(allocCount.load() - allocsBefore) / iterations;
+    result.allocBytesPerOp = (double)(allocBytes.load() - bytesBefore) / iterations;
+    return result;
+}
+
+static void finish(Result& result, const std::string& serializer, const char* operation,
+                   size_t payloadBytes, size_t encodedBytes) {
+    result.serializer = serializer;
+    result.operation = operation;
+    result.payloadBytes = payloadBytes;
+    result.encodedBytes = encodedBytes;
+    result.mbPerSec = result.nsPerOp > 0 ? payloadBytes / result.nsPerOp * 1e9 / (1024.0 * 1024.0) : 0;
+}
+
+static void benchSerializer(IMmwMessageSerializer* serializer, const Options& options, std::vector<Result>& results) {
+    for (size_t size = 16; size <= options.maxSize; size *= 4) {
+        // Text payloads for the string path, arbitrary bytes for the raw path
+        std::string text(size, '\0');
+        std::string bytes(size, '\0');
+        for (size_t i = 0; i < size; ++i) {
+            text[i] = static_cast<char>('a' + i % 26);
+            bytes[i] = static_cast<char>(rand());
+        }
+
+        MmwMessage msg{};
+        msg.messageId = 42;
+        msg.type = "publish";
+        msg.topic = "bench/topic";
+        msg.payload = text;
+        msg.size = size;
+        msg.topicId = 7;
+
+        MmwMessage rawMsg = msg;
+        rawMsg.payload.clear();
+        rawMsg.payload_raw = &bytes[0];
+
+        std::string encoded = serializer->serialize(msg);
+        std::string encodedRaw = serializer->serialize_raw(rawMsg);
+
+        Result r = measure(options, [&]() { return serializer->serialize(msg).size(); });
+        finish(r, serializer->name(), "serialize", size, encoded.size());
+        results.push_back(r);
+
+        r = measure(options, [&]() { return serializer->serialize_raw(rawMsg).size(); });
+        finish(r, serializer->name(), "serialize_raw", size, encodedRaw.size());
+        results.push_back(r);
+
+        r = measure(options, [&]() { return serializer->deserialize(encoded).payload.size(); });
+        finish(r, serializer->name(), "deserialize", size, encoded.size());
+        results.push_back(r);
+
+        r = measure(options, [&]() { return serializer->deserialize_raw(encodedRaw).payload.size(); });
+        finish(r, serializer->name(), "deserialize_raw", size, encodedRaw.size());
+        results.push_back(r);
+
+        // The subscriber path, decoding into a reused backing message
+        MmwMessageView view;
+        MmwMessage backing{};
+        r = measure(options, [&]() {
+            serializer->deserialize_view(encodedRaw.data(), encodedRaw.size(), true, view, backing);
+            return view.size;
+        });
+        finish(r, serializer->name(), "deserialize_view", size, encodedRaw.size());
+        results.push_back(r);
+    }
+}
+
+static void printCsv(const std::vector<Result>& results) {
+    printf("serializer,operation,payload_bytes,encoded_bytes,iterations,ns_per_op,mb_per_s,allocs_per_op,alloc_bytes_per_op\n");
+    for (const Result& r : results) {
+        printf("%s,%s,%zu,%zu,%llu,%.1f,%.1f,%.2f,%.1f\n", r.serializer.c_str(), r.operation.c_str(),
+               r.payloadBytes, r.encodedBytes, (unsigned long long)r.iterations, r.nsPerOp, r.mbPerSec,
+               r.allocsPerOp, r.allocBytesPerOp);
+    }
+}
+
+static void printJson(const std::vector<Result>& results) {
+    nlohmann::json out = nlohmann::json::array();
+    for (const Result& r : results) {
+        out.push_back({
+            {"serializer", r.serializer},
+            {"operation", r.operation},
+            {"payload_bytes", r.payloadBytes},
+            {"encoded_bytes", r.encodedBytes},
+            {"iterations", r.iterations},
+            {"ns_per_op", r.nsPerOp},
+            {"mb_per_s", r.mbPerSec},
+            {"allocs_per_op", r.allocsPerOp},
+            {"alloc_bytes_per_op", r.allocBytesPerOp}
+        });
+    }
+    printf("%s\n", out.dump(2).c_str());
+}
+
+static void usage(const char* argv0) {
+    fprintf(stderr, "Usage: %s [--output csv|json] [--min-time-ms N] [--serializer cereal|json|binary] [--max-size bytes]\n", argv0);
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (arg == "--output") {
+            options.output = argv[++i];
+        } else if (arg == "--min-time-ms") {
+            options.minTimeMs = atol(argv[++i]);
+        } else if (arg == "--serializer") {
+            options.serializer = argv[++i];
+        } else if (arg == "--max-size") {
+            options.maxSize = (size_t)atol(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.output != "csv" && options.output != "json") {
+        usage(argv[0]);
+        return 1;
+    }
+
+    srand(1);
+    std::vector<Result> results;
+    for (size_t i = 0; i < SERIALIZER_FORMAT_COUNT; ++i) {
+        IMmwMessageSerializer* serializer = CreateSerializer(static_cast<MmwSerializerFormat>(i));
+        if (options.serializer.empty() || options.serializer == serializer->name()) {
+            fprintf(stderr, "Benchmarking %s serializer\n", serializer->name());
+            benchSerializer(serializer, options, results);
+        }
+        delete serializer;
+    }
+
+    if (options.output == "json") {
+        printJson(results);
+    } else {
+        printCsv(results);
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Counters of one topic, indexed by its interned id
+struct TopicMetrics {
+    std::atomic<uint64_t> messagesIn{0};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> messagesOut{0};   // one per subscriber a message was sent to
+    std::atomic<uint64_t> bytesOut{0};
+    std::atomic<uint32_t> lastFanout{0};    // subscribers the latest message was routed to
+};
+
+// Counters and gauges of one client connection, shared by every thread that sends to it
+struct ConnectionMetrics {
+    int fd = -1;
+    std::chrono::steady_clock::time_point connectedAt;
+    std::atomic<uint64_t> messagesIn{0};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> messagesOut{0};
+    std::atomic<uint64_t> bytesOut{0};
+    std::atomic<int64_t> unacked{0};        // reliable messages sent and not yet acked
+    std::atomic<int64_t> backlog{0};        // messages held back for lack of flow-control credit
+
+    // Set once at registration, read under BrokerMetrics' registry lock
+    std::string role;
+    std::string topic;
+    std::string format;
+};
+
+/**
+ * Broker-wide counters and gauges.
+ *
+ * Hot paths only touch relaxed atomics: topic counters live in fixed segments
+ * that are allocated on first use and never move, connection counters are
+ * reached through the shared_ptr each client keeps. snapshot() walks
+ * everything and renders JSON for the stats endpoint and the $SYS topic.
+ */
+class BrokerMetrics {
+public:
+    BrokerMetrics();
+    ~BrokerMetrics();
+
+    // Maps topic ids back to names in snapshots
+    typedef std::function<std::string(uint32_t)> TopicResolver;
+    void setTopicResolver(TopicResolver resolver);
+
+    // Gauge read at snapshot time, e.g. the persistence queue depth
+    typedef std::function<int64_t()> GaugeReader;
+    void addGauge(const std::string& name, GaugeReader reader);
+
+    // Nested JSON object rendered at snapshot time, e.g. the lock profile
+    typedef std::function<std::string()> SectionReader;
+    void addSection(const std::string& name, SectionReader reader);
+
+    TopicMetrics& topic(uint32_t topicId);
+
+    std::shared_ptr<ConnectionMetrics> openConnection(int fd);
+    void registerConnection(int fd, const std::string& role, const std::string& topic, const std::string& format);
+    std::shared_ptr<ConnectionMetrics> findConnection(int fd);
+    void closeConnection(int fd);
+
+    // Broker-wide event counters
+    std::atomic<uint64_t> connectionsAccepted{0};
+    std::atomic<uint64_t> connectionsClosed{0};
+    std::atomic<uint64_t> registrationsRejected{0};
+    std::atomic<uint64_t> publishesRejected{0};
+    std::atomic<uint64_t> decodeErrors{0};
+    std::atomic<uint64_t> retransmits{0};
+    std::atomic<uint64_t> retransmitFailures{0}; // subscribers dropped after the last retry
+    std::atomic<uint64_t> heartbeatTimeouts{0};
+    std::atomic<uint64_t> backlogDrops{0};       // best-effort messages discarded from a full backlog
+    std::atomic<uint64_t> slowSubscribersClosed{0}; // subscribers closed with a backlog full of reliable messages
+    std::atomic<uint64_t> sendFailures{0};
+    std::atomic<uint64_t> requestsRouted{0};
+    std::atomic<uint64_t> requestsFailed{0};     // answered by the broker: no server, server gone or timed out
+
+    // Current state as a JSON object
+    std::string snapshot();
+
+    // Serve snapshot() over HTTP on 127.0.0.1:port from a background thread
+    bool startStatsServer(int port);
+    void stopStatsServer();
+
+private:
+    static const size_t SEGMENT_SIZE = 1024;
+    static const size_t MAX_SEGMENTS = 1024;
+
+    std::atomic<TopicMetrics*> segments_[MAX_SEGMENTS];
+    TopicMetrics overflow_;                      // topics past SEGMENT_SIZE * MAX_SEGMENTS share this
+    std::atomic<uint32_t> highestTopic_{0};
+    std::chrono::steady_clock::time_point startedAt_;
+
+    std::mutex mtx_;
+    TopicResolver topicResolver_;
+    std::map<std::string, GaugeReader> gauges_;
+    std::map<std::string, SectionReader> sections_;
+    std::map<int, std::shared_ptr<ConnectionMetrics>> connections_;
+
+    int statsFd_ = -1;
+    std::atomic<bool> statsRunning_{false};
+    std::thread statsThread_;
+    void serveStats();
+};
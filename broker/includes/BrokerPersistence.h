@@ -1,10 +1,13 @@
 #pragma once
+#include <atomic>
 #include <string>
 #include <mutex>
 #include <thread>
 #include <queue>
 #include <condition_variable>
+#include <functional>
 #include "MmwMessage.h"
+#include "LockProfiler.h"
 #include <sqlite3.h>
 
 class BrokerPersistence {
@@ -12,26 +15,46 @@ public:
     BrokerPersistence(const std::string& dbPath);
     ~BrokerPersistence();
 
+    // Called from the worker thread once the write is committed (true) or failed (false)
+    typedef std::function<void(bool)> PersistCallback;
+
+    // Maps a topic id back to its name for messages published by id
+    typedef std::function<std::string(uint32_t)> TopicResolver;
+    void setTopicResolver(TopicResolver resolver);
+
     // Queue message for async persistence
-    bool persistMessage(const MmwMessage& msg);
+    bool persistMessage(const MmwMessage& msg, PersistCallback onPersisted = nullptr);
 
     // Get the next messageId (based on DB max)
     uint32_t getNextMessageId();
 
+    // Messages queued or being written, readable without taking the queue lock
+    size_t queueDepth() const { return depth_.load(std::memory_order_relaxed); }
+
 private:
+    struct PendingWrite {
+        MmwMessage msg;
+        PersistCallback onPersisted;
+    };
+
     // Blocking persistence function, used by worker thread
     bool persistBlocking(const MmwMessage& msg);
 
+    // Write everything queued so far in a single transaction
+    void persistBatch(std::queue<PendingWrite>& batch);
+
     bool prepareDatabase();
 
     sqlite3* db_;
-    std::mutex dbMutex_;
+    MMW_BROKER_MUTEX(dbMutex_, "persistence.db");
     std::string dbPath_;
+    TopicResolver topicResolver_;
 
     // Async queue
-    std::queue<MmwMessage> queue_;
-    std::mutex queueMutex_;
-    std::condition_variable cv_;
+    std::queue<PendingWrite> queue_;
+    MMW_BROKER_MUTEX(queueMutex_, "persistence.queue");
+    BrokerCondition cv_;
     std::thread worker_;
     bool running_;
+    std::atomic<size_t> depth_;
 };
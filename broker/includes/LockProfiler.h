@@ -0,0 +1,99 @@
+#pragma once
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+/**
+ * Contention profiling for the broker's hot locks.
+ *
+ * Built with MMW_LOCK_INSTRUMENTATION, every lock declared through
+ * MMW_BROKER_MUTEX records its acquisitions, how many of them had to wait,
+ * and power-of-two histograms of wait and hold times. Locks that share a name
+ * share their statistics. Without the define BrokerMutex is a plain
+ * std::mutex and nothing here costs anything.
+ */
+#if defined(MMW_LOCK_INSTRUMENTATION)
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+struct LockStats {
+    static const int BUCKETS = 40; // bucket i counts durations in [2^(i-1), 2^i) ns, the last one everything longer
+
+    const char* name;
+    std::atomic<uint64_t> acquisitions;
+    std::atomic<uint64_t> contended;
+    std::atomic<uint64_t> waitNs;      // total over contended acquisitions only
+    std::atomic<uint64_t> holdNs;
+    std::atomic<uint64_t> waitBuckets[BUCKETS];
+    std::atomic<uint64_t> holdBuckets[BUCKETS];
+
+    void recordWait(uint64_t ns);
+    void recordHold(uint64_t ns);
+};
+
+class InstrumentedMutex {
+public:
+    explicit InstrumentedMutex(const char* name);
+    InstrumentedMutex(const InstrumentedMutex&) = delete;
+    InstrumentedMutex& operator=(const InstrumentedMutex&) = delete;
+
+    void lock() {
+        // The uncontended path costs one try_lock and one clock read
+        if (!mtx_.try_lock()) {
+            uint64_t start = now();
+            mtx_.lock();
+            acquiredAt_ = now();
+            stats_->contended.fetch_add(1, std::memory_order_relaxed);
+            stats_->recordWait(acquiredAt_ - start);
+        } else {
+            acquiredAt_ = now();
+        }
+        stats_->acquisitions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool try_lock() {
+        if (!mtx_.try_lock()) {
+            return false;
+        }
+        acquiredAt_ = now();
+        stats_->acquisitions.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void unlock() {
+        uint64_t held = now() - acquiredAt_;
+        mtx_.unlock();
+        stats_->recordHold(held);
+    }
+
+private:
+    static uint64_t now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    std::mutex mtx_;
+    LockStats* stats_;
+    uint64_t acquiredAt_ = 0; // only written and read by the holder
+};
+
+typedef InstrumentedMutex BrokerMutex;
+typedef std::condition_variable_any BrokerCondition;
+#define MMW_BROKER_MUTEX(var, name) BrokerMutex var{name}
+#else
+typedef std::mutex BrokerMutex;
+typedef std::condition_variable BrokerCondition;
+#define MMW_BROKER_MUTEX(var, name) BrokerMutex var
+#endif
+
+namespace LockProfiler {
+    // Whether the build records anything at all
+    bool enabled();
+
+    // Names the calling thread so it can be told apart in the CPU time report
+    void nameThread(const std::string& name);
+
+    // Lock statistics and per-thread CPU time as a JSON object, "{}" when compiled out
+    std::string report();
+}
@@ -4,8 +4,14 @@
 #else
 #include <unistd.h>
 #endif
+#include <cstdlib>
 #include <cstring>
 #include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <memory>
 #include <thread>
 #include <mutex>
 #include <algorithm>
@@ -20,6 +26,12 @@
 #include "SerializerAbstraction.h"
 #include "SocketAbstraction.h"
 #include "BrokerPersistence.h"
+#include "BrokerMetrics.h"
+#include "LockProfiler.h"
+#include "MmwLog.h"
+#include "MmwRegistration.h"
+#include "BufferPool.h"
+#include "CodecAbstraction.h"
 
 #ifdef _WIN32
 #include <BaseTsd.h>
@@ -28,19 +40,24 @@ typedef SSIZE_T ssize_t;
 
 struct ConnectedClient {
     int socket_fd;
-    std::string type; // "publisher" or "subscriber"
+    std::string type; // "publisher", "subscriber" or "server"
     std::string topic;
     std::chrono::steady_clock::time_point lastHeartbeat;
+    uint32_t topicId;
+    MmwSerializerFormat format; // wire format the client registered with
+    std::shared_ptr<ConnectionMetrics> metrics;
+    std::string group; // queue group of a competing subscriber, empty for plain fan-out
+    std::vector<uint32_t> partitions; // partitions a plain subscriber receives, empty for all
 };
 
 struct PendingAck {
-    MmwMessage msg;
+    MmwMessage msg{};
     std::chrono::steady_clock::time_point timestamp;
     int retryCount = 0;  // count how many times we've resent
 };
 
 static std::vector<ConnectedClient> connectedClientList;
-static std::mutex clientListMutex;
+static MMW_BROKER_MUTEX(clientListMutex, "clientList");
 
 static std::vector<std::thread> clientThreads;
 static std::mutex threadListMutex;
@@ -48,63 +65,547 @@ static std::mutex threadListMutex;
 static int server_fd = -1;
 static std::atomic<bool> running(true);
 
-static IMmwMessageSerializer* g_serializer = nullptr;
+// Every format is available, each connection is answered in the one it registered with
+static IMmwMessageSerializer* g_serializers[SERIALIZER_FORMAT_COUNT] = {};
+static MMW_BROKER_MUTEX(clientFormatMutex, "clientFormat");
+static std::unordered_map<int, MmwSerializerFormat> clientFormats;
 
-static std::mutex ackMutex;
+static MMW_BROKER_MUTEX(ackMutex, "ack");
 static std::unordered_map<int, std::unordered_map<uint32_t, PendingAck>> unackedMessages;
 
 static std::atomic<uint32_t> brokerMessageId{1}; // start at 1
 
 static BrokerPersistence* g_persistence = nullptr;
+static BrokerMetrics* g_metrics = nullptr;
+
+// Broker statistics are published on a reserved topic that clients may subscribe to but not publish on
+static const char* STATS_TOPIC = "$SYS/broker/stats";
+static const char* RESERVED_TOPIC_PREFIX = "$SYS/";
+static constexpr int STATS_PUBLISH_INTERVAL_MS = 5000;
+
+bool isReservedTopic(const char* topic, size_t len) {
+    size_t prefixLen = strlen(RESERVED_TOPIC_PREFIX);
+    return len >= prefixLen && memcmp(topic, RESERVED_TOPIC_PREFIX, prefixLen) == 0;
+}
+
+// Log messages the background writer can hold before the oldest are overwritten
+static constexpr size_t BROKER_LOG_QUEUE_SIZE = 8192;
+
+// Serialises writers to one socket, all sockets share the "socketSend" statistics
+struct SocketSendLock {
+    MMW_BROKER_MUTEX(mtx, "socketSend");
+};
+static std::map<int, SocketSendLock> socketSendMutexes;
+
+// Receive buffers come from the pool, frames above RESIDENT_BUFFER_SIZE give theirs back once handled
+static BufferPool bufferPool;
+static const size_t RESIDENT_BUFFER_SIZE = 64 * 1024;
+static MMW_BROKER_MUTEX(socketSendMutexMapLock, "socketSendMap");
+
+// Topic names are interned once, publishes and routing then work on the id
+static MMW_BROKER_MUTEX(topicMutex, "topic");
+static std::unordered_map<std::string, uint32_t> topicIds;
+static std::vector<std::string> topicNames{""}; // id 0 means "no topic"
+
+uint32_t internTopic(const std::string& topic) {
+    std::lock_guard<BrokerMutex> lock(topicMutex);
+    auto it = topicIds.find(topic);
+    if (it != topicIds.end()) {
+        return it->second;
+    }
+    uint32_t id = (uint32_t)topicNames.size();
+    topicNames.push_back(topic);
+    topicIds[topic] = id;
+    return id;
+}
+
+std::string topicName(uint32_t topicId) {
+    std::lock_guard<BrokerMutex> lock(topicMutex);
+    return topicId < topicNames.size() ? topicNames[topicId] : std::string();
+}
+
+// Payload type fingerprint a topic is bound to, set by the first typed registration
+static std::unordered_map<uint32_t, std::string> topicTypes;
+
+// Returns false if the topic is already bound to a different type, untyped clients always pass
+bool bindTopicType(uint32_t topicId, const std::string& type) {
+    if (type.empty()) {
+        return true;
+    }
+
+    std::lock_guard<BrokerMutex> lock(topicMutex);
+    auto it = topicTypes.find(topicId);
+    if (it == topicTypes.end()) {
+        topicTypes[topicId] = type;
+        return true;
+    }
+    return it->second == type;
+}
+
+static constexpr uint32_t MAX_TOPIC_PARTITIONS = 4096;
+
+// Publishes a partition holds before its publishers wait for the routing thread to catch up
+static constexpr size_t MAX_LANE_PENDING = 1024;
+
+struct PublisherConfirmState;
+
+// A received frame that subscribers using its format are sent as it is, restamped
+// with the ids the broker assigned, instead of the message being encoded again
+struct ForwardFrame {
+    char* data; // null when there is no frame to forward
+    size_t len;
+    MmwSerializerFormat format;
+};
+
+// A message waiting for its turn in a partition
+struct LanePublish {
+    MmwMessage msg;
+    std::string group;                                   // set when handing on a departed member's message
+    std::shared_ptr<PublisherConfirmState> routedConfirm; // confirm-mode publisher waiting for the route
+    uint32_t publisherSeq;
+    PooledBuffer frameBuffer;                            // holds frame.data until the message is routed
+    ForwardFrame frame;
+};
+
+// Messages of a partition are numbered and queued under the lane lock, then routed
+// in that order by whichever thread finds the lane idle, without holding the lock
+struct PartitionLane {
+    MMW_BROKER_MUTEX(mtx, "partition");
+    BrokerCondition space;
+    std::deque<LanePublish> pending;
+    bool routing = false;
+};
+
+// A partitioned topic splits its messages by key, order holds within each partition
+struct TopicPartitions {
+    uint32_t count;
+    std::unique_ptr<PartitionLane[]> lanes;
+    std::atomic<uint32_t> cursor; // spreads unkeyed messages over the partitions
+};
+
+// Guarded by topicMutex, set by the first registration that names a partition count
+static std::unordered_map<uint32_t, std::shared_ptr<TopicPartitions>> topicPartitions;
+
+// Returns false if the topic already has a different partition count, 0 always passes
+bool bindTopicPartitions(uint32_t topicId, uint32_t count) {
+    if (count == 0) {
+        return true;
+    }
+
+    std::lock_guard<BrokerMutex> lock(topicMutex);
+    auto it = topicPartitions.find(topicId);
+    if (it == topicPartitions.end()) {
+        std::shared_ptr<TopicPartitions> partitions = std::make_shared<TopicPartitions>();
+        partitions->count = count;
+        partitions->lanes.reset(new PartitionLane[count]);
+        partitions->cursor = 0;
+        topicPartitions[topicId] = partitions;
+        return true;
+    }
+    return it->second->count == count;
+}
+
+std::shared_ptr<TopicPartitions> partitionsOf(uint32_t topicId) {
+    std::lock_guard<BrokerMutex> lock(topicMutex);
+    auto it = topicPartitions.find(topicId);
+    return it == topicPartitions.end() ? nullptr : it->second;
+}
+
+uint32_t topicPartitionCount(uint32_t topicId) {
+    std::shared_ptr<TopicPartitions> partitions = partitionsOf(topicId);
+    return partitions ? partitions->count : 0;
+}
+
+// Partition of a keyed message, -1 when the message has no key
+int32_t keyPartition(const TopicPartitions& partitions, const MmwMessage& msg) {
+    if (msg.key.empty()) {
+        return -1;
+    }
+    return (int32_t)(MmwKeyHash(msg.key.data(), msg.key.size()) % partitions.count);
+}
+
+// Parses a comma separated list of partition numbers, false if one is not below count
+bool parsePartitionList(const std::string& list, uint32_t count, std::vector<uint32_t>& out) {
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = list.find(',', start);
+        std::string item = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        char* last = nullptr;
+        unsigned long partition = strtoul(item.c_str(), &last, 10);
+        if (item.empty() || *last != '\0' || partition >= count) {
+            return false;
+        }
+        out.push_back((uint32_t)partition);
+        start = end == std::string::npos ? list.size() : end + 1;
+    }
+    return !out.empty();
+}
+
+// Parses a credit amount, false unless the whole text is a number in 0..INT64_MAX
+bool parseCredit(const std::string& text, int64_t& out) {
+    if (text.empty() || text[0] == '-') {
+        return false;
+    }
+    char* last = nullptr;
+    errno = 0;
+    long long value = strtoll(text.c_str(), &last, 10);
+    if (*last != '\0' || errno == ERANGE) {
+        return false;
+    }
+    out = (int64_t)value;
+    return true;
+}
+
+// Serializer for a connection, clients that have not sent a frame yet get the build default
+IMmwMessageSerializer* serializerFor(int fd) {
+    std::lock_guard<BrokerMutex> lock(clientFormatMutex);
+    auto it = clientFormats.find(fd);
+    return g_serializers[it == clientFormats.end() ? DefaultSerializerFormat() : it->second];
+}
+
+// Publisher confirm state for a single publisher connection
+struct PublisherConfirmState {
+    int socket_fd;
+    IMmwMessageSerializer* serializer;
+    std::string topic;
+    bool persisted;              // confirm after persistence instead of after routing
+    uint32_t lastReceived = 0;   // highest publisher sequence read from the socket
+    std::set<uint32_t> inFlight; // received but not yet routed or persisted, partitions finish out of order
+    uint32_t pendingConfirm = 0; // highest sequence with nothing unsettled at or below it
+    uint32_t lastConfirmed = 0;  // highest sequence actually confirmed to the publisher
+    bool open = true;
+    MMW_BROKER_MUTEX(mtx, "publisherConfirm");
+};
+
+// Confirms are cumulative, so one ack can cover a whole batch of publishes
+static constexpr uint32_t CONFIRM_BATCH_SIZE = 64;
+
+// Credit granted by a flow-controlled subscriber, messages wait in the backlog when it runs out
+struct SubscriberFlow {
+    bool limitMessages = false;
+    bool limitBytes = false;
+    int64_t messageCredit = 0;
+    int64_t byteCredit = 0;
+    std::deque<MmwMessage> backlog;
+    MMW_BROKER_MUTEX(mtx, "subscriberFlow");
+};
+
+static MMW_BROKER_MUTEX(flowMutex, "flowMap");
+static std::unordered_map<int, std::shared_ptr<SubscriberFlow>> subscriberFlows;
+
+// Bound on messages held for a subscriber that is out of credit, oldest are dropped first
+static constexpr size_t MAX_SUBSCRIBER_BACKLOG = 10000;
+
+// Subscribers that register with a group name compete for the topic's messages, each goes to one member
+enum GroupBalance {
+    GROUP_BALANCE_ROUND_ROBIN,
+    GROUP_BALANCE_LEAST_OUTSTANDING, // fewest unacked and backlogged messages
+    GROUP_BALANCE_KEY_HASH           // same key to the same member while membership is unchanged
+};
+
+struct QueueGroup {
+    GroupBalance balance; // chosen by the first member
+    uint32_t cursor;
+};
 
-static std::map<int, std::mutex> socketSendMutexes;
-static std::mutex socketSendMutexMapLock;
+// Guarded by clientListMutex. Memberships outlive the client list entry so a
+// member's unacked work can still be handed on once it is gone.
+static std::map<std::pair<uint32_t, std::string>, QueueGroup> queueGroups;
+static std::unordered_map<int, std::pair<uint32_t, std::string>> groupMemberships;
+
+GroupBalance parseGroupBalance(const std::string& name) {
+    if (name == "least_outstanding") return GROUP_BALANCE_LEAST_OUTSTANDING;
+    if (name == "key_hash") return GROUP_BALANCE_KEY_HASH;
+    if (name != "round_robin") {
+        MMW_LOG_WARN(MMW_LOG_SUBSCRIBE, "Unknown queue group balancing {}, using round_robin", name);
+    }
+    return GROUP_BALANCE_ROUND_ROBIN;
+}
+
+// A request forwarded to a server and not answered yet. Servers see the broker's
+// request id, the reply goes back to the requester under its own correlation id.
+struct PendingRequest {
+    int requesterFd;
+    uint32_t correlationId;
+    int serverFd;
+    std::string service;
+    std::chrono::steady_clock::time_point forwardedAt;
+};
+
+static MMW_BROKER_MUTEX(requestMutex, "request");
+static std::unordered_map<uint32_t, PendingRequest> pendingRequests;
+static std::unordered_map<uint32_t, uint32_t> serviceCursors; // round robin position per service topic id
+static uint32_t nextRequestId = 1;
+
+// Requests a server has not answered by then fail, requesters usually give up much earlier
+static constexpr int REQUEST_TIMEOUT_MS = 30000;
 
 // Send a length-prefixed message
-inline bool sendMessage(int sock_fd, const std::string& data) {
-    std::mutex* mtx;
+inline bool sendMessage(int sock_fd, const char* data, size_t size) {
+    BrokerMutex* mtx;
     {
-        std::lock_guard<std::mutex> lock(socketSendMutexMapLock);
-        mtx = &socketSendMutexes[sock_fd];
+        std::lock_guard<BrokerMutex> lock(socketSendMutexMapLock);
+        mtx = &socketSendMutexes[sock_fd].mtx;
     }
 
-    std::lock_guard<std::mutex> lock(*mtx);
+    std::lock_guard<BrokerMutex> lock(*mtx);
 
-    uint32_t len = htonl(data.size());
+    // Length prefix and body go out in a single syscall
+    uint32_t len = htonl(size);
+    SocketBuffer bufs[] = {
+        { &len, sizeof(len) },
+        { data, size }
+    };
 
-    if (SocketAbstraction::Send(sock_fd, &len, sizeof(len), 0) != sizeof(len)) {
+    return SocketAbstraction::SendV(sock_fd, bufs, 2) == (int)(sizeof(len) + size);
+}
+
+inline bool sendMessage(int sock_fd, const std::string& data) {
+    return sendMessage(sock_fd, data.data(), data.size());
+}
+
+// Send to a single subscriber and track the message if it needs an ack
+bool deliverToSubscriber(int fd, const MmwMessage& msg, const char* frame, size_t frameLen, ConnectionMetrics* metrics) {
+    if (!sendMessage(fd, frame, frameLen)) {
+        g_metrics->sendFailures.fetch_add(1, std::memory_order_relaxed);
         return false;
     }
 
-    if (SocketAbstraction::Send(sock_fd, data.data(), data.size(), 0) != (ssize_t)data.size()) {
-        return false;
+    TopicMetrics& topic = g_metrics->topic(msg.topicId);
+    topic.messagesOut.fetch_add(1, std::memory_order_relaxed);
+    topic.bytesOut.fetch_add(msg.payload.size(), std::memory_order_relaxed);
+    if (metrics) {
+        metrics->messagesOut.fetch_add(1, std::memory_order_relaxed);
+        metrics->bytesOut.fetch_add(sizeof(uint32_t) + frameLen, std::memory_order_relaxed);
     }
 
+    // Only track unacked messages if reliability was set
+    if (msg.reliability) {
+        std::lock_guard<BrokerMutex> lock(ackMutex);
+        PendingAck ack;
+        ack.msg = msg;
+        ack.timestamp = std::chrono::steady_clock::now();
+        ack.retryCount = 0;
+        auto inserted = unackedMessages[fd].insert(std::make_pair(msg.messageId, ack));
+        if (!inserted.second) {
+            inserted.first->second = ack;
+        } else if (metrics) {
+            metrics->unacked.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
     return true;
 }
 
-// Helper function to route messages to subscribers
-void routeMessageToSubscribers(const std::string& topic, const MmwMessage& msg) {
-    if (topic.empty()) {
-        return;
+std::shared_ptr<SubscriberFlow> findSubscriberFlow(int fd) {
+    std::lock_guard<BrokerMutex> lock(flowMutex);
+    auto it = subscriberFlows.find(fd);
+    return it == subscriberFlows.end() ? nullptr : it->second;
+}
+
+// Byte credit may overdraw by one message so a payload larger than the window still gets through
+bool hasCredit(const SubscriberFlow& flow) {
+    return (!flow.limitMessages || flow.messageCredit > 0) && (!flow.limitBytes || flow.byteCredit > 0);
+}
+
+// Bytes are counted on the wire so both ends agree regardless of serializer
+void consumeCredit(SubscriberFlow& flow, size_t frameLen) {
+    flow.messageCredit--;
+    flow.byteCredit -= (int64_t)frameLen;
+}
+
+// Add credit from a subscriber and send whatever the backlog now allows
+bool grantCredit(int fd, uint32_t messages, int64_t bytes) {
+    std::shared_ptr<SubscriberFlow> flow = findSubscriberFlow(fd);
+    if (!flow) {
+        return true;
     }
 
-    std::vector<int> targets;
-    {
-        std::lock_guard<std::mutex> lock(clientListMutex);
-        for (auto& client : connectedClientList) {
-            if (client.type == "subscriber" && client.topic == topic) {
-                targets.push_back(client.socket_fd);
+    std::shared_ptr<ConnectionMetrics> metrics = g_metrics->findConnection(fd);
+    std::lock_guard<BrokerMutex> lock(flow->mtx);
+    flow->messageCredit += messages;
+    // Saturate rather than wrap when a subscriber grants more than fits
+    flow->byteCredit = flow->byteCredit > 0 && bytes > INT64_MAX - flow->byteCredit ? INT64_MAX : flow->byteCredit + bytes;
+
+    while (!flow->backlog.empty() && hasCredit(*flow)) {
+        const MmwMessage& msg = flow->backlog.front();
+        std::string serialized = serializerFor(fd)->serialize(msg);
+        consumeCredit(*flow, serialized.size());
+        if (!deliverToSubscriber(fd, msg, serialized.data(), serialized.size(), metrics.get())) {
+            return false;
+        }
+        flow->backlog.pop_front();
+        if (metrics) {
+            metrics->backlog.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+    return true;
+}
+
+struct RouteTarget {
+    int fd;
+    MmwSerializerFormat format;
+    std::shared_ptr<ConnectionMetrics> metrics;
+};
+
+// The member of a queue group that gets a message, the caller holds clientListMutex
+const ConnectedClient* pickGroupMember(QueueGroup& group, const std::vector<const ConnectedClient*>& members, const MmwMessage& msg) {
+    switch (group.balance) {
+        case GROUP_BALANCE_KEY_HASH:
+            if (!msg.key.empty()) {
+                return members[MmwKeyHash(msg.key.data(), msg.key.size()) % members.size()];
             }
+            break;
+        case GROUP_BALANCE_LEAST_OUTSTANDING: {
+            // Scanning from the cursor spreads ties, so idle members take turns
+            const ConnectedClient* best = nullptr;
+            int64_t bestOutstanding = 0;
+            for (size_t i = 0; i < members.size(); ++i) {
+                const ConnectedClient* member = members[(group.cursor + i) % members.size()];
+                int64_t outstanding = member->metrics ? member->metrics->unacked.load(std::memory_order_relaxed) +
+                                                        member->metrics->backlog.load(std::memory_order_relaxed) : 0;
+                if (!best || outstanding < bestOutstanding) {
+                    best = member;
+                    bestOutstanding = outstanding;
+                }
+            }
+            group.cursor++;
+            return best;
         }
+        default:
+            break;
     }
+    return members[group.cursor++ % members.size()];
+}
 
-    std::string serialized = g_serializer->serialize(msg);
+// Every plain subscriber of the topic and one member of each queue group,
+// or only a member of onlyGroup when handing on a departed member's work.
+// On a partitioned topic plain subscribers may be limited to some partitions
+// and each group member owns the partitions p with p % members == its index.
+std::vector<RouteTarget> selectTargets(uint32_t topicId, const MmwMessage& msg, const std::string* onlyGroup, int32_t partition) {
+    std::vector<RouteTarget> targets;
+    std::vector<const ConnectedClient*> grouped;
+
+    std::lock_guard<BrokerMutex> lock(clientListMutex);
+    for (auto& client : connectedClientList) {
+        if (client.topicId != topicId || client.type != "subscriber") {
+            continue;
+        }
+        if (!client.group.empty()) {
+            grouped.push_back(&client);
+        } else if (!onlyGroup && (partition < 0 || client.partitions.empty() ||
+                                  std::find(client.partitions.begin(), client.partitions.end(), (uint32_t)partition) != client.partitions.end())) {
+            targets.push_back(RouteTarget{client.socket_fd, client.format, client.metrics});
+        }
+    }
 
-    for (int fd : targets) {
-        if (!sendMessage(fd, serialized)) {
-            spdlog::error("send to subscriber fd={} failed, removing client", fd);
-            std::lock_guard<std::mutex> lock(clientListMutex);
+    // Members stay in registration order, which keeps key hashing stable
+    std::vector<const ConnectedClient*> members;
+    for (size_t i = 0; i < grouped.size(); ++i) {
+        const std::string& name = grouped[i]->group;
+        if ((onlyGroup && name != *onlyGroup) ||
+            std::any_of(grouped.begin(), grouped.begin() + i, [&name](const ConnectedClient* c) { return c->group == name; })) {
+            continue;
+        }
+
+        members.clear();
+        for (size_t j = i; j < grouped.size(); ++j) {
+            if (grouped[j]->group == name) {
+                members.push_back(grouped[j]);
+            }
+        }
+        auto groupIt = queueGroups.find(std::make_pair(topicId, name));
+        if (groupIt == queueGroups.end()) {
+            continue;
+        }
+        const ConnectedClient* member = partition >= 0 ? members[partition % members.size()]
+                                                       : pickGroupMember(groupIt->second, members, msg);
+        targets.push_back(RouteTarget{member->socket_fd, member->format, member->metrics});
+    }
+    return targets;
+}
+
+// Send a message to the chosen subscribers, subscribers whose socket fails are dropped
+void deliverToTargets(const MmwMessage& msg, const std::vector<RouteTarget>& targets, const ForwardFrame& frame) {
+    // Traced messages note when fan-out starts, once the subscribers are known
+    MmwMessage traced{};
+    const MmwMessage& out = msg.trace.id != 0 ? traced : msg;
+    if (msg.trace.id != 0) {
+        traced = msg;
+        traced.trace.stamps[MMW_TRACE_BROKER_ROUTED] = MmwTraceNow();
+    }
+
+    // The received frame goes out as it is in its own format, the others are encoded at most once.
+    // A traced frame is restamped again so it carries the routing time.
+    bool forwarding = frame.data && (msg.trace.id == 0 ||
+                                     g_serializers[frame.format]->restamp(frame.data, frame.len, out.messageId, out.topicId, out.trace));
+    std::string encoded[SERIALIZER_FORMAT_COUNT];
+    bool isEncoded[SERIALIZER_FORMAT_COUNT] = {};
+
+    for (auto& target : targets) {
+        int fd = target.fd;
+        ConnectionMetrics* metrics = target.metrics.get();
+        const char* serialized;
+        size_t serializedLen;
+        if (forwarding && target.format == frame.format) {
+            serialized = frame.data;
+            serializedLen = frame.len;
+        } else {
+            if (!isEncoded[target.format]) {
+                encoded[target.format] = g_serializers[target.format]->serialize(out);
+                isEncoded[target.format] = true;
+            }
+            serialized = encoded[target.format].data();
+            serializedLen = encoded[target.format].size();
+        }
+
+        bool sent;
+        std::shared_ptr<SubscriberFlow> flow = findSubscriberFlow(fd);
+        if (flow) {
+            // Keep ordering behind anything already waiting for credit
+            std::lock_guard<BrokerMutex> lock(flow->mtx);
+            if (!flow->backlog.empty() || !hasCredit(*flow)) {
+                if (flow->backlog.size() < MAX_SUBSCRIBER_BACKLOG) {
+                    if (metrics) {
+                        metrics->backlog.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    flow->backlog.push_back(out);
+                    continue;
+                }
+
+                // A full backlog sheds its oldest best-effort message, reliable ones are never dropped
+                auto victim = std::find_if(flow->backlog.begin(), flow->backlog.end(),
+                                           [](const MmwMessage& m) { return !m.reliability; });
+                if (victim != flow->backlog.end() || !out.reliability) {
+                    uint32_t dropped = victim != flow->backlog.end() ? victim->messageId : out.messageId;
+                    MMW_LOG_LIMITED(MMW_LOG_SUBSCRIBE, spdlog::level::warn, 1000, "Subscriber fd={} backlog full, dropping message {}", fd, dropped);
+                    g_metrics->backlogDrops.fetch_add(1, std::memory_order_relaxed);
+                    if (victim != flow->backlog.end()) {
+                        flow->backlog.erase(victim);
+                        flow->backlog.push_back(out);
+                    }
+                    continue;
+                }
+
+                // Only reliable messages are waiting, the subscriber is closed and a queue
+                // group member's backlog goes to the rest of its group on removal
+                MMW_LOG_ERROR(MMW_LOG_SUBSCRIBE, "Subscriber fd={} backlog full of reliable messages, closing it", fd);
+                g_metrics->slowSubscribersClosed.fetch_add(1, std::memory_order_relaxed);
+                if (metrics) {
+                    metrics->backlog.fetch_add(1, std::memory_order_relaxed);
+                }
+                flow->backlog.push_back(out);
+                sent = false;
+            } else {
+                consumeCredit(*flow, serializedLen);
+                sent = deliverToSubscriber(fd, out, serialized, serializedLen, metrics);
+            }
+        } else {
+            sent = deliverToSubscriber(fd, out, serialized, serializedLen, metrics);
+        }
+
+        if (!sent) {
+            MMW_LOG_ERROR(MMW_LOG_PUBLISH, "send to subscriber fd={} failed, removing client", fd);
+            std::lock_guard<BrokerMutex> lock(clientListMutex);
             connectedClientList.erase(
                 std::remove_if(
                     connectedClientList.begin(), connectedClientList.end(),
@@ -115,23 +616,242 @@ void routeMessageToSubscribers(const std::string& topic, const MmwMessage& msg)
                 connectedClientList.end()
             );
             SocketAbstraction::SocketClose(fd);
-        
-        // Only track unacked messages if reliability was set
-        } else if (msg.reliability) {
-            std::lock_guard<std::mutex> lock(ackMutex);
-            PendingAck ack;
-            ack.msg = msg;
-            ack.timestamp = std::chrono::steady_clock::now();
-            ack.retryCount = 0;
-            unackedMessages[fd][msg.messageId] = ack;
+        }
+    }
+}
+
+// Helper function to route messages to subscribers, partition is -1 on topics without partitions
+void routeMessageToSubscribers(uint32_t topicId, const MmwMessage& msg, int32_t partition, const ForwardFrame& frame = ForwardFrame()) {
+    if (topicId == 0) {
+        return;
+    }
+
+    std::vector<RouteTarget> targets = selectTargets(topicId, msg, nullptr, partition);
+    g_metrics->topic(topicId).lastFanout.store((uint32_t)targets.size(), std::memory_order_relaxed);
+    deliverToTargets(msg, targets, frame);
+}
+
+// Send a message to one member of a queue group only
+void routeToGroup(uint32_t topicId, const std::string& group, const MmwMessage& msg, int32_t partition) {
+    std::vector<RouteTarget> targets = selectTargets(topicId, msg, &group, partition);
+    if (targets.empty()) {
+        MMW_LOG_LIMITED(MMW_LOG_RELIABILITY, spdlog::level::warn, 1000, "No member left in group {} for message {}", group, msg.messageId);
+        return;
+    }
+    deliverToTargets(msg, targets, ForwardFrame());
+}
+
+// Send a cumulative ack, or a nack of the single message seq, back to a confirm-mode publisher.
+// The ack only reaches up to the oldest message still in flight, so a message finished in one
+// partition never confirms an earlier one that is still queued in another.
+void sendPublisherConfirm(PublisherConfirmState& state, uint32_t seq, bool ok, bool flushNow) {
+    std::lock_guard<BrokerMutex> lock(state.mtx);
+    state.inFlight.erase(seq);
+    state.pendingConfirm = state.inFlight.empty() ? state.lastReceived : *state.inFlight.begin() - 1;
+    if (!state.open) {
+        return;
+    }
+
+    if (!ok) {
+        MmwMessage nack{seq, "nack", state.topic, ""};
+        sendMessage(state.socket_fd, state.serializer->serialize(nack));
+        return;
+    }
+
+    // Persisted confirms flush once everything received so far is committed
+    flushNow = flushNow || (state.persisted && state.inFlight.empty());
+    if (state.pendingConfirm > state.lastConfirmed &&
+        (flushNow || state.pendingConfirm - state.lastConfirmed >= CONFIRM_BATCH_SIZE)) {
+        MmwMessage ack{state.pendingConfirm, "ack", state.topic, ""};
+        if (sendMessage(state.socket_fd, state.serializer->serialize(ack))) {
+            state.lastConfirmed = state.pendingConfirm;
+        }
+    }
+}
+
+// Refuse a publish, the publisher is answered with a nack of its message
+void rejectPublish(int client_fd, IMmwMessageSerializer* serializer, PublisherConfirmState* confirms,
+                   uint32_t publisherSeq, const std::string& topic, const char* reason) {
+    MMW_LOG_LIMITED(MMW_LOG_PUBLISH, spdlog::level::warn, 1000, "Rejected publish from fd={} on {}: {}", client_fd, topic, reason);
+    g_metrics->publishesRejected.fetch_add(1, std::memory_order_relaxed);
+    if (confirms) {
+        sendPublisherConfirm(*confirms, publisherSeq, false, true);
+        return;
+    }
+    MmwMessage nack{publisherSeq, "nack", topic, reason};
+    sendMessage(client_fd, serializer->serialize(nack));
+}
+
+// Routed confirms flush as soon as the publisher's burst has been drained
+void confirmRouted(PublisherConfirmState& state, uint32_t seq) {
+    bool drained = SocketAbstraction::BytesAvailable(state.socket_fd) <= 0;
+    sendPublisherConfirm(state, seq, true, drained);
+}
+
+// Route a partition's queued messages in order unless another thread already is,
+// the lane lock is held on entry and on return but never across a send
+void routePartition(uint32_t topicId, int32_t partition, PartitionLane& lane, std::unique_lock<BrokerMutex>& lock) {
+    if (lane.routing) {
+        return;
+    }
+    lane.routing = true;
+    while (!lane.pending.empty()) {
+        LanePublish next = std::move(lane.pending.front());
+        lane.pending.pop_front();
+        lane.space.notify_one();
+        lock.unlock();
+
+        if (next.group.empty()) {
+            routeMessageToSubscribers(topicId, next.msg, partition, next.frame);
+        } else {
+            routeToGroup(topicId, next.group, next.msg, partition);
+        }
+        if (next.routedConfirm) {
+            confirmRouted(*next.routedConfirm, next.publisherSeq);
+        }
+
+        lock.lock();
+    }
+    lane.routing = false;
+}
+
+// Hand a message a departed queue group member never acknowledged to another member
+void redeliverToGroup(uint32_t topicId, const std::string& group, const MmwMessage& msg) {
+    // A keyed message queues behind new publishes to its partition and goes to the member that owns it now
+    std::shared_ptr<TopicPartitions> partitions = partitionsOf(topicId);
+    int32_t partition = partitions ? keyPartition(*partitions, msg) : -1;
+    if (partition < 0) {
+        routeToGroup(topicId, group, msg, -1);
+        return;
+    }
+
+    PartitionLane& lane = partitions->lanes[partition];
+    std::unique_lock<BrokerMutex> lock(lane.mtx);
+    lane.pending.push_back(LanePublish{msg, group, nullptr, 0});
+    routePartition(topicId, partition, lane, lock);
+}
+
+// Answer a request on the broker's behalf, the requester sees a failed reply
+void sendReplyError(int requesterFd, uint32_t correlationId, const std::string& service, const char* reason) {
+    g_metrics->requestsFailed.fetch_add(1, std::memory_order_relaxed);
+    MmwMessage error{correlationId, "reply_error", service, reason};
+    if (!sendMessage(requesterFd, serializerFor(requesterFd)->serialize(error))) {
+        g_metrics->sendFailures.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Next server registered for a service in round robin order, -1 when there is none
+int pickServer(uint32_t serviceId) {
+    std::vector<int> servers;
+    {
+        std::lock_guard<BrokerMutex> lock(clientListMutex);
+        for (auto& client : connectedClientList) {
+            if (client.topicId == serviceId && client.type == "server") {
+                servers.push_back(client.socket_fd);
+            }
+        }
+    }
+    if (servers.empty()) {
+        return -1;
+    }
+
+    std::lock_guard<BrokerMutex> lock(requestMutex);
+    return servers[serviceCursors[serviceId]++ % servers.size()];
+}
+
+// Send a received request or reply on under another message id, as the frame it came in when
+// the receiver uses the same format
+bool forwardFrame(int fd, const MmwMessageView& view, const ForwardFrame& frame, uint32_t messageId) {
+    IMmwMessageSerializer* serializer = serializerFor(fd);
+    if (serializer == g_serializers[frame.format] &&
+        serializer->restamp(frame.data, frame.len, messageId, view.topicId, view.trace)) {
+        return sendMessage(fd, frame.data, frame.len);
+    }
+    MmwMessage msg = view.toMessage();
+    msg.messageId = messageId;
+    return sendMessage(fd, serializer->serialize(msg));
+}
+
+// Hand a request to one server of its service, the reply is routed back by forwardReply
+void forwardRequest(int requesterFd, const MmwMessageView& view, const ForwardFrame& frame) {
+    uint32_t correlationId = view.messageId;
+    std::string service(view.topic, view.topicLen);
+    int serverFd = pickServer(internTopic(service));
+    if (serverFd < 0) {
+        MMW_LOG_LIMITED(MMW_LOG_CONNECTION, spdlog::level::warn, 1000, "No server for service {}, failing request from fd={}", service, requesterFd);
+        sendReplyError(requesterFd, correlationId, service, "no server");
+        return;
+    }
+
+    uint32_t requestId;
+    {
+        std::lock_guard<BrokerMutex> lock(requestMutex);
+        do {
+            requestId = nextRequestId++;
+        } while (requestId == 0 || pendingRequests.count(requestId) != 0);
+        pendingRequests[requestId] = PendingRequest{requesterFd, correlationId, serverFd, service, std::chrono::steady_clock::now()};
+    }
+
+    if (!forwardFrame(serverFd, view, frame, requestId)) {
+        g_metrics->sendFailures.fetch_add(1, std::memory_order_relaxed);
+        bool pending;
+        {
+            std::lock_guard<BrokerMutex> lock(requestMutex);
+            pending = pendingRequests.erase(requestId) > 0;
+        }
+        if (pending) {
+            sendReplyError(requesterFd, correlationId, service, "server unavailable");
+        }
+        return;
+    }
+    g_metrics->requestsRouted.fetch_add(1, std::memory_order_relaxed);
+    MMW_LOG_TRACE(MMW_LOG_CONNECTION, "Request {} from fd={} forwarded to server fd={} as {}", correlationId, requesterFd, serverFd, requestId);
+}
+
+// Route a server's reply straight to the connection that sent the request
+void forwardReply(int serverFd, const MmwMessageView& view, const ForwardFrame& frame) {
+    PendingRequest pending;
+    {
+        std::lock_guard<BrokerMutex> lock(requestMutex);
+        auto it = pendingRequests.find(view.messageId);
+        if (it == pendingRequests.end() || it->second.serverFd != serverFd) {
+            MMW_LOG_DEBUG(MMW_LOG_CONNECTION, "Dropping reply {} from fd={}, the request is no longer pending", view.messageId, serverFd);
+            return;
+        }
+        pending = it->second;
+        pendingRequests.erase(it);
+    }
+
+    if (!forwardFrame(pending.requesterFd, view, frame, pending.correlationId)) {
+        g_metrics->sendFailures.fetch_add(1, std::memory_order_relaxed);
+    }
+}
 
+// Fail the requests that match, the caller decides which under the request lock
+template <typename Predicate>
+void failRequests(Predicate matches, const char* reason) {
+    std::vector<PendingRequest> failed;
+    {
+        std::lock_guard<BrokerMutex> lock(requestMutex);
+        for (auto it = pendingRequests.begin(); it != pendingRequests.end();) {
+            if (matches(it->second)) {
+                failed.push_back(it->second);
+                it = pendingRequests.erase(it);
+            } else {
+                ++it;
+            }
         }
     }
+    for (auto& pending : failed) {
+        sendReplyError(pending.requesterFd, pending.correlationId, pending.service, reason);
+    }
 }
 
 void removeClientByFd(int client_fd) {
+    std::pair<uint32_t, std::string> membership;
+    bool grouped = false;
     {
-        std::lock_guard<std::mutex> lock(clientListMutex);
+        std::lock_guard<BrokerMutex> lock(clientListMutex);
         connectedClientList.erase(
             std::remove_if(
                 connectedClientList.begin(), connectedClientList.end(),
@@ -141,17 +861,86 @@ void removeClientByFd(int client_fd) {
             ),
             connectedClientList.end()
         );
+
+        auto it = groupMemberships.find(client_fd);
+        if (it != groupMemberships.end()) {
+            membership = it->second;
+            grouped = true;
+            groupMemberships.erase(it);
+        }
     }
 
-    // Remove unacked messages when subscriber disconnects
+    // Remove unacked messages when subscriber disconnects, a queue group member's
+    // unacked and backlogged messages are handed to the rest of its group
+    std::vector<MmwMessage> orphaned;
     {
-        std::lock_guard<std::mutex> lock(ackMutex);
-        unackedMessages.erase(client_fd);
+        std::lock_guard<BrokerMutex> lock(ackMutex);
+        auto it = unackedMessages.find(client_fd);
+        if (it != unackedMessages.end()) {
+            if (grouped) {
+                for (auto& pending : it->second) {
+                    orphaned.push_back(pending.second.msg);
+                }
+            }
+            unackedMessages.erase(it);
+        }
     }
+
+    {
+        std::lock_guard<BrokerMutex> lock(flowMutex);
+        auto it = subscriberFlows.find(client_fd);
+        if (it != subscriberFlows.end()) {
+            if (grouped) {
+                std::lock_guard<BrokerMutex> flowLock(it->second->mtx);
+                orphaned.insert(orphaned.end(), it->second->backlog.begin(), it->second->backlog.end());
+            }
+            subscriberFlows.erase(it);
+        }
+    }
+
+    if (!orphaned.empty()) {
+        std::sort(orphaned.begin(), orphaned.end(), [](const MmwMessage& a, const MmwMessage& b) {
+            return a.messageId < b.messageId;
+        });
+        MMW_LOG_INFO(MMW_LOG_RELIABILITY, "Handing {} messages of fd={} to the rest of group {}", orphaned.size(), client_fd, membership.second);
+        for (auto& msg : orphaned) {
+            redeliverToGroup(membership.first, membership.second, msg);
+        }
+    }
+
+    // Requests from this client need no answer, requests it was serving fail
+    {
+        std::lock_guard<BrokerMutex> lock(requestMutex);
+        for (auto it = pendingRequests.begin(); it != pendingRequests.end();) {
+            it = it->second.requesterFd == client_fd ? pendingRequests.erase(it) : std::next(it);
+        }
+    }
+    failRequests([client_fd](const PendingRequest& r) { return r.serverFd == client_fd; }, "server disconnected");
+
+    {
+        std::lock_guard<BrokerMutex> lock(clientFormatMutex);
+        clientFormats.erase(client_fd);
+    }
+
+    g_metrics->closeConnection(client_fd);
 }
 
 
 void handleClient(int client_fd) {
+    std::shared_ptr<PublisherConfirmState> confirms;
+    IMmwMessageSerializer* serializer = nullptr;
+    MmwSerializerFormat format = DefaultSerializerFormat();
+    uint32_t registeredTopicId = 0; // the only id this connection may publish by
+    bool registeredReserved = false;
+
+    LockProfiler::nameThread("mmw-client-" + std::to_string(client_fd));
+    std::shared_ptr<ConnectionMetrics> metrics = g_metrics->openConnection(client_fd);
+
+    // Reused for every frame on this connection, control frames are handled straight from the view
+    PooledBuffer buf;
+    MmwMessageView view;
+    MmwMessage backing{};
+
     while (running) {
         uint32_t netLen;
         ssize_t n = SocketAbstraction::Recv(client_fd, &netLen, sizeof(netLen), MSG_WAITALL);
@@ -164,76 +953,301 @@ void handleClient(int client_fd) {
             continue;
         }
 
-        std::vector<char> buf(msgLen);
+        if (buf.capacity() < msgLen) {
+            buf = bufferPool.acquire(msgLen);
+        }
         n = SocketAbstraction::Recv(client_fd, buf.data(), msgLen, MSG_WAITALL);
         if (n <= 0) {
             break;
         }
+        uint64_t receivedNs = MmwTraceNow();
+        metrics->messagesIn.fetch_add(1, std::memory_order_relaxed);
+        metrics->bytesIn.fetch_add(sizeof(netLen) + msgLen, std::memory_order_relaxed);
+
+        // The first frame decides the format for the rest of the connection
+        if (!serializer) {
+            if (!DetectSerializerFormat(buf.data(), msgLen, format)) {
+                MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Client fd={} sent a frame in no known format, closing", client_fd);
+                break;
+            }
+            serializer = g_serializers[format];
+            {
+                std::lock_guard<BrokerMutex> lock(clientFormatMutex);
+                clientFormats[client_fd] = format;
+            }
+            MMW_LOG_INFO(MMW_LOG_CONNECTION, "Client fd={} uses the {} serializer", client_fd, serializer->name());
+        }
 
         try {
-            MmwMessage msg = g_serializer->deserialize(std::string(buf.data(), msgLen));
-
-            if (msg.type == "register") {
-                auto now = std::chrono::steady_clock::now();
-                ConnectedClient newClient{client_fd, msg.payload, msg.topic, std::chrono::steady_clock::now()};
-                std::lock_guard<std::mutex> lock(clientListMutex);
-                connectedClientList.push_back(newClient);
-                spdlog::info("Registered {} for topic {} (fd={})", msg.payload, msg.topic, client_fd);
-            } else if (msg.type == "unregister") {
-                std::lock_guard<std::mutex> lock(clientListMutex);
+            serializer->deserialize_view(buf.data(), msgLen, false, view, backing);
+
+            if (view.isType("register")) {
+                MmwMessage msg = view.toMessage();
+                MmwRegistration reg = MmwRegistration::parse(msg.payload);
+                bool requester = reg.role == "requester";
+                uint32_t topicId = requester ? 0 : internTopic(msg.topic);
+
+                std::string type = reg.option("type");
+                unsigned long partitionCount = strtoul(reg.option("partitions", "0").c_str(), nullptr, 10);
+                std::string group = reg.role == "subscriber" ? reg.option("group") : "";
+                std::string partitionList = reg.role == "subscriber" && group.empty() ? reg.option("partition_list") : "";
+                std::vector<uint32_t> wantedPartitions;
+                std::string creditMessages = reg.role == "subscriber" ? reg.option("credit_msgs") : "";
+                std::string creditBytes = reg.role == "subscriber" ? reg.option("credit_bytes") : "";
+                int64_t initialMessages = 0;
+                int64_t initialBytes = 0;
+                if (requester) {
+                    // Replies are routed to the connection, so requesters register no topic
+                    MmwMessage reply{0, "registered", "", reg.role};
+                    sendMessage(client_fd, serializer->serialize(reply));
+                    g_metrics->registerConnection(client_fd, reg.role, "", serializer->name());
+                    MMW_LOG_INFO(MMW_LOG_CONNECTION, "Registered requester (fd={})", client_fd);
+                } else if ((reg.role == "publisher" || reg.role == "server") && isReservedTopic(msg.topic.data(), msg.topic.size())) {
+                    MMW_LOG_WARN(MMW_LOG_CONNECTION, "Rejected {} fd={} on reserved topic {}", reg.role, client_fd, msg.topic);
+                    g_metrics->registrationsRejected.fetch_add(1, std::memory_order_relaxed);
+                    MmwMessage reply{0, "rejected", msg.topic, "reserved topic"};
+                    sendMessage(client_fd, serializer->serialize(reply));
+                } else if (!bindTopicType(topicId, type)) {
+                    MMW_LOG_WARN(MMW_LOG_CONNECTION, "Rejected {} fd={} on topic {}: type {} does not match", reg.role, client_fd, msg.topic, type);
+                    g_metrics->registrationsRejected.fetch_add(1, std::memory_order_relaxed);
+                    MmwMessage reply{0, "rejected", msg.topic, "type mismatch"};
+                    sendMessage(client_fd, serializer->serialize(reply));
+                } else if (partitionCount > MAX_TOPIC_PARTITIONS || !bindTopicPartitions(topicId, (uint32_t)partitionCount)) {
+                    MMW_LOG_WARN(MMW_LOG_CONNECTION, "Rejected {} fd={} on topic {}: {} partitions do not match", reg.role, client_fd, msg.topic, partitionCount);
+                    g_metrics->registrationsRejected.fetch_add(1, std::memory_order_relaxed);
+                    MmwMessage reply{0, "rejected", msg.topic, "partition mismatch"};
+                    sendMessage(client_fd, serializer->serialize(reply));
+                } else if (!partitionList.empty() && !parsePartitionList(partitionList, topicPartitionCount(topicId), wantedPartitions)) {
+                    MMW_LOG_WARN(MMW_LOG_CONNECTION, "Rejected subscriber fd={} on topic {}: no such partitions {}", client_fd, msg.topic, partitionList);
+                    g_metrics->registrationsRejected.fetch_add(1, std::memory_order_relaxed);
+                    MmwMessage reply{0, "rejected", msg.topic, "unknown partition"};
+                    sendMessage(client_fd, serializer->serialize(reply));
+                } else if ((!creditMessages.empty() && !parseCredit(creditMessages, initialMessages)) ||
+                           (!creditBytes.empty() && !parseCredit(creditBytes, initialBytes))) {
+                    MMW_LOG_WARN(MMW_LOG_CONNECTION, "Rejected subscriber fd={} on topic {}: invalid credit {}/{}", client_fd, msg.topic, creditMessages, creditBytes);
+                    g_metrics->registrationsRejected.fetch_add(1, std::memory_order_relaxed);
+                    MmwMessage reply{0, "rejected", msg.topic, "invalid credit"};
+                    sendMessage(client_fd, serializer->serialize(reply));
+                } else {
+                    std::string confirmMode = reg.option("confirm");
+                    if (reg.role == "publisher" && (confirmMode == "routed" || confirmMode == "persisted")) {
+                        confirms = std::make_shared<PublisherConfirmState>();
+                        confirms->socket_fd = client_fd;
+                        confirms->serializer = serializer;
+                        confirms->topic = msg.topic;
+                        confirms->persisted = confirmMode == "persisted";
+                    }
+
+                    // Flow-controlled subscribers start with the credit they registered with
+                    if (!creditMessages.empty() || !creditBytes.empty()) {
+                        auto flow = std::make_shared<SubscriberFlow>();
+                        flow->limitMessages = !creditMessages.empty();
+                        flow->limitBytes = !creditBytes.empty();
+                        flow->messageCredit = initialMessages;
+                        flow->byteCredit = initialBytes;
+                        std::lock_guard<BrokerMutex> lock(flowMutex);
+                        subscriberFlows[client_fd] = flow;
+                    }
+
+                    // Publishers learn the topic id so they can stop sending the name, and the codec
+                    // they may compress with. Compressed payloads are forwarded without decoding.
+                    MmwRegistration accepted;
+                    accepted.role = reg.role;
+                    if (reg.role == "publisher") {
+                        IMmwCodec* codec = GetCodec(reg.option("codec", "none"));
+                        accepted.options["codec"] = codec ? codec->name() : "none";
+                        if (!codec) {
+                            MMW_LOG_WARN(MMW_LOG_CONNECTION, "Publisher fd={} asked for unknown codec {}, using none", client_fd, reg.option("codec"));
+                        }
+                    }
+
+                    // Answer before the client is routable so the reply is the first frame it reads
+                    MmwMessage reply{topicId, "registered", msg.topic, accepted.encode()};
+                    reply.topicId = topicId;
+                    sendMessage(client_fd, serializer->serialize(reply));
+
+                    g_metrics->registerConnection(client_fd, reg.role, msg.topic, serializer->name());
+                    registeredTopicId = topicId;
+                    registeredReserved = isReservedTopic(msg.topic.data(), msg.topic.size());
+                    ConnectedClient newClient{client_fd, reg.role, msg.topic, std::chrono::steady_clock::now(), topicId, format, metrics, group, wantedPartitions};
+                    {
+                        std::lock_guard<BrokerMutex> lock(clientListMutex);
+                        connectedClientList.push_back(newClient);
+                        if (!group.empty()) {
+                            GroupBalance balance = parseGroupBalance(reg.option("balance", "round_robin"));
+                            auto inserted = queueGroups.insert(std::make_pair(std::make_pair(topicId, group), QueueGroup{balance, 0}));
+                            if (!inserted.second && inserted.first->second.balance != balance) {
+                                MMW_LOG_WARN(MMW_LOG_SUBSCRIBE, "Group {} on {} keeps the balancing of its first member", group, msg.topic);
+                            }
+                            groupMemberships[client_fd] = std::make_pair(topicId, group);
+                        }
+                    }
+                    MMW_LOG_INFO(MMW_LOG_CONNECTION, "Registered {} for topic {} (id={}, fd={})", msg.payload, msg.topic, topicId, client_fd);
+                }
+            } else if (view.isType("unregister")) {
+                std::string topic(view.topic, view.topicLen);
+                std::lock_guard<BrokerMutex> lock(clientListMutex);
                 connectedClientList.erase(
                     std::remove_if(
                         connectedClientList.begin(), connectedClientList.end(),
                             [&](const ConnectedClient& c){
-                            return c.socket_fd == client_fd && c.topic == msg.topic;
+                            return c.socket_fd == client_fd && c.topic == topic;
                         }
                     ),
                     connectedClientList.end()
                 );
-                spdlog::info("Unregistered client fd={} topic={}", client_fd, msg.topic);
-            } else if (msg.type == "publish") {
+                MMW_LOG_INFO(MMW_LOG_CONNECTION, "Unregistered client fd={} topic={}", client_fd, topic);
+            } else if (view.isType("publish") && view.topicId != 0 && view.topicId != registeredTopicId) {
+                // A topic id is only accepted from the connection it was handed to at registration
+                rejectPublish(client_fd, serializer, confirms.get(), view.messageId, std::string(view.topic, view.topicLen), "unknown topic id");
+            } else if (view.isType("publish") && (view.topicId != 0 ? registeredReserved : isReservedTopic(view.topic, view.topicLen))) {
+                // Only the broker publishes on $SYS/ topics, whether they are named or given by id
+                rejectPublish(client_fd, serializer, confirms.get(), view.messageId, std::string(view.topic, view.topicLen), "reserved topic");
+            } else if (view.isType("publish")) {
+                // Persistence keeps a copy of every publish, the same message backs backlogs,
+                // redelivery and subscribers whose format differs from the publisher's
+                MmwMessage msg = view.toMessage();
+
+                // Publishers that know the topic id leave the name out
+                uint32_t topicId = msg.topicId != 0 ? msg.topicId : internTopic(msg.topic);
+                msg.topicId = topicId;
+                TopicMetrics& topicMetrics = g_metrics->topic(topicId);
+                topicMetrics.messagesIn.fetch_add(1, std::memory_order_relaxed);
+                topicMetrics.bytesIn.fetch_add(msg.payload.size(), std::memory_order_relaxed);
+                if (msg.trace.id != 0) {
+                    msg.trace.stamps[MMW_TRACE_BROKER_RECEIVED] = receivedNs;
+                    msg.trace.stamps[MMW_TRACE_BROKER_PARSED] = MmwTraceNow();
+                }
+
+                // Confirm-mode publishers number their messages, keep that before it is replaced
+                uint32_t publisherSeq = msg.messageId;
+                if (confirms) {
+                    std::lock_guard<BrokerMutex> lock(confirms->mtx);
+                    confirms->lastReceived = publisherSeq;
+                    confirms->inFlight.insert(publisherSeq);
+                }
+
+                // Publishes to one partition are numbered and queued under its lane lock, so
+                // message ids and delivery order agree within the partition while partitions
+                // run in parallel. The lock covers numbering, the persistence queue push and
+                // the hand-off, routing happens outside it.
+                std::shared_ptr<TopicPartitions> partitions = partitionsOf(topicId);
+                int32_t partition = -1;
+                std::unique_lock<BrokerMutex> laneLock;
+                if (partitions) {
+                    partition = keyPartition(*partitions, msg);
+                    if (partition < 0) {
+                        partition = (int32_t)(partitions->cursor.fetch_add(1, std::memory_order_relaxed) % partitions->count);
+                    }
+                    PartitionLane& lane = partitions->lanes[partition];
+                    laneLock = std::unique_lock<BrokerMutex>(lane.mtx);
+                    lane.space.wait(laneLock, [&lane] { return lane.pending.size() < MAX_LANE_PENDING; });
+                }
 
                 // Assign a unique messageId
                 // TODO: This could eventually reach a limit
                 msg.messageId = brokerMessageId++;
 
                 // Write message to sqlite database for persistence
-                if (!g_persistence->persistMessage(msg)) {
-                    spdlog::warn("Failed to persist message {}", msg.messageId);
+                BrokerPersistence::PersistCallback onPersisted;
+                if (confirms && confirms->persisted) {
+                    std::shared_ptr<PublisherConfirmState> state = confirms;
+                    onPersisted = [state, publisherSeq](bool ok) {
+                        sendPublisherConfirm(*state, publisherSeq, ok, false);
+                    };
+                }
+                if (!g_persistence->persistMessage(msg, onPersisted)) {
+                    MMW_LOG_LIMITED(MMW_LOG_PERSISTENCE, spdlog::level::warn, 1000, "Failed to persist message {}", msg.messageId);
+                    if (onPersisted) {
+                        onPersisted(false);
+                    }
+                }
+                if (msg.trace.id != 0) {
+                    msg.trace.stamps[MMW_TRACE_BROKER_PERSIST_QUEUED] = MmwTraceNow();
                 }
 
-                routeMessageToSubscribers(msg.topic, msg);
+                // Subscribers in the publisher's format get the received frame, restamped with the broker's ids
+                ForwardFrame frame{nullptr, msgLen, format};
+                if (serializer->restamp(buf.data(), msgLen, msg.messageId, topicId, msg.trace)) {
+                    frame.data = buf.data();
+                }
 
-            } else if (msg.type == "ack") {
-                std::lock_guard<std::mutex> lock(ackMutex);
+                std::shared_ptr<PublisherConfirmState> routedConfirm = confirms && !confirms->persisted ? confirms : nullptr;
+                if (partitions) {
+                    // The lane may route it from another thread, it takes the buffer and the next frame gets a fresh one
+                    PartitionLane& lane = partitions->lanes[partition];
+                    lane.pending.push_back(LanePublish{std::move(msg), std::string(), routedConfirm, publisherSeq,
+                                                       frame.data ? std::move(buf) : PooledBuffer(), frame});
+                    routePartition(topicId, partition, lane, laneLock);
+                } else {
+                    routeMessageToSubscribers(topicId, msg, -1, frame);
+                    if (routedConfirm) {
+                        confirmRouted(*routedConfirm, publisherSeq);
+                    }
+                }
+
+            } else if (view.isType("ack")) {
+                std::lock_guard<BrokerMutex> lock(ackMutex);
                 auto subIt = unackedMessages.find(client_fd);
-                if (subIt != unackedMessages.end()) {
-                    subIt->second.erase(msg.messageId);
+                if (subIt != unackedMessages.end() && subIt->second.erase(view.messageId) > 0) {
+                    metrics->unacked.fetch_sub(1, std::memory_order_relaxed);
+                }
+                MMW_LOG_TRACE(MMW_LOG_RELIABILITY, "Received ACK for message {} from subscriber fd={}", view.messageId, client_fd);
+            } else if (view.isType("credit")) {
+                int64_t bytes = 0;
+                if (view.size != 0 && !parseCredit(std::string(view.payload, view.size), bytes)) {
+                    MMW_LOG_LIMITED(MMW_LOG_SUBSCRIBE, spdlog::level::warn, 1000, "Ignoring invalid credit from subscriber fd={}", client_fd);
+                    g_metrics->decodeErrors.fetch_add(1, std::memory_order_relaxed);
+                } else if (!grantCredit(client_fd, view.messageId, bytes)) {
+                    MMW_LOG_ERROR(MMW_LOG_SUBSCRIBE, "send to subscriber fd={} failed while draining backlog", client_fd);
+                    break;
                 }
-                spdlog::info("Received ACK for message {} from subscriber fd={}", msg.messageId, client_fd);
-            } else if (msg.type == "heartbeat") {
-                std::lock_guard<std::mutex> lock(clientListMutex);
+            } else if (view.isType("request")) {
+                forwardRequest(client_fd, view, ForwardFrame{buf.data(), msgLen, format});
+            } else if (view.isType("reply") || view.isType("reply_error")) {
+                forwardReply(client_fd, view, ForwardFrame{buf.data(), msgLen, format});
+            } else if (view.isType("heartbeat")) {
+                std::lock_guard<BrokerMutex> lock(clientListMutex);
                 for (auto& client : connectedClientList) {
                     if (client.socket_fd == client_fd) {
                         client.lastHeartbeat = std::chrono::steady_clock::now();
                         break;
                     }
                 }
-                spdlog::info("Received heartbeat for message  subscriber fd={}", client_fd);
+                MMW_LOG_TRACE(MMW_LOG_HEARTBEAT, "Received heartbeat for message  subscriber fd={}", client_fd);
             }
 
         } catch (const std::exception& e) {
-            spdlog::error("Failed to deserialize message: {}", e.what());
+            MMW_LOG_LIMITED(MMW_LOG_GENERAL, spdlog::level::err, 1000, "Failed to deserialize message: {}", e.what());
+            g_metrics->decodeErrors.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Don't let one large message pin a large buffer on this connection
+        if (buf.capacity() > RESIDENT_BUFFER_SIZE) {
+            buf.reset();
         }
     }
 
+    // Pending persistence callbacks may still hold the state, make sure they stop sending
+    if (confirms) {
+        std::lock_guard<BrokerMutex> lock(confirms->mtx);
+        confirms->open = false;
+    }
+
     SocketAbstraction::SocketClose(client_fd);
     removeClientByFd(client_fd);
-    spdlog::info("Client disconnected (fd={})", client_fd);
+    MMW_LOG_INFO(MMW_LOG_CONNECTION, "Client disconnected (fd={})", client_fd);
+}
+
+// Set from SIGUSR1, the stats thread logs the lock profile since a signal handler cannot
+static std::atomic<bool> lockReportRequested(false);
+
+void handleLockReportSignal(int) {
+    lockReportRequested = true;
 }
 
 void handleSignal(int signum) {
-    spdlog::info("Signal received ({}), shutting down broker...", signum);
+    MMW_LOG_INFO(MMW_LOG_GENERAL, "Signal received ({}), shutting down broker...", signum);
     running = false;
     if (server_fd != -1) {
         SocketAbstraction::SocketClose(server_fd);
@@ -245,8 +1259,23 @@ int main(int argc, char *argv[]) {
     signal(SIGINT, handleSignal);
     signal(SIGTERM, handleSignal);
 
-    g_serializer = CreateSerializer();
+    // Per-message events must never wait on the console
+    MmwLog::setAsync(BROKER_LOG_QUEUE_SIZE);
+
+    for (size_t i = 0; i < SERIALIZER_FORMAT_COUNT; ++i) {
+        g_serializers[i] = CreateSerializer(static_cast<MmwSerializerFormat>(i));
+    }
     g_persistence = new BrokerPersistence("broker_data.db");
+    g_persistence->setTopicResolver(topicName);
+    g_metrics = new BrokerMetrics();
+    g_metrics->setTopicResolver(topicName);
+    g_metrics->addGauge("persistence_queue", []() { return (int64_t)g_persistence->queueDepth(); });
+    if (LockProfiler::enabled()) {
+        g_metrics->addSection("lock_profile", LockProfiler::report);
+#if !defined(_WIN32)
+        signal(SIGUSR1, handleLockReportSignal);
+#endif
+    }
 
     // Initialize brokerMessageId based on existing messages in DB
     brokerMessageId = g_persistence->getNextMessageId();
@@ -270,15 +1299,29 @@ int main(int argc, char *argv[]) {
         try {
             port = std::stoi(argv[1]);
             if (port <= 0 || port > 65535) {
-                spdlog::warn("Invalid port number '{}', using default {}", argv[1], port);
+                MMW_LOG_WARN(MMW_LOG_GENERAL, "Invalid port number '{}', using default {}", argv[1], port);
                 port = 5000;
             }
         } catch (const std::exception& e) {
-            spdlog::warn("Invalid port argument '{}', using default {}", argv[1], port);
+            MMW_LOG_WARN(MMW_LOG_GENERAL, "Invalid port argument '{}', using default {}", argv[1], port);
             port = 5000;
         }
     }
 
+    // Stats endpoint defaults to the port after the broker's, 0 turns it off
+    int statsPort = port < 65535 ? port + 1 : 0;
+    if (argc > 2) {
+        try {
+            statsPort = std::stoi(argv[2]);
+        } catch (const std::exception& e) {
+            statsPort = -1;
+        }
+        if (statsPort < 0 || statsPort > 65535) {
+            MMW_LOG_WARN(MMW_LOG_GENERAL, "Invalid stats port argument '{}', stats endpoint disabled", argv[2]);
+            statsPort = 0;
+        }
+    }
+
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
     address.sin_port = htons(port);
@@ -292,19 +1335,28 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    spdlog::info("Broker listening on port {}", port);
+    MMW_LOG_INFO(MMW_LOG_GENERAL, "Broker listening on port {}", port);
+    if (statsPort != 0) {
+        g_metrics->startStatsServer(statsPort);
+    }
 
     // Start heartbeat monitoring thread
     std::thread heartbeatMonitor([]() {
+        LockProfiler::nameThread("mmw-heartbeat");
         constexpr int TIMEOUT_MS = 6000; // 6 seconds timeout
         while (running) {
             std::this_thread::sleep_for(std::chrono::milliseconds(1000));
             auto now = std::chrono::steady_clock::now();
-            std::lock_guard<std::mutex> lock(clientListMutex);
+            failRequests([now](const PendingRequest& r) {
+                return std::chrono::duration_cast<std::chrono::milliseconds>(now - r.forwardedAt).count() > REQUEST_TIMEOUT_MS;
+            }, "timeout");
+
+            std::lock_guard<BrokerMutex> lock(clientListMutex);
             for (auto it = connectedClientList.begin(); it != connectedClientList.end();) {
-                if (it->type == "subscriber" &&
+                if ((it->type == "subscriber" || it->type == "server") &&
                     std::chrono::duration_cast<std::chrono::milliseconds>(now - it->lastHeartbeat).count() > TIMEOUT_MS) {
-                    spdlog::warn("Subscriber fd={} timed out, removing", it->socket_fd);
+                    MMW_LOG_WARN(MMW_LOG_HEARTBEAT, "{} fd={} timed out, removing", it->type, it->socket_fd);
+                    g_metrics->heartbeatTimeouts.fetch_add(1, std::memory_order_relaxed);
                     SocketAbstraction::SocketClose(it->socket_fd);
                     it = connectedClientList.erase(it);
                 } else {
@@ -317,13 +1369,14 @@ int main(int argc, char *argv[]) {
     // Start resend thread for unacked messages
     constexpr int MAX_RETRIES = 3;
     std::thread resendThread([MAX_RETRIES]() {
+        LockProfiler::nameThread("mmw-resend");
         while (running) {
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
             auto now = std::chrono::steady_clock::now();
             std::vector<int> fdsToRemove;
 
             {
-                std::lock_guard<std::mutex> lock(ackMutex);
+                std::lock_guard<BrokerMutex> lock(ackMutex);
                 for (auto& clientPair : unackedMessages) {
                     int fd = clientPair.first;
                     auto& msgMap = clientPair.second;
@@ -334,12 +1387,14 @@ int main(int argc, char *argv[]) {
 
                         if (elapsed.count() > 2) { // retry delay
                             if (pending.retryCount >= MAX_RETRIES) {
-                                spdlog::error("Max retries reached for message {} to fd={}", pending.msg.messageId, fd);
+                                MMW_LOG_ERROR(MMW_LOG_RELIABILITY, "Max retries reached for message {} to fd={}", pending.msg.messageId, fd);
+                                g_metrics->retransmitFailures.fetch_add(1, std::memory_order_relaxed);
                                 fdsToRemove.push_back(fd);
                                 break;
                             } else {
-                                spdlog::warn("Resending message {} to fd={}", pending.msg.messageId, fd);
-                                sendMessage(fd, g_serializer->serialize(pending.msg));
+                                MMW_LOG_LIMITED(MMW_LOG_RELIABILITY, spdlog::level::warn, 1000, "Resending message {} to fd={}", pending.msg.messageId, fd);
+                                sendMessage(fd, serializerFor(fd)->serialize(pending.msg));
+                                g_metrics->retransmits.fetch_add(1, std::memory_order_relaxed);
                                 pending.timestamp = now;
                                 pending.retryCount++;
                                 ++it;
@@ -349,13 +1404,35 @@ int main(int argc, char *argv[]) {
                         }
                     }
                 }
+            }
 
-                for (int fd : fdsToRemove) {
-                    unackedMessages.erase(fd);
-                    SocketAbstraction::SocketClose(fd);
-                    removeClientByFd(fd);
-                }
+            // removeClientByFd takes the ack lock itself, and hands group members' messages on
+            for (int fd : fdsToRemove) {
+                SocketAbstraction::SocketClose(fd);
+                removeClientByFd(fd);
+            }
+        }
+    });
+
+    // Periodically publish the metrics snapshot on the reserved stats topic
+    std::thread statsPublisher([]() {
+        LockProfiler::nameThread("mmw-stats");
+        uint32_t topicId = internTopic(STATS_TOPIC);
+        auto next = std::chrono::steady_clock::now() + std::chrono::milliseconds(STATS_PUBLISH_INTERVAL_MS);
+        while (running) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            if (lockReportRequested.exchange(false)) {
+                MMW_LOG_INFO(MMW_LOG_GENERAL, "Lock profile: {}", LockProfiler::report());
             }
+            if (std::chrono::steady_clock::now() < next) {
+                continue;
+            }
+            next += std::chrono::milliseconds(STATS_PUBLISH_INTERVAL_MS);
+
+            MmwMessage msg{brokerMessageId++, "publish", STATS_TOPIC, g_metrics->snapshot()};
+            msg.size = msg.payload.size();
+            msg.topicId = topicId;
+            routeMessageToSubscribers(topicId, msg, -1);
         }
     });
 
@@ -375,8 +1452,9 @@ int main(int argc, char *argv[]) {
             continue;
         }
 
-        spdlog::info("Client connected from {}:{} (fd={})", inet_ntoa(client_addr.sin_addr),
+        MMW_LOG_INFO(MMW_LOG_CONNECTION, "Client connected from {}:{} (fd={})", inet_ntoa(client_addr.sin_addr),
                      ntohs(client_addr.sin_port), client_fd);
+        SocketAbstraction::SetNoDelay(client_fd);
 
         {
             std::lock_guard<std::mutex> lt(threadListMutex);
@@ -398,10 +1476,11 @@ int main(int argc, char *argv[]) {
     }
 
     resendThread.join();
+    statsPublisher.join();
 
     // Cleanup remaining clients
     {
-        std::lock_guard<std::mutex> lock(clientListMutex);
+        std::lock_guard<BrokerMutex> lock(clientListMutex);
         for (auto& c : connectedClientList) {
             if (c.socket_fd != -1) {
                 SocketAbstraction::SocketClose(c.socket_fd);
@@ -415,16 +1494,23 @@ int main(int argc, char *argv[]) {
         server_fd = -1;
     }
 
+    // Stop the stats endpoint before the persistence gauge it reads goes away
+    delete g_metrics;
+    g_metrics = nullptr;
+
     // Cleanup broker persistence
     delete g_persistence;
     g_persistence = nullptr;
 
-    // Cleanup serializer
-    delete g_serializer;
-    g_serializer = nullptr;
+    // Cleanup serializers
+    for (size_t i = 0; i < SERIALIZER_FORMAT_COUNT; ++i) {
+        delete g_serializers[i];
+        g_serializers[i] = nullptr;
+    }
 
     SocketAbstraction::SocketCleanup();
-    spdlog::info("Broker exited cleanly");
+    MMW_LOG_INFO(MMW_LOG_GENERAL, "Broker exited cleanly");
+    MmwLog::flush();
 
     return 0;
 }
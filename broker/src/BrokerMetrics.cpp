@@ -0,0 +1,251 @@
+#include "BrokerMetrics.h"
+#include "SocketAbstraction.h"
+#include "LockProfiler.h"
+#include "MmwLog.h"
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+#include <cstring>
+
+BrokerMetrics::BrokerMetrics() : startedAt_(std::chrono::steady_clock::now()) {
+    for (size_t i = 0; i < MAX_SEGMENTS; ++i) {
+        segments_[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+BrokerMetrics::~BrokerMetrics() {
+    stopStatsServer();
+    for (size_t i = 0; i < MAX_SEGMENTS; ++i) {
+        delete[] segments_[i].load(std::memory_order_relaxed);
+    }
+}
+
+void BrokerMetrics::setTopicResolver(TopicResolver resolver) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    topicResolver_ = resolver;
+}
+
+void BrokerMetrics::addGauge(const std::string& name, GaugeReader reader) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    gauges_[name] = reader;
+}
+
+void BrokerMetrics::addSection(const std::string& name, SectionReader reader) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    sections_[name] = reader;
+}
+
+TopicMetrics& BrokerMetrics::topic(uint32_t topicId) {
+    size_t segment = topicId / SEGMENT_SIZE;
+    if (segment >= MAX_SEGMENTS) {
+        return overflow_;
+    }
+
+    uint32_t highest = highestTopic_.load(std::memory_order_relaxed);
+    while (topicId > highest && !highestTopic_.compare_exchange_weak(highest, topicId, std::memory_order_relaxed)) {
+    }
+
+    // Whoever loses the race to allocate a segment frees its copy and uses the winner's
+    TopicMetrics* table = segments_[segment].load(std::memory_order_acquire);
+    if (!table) {
+        TopicMetrics* fresh = new TopicMetrics[SEGMENT_SIZE];
+        if (segments_[segment].compare_exchange_strong(table, fresh, std::memory_order_acq_rel)) {
+            table = fresh;
+        } else {
+            delete[] fresh;
+        }
+    }
+    return table[topicId % SEGMENT_SIZE];
+}
+
+std::shared_ptr<ConnectionMetrics> BrokerMetrics::openConnection(int fd) {
+    auto conn = std::make_shared<ConnectionMetrics>();
+    conn->fd = fd;
+    conn->connectedAt = std::chrono::steady_clock::now();
+    connectionsAccepted.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    connections_[fd] = conn;
+    return conn;
+}
+
+void BrokerMetrics::registerConnection(int fd, const std::string& role, const std::string& topic, const std::string& format) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = connections_.find(fd);
+    if (it != connections_.end()) {
+        it->second->role = role;
+        it->second->topic = topic;
+        it->second->format = format;
+    }
+}
+
+std::shared_ptr<ConnectionMetrics> BrokerMetrics::findConnection(int fd) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = connections_.find(fd);
+    return it == connections_.end() ? nullptr : it->second;
+}
+
+void BrokerMetrics::closeConnection(int fd) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (connections_.erase(fd) > 0) {
+        connectionsClosed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::string BrokerMetrics::snapshot() {
+    auto now = std::chrono::steady_clock::now();
+    nlohmann::json j;
+    j["uptime_s"] = std::chrono::duration_cast<std::chrono::seconds>(now - startedAt_).count();
+    j["connections_accepted"] = connectionsAccepted.load(std::memory_order_relaxed);
+    j["connections_closed"] = connectionsClosed.load(std::memory_order_relaxed);
+    j["registrations_rejected"] = registrationsRejected.load(std::memory_order_relaxed);
+    j["publishes_rejected"] = publishesRejected.load(std::memory_order_relaxed);
+    j["decode_errors"] = decodeErrors.load(std::memory_order_relaxed);
+    j["retransmits"] = retransmits.load(std::memory_order_relaxed);
+    j["retransmit_failures"] = retransmitFailures.load(std::memory_order_relaxed);
+    j["heartbeat_timeouts"] = heartbeatTimeouts.load(std::memory_order_relaxed);
+    j["backlog_drops"] = backlogDrops.load(std::memory_order_relaxed);
+    j["slow_subscribers_closed"] = slowSubscribersClosed.load(std::memory_order_relaxed);
+    j["send_failures"] = sendFailures.load(std::memory_order_relaxed);
+    j["requests_routed"] = requestsRouted.load(std::memory_order_relaxed);
+    j["requests_failed"] = requestsFailed.load(std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (auto& gauge : gauges_) {
+        j[gauge.first] = gauge.second();
+    }
+    for (auto& section : sections_) {
+        j[section.first] = nlohmann::json::parse(section.second());
+    }
+
+    uint64_t totals[4] = {};
+    nlohmann::json topics = nlohmann::json::array();
+    uint32_t highest = highestTopic_.load(std::memory_order_relaxed);
+    for (uint32_t id = 1; id <= highest && id / SEGMENT_SIZE < MAX_SEGMENTS; ++id) {
+        TopicMetrics* table = segments_[id / SEGMENT_SIZE].load(std::memory_order_acquire);
+        if (!table) {
+            continue;
+        }
+        const TopicMetrics& t = table[id % SEGMENT_SIZE];
+        uint64_t values[4] = {
+            t.messagesIn.load(std::memory_order_relaxed), t.bytesIn.load(std::memory_order_relaxed),
+            t.messagesOut.load(std::memory_order_relaxed), t.bytesOut.load(std::memory_order_relaxed)
+        };
+        if (values[0] == 0 && values[2] == 0) {
+            continue;
+        }
+        for (int i = 0; i < 4; ++i) {
+            totals[i] += values[i];
+        }
+        topics.push_back({
+            {"topic", topicResolver_ ? topicResolver_(id) : std::to_string(id)},
+            {"id", id},
+            {"messages_in", values[0]},
+            {"bytes_in", values[1]},
+            {"messages_out", values[2]},
+            {"bytes_out", values[3]},
+            {"last_fanout", t.lastFanout.load(std::memory_order_relaxed)}
+        });
+    }
+    j["messages_in"] = totals[0];
+    j["bytes_in"] = totals[1];
+    j["messages_out"] = totals[2];
+    j["bytes_out"] = totals[3];
+    j["topics"] = topics;
+
+    int64_t unacked = 0;
+    int64_t backlog = 0;
+    nlohmann::json clients = nlohmann::json::array();
+    for (auto& entry : connections_) {
+        const ConnectionMetrics& c = *entry.second;
+        int64_t connUnacked = c.unacked.load(std::memory_order_relaxed);
+        int64_t connBacklog = c.backlog.load(std::memory_order_relaxed);
+        unacked += connUnacked;
+        backlog += connBacklog;
+        clients.push_back({
+            {"fd", c.fd},
+            {"role", c.role},
+            {"topic", c.topic},
+            {"format", c.format},
+            {"connected_s", std::chrono::duration_cast<std::chrono::seconds>(now - c.connectedAt).count()},
+            {"messages_in", c.messagesIn.load(std::memory_order_relaxed)},
+            {"bytes_in", c.bytesIn.load(std::memory_order_relaxed)},
+            {"messages_out", c.messagesOut.load(std::memory_order_relaxed)},
+            {"bytes_out", c.bytesOut.load(std::memory_order_relaxed)},
+            {"unacked", connUnacked},
+            {"backlog", connBacklog},
+            {"unsent_bytes", SocketAbstraction::BytesUnsent(c.fd)}
+        });
+    }
+    j["connections"] = connections_.size();
+    j["unacked"] = unacked;
+    j["backlog"] = backlog;
+    j["clients"] = clients;
+    return j.dump();
+}
+
+bool BrokerMetrics::startStatsServer(int port) {
+    statsFd_ = (int)socket(AF_INET, SOCK_STREAM, 0);
+    if (statsFd_ < 0) {
+        return false;
+    }
+    int opt = 1;
+    setsockopt(statsFd_, SOL_SOCKET, SO_REUSEADDR, (const char*)&opt, sizeof(opt));
+
+    // Loopback only, the endpoint is for local tooling and has no authentication
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((unsigned short)port);
+    if (bind(statsFd_, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(statsFd_, 16) < 0) {
+        MMW_LOG_ERROR(MMW_LOG_GENERAL, "Stats endpoint could not listen on 127.0.0.1:{}", port);
+        SocketAbstraction::SocketClose(statsFd_);
+        statsFd_ = -1;
+        return false;
+    }
+
+    statsRunning_ = true;
+    statsThread_ = std::thread(&BrokerMetrics::serveStats, this);
+    MMW_LOG_INFO(MMW_LOG_GENERAL, "Stats endpoint listening on http://127.0.0.1:{}/stats", port);
+    return true;
+}
+
+void BrokerMetrics::stopStatsServer() {
+    if (!statsRunning_.exchange(false)) {
+        return;
+    }
+#if defined(_WIN32)
+    shutdown(statsFd_, SD_BOTH);
+#else
+    shutdown(statsFd_, SHUT_RDWR);
+#endif
+    SocketAbstraction::SocketClose(statsFd_);
+    statsFd_ = -1;
+    if (statsThread_.joinable()) {
+        statsThread_.join();
+    }
+}
+
+// Every request gets the snapshot, so curl and monitoring agents need no particular path
+void BrokerMetrics::serveStats() {
+    LockProfiler::nameThread("mmw-stats-http");
+    while (statsRunning_) {
+        int client = (int)accept(statsFd_, nullptr, nullptr);
+        if (client < 0) {
+            // Back off rather than spin if accept keeps failing, e.g. out of descriptors
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        // Read the request head so the client does not see a reset, without waiting on slow peers
+        SocketAbstraction::SetRecvTimeout(client, 500);
+        char request[1024];
+        SocketAbstraction::Recv(client, request, sizeof(request), 0);
+
+        std::string body = snapshot();
+        std::string response = "HTTP/1.0 200 OK\r\nContent-Type: application/json\r\nContent-Length: " +
+                               std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+        SocketAbstraction::Send(client, response.data(), (int32_t)response.size(), 0);
+        SocketAbstraction::SocketClose(client);
+    }
+}
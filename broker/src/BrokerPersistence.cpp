@@ -1,12 +1,14 @@
 #include "BrokerPersistence.h"
 #include <spdlog/spdlog.h>
+#include "MmwLog.h"
+#include <vector>
 
 BrokerPersistence::BrokerPersistence(const std::string& dbPath)
-    : db_(nullptr), dbPath_(dbPath), running_(true)
+    : db_(nullptr), dbPath_(dbPath), running_(true), depth_(0)
 {
-    std::lock_guard<std::mutex> lock(dbMutex_);
+    std::lock_guard<BrokerMutex> lock(dbMutex_);
     if (sqlite3_open_v2(dbPath_.c_str(), &db_, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX, nullptr) != SQLITE_OK) {
-        spdlog::error("Failed to open SQLite DB {}: {}", dbPath_, sqlite3_errmsg(db_));
+        MMW_LOG_ERROR(MMW_LOG_PERSISTENCE, "Failed to open SQLite DB {}: {}", dbPath_, sqlite3_errmsg(db_));
         db_ = nullptr;
         return;
     }
@@ -14,30 +16,32 @@ BrokerPersistence::BrokerPersistence(const std::string& dbPath)
 
     // Start background worker
     worker_ = std::thread([this]() {
+        LockProfiler::nameThread("mmw-persist");
         while (running_) {
-            std::unique_lock<std::mutex> lock(queueMutex_);
+            std::unique_lock<BrokerMutex> lock(queueMutex_);
             cv_.wait(lock, [this]() { return !queue_.empty() || !running_; });
             if (!running_) break;
 
-            MmwMessage msg = std::move(queue_.front());
-            queue_.pop();
+            // Take everything queued so far, one commit covers the whole batch
+            std::queue<PendingWrite> batch;
+            std::swap(batch, queue_);
             lock.unlock();
 
-            persistBlocking(msg);
+            persistBatch(batch);
         }
     });
 }
 
 BrokerPersistence::~BrokerPersistence() {
     {
-        std::lock_guard<std::mutex> lock(queueMutex_);
+        std::lock_guard<BrokerMutex> lock(queueMutex_);
         running_ = false;
     }
     cv_.notify_all();
     if (worker_.joinable())
         worker_.join();
 
-    std::lock_guard<std::mutex> lock(dbMutex_);
+    std::lock_guard<BrokerMutex> lock(dbMutex_);
     if (db_) {
         sqlite3_close(db_);
         db_ = nullptr;
@@ -55,7 +59,7 @@ bool BrokerPersistence::prepareDatabase() {
 
     char* errMsg = nullptr;
     if (sqlite3_exec(db_, createTableSQL, nullptr, nullptr, &errMsg) != SQLITE_OK) {
-        spdlog::error("Failed to create messages table: {}", errMsg);
+        MMW_LOG_ERROR(MMW_LOG_PERSISTENCE, "Failed to create messages table: {}", errMsg);
         sqlite3_free(errMsg);
         return false;
     }
@@ -63,36 +67,82 @@ bool BrokerPersistence::prepareDatabase() {
 }
 
 // Public async interface
-bool BrokerPersistence::persistMessage(const MmwMessage& msg) {
+bool BrokerPersistence::persistMessage(const MmwMessage& msg, PersistCallback onPersisted) {
     if (!db_ || !running_) return false;
     {
-        std::lock_guard<std::mutex> lock(queueMutex_);
-        queue_.push(msg);
+        std::lock_guard<BrokerMutex> lock(queueMutex_);
+        queue_.push(PendingWrite{msg, onPersisted});
     }
+    depth_.fetch_add(1, std::memory_order_relaxed);
     cv_.notify_one();
     return true;
 }
 
+void BrokerPersistence::persistBatch(std::queue<PendingWrite>& batch) {
+    {
+        std::lock_guard<BrokerMutex> lock(dbMutex_);
+        sqlite3_exec(db_, "BEGIN;", nullptr, nullptr, nullptr);
+    }
+
+    std::vector<PendingWrite> writes;
+    std::vector<bool> results;
+    writes.reserve(batch.size());
+    results.reserve(batch.size());
+    while (!batch.empty()) {
+        writes.push_back(std::move(batch.front()));
+        batch.pop();
+        results.push_back(persistBlocking(writes.back().msg));
+    }
+
+    bool committed;
+    {
+        std::lock_guard<BrokerMutex> lock(dbMutex_);
+        committed = sqlite3_exec(db_, "COMMIT;", nullptr, nullptr, nullptr) == SQLITE_OK;
+        if (!committed) {
+            MMW_LOG_ERROR(MMW_LOG_PERSISTENCE, "Failed to commit persistence batch: {}", sqlite3_errmsg(db_));
+            sqlite3_exec(db_, "ROLLBACK;", nullptr, nullptr, nullptr);
+        }
+    }
+
+    // Only report success once the data is durable
+    for (size_t i = 0; i < writes.size(); ++i) {
+        if (writes[i].onPersisted) {
+            writes[i].onPersisted(committed && results[i]);
+        }
+    }
+    depth_.fetch_sub(writes.size(), std::memory_order_relaxed);
+}
+
+void BrokerPersistence::setTopicResolver(TopicResolver resolver) {
+    std::lock_guard<BrokerMutex> lock(dbMutex_);
+    topicResolver_ = resolver;
+}
+
 // Actual SQLite write (blocking, used only by worker thread)
 bool BrokerPersistence::persistBlocking(const MmwMessage& msg) {
-    std::lock_guard<std::mutex> lock(dbMutex_);
+    std::lock_guard<BrokerMutex> lock(dbMutex_);
 
     sqlite3_stmt* stmt = nullptr;
     const char* insertSQL = "INSERT INTO messages (messageId, topic, payload, reliability) VALUES (?, ?, ?, ?);";
 
     if (sqlite3_prepare_v2(db_, insertSQL, -1, &stmt, nullptr) != SQLITE_OK) {
-        spdlog::error("Failed to prepare statement: {}", sqlite3_errmsg(db_));
+        MMW_LOG_ERROR(MMW_LOG_PERSISTENCE, "Failed to prepare statement: {}", sqlite3_errmsg(db_));
         return false;
     }
 
+    std::string topic = msg.topic;
+    if (topic.empty() && msg.topicId != 0 && topicResolver_) {
+        topic = topicResolver_(msg.topicId);
+    }
+
     sqlite3_bind_int(stmt, 1, msg.messageId);
-    sqlite3_bind_text(stmt, 2, msg.topic.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(stmt, 2, topic.c_str(), -1, SQLITE_TRANSIENT);
     sqlite3_bind_blob(stmt, 3, msg.payload.data(), static_cast<int>(msg.payload.size()), SQLITE_TRANSIENT);
     sqlite3_bind_int(stmt, 4, msg.reliability ? 1 : 0);
 
     int rc = sqlite3_step(stmt);
     if (rc != SQLITE_DONE) {
-        spdlog::error("Failed to execute statement: {}", sqlite3_errmsg(db_));
+        MMW_LOG_ERROR(MMW_LOG_PERSISTENCE, "Failed to execute statement: {}", sqlite3_errmsg(db_));
         sqlite3_finalize(stmt);
         return false;
     }
@@ -106,7 +156,7 @@ uint32_t BrokerPersistence::getNextMessageId() {
     const char* sql = "SELECT MAX(messageId) FROM messages;";
     uint32_t nextId = 1;
 
-    std::lock_guard<std::mutex> lock(dbMutex_);
+    std::lock_guard<BrokerMutex> lock(dbMutex_);
     if (sqlite3_prepare_v2(db_, sql, -1, &stmt, nullptr) == SQLITE_OK) {
         if (sqlite3_step(stmt) == SQLITE_ROW) {
             int maxId = sqlite3_column_int(stmt, 0);
@@ -0,0 +1,222 @@
+#include "LockProfiler.h"
+
+#if defined(MMW_LOCK_INSTRUMENTATION)
+#include <nlohmann/json.hpp>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__linux__)
+#include <dirent.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+static int bucketOf(uint64_t ns) {
+    if (ns == 0) {
+        return 0;
+    }
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, ns);
+    int bucket = (int)index + 1;
+#else
+    int bucket = 64 - __builtin_clzll(ns);
+#endif
+    return bucket < LockStats::BUCKETS ? bucket : LockStats::BUCKETS - 1;
+}
+
+void LockStats::recordWait(uint64_t ns) {
+    waitNs.fetch_add(ns, std::memory_order_relaxed);
+    waitBuckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void LockStats::recordHold(uint64_t ns) {
+    holdNs.fetch_add(ns, std::memory_order_relaxed);
+    holdBuckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+}
+
+// Broker locks are globals constructed during static initialisation, so the
+// registry lives in a function-local static that exists before the first of them
+struct LockRegistry {
+    static const size_t MAX_LOCKS = 64;
+    std::mutex mtx;
+    LockStats locks[MAX_LOCKS];
+    size_t count = 0;
+    LockStats overflow;
+};
+
+static LockRegistry& registry() {
+    static LockRegistry instance;
+    return instance;
+}
+
+static void resetStats(LockStats& stats, const char* name) {
+    stats.name = name;
+    stats.acquisitions = 0;
+    stats.contended = 0;
+    stats.waitNs = 0;
+    stats.holdNs = 0;
+    for (int i = 0; i < LockStats::BUCKETS; ++i) {
+        stats.waitBuckets[i] = 0;
+        stats.holdBuckets[i] = 0;
+    }
+}
+
+static LockStats* statsFor(const char* name) {
+    LockRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mtx);
+    for (size_t i = 0; i < reg.count; ++i) {
+        if (strcmp(reg.locks[i].name, name) == 0) {
+            return &reg.locks[i];
+        }
+    }
+    if (reg.count == LockRegistry::MAX_LOCKS) {
+        if (!reg.overflow.name) {
+            resetStats(reg.overflow, "other");
+        }
+        return &reg.overflow;
+    }
+    LockStats* stats = &reg.locks[reg.count++];
+    resetStats(*stats, name);
+    return stats;
+}
+
+InstrumentedMutex::InstrumentedMutex(const char* name) : stats_(statsFor(name)) {
+}
+
+// Upper bound in ns of the bucket holding the given fraction of samples
+static uint64_t percentile(const std::atomic<uint64_t>* buckets, uint64_t total, double fraction) {
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(total * fraction);
+    uint64_t seen = 0;
+    for (int i = 0; i < LockStats::BUCKETS; ++i) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            return (uint64_t)1 << i;
+        }
+    }
+    return (uint64_t)1 << (LockStats::BUCKETS - 1);
+}
+
+static nlohmann::json histogram(const std::atomic<uint64_t>* buckets) {
+    nlohmann::json j = nlohmann::json::object();
+    for (int i = 0; i < LockStats::BUCKETS; ++i) {
+        uint64_t n = buckets[i].load(std::memory_order_relaxed);
+        if (n != 0) {
+            j[std::to_string((uint64_t)1 << i)] = n;
+        }
+    }
+    return j;
+}
+
+static nlohmann::json lockReport(const LockStats& s) {
+    uint64_t acquisitions = s.acquisitions.load(std::memory_order_relaxed);
+    uint64_t contended = s.contended.load(std::memory_order_relaxed);
+    return {
+        {"name", s.name},
+        {"acquisitions", acquisitions},
+        {"contended", contended},
+        {"wait_ns", s.waitNs.load(std::memory_order_relaxed)},
+        {"hold_ns", s.holdNs.load(std::memory_order_relaxed)},
+        {"wait_p50_ns", percentile(s.waitBuckets, contended, 0.50)},
+        {"wait_p99_ns", percentile(s.waitBuckets, contended, 0.99)},
+        {"hold_p50_ns", percentile(s.holdBuckets, acquisitions, 0.50)},
+        {"hold_p99_ns", percentile(s.holdBuckets, acquisitions, 0.99)},
+        {"wait_histogram", histogram(s.waitBuckets)},
+        {"hold_histogram", histogram(s.holdBuckets)}
+    };
+}
+
+// User and system CPU time of every thread in the process
+static nlohmann::json threadReport() {
+    nlohmann::json threads = nlohmann::json::array();
+#if defined(__linux__)
+    DIR* dir = opendir("/proc/self/task");
+    if (!dir) {
+        return threads;
+    }
+    long ticksPerSecond = sysconf(_SC_CLK_TCK);
+    while (struct dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        std::string base = std::string("/proc/self/task/") + entry->d_name;
+
+        std::string name;
+        std::ifstream comm(base + "/comm");
+        std::getline(comm, name);
+
+        // Fields after the parenthesised command start at field 3, utime and stime are fields 14 and 15
+        std::ifstream statFile(base + "/stat");
+        std::string stat((std::istreambuf_iterator<char>(statFile)), std::istreambuf_iterator<char>());
+        size_t close = stat.rfind(')');
+        if (close == std::string::npos) {
+            continue;
+        }
+        std::istringstream fields(stat.substr(close + 1));
+        std::vector<std::string> values;
+        std::string value;
+        while (values.size() < 13 && fields >> value) {
+            values.push_back(value);
+        }
+        if (values.size() < 13) {
+            continue;
+        }
+        threads.push_back({
+            {"tid", atoi(entry->d_name)},
+            {"name", name},
+            {"user_ms", std::stoull(values[11]) * 1000 / ticksPerSecond},
+            {"system_ms", std::stoull(values[12]) * 1000 / ticksPerSecond}
+        });
+    }
+    closedir(dir);
+#endif
+    return threads;
+}
+
+bool LockProfiler::enabled() {
+    return true;
+}
+
+void LockProfiler::nameThread(const std::string& name) {
+#if defined(__linux__)
+    // Linux limits thread names to 15 characters
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#endif
+}
+
+std::string LockProfiler::report() {
+    LockRegistry& reg = registry();
+    nlohmann::json locks = nlohmann::json::array();
+    {
+        std::lock_guard<std::mutex> lock(reg.mtx);
+        for (size_t i = 0; i < reg.count; ++i) {
+            locks.push_back(lockReport(reg.locks[i]));
+        }
+        if (reg.overflow.name) {
+            locks.push_back(lockReport(reg.overflow));
+        }
+    }
+    nlohmann::json j;
+    j["locks"] = locks;
+    j["threads"] = threadReport();
+    return j.dump();
+}
+#else
+bool LockProfiler::enabled() {
+    return false;
+}
+
+void LockProfiler::nameThread(const std::string&) {
+}
+
+std::string LockProfiler::report() {
+    return "{}";
+}
+#endif
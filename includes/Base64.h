@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/**
+ * Standard padded base64, used by the JSON serializer for binary payloads.
+ *
+ * The encoder and decoder pick an AVX2 or SSSE3 implementation at runtime
+ * when the CPU has one, and fall back to a table-driven scalar loop.
+ */
+
+// Encoded length of len bytes, including padding
+inline size_t Base64EncodedSize(size_t len) {
+    return (len + 2) / 3 * 4;
+}
+
+// Replace out with the encoding of data, reusing its capacity
+void Base64Encode(const void* data, size_t len, std::string& out);
+
+// Replace out with the decoded bytes, throws std::runtime_error on malformed input
+void Base64Decode(const char* data, size_t len, std::string& out);
+
+// Implementation selected for this CPU: "avx2", "ssse3" or "scalar"
+const char* Base64Implementation();
@@ -0,0 +1,98 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include "IMmwMessageSerializer.h"
+#include "MmwMessage.h"
+
+/**
+ * Compact fixed-layout wire format.
+ *
+ * Every frame starts with a 24 byte little-endian header followed by the
+ * topic bytes and the payload bytes:
+ *
+ *   offset  size  field
+ *        0     2  magic "MW"
+ *        2     1  version
+ *        3     1  message type (BinaryMessageType)
+ *        4     2  flags (BinaryFlags, the high byte is the payload codec id)
+ *        6     2  topic length
+ *        8     8  message id
+ *       16     4  topic id
+ *       20     4  payload length
+ *
+ * Keyed messages set BINARY_FLAG_KEY and put a 2 byte key length and the
+ * key bytes between the topic and the payload.
+ *
+ * Traced messages set BINARY_FLAG_TRACE and append a trace block after the
+ * payload: the 8 byte trace id, a 1 byte stamp count and that many 8 byte
+ * stamps.
+ *
+ * VERSION changes with every layout change and frames of any other version
+ * are rejected: 1 was the plain layout, 2 added the payload codec id, 3
+ * the trace block and 4 the key block.
+ */
+enum BinaryMessageType : uint8_t {
+    BINARY_TYPE_PUBLISH = 1,
+    BINARY_TYPE_ACK = 2,
+    BINARY_TYPE_NACK = 3,
+    BINARY_TYPE_HEARTBEAT = 4,
+    BINARY_TYPE_REGISTER = 5,
+    BINARY_TYPE_UNREGISTER = 6,
+    BINARY_TYPE_CREDIT = 7,
+    BINARY_TYPE_REGISTERED = 8,
+    BINARY_TYPE_REJECTED = 9,
+    BINARY_TYPE_REQUEST = 10,
+    BINARY_TYPE_REPLY = 11,
+    BINARY_TYPE_REPLY_ERROR = 12
+};
+
+enum BinaryFlags : uint16_t {
+    BINARY_FLAG_RELIABLE = 1 << 0,
+    BINARY_FLAG_RAW = 1 << 1,
+    BINARY_FLAG_TRACE = 1 << 2,
+    BINARY_FLAG_KEY = 1 << 3,
+    BINARY_FLAG_CODEC_SHIFT = 8
+};
+
+// Non-owning view of a frame, points into the buffer it was parsed from
+struct BinaryFrameView {
+    uint8_t type;
+    uint16_t flags;
+    uint64_t messageId;
+    uint32_t topicId;
+    const char* topic;
+    size_t topicLen;
+    const char* key;     // ordering key, null when the message has none
+    size_t keyLen;
+    const char* payload;
+    size_t payloadLen;
+    const char* trace;   // trace block, null when the message is not traced
+};
+
+class BinarySerializer : public IMmwMessageSerializer {
+    public:
+        static const uint8_t VERSION = 4;
+        static const size_t HEADER_SIZE = 24;
+        static const size_t TRACE_SIZE = 9 + 8 * MMW_TRACE_WIRE_STAGES;
+
+        const char* name() const override { return "binary"; }
+        std::string serialize(const MmwMessage& msg) override;
+        std::string serialize_raw(const MmwMessage& msg) override;
+        MmwMessage deserialize(const std::string& data) override;
+        MmwMessage deserialize_raw(const std::string& data) override;
+        bool frame_raw(const MmwMessage& msg, MmwRawFrame& frame) override;
+        bool restamp(char* data, size_t len, uint32_t messageId, uint32_t topicId, const MmwTrace& trace) override;
+        void deserialize_view(const char* data, size_t len, bool raw,
+                              MmwMessageView& view, MmwMessage& backing) override;
+
+        // Validate and decode a frame in place, no allocation
+        static bool parse(const char* data, size_t len, BinaryFrameView& view);
+
+    private:
+        static size_t headerSize(const MmwMessage& msg);
+        static size_t writeHeader(char* out, const MmwMessage& msg, uint16_t flags, size_t payloadLen);
+        static MmwMessage toMessage(const BinaryFrameView& view);
+        static size_t writeTrace(char* out, const MmwTrace& trace);
+        static void readTrace(const BinaryFrameView& view, MmwTrace& trace);
+};
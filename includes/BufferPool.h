@@ -0,0 +1,144 @@
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <vector>
+
+class BufferPool;
+
+/**
+ * Buffer borrowed from a BufferPool, handed back when it goes out of scope.
+ *
+ * Move-only, so a connection can keep one across messages and swap it for a
+ * larger class when a bigger frame arrives.
+ */
+class PooledBuffer {
+public:
+    PooledBuffer() : pool_(nullptr), data_(nullptr), capacity_(0) {}
+    PooledBuffer(BufferPool* pool, char* data, size_t capacity)
+        : pool_(pool), data_(data), capacity_(capacity) {}
+    ~PooledBuffer() { reset(); }
+
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    PooledBuffer(PooledBuffer&& other)
+        : pool_(other.pool_), data_(other.data_), capacity_(other.capacity_) {
+        other.pool_ = nullptr;
+        other.data_ = nullptr;
+        other.capacity_ = 0;
+    }
+
+    PooledBuffer& operator=(PooledBuffer&& other) {
+        if (this != &other) {
+            reset();
+            pool_ = other.pool_;
+            data_ = other.data_;
+            capacity_ = other.capacity_;
+            other.pool_ = nullptr;
+            other.data_ = nullptr;
+            other.capacity_ = 0;
+        }
+        return *this;
+    }
+
+    char* data() const { return data_; }
+    size_t capacity() const { return capacity_; }
+
+    // Give the memory back to the pool now instead of at destruction
+    inline void reset();
+
+private:
+    BufferPool* pool_;
+    char* data_;
+    size_t capacity_;
+};
+
+/**
+ * Thread-safe pool of power-of-two sized buffers.
+ *
+ * Buffers from MIN_SIZE up to MAX_SIZE are recycled through a free list per
+ * size class, so a steady stream of similar messages stops hitting the heap
+ * after warm-up. Larger requests are served straight from the heap. Each
+ * class keeps at most MAX_FREE_PER_CLASS idle buffers.
+ */
+class BufferPool {
+public:
+    static const size_t MIN_SHIFT = 8;   // 256 bytes
+    static const size_t MAX_SHIFT = 22;  // 4 MB
+    static const size_t MIN_SIZE = (size_t)1 << MIN_SHIFT;
+    static const size_t MAX_SIZE = (size_t)1 << MAX_SHIFT;
+    static const size_t MAX_FREE_PER_CLASS = 16;
+
+    BufferPool() {}
+    ~BufferPool() {
+        for (size_t i = 0; i < NUM_CLASSES; ++i) {
+            for (char* buf : freeLists_[i]) {
+                free(buf);
+            }
+        }
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    PooledBuffer acquire(size_t size) {
+        if (size > MAX_SIZE) {
+            char* data = static_cast<char*>(malloc(size));
+            if (!data) throw std::bad_alloc();
+            return PooledBuffer(this, data, size);
+        }
+
+        size_t cls = sizeClass(size);
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            std::vector<char*>& list = freeLists_[cls];
+            if (!list.empty()) {
+                char* data = list.back();
+                list.pop_back();
+                return PooledBuffer(this, data, classSize(cls));
+            }
+        }
+
+        char* data = static_cast<char*>(malloc(classSize(cls)));
+        if (!data) throw std::bad_alloc();
+        return PooledBuffer(this, data, classSize(cls));
+    }
+
+    void release(char* data, size_t capacity) {
+        if (capacity <= MAX_SIZE) {
+            size_t cls = sizeClass(capacity);
+            std::lock_guard<std::mutex> lock(mtx_);
+            std::vector<char*>& list = freeLists_[cls];
+            if (list.size() < MAX_FREE_PER_CLASS) {
+                list.push_back(data);
+                return;
+            }
+        }
+        free(data);
+    }
+
+private:
+    static const size_t NUM_CLASSES = MAX_SHIFT - MIN_SHIFT + 1;
+
+    static size_t sizeClass(size_t size) {
+        size_t cls = 0;
+        while (classSize(cls) < size) ++cls;
+        return cls;
+    }
+
+    static size_t classSize(size_t cls) { return MIN_SIZE << cls; }
+
+    std::mutex mtx_;
+    std::vector<char*> freeLists_[NUM_CLASSES];
+};
+
+inline void PooledBuffer::reset() {
+    if (data_) {
+        pool_->release(data_, capacity_);
+        pool_ = nullptr;
+        data_ = nullptr;
+        capacity_ = 0;
+    }
+}
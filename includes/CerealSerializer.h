@@ -5,8 +5,13 @@
 
 class CerealSerializer : public IMmwMessageSerializer {
     public:
+        const char* name() const override { return "cereal"; }
         std::string serialize(const MmwMessage& msg) override;
         std::string serialize_raw(const MmwMessage& msg) override;
         MmwMessage deserialize(const std::string& data) override;
         MmwMessage deserialize_raw(const std::string& data) override;
+        bool frame_raw(const MmwMessage& msg, MmwRawFrame& frame) override;
+        bool restamp(char* data, size_t len, uint32_t messageId, uint32_t topicId, const MmwTrace& trace) override;
+        void deserialize_view(const char* data, size_t len, bool raw,
+                              MmwMessageView& view, MmwMessage& backing) override;
 };
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string>
+#include "IMmwCodec.h"
+
+// Look up a codec by its wire id or registration name, nullptr if unknown
+IMmwCodec* GetCodec(uint8_t id);
+IMmwCodec* GetCodec(const std::string& name);
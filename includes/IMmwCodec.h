@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Payload compression codec. Codecs are stateless and shared between threads.
+class IMmwCodec {
+    public:
+        virtual ~IMmwCodec() {}
+
+        // Carried in every message compressed with this codec
+        virtual uint8_t id() const = 0;
+
+        // Name used when negotiating the codec at registration
+        virtual const char* name() const = 0;
+
+        // Worst-case compressed size for len input bytes
+        virtual size_t maxCompressedSize(size_t len) const = 0;
+
+        // Returns the number of bytes written to out, 0 if they did not fit
+        virtual size_t compress(const char* in, size_t len, char* out, size_t capacity) = 0;
+
+        // Decompress into exactly originalLen bytes, false if the input is corrupt
+        virtual bool decompress(const char* in, size_t len, char* out, size_t originalLen) = 0;
+};
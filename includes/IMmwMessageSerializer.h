@@ -1,12 +1,108 @@
 #pragma once
 #include <string>
+#include <cstddef>
+#include <cstring>
 #include "MmwMessage.h"
 
+// Encoded bytes that surround an unmodified raw payload on the wire, so the
+// sender can hand the user's buffer straight to a scatter-gather send.
+struct MmwRawFrame {
+    static const size_t MAX_HEADER = 512;
+    static const size_t MAX_TRAILER = 384;
+    char header[MAX_HEADER];
+    size_t headerLen;
+    char trailer[MAX_TRAILER];
+    size_t trailerLen;
+};
+
+// Non-owning view of a received message. Fields point either into the frame
+// buffer or into the backing message passed to deserialize_view, and are only
+// valid while both are left untouched.
+struct MmwMessageView {
+    uint32_t messageId;
+    const char* type;
+    size_t typeLen;
+    const char* topic;
+    size_t topicLen;
+    const char* payload;
+    size_t size;
+    bool reliability;
+    uint32_t topicId;
+    uint8_t codec;
+    bool rawPayload;
+    MmwTrace trace;
+    const char* key;
+    size_t keyLen;
+
+    bool isType(const char* name) const {
+        return strlen(name) == typeLen && memcmp(type, name, typeLen) == 0;
+    }
+
+    // Point the view at a decoded message
+    void assign(const MmwMessage& msg) {
+        messageId = msg.messageId;
+        type = msg.type.data();
+        typeLen = msg.type.size();
+        topic = msg.topic.data();
+        topicLen = msg.topic.size();
+        payload = msg.payload.data();
+        size = msg.payload.size();
+        reliability = msg.reliability;
+        topicId = msg.topicId;
+        codec = msg.codec;
+        rawPayload = msg.rawPayload;
+        trace.assign(msg.trace);
+        key = msg.key.data();
+        keyLen = msg.key.size();
+    }
+
+    // Owning copy, for messages that outlive the frame
+    MmwMessage toMessage() const {
+        MmwMessage msg{};
+        msg.messageId = messageId;
+        msg.type.assign(type, typeLen);
+        msg.topic.assign(topic, topicLen);
+        msg.payload.assign(payload, size);
+        msg.size = size;
+        msg.reliability = reliability;
+        msg.topicId = topicId;
+        msg.codec = codec;
+        msg.rawPayload = rawPayload;
+        msg.trace.assign(trace);
+        msg.key.assign(key, keyLen);
+        return msg;
+    }
+};
+
 class IMmwMessageSerializer {
     public:
         virtual ~IMmwMessageSerializer() {}
+        virtual const char* name() const = 0;
         virtual std::string serialize(const MmwMessage& msg) = 0;
         virtual std::string serialize_raw(const MmwMessage& msg) = 0;
         virtual MmwMessage deserialize(const std::string& data) = 0;
         virtual MmwMessage deserialize_raw(const std::string& data) = 0;
+
+        // Fill in the bytes before and after msg.payload_raw so that
+        // header + payload + trailer equals serialize_raw(msg). Returns false
+        // when the format cannot carry the payload verbatim.
+        virtual bool frame_raw(const MmwMessage& msg, MmwRawFrame& frame) { return false; }
+
+        // Rewrite the message id, topic id and trace stamps of an encoded frame
+        // in place, so a received frame can be sent on without decoding and
+        // encoding it again. The trace stamps are only written when the frame
+        // carries a trace. Returns false, leaving the frame untouched, when the
+        // format cannot, callers then serialize the message instead.
+        virtual bool restamp(char* data, size_t len, uint32_t messageId, uint32_t topicId, const MmwTrace& trace) { return false; }
+
+        // Decode a frame without copying it. Formats that can point into the
+        // frame do so; the others decode into backing, which callers keep per
+        // connection so its string capacity is reused. raw selects how the
+        // payload was encoded, as with deserialize_raw.
+        virtual void deserialize_view(const char* data, size_t len, bool raw,
+                                      MmwMessageView& view, MmwMessage& backing) {
+            std::string frame(data, len);
+            backing = raw ? deserialize_raw(frame) : deserialize(frame);
+            view.assign(backing);
+        }
 };
@@ -4,8 +4,11 @@
 
 class JsonSerializer : public IMmwMessageSerializer {
     public:
+        const char* name() const override { return "json"; }
         std::string serialize(const MmwMessage& msg) override;
         std::string serialize_raw(const MmwMessage& msg) override;
         MmwMessage deserialize(const std::string& data) override;
         MmwMessage deserialize_raw(const std::string& data) override;
+        void deserialize_view(const char* data, size_t len, bool raw,
+                              MmwMessageView& view, MmwMessage& backing) override;
 };
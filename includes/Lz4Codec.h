@@ -0,0 +1,22 @@
+#pragma once
+#include "IMmwCodec.h"
+
+/**
+ * Fast LZ77 codec producing the LZ4 block format.
+ *
+ * Each sequence is a token (literal length in the high nibble, match length
+ * minus 4 in the low nibble), optional length extension bytes, the literals
+ * and a 2 byte little-endian match offset. The last 5 bytes of a block are
+ * always literals. Blocks carry no size, the caller stores the original
+ * length alongside.
+ */
+class Lz4Codec : public IMmwCodec {
+    public:
+        static const uint8_t ID = 1;
+
+        uint8_t id() const override { return ID; }
+        const char* name() const override { return "lz4"; }
+        size_t maxCompressedSize(size_t len) const override { return len + len / 255 + 16; }
+        size_t compress(const char* in, size_t len, char* out, size_t capacity) override;
+        bool decompress(const char* in, size_t len, char* out, size_t originalLen) override;
+};
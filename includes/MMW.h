@@ -3,9 +3,11 @@
 
 #ifdef __cplusplus
 #include <cstddef>
+#include <cstdint>
 extern "C" {
 #else
 #include <stddef.h>
+#include <stdint.h>
 #endif
 
 /**
@@ -26,6 +28,34 @@ typedef enum {
     MMW_RELIABLE // At least once
 } MmwReliability;
 
+/**
+ * @enum MmwConfirmMode
+ * @brief When the broker confirms a message from a confirm-mode publisher.
+ */
+typedef enum {
+    MMW_CONFIRM_ROUTED,    /**< Confirm once the broker has routed the message to subscribers. */
+    MMW_CONFIRM_PERSISTED  /**< Confirm once the broker has durably persisted the message. */
+} MmwConfirmMode;
+
+/**
+ * @enum MmwSerializerFormat
+ * @brief Wire format used on the connections to the broker.
+ */
+typedef enum {
+    MMW_SERIALIZER_CEREAL = 0,  /**< cereal binary archives. */
+    MMW_SERIALIZER_JSON = 1,    /**< JSON objects, easy to inspect. */
+    MMW_SERIALIZER_BINARY = 2   /**< Compact fixed-layout binary frames. */
+} MmwSerializerFormat;
+
+/**
+ * @enum MmwCodec
+ * @brief Payload compression codec for a topic.
+ */
+typedef enum {
+    MMW_CODEC_NONE = 0,  /**< Payloads are sent as is. */
+    MMW_CODEC_LZ4 = 1    /**< Fast LZ77 compression in the LZ4 block format. */
+} MmwCodec;
+
 typedef enum {
     MMW_LOG_LEVEL_OFF,
     MMW_LOG_LEVEL_ERROR,
@@ -35,6 +65,147 @@ typedef enum {
     MMW_LOG_LEVEL_TRACE
 } MmwLogLevel;
 
+/**
+ * @enum MmwLogSubsystem
+ * @brief Part of the middleware a log message comes from, each can have its own level.
+ */
+typedef enum {
+    MMW_LOG_GENERAL = 0,      /**< Setup, configuration and anything not covered below. */
+    MMW_LOG_CONNECTION = 1,   /**< Connects, registrations and disconnects. */
+    MMW_LOG_PUBLISH = 2,      /**< Publishing and routing messages. */
+    MMW_LOG_SUBSCRIBE = 3,    /**< Receiving, decoding and delivering messages, flow control. */
+    MMW_LOG_RELIABILITY = 4,  /**< Acks, retransmits and publisher confirms. */
+    MMW_LOG_HEARTBEAT = 5,    /**< Subscriber heartbeats and timeouts. */
+    MMW_LOG_PERSISTENCE = 6,  /**< Broker message store. */
+    MMW_LOG_SUBSYSTEM_COUNT
+} MmwLogSubsystem;
+
+/**
+ * @enum MmwQueueFullPolicy
+ * @brief What an asynchronous publish does when the send queue is full.
+ */
+typedef enum {
+    MMW_QUEUE_FULL_BLOCK,   /**< Wait until the sender thread frees a slot. */
+    MMW_QUEUE_FULL_REJECT   /**< Return MMW_ERROR immediately, message is not queued. */
+} MmwQueueFullPolicy;
+
+/**
+ * @enum MmwTraceStage
+ * @brief Points along a message's path that are stamped when it is traced.
+ */
+typedef enum {
+    MMW_TRACE_PUBLISH = 0,           /**< Publisher: publish call entered. */
+    MMW_TRACE_ENCODE,                /**< Publisher: payload compressed and confirm window taken, frame is encoded and sent. */
+    MMW_TRACE_BROKER_RECEIVED,       /**< Broker: frame read from the publisher's connection. */
+    MMW_TRACE_BROKER_PARSED,         /**< Broker: frame decoded and topic resolved. */
+    MMW_TRACE_BROKER_PERSIST_QUEUED, /**< Broker: message handed to the persistence queue. */
+    MMW_TRACE_BROKER_ROUTED,         /**< Broker: fan-out to subscribers started. */
+    MMW_TRACE_RECEIVED,              /**< Subscriber: frame read from the broker connection. */
+    MMW_TRACE_DECODED,               /**< Subscriber: frame decoded and payload decompressed, callback about to run. */
+    MMW_TRACE_DELIVERED,             /**< Subscriber: callback returned. */
+    MMW_TRACE_STAGE_COUNT
+} MmwTraceStage;
+
+/** @brief Longest topic name kept in a ::MmwTraceRecord, longer names are truncated. */
+#define MMW_TRACE_TOPIC_MAX 64
+
+/**
+ * @brief A traced message as seen by a subscriber.
+ *
+ * Stamps are nanoseconds of the monotonic clock indexed by ::MmwTraceStage,
+ * 0 for stages that were not reached. Stamps from the publisher, broker and
+ * subscriber are only comparable when all three run on the same host.
+ */
+typedef struct {
+    uint64_t traceId;                          /**< Identifies the publish across hops. */
+    uint32_t messageId;                        /**< Broker-assigned message id. */
+    char topic[MMW_TRACE_TOPIC_MAX];           /**< NUL-terminated topic name. */
+    uint64_t stamps[MMW_TRACE_STAGE_COUNT];    /**< Stage timestamps in nanoseconds. */
+} MmwTraceRecord;
+
+/**
+ * @brief Completion callback for asynchronous publishes.
+ *
+ * Invoked on the sender thread once the message has been written to the
+ * broker socket (MMW_OK) or failed to send (MMW_ERROR).
+ */
+typedef void (*MmwPublishCallback)(const char* topic, MmwResult result, void* userData);
+
+/**
+ * @brief Opaque handle to a publisher.
+ *
+ * Publishing through a handle skips the topic lookup and sends the
+ * broker-assigned topic id instead of the topic name.
+ */
+typedef struct MmwPublisher* mmw_publisher_t;
+
+/**
+ * @brief Opaque handle to one subscriber, see MmwSubscriberOptions::handle.
+ */
+typedef struct MmwSubscriber* mmw_subscriber_t;
+
+/**
+ * @brief Callback for subscribers that need the payload size.
+ *
+ * The payload points into the receive buffer and is only valid until the
+ * callback returns.
+ */
+typedef void (*MmwSizedRawCallback)(const char* topic, const void* message, size_t size, void* userData);
+
+/**
+ * @brief Opaque handle to a request delivered to a server.
+ *
+ * Answered exactly once with mmw_reply() or mmw_reply_error(), which also
+ * free it. It may be answered after the handler has returned, from any thread.
+ */
+typedef struct MmwRequest* mmw_request_t;
+
+/**
+ * @brief Handler for requests to a service, see mmw_serve().
+ *
+ * The request payload points into the receive buffer and is only valid until
+ * the handler returns.
+ */
+typedef void (*MmwRequestHandler)(const char* service, const void* request, size_t size, mmw_request_t handle, void* userData);
+
+/**
+ * @brief Completion callback for mmw_request_async().
+ *
+ * Invoked on a library thread with MMW_OK and the reply, or with MMW_ERROR
+ * and the reason as text: "timeout", "no server", "server disconnected",
+ * "disconnected", "closed", or whatever the server passed to mmw_reply_error().
+ * The payload is only valid until the callback returns.
+ */
+typedef void (*MmwReplyCallback)(MmwResult result, const void* reply, size_t size, void* userData);
+
+/**
+ * @enum MmwGroupBalance
+ * @brief How a queue group shares a topic's messages among its members.
+ */
+typedef enum {
+    MMW_BALANCE_ROUND_ROBIN,        /**< Members take turns. */
+    MMW_BALANCE_LEAST_OUTSTANDING,  /**< The member with the fewest unacknowledged and held back messages. */
+    MMW_BALANCE_KEY_HASH            /**< Messages with the same key go to the same member, unkeyed ones take turns. */
+} MmwGroupBalance;
+
+/**
+ * @brief Options for mmw_create_subscriber_sized().
+ *
+ * Zero-initialise and set the fields you need.
+ */
+typedef struct {
+    uint64_t typeFingerprint;                /**< Registered with the broker, 0 accepts any publisher. */
+    size_t size;                             /**< Expected payload size, 0 accepts any size. */
+    size_t alignment;                        /**< Payload alignment the callback relies on, a power of two or 0 for the platform maximum. */
+    void* userData;                          /**< Passed to every callback invocation. */
+    void (*releaseUserData)(void* userData); /**< Called once the subscriber is gone, can be NULL. */
+    const char* group;                       /**< Queue group to join, NULL to receive every message. */
+    MmwGroupBalance balance;                 /**< Balancing of a new group, later members follow the first. */
+    const uint32_t* partitions;              /**< Partitions to receive on a partitioned topic, NULL for all. Ignored for group members. */
+    size_t partitionCount;                   /**< Number of entries in partitions. */
+    mmw_subscriber_t* handle;                /**< Receives a handle for mmw_delete_subscriber_handle(), can be NULL. */
+} MmwSubscriberOptions;
+
 /**
  * @brief Set the current log level for the middleware.
  *
@@ -44,6 +215,44 @@ typedef enum {
  */
 void mmw_set_log_level(MmwLogLevel level);
 
+/**
+ * @brief Set the log level of one subsystem, overriding mmw_set_log_level() for it.
+ *
+ * Useful to keep e.g. ::MMW_LOG_RELIABILITY at debug while everything else
+ * stays at warn. Log calls below the build's MMW_LOG_ACTIVE_LEVEL are compiled
+ * out and cannot be turned back on at runtime.
+ *
+ * @param subsystem Subsystem to configure (see ::MmwLogSubsystem enum).
+ * @param level     Logging level for that subsystem.
+ */
+void mmw_set_subsystem_log_level(MmwLogSubsystem subsystem, MmwLogLevel level);
+
+/**
+ * @brief Format and write log messages on a background thread.
+ *
+ * Log calls only enqueue the message, so they no longer block on the
+ * console or a file. When the queue is full the oldest messages are
+ * overwritten instead of stalling the caller. Calling it again with another
+ * size moves logging onto a new queue of that size.
+ *
+ * @param queueSize Messages the queue holds, 0 switches back to synchronous logging.
+ * @return MMW_OK on success, MMW_ERROR if the logger could not be created.
+ */
+MmwResult mmw_set_log_async(size_t queueSize);
+
+/**
+ * @brief Choose the wire format for this process.
+ *
+ * All formats are built in and the broker accepts any of them, each
+ * connection is answered in the format it registered with. Defaults to the
+ * format selected at build time. Must be called before creating publishers
+ * or subscribers.
+ *
+ * @param format The wire format (see ::MmwSerializerFormat).
+ * @return MMW_OK on success, MMW_ERROR for an unknown format.
+ */
+MmwResult mmw_set_serializer(MmwSerializerFormat format);
+
 /**
  * @brief Initialize the middleware library.
  *
@@ -55,6 +264,36 @@ void mmw_set_log_level(MmwLogLevel level);
  */
 MmwResult mmw_initialize(const char* brokerIp, unsigned short port);
 
+/**
+ * @brief Choose the payload compression codec for a topic.
+ *
+ * Applies to publishers created for the topic after this call. The codec is
+ * negotiated with the broker at registration. Payloads are compressed once
+ * by the publisher, forwarded compressed by the broker and decompressed by
+ * subscribers before their callback runs. Payloads that are small or do not
+ * shrink are sent uncompressed.
+ *
+ * @param topic The topic name.
+ * @param codec The codec to use (see ::MmwCodec).
+ * @return MMW_OK on success, MMW_ERROR for an unknown codec.
+ */
+MmwResult mmw_set_topic_codec(const char* topic, MmwCodec codec);
+
+/**
+ * @brief Split a topic into partitions for publishers and subscribers created from now on.
+ *
+ * The broker hashes each message's key (see mmw_publish_keyed()) to one of
+ * the partitions and keeps messages in order within a partition. Queue group
+ * members on a partitioned topic each own a share of the partitions instead
+ * of following the group's balancing. The first registration that declares
+ * a count fixes it, the broker rejects clients declaring a different one.
+ *
+ * @param topic The topic name.
+ * @param partitions Number of partitions, 0 stops declaring a count.
+ * @return MMW_OK on success, MMW_ERROR if topic is NULL.
+ */
+MmwResult mmw_set_topic_partitions(const char* topic, uint32_t partitions);
+
 /**
  * @brief Create a publisher for a topic.
  *
@@ -65,6 +304,71 @@ MmwResult mmw_initialize(const char* brokerIp, unsigned short port);
  */
 MmwResult mmw_create_publisher(const char* topic);
 
+/**
+ * @brief Create a publisher for a topic and return a handle to it.
+ *
+ * Several handles may be created for the same topic, each with its own
+ * connection to the broker.
+ *
+ * @param topic The topic name.
+ * @param publisher Receives the publisher handle.
+ * @return MMW_OK on success, MMW_ERROR on failure.
+ */
+MmwResult mmw_create_publisher_handle(const char* topic, mmw_publisher_t* publisher);
+
+/**
+ * @brief Create a publisher handle bound to a payload type.
+ *
+ * The broker records the first type fingerprint registered on a topic and
+ * rejects publishers and subscribers that register a different one. See
+ * MmwTyped.h for the C++ templates that compute the fingerprint.
+ *
+ * @param topic The topic name.
+ * @param typeFingerprint Fingerprint of the payload type, 0 for none.
+ * @param publisher Receives the publisher handle.
+ * @return MMW_OK on success, MMW_ERROR on failure or type mismatch.
+ */
+MmwResult mmw_create_publisher_typed(const char* topic, uint64_t typeFingerprint, mmw_publisher_t* publisher);
+
+/**
+ * @brief Create a publisher whose messages are confirmed by the broker.
+ *
+ * The broker acknowledges publishes in cumulative batches. At most
+ * @p window messages may be unconfirmed at any time, further publishes on
+ * the topic block until confirms arrive.
+ *
+ * @param topic The topic name.
+ * @param mode When the broker should confirm (see ::MmwConfirmMode).
+ * @param window Maximum number of unconfirmed messages in flight.
+ * @return MMW_OK on success, MMW_ERROR on failure.
+ */
+MmwResult mmw_create_publisher_confirmed(const char* topic, MmwConfirmMode mode, size_t window);
+
+/**
+ * @brief Wait until every message published on a confirm-mode topic is confirmed.
+ *
+ * @param topic The topic name.
+ * @param timeoutMs Maximum time to wait in milliseconds, negative waits forever.
+ * @return MMW_OK if everything was confirmed, MMW_ERROR on timeout, if the
+ *         broker rejected a message, or if the topic has no confirm-mode publisher.
+ */
+MmwResult mmw_wait_for_confirms(const char* topic, int timeoutMs);
+
+/**
+ * @brief Set the flow control window for subscribers created afterwards.
+ *
+ * Subscribers grant the broker credit for at most @p messages messages and
+ * @p bytes bytes of encoded frames. The broker stops sending once the credit is used
+ * up and resumes as callbacks return and credit is handed back, so memory
+ * stays bounded on both sides when a subscriber falls behind. Pass 0 for
+ * either limit to leave it unbounded. Flow control is off by default.
+ *
+ * @param messages Maximum number of messages in flight per subscriber.
+ * @param bytes Maximum number of frame bytes in flight per subscriber.
+ * @return MMW_OK on success, MMW_ERROR on failure.
+ */
+MmwResult mmw_set_subscriber_credit(size_t messages, size_t bytes);
+
 /**
  * @brief Create a subscriber for a topic (string messages).
  *
@@ -87,6 +391,38 @@ MmwResult mmw_create_subscriber(const char* topic, void (*mmw_callback)(const ch
  */
 MmwResult mmw_create_subscriber_raw(const char* topic, void (*mmw_callback)(const char*, void*));
 
+/**
+ * @brief Join a queue group on a topic (string messages).
+ *
+ * Subscribers that join the same group share the topic's messages, each
+ * message goes to exactly one member while plain subscribers still receive
+ * every message. Reliable messages a member has not acknowledged when it
+ * disconnects or stops answering are delivered to another member.
+ *
+ * @param topic The topic name.
+ * @param group The group name.
+ * @param balance Balancing of a new group, later members follow the first.
+ * @param mmw_callback Callback function that receives the message as a string.
+ * @return MMW_OK on success, MMW_ERROR on failure.
+ */
+MmwResult mmw_create_subscriber_group(const char* topic, const char* group, MmwGroupBalance balance,
+                                      void (*mmw_callback)(const char*, const char*));
+
+/**
+ * @brief Create a subscriber that receives raw messages with their size.
+ *
+ * The payload is handed over in place, without a copy, unless it has to be
+ * moved to meet the requested alignment. When options set a type
+ * fingerprint, the broker rejects the subscriber if the topic is bound to a
+ * different type. releaseUserData is also called when creation fails.
+ *
+ * @param topic The topic name.
+ * @param callback Callback that receives the payload and its size.
+ * @param options Optional settings, can be NULL.
+ * @return MMW_OK on success, MMW_ERROR on failure or type mismatch.
+ */
+MmwResult mmw_create_subscriber_sized(const char* topic, MmwSizedRawCallback callback, const MmwSubscriberOptions* options);
+
 /**
  * @brief Publish a message as a string.
  *
@@ -110,6 +446,259 @@ MmwResult mmw_publish(const char* topic, const char* message, MmwReliability rel
  */
 MmwResult mmw_publish_raw(const char* topic, void* message, size_t size, MmwReliability reliability);
 
+/**
+ * @brief Publish raw bytes with an ordering key.
+ *
+ * Queue groups balanced with ::MMW_BALANCE_KEY_HASH deliver all messages
+ * with the same key to the same member, in order. On a partitioned topic
+ * the key selects the partition.
+ *
+ * @param topic The topic name.
+ * @param key NUL terminated key of at most 255 bytes.
+ * @param message Pointer to message data.
+ * @param size Size of the message in bytes.
+ * @param reliability Delivery guarantee for the message.
+ * @return MMW_OK on success, MMW_ERROR on failure.
+ */
+MmwResult mmw_publish_keyed(const char* topic, const char* key, const void* message, size_t size, MmwReliability reliability);
+
+/**
+ * @brief Publish a message as a string through a publisher handle.
+ *
+ * @param publisher Handle from mmw_create_publisher_handle().
+ * @param message The message to publish.
+ * @param reliability Delivery guarantee for the message.
+ * @return MMW_OK on success, MMW_ERROR on failure.
+ */
+MmwResult mmw_publish_handle(mmw_publisher_t publisher, const char* message, MmwReliability reliability);
+
+/**
+ * @brief Publish raw bytes through a publisher handle.
+ *
+ * @param publisher Handle from mmw_create_publisher_handle().
+ * @param message Pointer to message data.
+ * @param size Size of the message in bytes.
+ * @param reliability Delivery guarantee for the message.
+ * @return MMW_OK on success, MMW_ERROR on failure.
+ */
+MmwResult mmw_publish_raw_handle(mmw_publisher_t publisher, void* message, size_t size, MmwReliability reliability);
+
+/**
+ * @brief Borrow a buffer to build a raw message in place.
+ *
+ * The returned region sits inside the outgoing frame buffer, so a message
+ * written into it is sent by mmw_publish_loaned() without being copied.
+ * It is aligned for any fundamental type, like memory from malloc().
+ * The loan must be handed back with mmw_publish_loaned() or
+ * mmw_release_loan().
+ *
+ * @param topic The topic the message will be published on.
+ * @param size Size of the message in bytes.
+ * @return Writable pointer to size bytes, NULL if there is no publisher for the topic.
+ */
+void* mmw_loan(const char* topic, size_t size);
+
+/**
+ * @brief Publish a message built in a loaned buffer.
+ *
+ * The loan is consumed whether or not the send succeeds, the pointer must
+ * not be used afterwards.
+ *
+ * @param topic The topic name, must match the topic the loan was taken for.
+ * @param message Pointer returned by mmw_loan().
+ * @param reliability Delivery guarantee for the message.
+ * @return MMW_OK on success, MMW_ERROR on failure.
+ */
+MmwResult mmw_publish_loaned(const char* topic, void* message, MmwReliability reliability);
+
+/**
+ * @brief Return a loaned buffer without publishing it.
+ *
+ * @param message Pointer returned by mmw_loan().
+ * @return MMW_OK on success, MMW_ERROR if the pointer is not an outstanding loan.
+ */
+MmwResult mmw_release_loan(void* message);
+
+/**
+ * @brief Configure the asynchronous publish queue.
+ *
+ * Must be called before the first asynchronous publish. The capacity is
+ * rounded up to the next power of two. Defaults to 8192 entries and
+ * ::MMW_QUEUE_FULL_BLOCK.
+ *
+ * @param capacity Maximum number of queued messages.
+ * @param policy Behaviour when the queue is full (see ::MmwQueueFullPolicy).
+ * @return MMW_OK on success, MMW_ERROR if the sender thread is already running.
+ */
+MmwResult mmw_set_async_queue(size_t capacity, MmwQueueFullPolicy policy);
+
+/**
+ * @brief Publish a message as a string without blocking on the socket.
+ *
+ * The message is copied into a lock-free queue and sent by a dedicated
+ * sender thread. Calls made from a completion callback while mmw_cleanup()
+ * drains the queue are rejected.
+ *
+ * @param topic The topic name.
+ * @param message The message to publish.
+ * @param reliability Delivery guarantee for the message.
+ * @param callback Optional completion callback (can be NULL).
+ * @param userData Opaque pointer passed back to the callback.
+ * @return MMW_OK if the message was queued, MMW_ERROR otherwise.
+ */
+MmwResult mmw_publish_async(const char* topic, const char* message, MmwReliability reliability,
+                            MmwPublishCallback callback, void* userData);
+
+/**
+ * @brief Publish raw bytes without blocking on the socket.
+ *
+ * The bytes are copied before returning, so the caller may reuse the buffer
+ * immediately.
+ *
+ * @param topic The topic name.
+ * @param message Pointer to message data.
+ * @param size Size of the message in bytes.
+ * @param reliability Delivery guarantee for the message.
+ * @param callback Optional completion callback (can be NULL).
+ * @param userData Opaque pointer passed back to the callback.
+ * @return MMW_OK if the message was queued, MMW_ERROR otherwise.
+ */
+MmwResult mmw_publish_raw_async(const char* topic, const void* message, size_t size, MmwReliability reliability,
+                                MmwPublishCallback callback, void* userData);
+
+/**
+ * @brief Wait until every queued asynchronous publish has been sent.
+ *
+ * @param timeoutMs Maximum time to wait in milliseconds, negative waits forever.
+ * @return MMW_OK once the queue is drained, MMW_ERROR on timeout.
+ */
+MmwResult mmw_flush(int timeoutMs);
+
+/**
+ * @brief Send a request to a service and wait for the reply.
+ *
+ * Requests of the whole process share one connection to the broker, which
+ * hands each to one of the service's servers in turn and routes the reply
+ * straight back. Must not be called from a reply callback.
+ *
+ * @param service The service name.
+ * @param request Pointer to the request bytes.
+ * @param size Size of the request in bytes.
+ * @param reply Receives the reply, NUL terminated, release it with mmw_free_reply().
+ * @param replySize Receives the size of the reply without the terminator.
+ * @param timeoutMs Maximum time to wait in milliseconds, negative waits for the broker to give up.
+ * @return MMW_OK with the reply, MMW_ERROR on timeout, failure or an error reply.
+ */
+MmwResult mmw_request(const char* service, const void* request, size_t size, void** reply, size_t* replySize, int timeoutMs);
+
+/**
+ * @brief Send a request to a service without waiting for the reply.
+ *
+ * Any number of requests may be outstanding at once, each is matched to its
+ * reply by a correlation id.
+ *
+ * @param service The service name.
+ * @param request Pointer to the request bytes, copied before returning.
+ * @param size Size of the request in bytes.
+ * @param timeoutMs Time after which the request fails with "timeout", negative for no limit.
+ * @param callback Called exactly once with the outcome, unless sending fails.
+ * @param userData Opaque pointer passed back to the callback.
+ * @return MMW_OK if the request was sent, MMW_ERROR otherwise.
+ */
+MmwResult mmw_request_async(const char* service, const void* request, size_t size, int timeoutMs,
+                            MmwReplyCallback callback, void* userData);
+
+/**
+ * @brief Release a reply returned by mmw_request().
+ *
+ * @param reply The reply, NULL is ignored.
+ */
+void mmw_free_reply(void* reply);
+
+/**
+ * @brief Serve requests to a service.
+ *
+ * The handler runs on a dedicated thread for this service. Several
+ * processes may serve the same service, the broker spreads requests over
+ * them round robin.
+ *
+ * @param service The service name.
+ * @param handler Called for every request.
+ * @param userData Opaque pointer passed to every handler invocation.
+ * @return MMW_OK on success, MMW_ERROR on failure or if this process already serves the service.
+ */
+MmwResult mmw_serve(const char* service, MmwRequestHandler handler, void* userData);
+
+/**
+ * @brief Answer a request.
+ *
+ * @param handle The request, freed by this call.
+ * @param reply Pointer to the reply bytes.
+ * @param size Size of the reply in bytes.
+ * @return MMW_OK on success, MMW_ERROR on failure.
+ */
+MmwResult mmw_reply(mmw_request_t handle, const void* reply, size_t size);
+
+/**
+ * @brief Fail a request, the requester receives MMW_ERROR with the reason.
+ *
+ * @param handle The request, freed by this call.
+ * @param reason Text handed to the requester.
+ * @return MMW_OK on success, MMW_ERROR on failure.
+ */
+MmwResult mmw_reply_error(mmw_request_t handle, const char* reason);
+
+/**
+ * @brief Stop serving a service.
+ *
+ * Requests already forwarded to this process fail with "server disconnected".
+ * Requests handed to the handler and not answered yet fail with "server
+ * stopped", answering them afterwards returns MMW_ERROR and frees the handle.
+ * May be called from the service's own handler.
+ *
+ * @param service The service name.
+ * @return MMW_OK on success, MMW_ERROR if the service is not served here.
+ */
+MmwResult mmw_stop_serving(const char* service);
+
+/**
+ * @brief Trace a sample of the messages this process publishes.
+ *
+ * One in every @p oneIn publishes carries a trace that the publisher, the
+ * broker and each subscriber stamp as the message passes through them.
+ * Subscribers in this process keep the traces of the messages they receive,
+ * see mmw_read_traces() and mmw_set_trace_file(). Untraced messages carry
+ * nothing extra on the wire.
+ *
+ * @param oneIn Sampling interval, 1 traces every message and 0 turns tracing off.
+ * @return MMW_OK on success, MMW_ERROR on failure.
+ */
+MmwResult mmw_set_trace_sampling(uint32_t oneIn);
+
+/**
+ * @brief Append the traces received by this process to a CSV file.
+ *
+ * Each line holds the trace id, topic and message id followed by the time of
+ * every stage in nanoseconds after the publish, so consecutive columns give
+ * the per-stage breakdown. Stages that were not reached are left empty.
+ *
+ * @param path File to append to, NULL closes the current file.
+ * @return MMW_OK on success, MMW_ERROR if the file cannot be opened.
+ */
+MmwResult mmw_set_trace_file(const char* path);
+
+/**
+ * @brief Take the traces received by subscribers in this process.
+ *
+ * Traces are kept in a bounded buffer until read, the oldest are dropped
+ * when it is full.
+ *
+ * @param records Array receiving the traces, oldest first.
+ * @param max Capacity of @p records.
+ * @return Number of traces written to @p records.
+ */
+size_t mmw_read_traces(MmwTraceRecord* records, size_t max);
+
 /**
  * @brief Delete publisher.
  *
@@ -120,16 +709,38 @@ MmwResult mmw_publish_raw(const char* topic, void* message, size_t size, MmwReli
  */
 MmwResult mmw_delete_publisher(const char* topic);
 
+/**
+ * @brief Delete a publisher created with mmw_create_publisher_handle().
+ *
+ * The handle must not be used afterwards.
+ *
+ * @param publisher The publisher handle.
+ * @return MMW_OK on success, MMW_ERROR on failure.
+ */
+MmwResult mmw_delete_publisher_handle(mmw_publisher_t publisher);
+
 /**
  * @brief Delete subscriber.
  *
- * Destroys a singular subscriber for a specified topic.
+ * Destroys every subscriber this process created for the topic, including
+ * all queue group members.
  *
  * @param topic The topic name.
  * @return MMW_OK on success, MMW_ERROR on failure.
  */
 MmwResult mmw_delete_subscriber(const char* topic);
 
+/**
+ * @brief Delete one subscriber, leaving the others on its topic running.
+ *
+ * The handle must not be used afterwards, nor once mmw_delete_subscriber()
+ * or mmw_cleanup() has removed the subscriber.
+ *
+ * @param subscriber Handle from MmwSubscriberOptions::handle.
+ * @return MMW_OK on success, MMW_ERROR on failure.
+ */
+MmwResult mmw_delete_subscriber_handle(mmw_subscriber_t subscriber);
+
 /**
  * @brief Clean up all middleware resources.
  *
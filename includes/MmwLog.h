@@ -0,0 +1,226 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <spdlog/spdlog.h>
+#include <spdlog/async.h>
+#include <spdlog/async_logger.h>
+#include "MMW.h"
+
+// Log calls below this level are compiled out, set through the MMW_LOG_ACTIVE_LEVEL CMake option
+#ifndef MMW_LOG_ACTIVE_LEVEL
+#define MMW_LOG_ACTIVE_LEVEL SPDLOG_LEVEL_DEBUG
+#endif
+
+/**
+ * Per-subsystem logging for the library and the broker.
+ *
+ * Every subsystem has its own spdlog logger sharing the default logger's
+ * sinks, so each can be given its own level and shows up by name in the
+ * output. spdlog checks the level before formatting, which keeps disabled
+ * calls down to one atomic load. Loggers are swapped, never destroyed, when
+ * switching between synchronous and asynchronous mode, so a thread that is
+ * logging at that moment keeps a valid pointer.
+ */
+namespace MmwLog {
+
+inline spdlog::level::level_enum toSpdlog(MmwLogLevel level) {
+    switch (level) {
+        case MMW_LOG_LEVEL_ERROR: return spdlog::level::err;
+        case MMW_LOG_LEVEL_WARN:  return spdlog::level::warn;
+        case MMW_LOG_LEVEL_INFO:  return spdlog::level::info;
+        case MMW_LOG_LEVEL_DEBUG: return spdlog::level::debug;
+        case MMW_LOG_LEVEL_TRACE: return spdlog::level::trace;
+        default:                  return spdlog::level::off;
+    }
+}
+
+struct State {
+    std::mutex mtx;
+    std::atomic<spdlog::logger*> loggers[MMW_LOG_SUBSYSTEM_COUNT];
+    std::vector<std::shared_ptr<spdlog::logger>> owned; // every logger ever handed out
+    std::map<size_t, std::shared_ptr<spdlog::details::thread_pool>> pools; // one per queue size used, by size
+    spdlog::level::level_enum global = spdlog::level::info;
+    int overrides[MMW_LOG_SUBSYSTEM_COUNT];             // -1 follows the global level
+    size_t asyncQueueSize = 0;
+
+    State() {
+        for (int i = 0; i < MMW_LOG_SUBSYSTEM_COUNT; ++i) {
+            loggers[i].store(nullptr, std::memory_order_relaxed);
+            overrides[i] = -1;
+        }
+    }
+};
+
+inline State& state() {
+    static State instance;
+    return instance;
+}
+
+inline const char* subsystemName(int subsystem) {
+    static const char* names[MMW_LOG_SUBSYSTEM_COUNT] = {
+        "mmw", "connection", "publish", "subscribe", "reliability", "heartbeat", "persistence"
+    };
+    return names[subsystem];
+}
+
+// Build a full set of loggers for the current mode, the caller holds the state lock
+inline void rebuildLocked(State& s) {
+    const std::vector<spdlog::sink_ptr>& sinks = spdlog::default_logger()->sinks();
+    std::shared_ptr<spdlog::details::thread_pool> pool;
+    if (s.asyncQueueSize != 0) {
+        pool = s.pools[s.asyncQueueSize];
+    }
+
+    for (int i = 0; i < MMW_LOG_SUBSYSTEM_COUNT; ++i) {
+        std::shared_ptr<spdlog::logger> logger;
+        if (pool) {
+            logger = std::make_shared<spdlog::async_logger>(subsystemName(i), sinks.begin(), sinks.end(), pool,
+                                                            spdlog::async_overflow_policy::overrun_oldest);
+        } else {
+            logger = std::make_shared<spdlog::logger>(subsystemName(i), sinks.begin(), sinks.end());
+        }
+        logger->set_level(s.overrides[i] < 0 ? s.global : (spdlog::level::level_enum)s.overrides[i]);
+        logger->flush_on(spdlog::level::err);
+        s.owned.push_back(logger);
+        s.loggers[i].store(logger.get(), std::memory_order_release);
+    }
+}
+
+inline spdlog::logger* logger(MmwLogSubsystem subsystem) {
+    State& s = state();
+    spdlog::logger* l = s.loggers[subsystem].load(std::memory_order_acquire);
+    if (l) {
+        return l;
+    }
+    std::lock_guard<std::mutex> lock(s.mtx);
+    if (!s.loggers[subsystem].load(std::memory_order_relaxed)) {
+        rebuildLocked(s);
+    }
+    return s.loggers[subsystem].load(std::memory_order_relaxed);
+}
+
+inline void setLevel(MmwLogLevel level) {
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.mtx);
+    s.global = toSpdlog(level);
+    spdlog::set_level(s.global);
+    for (int i = 0; i < MMW_LOG_SUBSYSTEM_COUNT; ++i) {
+        spdlog::logger* l = s.loggers[i].load(std::memory_order_relaxed);
+        if (l && s.overrides[i] < 0) {
+            l->set_level(s.global);
+        }
+    }
+}
+
+inline void setSubsystemLevel(MmwLogSubsystem subsystem, MmwLogLevel level) {
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.mtx);
+    s.overrides[subsystem] = (int)toSpdlog(level);
+    spdlog::logger* l = s.loggers[subsystem].load(std::memory_order_relaxed);
+    if (l) {
+        l->set_level(toSpdlog(level));
+    }
+}
+
+// Switch every subsystem to a background writer with room for queueSize messages, 0 goes back to synchronous
+inline void setAsync(size_t queueSize) {
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.mtx);
+    // Async loggers only hold their pool weakly and replaced ones may still be in use, so pools are
+    // kept and switching back to a size reuses its pool. Only distinct sizes cost a thread each.
+    if (queueSize != 0 && !s.pools[queueSize]) {
+        s.pools[queueSize] = std::make_shared<spdlog::details::thread_pool>(queueSize, 1);
+    }
+    s.asyncQueueSize = queueSize;
+    rebuildLocked(s);
+}
+
+// Write out whatever is queued, async loggers hand the flush to the background thread
+inline void flush() {
+    State& s = state();
+    std::lock_guard<std::mutex> lock(s.mtx);
+    for (int i = 0; i < MMW_LOG_SUBSYSTEM_COUNT; ++i) {
+        spdlog::logger* l = s.loggers[i].load(std::memory_order_relaxed);
+        if (l) {
+            l->flush();
+        }
+    }
+}
+
+/**
+ * Lets one message through per interval and counts the rest.
+ *
+ * Used through MMW_LOG_LIMITED, which keeps one limiter per call site so a
+ * storm of identical warnings costs an atomic increment each instead of a
+ * formatted write.
+ */
+class RateLimiter {
+public:
+    bool allow(int64_t intervalMs, uint64_t& suppressed) {
+        int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        int64_t next = next_.load(std::memory_order_relaxed);
+        if (now < next || !next_.compare_exchange_strong(next, now + intervalMs, std::memory_order_relaxed)) {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    std::atomic<int64_t> next_{0};
+    std::atomic<uint64_t> suppressed_{0};
+};
+
+} // namespace MmwLog
+
+#if MMW_LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
+#define MMW_LOG_TRACE(subsystem, ...) MmwLog::logger(subsystem)->trace(__VA_ARGS__)
+#else
+#define MMW_LOG_TRACE(subsystem, ...) (void)0
+#endif
+
+#if MMW_LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+#define MMW_LOG_DEBUG(subsystem, ...) MmwLog::logger(subsystem)->debug(__VA_ARGS__)
+#else
+#define MMW_LOG_DEBUG(subsystem, ...) (void)0
+#endif
+
+#if MMW_LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_INFO
+#define MMW_LOG_INFO(subsystem, ...) MmwLog::logger(subsystem)->info(__VA_ARGS__)
+#else
+#define MMW_LOG_INFO(subsystem, ...) (void)0
+#endif
+
+#if MMW_LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_WARN
+#define MMW_LOG_WARN(subsystem, ...) MmwLog::logger(subsystem)->warn(__VA_ARGS__)
+#else
+#define MMW_LOG_WARN(subsystem, ...) (void)0
+#endif
+
+#if MMW_LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_ERROR
+#define MMW_LOG_ERROR(subsystem, ...) MmwLog::logger(subsystem)->error(__VA_ARGS__)
+#else
+#define MMW_LOG_ERROR(subsystem, ...) (void)0
+#endif
+
+// At most one message per intervalMs from this call site, followed by a count of the ones dropped meanwhile
+#define MMW_LOG_LIMITED(subsystem, level, intervalMs, ...)                                          \
+    do {                                                                                            \
+        static MmwLog::RateLimiter mmwLimiter_;                                                     \
+        uint64_t mmwSuppressed_ = 0;                                                                \
+        spdlog::logger* mmwLogger_ = MmwLog::logger(subsystem);                                     \
+        if ((int)(level) >= MMW_LOG_ACTIVE_LEVEL && mmwLogger_->should_log(level) &&                \
+            mmwLimiter_.allow(intervalMs, mmwSuppressed_)) {                                        \
+            mmwLogger_->log(level, __VA_ARGS__);                                                    \
+            if (mmwSuppressed_ != 0) {                                                              \
+                mmwLogger_->log(level, "{} similar messages suppressed", mmwSuppressed_);           \
+            }                                                                                       \
+        }                                                                                           \
+    } while (0)
@@ -1,13 +1,32 @@
 #pragma once
 #include <string>
 #include <cstdint>
+#include "MmwTrace.h"
+
+// Longest ordering key a message may carry, every format has room for it in its frame
+static const size_t MMW_MAX_KEY_SIZE = 255;
 
 struct MmwMessage {
     uint32_t messageId;
     std::string type;    // "PUB_REGISTER", "SUB_REGISTER", "DATA", "UNREGISTER"
     std::string topic;   // topic name
     std::string payload; // message content, optional for register/unregister
-    void* payload_raw;   // message content as raw bytes, optional for register/unregister
+    void* payload_raw;   // raw bytes to publish, not owned; deserializers leave it null and fill payload
     size_t size;
     bool reliability;
+    uint32_t topicId;    // broker-assigned topic id, 0 when the frame carries the topic name
+    uint8_t codec;       // codec id of a compressed payload, 0 when the payload is not compressed
+    bool rawPayload;     // payload is binary data rather than text, lets the broker transcode it safely
+    MmwTrace trace;      // stage timestamps of a sampled message, trace.id is 0 when not traced
+    std::string key;     // ordering key from mmw_publish_keyed, empty for unkeyed messages
 };
+
+// FNV-1a, stable across hosts and runs so the same key always lands in the same place
+inline uint64_t MmwKeyHash(const char* key, size_t len) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= static_cast<unsigned char>(key[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <map>
+#include <string>
+
+/**
+ * Payload of a "register" message.
+ *
+ * The payload starts with the client role ("publisher" or "subscriber") and
+ * may be followed by ';'-separated key=value options, e.g.
+ * "publisher;confirm=routed". The broker answers with "registered", carrying
+ * the options it accepted, or "rejected". Unknown options are ignored.
+ *
+ * Brokers from before this format take the whole payload as the role, so a
+ * client that sends options to one is not registered as a publisher or
+ * subscriber. Such brokers never answer and the client reports the
+ * registration as failed.
+ */
+struct MmwRegistration {
+    std::string role;
+    std::map<std::string, std::string> options;
+
+    std::string option(const std::string& key, const std::string& fallback = "") const {
+        auto it = options.find(key);
+        return it == options.end() ? fallback : it->second;
+    }
+
+    std::string encode() const {
+        std::string out = role;
+        for (const auto& kv : options) {
+            out += ';';
+            out += kv.first;
+            out += '=';
+            out += kv.second;
+        }
+        return out;
+    }
+
+    static MmwRegistration parse(const std::string& payload) {
+        MmwRegistration reg;
+        size_t pos = payload.find(';');
+        reg.role = payload.substr(0, pos);
+        while (pos != std::string::npos) {
+            size_t start = pos + 1;
+            pos = payload.find(';', start);
+            std::string item = payload.substr(start, pos == std::string::npos ? std::string::npos : pos - start);
+            size_t eq = item.find('=');
+            if (eq != std::string::npos) {
+                reg.options[item.substr(0, eq)] = item.substr(eq + 1);
+            }
+        }
+        return reg;
+    }
+};
@@ -0,0 +1,37 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include "MMW.h"
+
+// Stages stamped by the publisher and the broker travel inside the frame,
+// the subscriber adds its own stages locally
+static const size_t MMW_TRACE_WIRE_STAGES = MMW_TRACE_BROKER_ROUTED + 1;
+
+/**
+ * Trace extension of a sampled message.
+ *
+ * id is 0 for messages that are not traced, which is almost all of them, so
+ * serializers leave the trace out of the frame entirely. Stamps are
+ * nanoseconds of the monotonic clock indexed by MmwTraceStage, 0 for stages
+ * that were not reached. Stamps taken in different processes are only
+ * comparable when they run on the same host.
+ */
+struct MmwTrace {
+    uint64_t id;
+    uint64_t stamps[MMW_TRACE_STAGE_COUNT];
+
+    // Copy only what a traced message carries, untraced messages just clear the id
+    void assign(const MmwTrace& other) {
+        id = other.id;
+        if (id != 0) {
+            memcpy(stamps, other.stamps, sizeof(stamps));
+        }
+    }
+};
+
+// steady_clock is CLOCK_MONOTONIC on Linux and QueryPerformanceCounter on Windows
+inline uint64_t MmwTraceNow() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
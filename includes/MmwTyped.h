@@ -0,0 +1,139 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include "MMW.h"
+
+/**
+ * Typed C++ publishers and subscribers for trivially copyable structs.
+ *
+ * The payload is the struct's bytes, so both ends must agree on its layout.
+ * Every type gets a compile-time fingerprint from its size, alignment and,
+ * if declared with MMW_DECLARE_TYPE, its name. The broker binds a topic to
+ * the first fingerprint registered on it and rejects any other.
+ *
+ *     struct Pose { double x, y, theta; };
+ *     MMW_DECLARE_TYPE(Pose)
+ *
+ *     mmw::Publisher<Pose> pub("pose");
+ *     pub.publish(Pose{1.0, 2.0, 0.5});
+ *
+ *     mmw::Subscriber<Pose> sub("pose", [](const Pose& p) { ... });
+ */
+namespace mmw {
+
+// Name mixed into a type's fingerprint, empty unless declared with MMW_DECLARE_TYPE
+template <typename T>
+struct TypeName {
+    static constexpr const char* value() { return ""; }
+};
+
+namespace detail {
+
+constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+constexpr uint64_t fnvString(const char* s, uint64_t h) {
+    return *s ? fnvString(s + 1, (h ^ static_cast<unsigned char>(*s)) * FNV_PRIME) : h;
+}
+
+constexpr uint64_t fnvInteger(uint64_t v, int bytes, uint64_t h) {
+    return bytes == 0 ? h : fnvInteger(v >> 8, bytes - 1, (h ^ (v & 0xFF)) * FNV_PRIME);
+}
+
+}  // namespace detail
+
+template <typename T>
+constexpr uint64_t typeFingerprint() {
+    return detail::fnvString(TypeName<T>::value(),
+           detail::fnvInteger(sizeof(T), 8,
+           detail::fnvInteger(alignof(T), 8, detail::FNV_OFFSET)));
+}
+
+/**
+ * Publishes values of T on a topic over its own broker connection.
+ */
+template <typename T>
+class Publisher {
+    static_assert(std::is_trivially_copyable<T>::value, "mmw::Publisher requires a trivially copyable type");
+
+public:
+    explicit Publisher(const std::string& topic) : handle_(nullptr) {
+        if (mmw_create_publisher_typed(topic.c_str(), typeFingerprint<T>(), &handle_) != MMW_OK) {
+            throw std::runtime_error("Failed to create typed publisher for topic " + topic);
+        }
+    }
+
+    ~Publisher() {
+        mmw_delete_publisher_handle(handle_);
+    }
+
+    Publisher(const Publisher&) = delete;
+    Publisher& operator=(const Publisher&) = delete;
+
+    MmwResult publish(const T& value, MmwReliability reliability = MMW_BEST_EFFORT) {
+        return mmw_publish_raw_handle(handle_, const_cast<T*>(&value), sizeof(T), reliability);
+    }
+
+private:
+    mmw_publisher_t handle_;
+};
+
+/**
+ * Delivers values of T from a topic. The callback gets a reference into the
+ * receive buffer, valid until it returns.
+ */
+template <typename T>
+class Subscriber {
+    static_assert(std::is_trivially_copyable<T>::value, "mmw::Subscriber requires a trivially copyable type");
+    static_assert(alignof(T) <= alignof(std::max_align_t), "mmw::Subscriber does not support over-aligned types");
+
+public:
+    typedef std::function<void(const T&)> Callback;
+
+    Subscriber(const std::string& topic, Callback callback) : topic_(topic) {
+        MmwSubscriberOptions options = {};
+        options.typeFingerprint = typeFingerprint<T>();
+        options.size = sizeof(T);
+        options.alignment = alignof(T);
+        options.userData = new Callback(std::move(callback));
+        options.releaseUserData = &Subscriber::release;
+
+        // The library owns the callback from here on and releases it even on failure
+        if (mmw_create_subscriber_sized(topic.c_str(), &Subscriber::dispatch, &options) != MMW_OK) {
+            throw std::runtime_error("Failed to create typed subscriber for topic " + topic);
+        }
+    }
+
+    ~Subscriber() {
+        mmw_delete_subscriber(topic_.c_str());
+    }
+
+    Subscriber(const Subscriber&) = delete;
+    Subscriber& operator=(const Subscriber&) = delete;
+
+private:
+    static void dispatch(const char* topic, const void* message, size_t size, void* userData) {
+        (*static_cast<Callback*>(userData))(*static_cast<const T*>(message));
+    }
+
+    static void release(void* userData) {
+        delete static_cast<Callback*>(userData);
+    }
+
+    std::string topic_;
+};
+
+}  // namespace mmw
+
+// Give T a name in its fingerprint, use at global scope after T is declared
+#define MMW_DECLARE_TYPE(T) \
+    namespace mmw { \
+    template <> \
+    struct TypeName<T> { \
+        static constexpr const char* value() { return #T; } \
+    }; \
+    }
@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+/**
+ * Bounded lock-free multi-producer / single-consumer queue.
+ *
+ * Based on Dmitry Vyukov's bounded MPMC ring: every cell carries a sequence
+ * number so producers claim slots with a single CAS and the consumer never
+ * touches the producers' cache line. Capacity is rounded up to a power of two.
+ */
+template <typename T>
+class MpscQueue {
+public:
+    explicit MpscQueue(size_t capacity)
+        : mask_(roundUpPow2(capacity < 2 ? 2 : capacity) - 1),
+          cells_(new Cell[mask_ + 1]),
+          enqueuePos_(0),
+          dequeuePos_(0)
+    {
+        for (size_t i = 0; i <= mask_; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    // Returns false if the queue is full, item is left untouched in that case
+    bool tryPush(T& item) {
+        Cell* cell;
+        size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Must only be called from the single consumer thread
+    bool tryPop(T& item) {
+        Cell* cell = &cells_[dequeuePos_ & mask_];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        if ((intptr_t)seq - (intptr_t)(dequeuePos_ + 1) < 0) {
+            return false;
+        }
+        item = std::move(cell->data);
+        cell->data = T();
+        cell->sequence.store(dequeuePos_ + mask_ + 1, std::memory_order_release);
+        ++dequeuePos_;
+        return true;
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    static size_t roundUpPow2(size_t v) {
+        size_t p = 1;
+        while (p < v) p <<= 1;
+        return p;
+    }
+
+    // Padding keeps producer and consumer indices on separate cache lines
+    // without needing over-aligned allocation
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    char pad0_[64];
+    std::atomic<size_t> enqueuePos_;
+    char pad1_[64];
+    size_t dequeuePos_;
+};
@@ -0,0 +1,14 @@
+#pragma once
+#include "IMmwCodec.h"
+
+// Stores the payload unchanged, lets a topic opt out of compression explicitly
+class NoneCodec : public IMmwCodec {
+    public:
+        static const uint8_t ID = 0;
+
+        uint8_t id() const override { return ID; }
+        const char* name() const override { return "none"; }
+        size_t maxCompressedSize(size_t len) const override { return len; }
+        size_t compress(const char* in, size_t len, char* out, size_t capacity) override;
+        bool decompress(const char* in, size_t len, char* out, size_t originalLen) override;
+};
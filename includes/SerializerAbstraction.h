@@ -1,5 +1,15 @@
 #pragma once
 
+#include <cstddef>
 #include "IMmwMessageSerializer.h"
+#include "MMW.h"
 
+static const size_t SERIALIZER_FORMAT_COUNT = 3;
+
+// Serializer for the format selected at build time
 IMmwMessageSerializer* CreateSerializer();
+IMmwMessageSerializer* CreateSerializer(MmwSerializerFormat format);
+MmwSerializerFormat DefaultSerializerFormat();
+
+// Identify the wire format of a connection's first frame, false if it matches none
+bool DetectSerializerFormat(const char* data, size_t len, MmwSerializerFormat& format);
@@ -3,7 +3,12 @@
 
 #if defined(__linux__) || defined(__APPLE__) || defined(__EMSCRIPTEN__)
     #include <arpa/inet.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
     #include <sys/socket.h>
+    #include <sys/ioctl.h>
+    #include <sys/uio.h>
+    #include <sys/time.h>
     #include <unistd.h>
     #include <stdint.h>
 #elif defined(_WIN32)
@@ -15,15 +20,31 @@
     #error "Unsupported platform"
 #endif
 
+#include <stddef.h>
+
+// One piece of a scatter-gather send
+struct SocketBuffer {
+    const void* data;
+    size_t len;
+};
+
 class SocketAbstraction {
 public:
+    static const int MAX_SEND_BUFFERS = 8;
+
     static int SocketStartup();
     static int SocketCleanup();
     static int SocketClose(int s);
+    static int ShutdownRead(int s);
     static int Send(int s, const void* buf, int32_t len, int32_t flags);
+    static int SendV(int s, const SocketBuffer* bufs, int count);
     static int Recv(int s, void* buf, int32_t len, int32_t flags);
     static int InetPtonAbstraction(int family, const char* pszAddrString, void* pAddrBuf);
     static int SetSockOpt(int s, int level, int optname, const char* optval, int optlen);
+    static int BytesAvailable(int s);
+    static int BytesUnsent(int s);
+    static int SetNoDelay(int s);
+    static int SetRecvTimeout(int s, int timeoutMs);
 };
 
 #endif
\ No newline at end of file
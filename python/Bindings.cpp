@@ -4,18 +4,168 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <queue>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <algorithm>
 #include <map>
 #include <string>
+#include <stdexcept>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
 #include "MMW.h"
 
 namespace py = pybind11;
 
-// Forward declaration
-class PySubscriber;
+// Messages of one Python subscriber waiting for the dispatch thread
+struct SubscriberQueue {
+    std::string topic;
+    py::function callback;       // only touched with the GIL held
+    size_t maxPending;           // 0 leaves the queue unbounded
+    size_t batchSize;            // 0 calls the callback once per message
+
+    std::mutex mtx;
+    std::condition_variable notFullCv;
+    std::deque<std::string> messages;
+    size_t pending = 0;          // queued plus handed to the callback and not yet returned
+    bool scheduled = false;      // on the dispatcher's ready list or being drained
+    bool open = true;
+
+    // Subscribers still registered at exit are freed after the interpreter is gone, leak the callback then
+    ~SubscriberQueue() {
+        if (!Py_IsInitialized()) {
+            callback.release();
+        }
+    }
+};
+
+// Topic -> queue of the Python subscriber on it, looked up from the library's receive threads
+static std::mutex g_instanceMutex;
+static std::map<std::string, std::shared_ptr<SubscriberQueue>> g_instanceMap;
+
+/**
+ * One thread delivers to every Python subscriber.
+ *
+ * Receive threads only queue messages. The dispatcher takes the GIL once per
+ * pass over all subscribers with pending messages, so N subscribers do not
+ * mean N threads contending for it. Each pass hands a subscriber at most one
+ * chunk, so a busy topic cannot starve the others.
+ */
+class PyDispatcher {
+public:
+    // Never destroyed, interpreter shutdown must not wait on a thread that may be waiting for the GIL
+    static PyDispatcher& instance() {
+        static PyDispatcher* dispatcher = new PyDispatcher();
+        return *dispatcher;
+    }
+
+    void schedule(const std::shared_ptr<SubscriberQueue>& queue) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            ready.push_back(queue);
+        }
+        cv.notify_one();
+    }
+
+private:
+    // Messages per callback turn when the subscriber does not ask for batches
+    static const size_t DISPATCH_CHUNK = 256;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<std::shared_ptr<SubscriberQueue>> ready;
+
+    PyDispatcher() {
+        std::thread(&PyDispatcher::run, this).detach();
+    }
 
-// Map of topic -> PySubscriber instance
-static std::map<std::string, PySubscriber*> g_instanceMap;
+    void run() {
+        std::vector<std::shared_ptr<SubscriberQueue>> pass;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [this] { return !ready.empty(); });
+                pass.swap(ready);
+            }
+            if (!Py_IsInitialized()) {
+                return;
+            }
+
+            std::vector<std::shared_ptr<SubscriberQueue>> again;
+            {
+                py::gil_scoped_acquire gil;
+                for (auto& queue : pass) {
+                    if (deliver(*queue)) {
+                        again.push_back(queue);
+                    }
+                }
+            }
+            pass.clear();
+
+            if (!again.empty()) {
+                std::lock_guard<std::mutex> lock(mtx);
+                ready.insert(ready.end(), again.begin(), again.end());
+            }
+        }
+    }
+
+    // Hands one chunk to the callback with the GIL held, returns true if more messages are waiting
+    bool deliver(SubscriberQueue& queue) {
+        std::vector<std::string> chunk;
+        {
+            std::lock_guard<std::mutex> lock(queue.mtx);
+            size_t limit = queue.batchSize;
+            if (limit == 0) {
+                limit = DISPATCH_CHUNK;
+            }
+            while (!queue.messages.empty() && chunk.size() < limit) {
+                chunk.push_back(std::move(queue.messages.front()));
+                queue.messages.pop_front();
+            }
+            if (chunk.empty() || !queue.open) {
+                queue.messages.clear();
+                queue.pending = 0;
+                queue.scheduled = false;
+                return false;
+            }
+        }
+
+        try {
+            if (queue.batchSize != 0) {
+                py::list batch(chunk.size());
+                for (size_t i = 0; i < chunk.size(); ++i) {
+                    batch[i] = py::str(chunk[i]);
+                }
+                queue.callback(queue.topic, batch);
+            } else {
+                for (auto& msg : chunk) {
+                    // A callback can let another thread delete the subscriber between messages
+                    if (!queue.callback) {
+                        break;
+                    }
+                    queue.callback(queue.topic, msg);
+                }
+            }
+        } catch (const std::exception &e) {
+            py::print("[PySubscriber] Exception in callback:", e.what());
+        }
+
+        // Room in a bounded queue only opens up once the callback is done with the messages
+        std::lock_guard<std::mutex> lock(queue.mtx);
+        queue.pending -= std::min(queue.pending, chunk.size());
+        queue.notFullCv.notify_all();
+        if (queue.messages.empty()) {
+            queue.scheduled = false;
+            return false;
+        }
+        return true;
+    }
+};
 
 // Subscriber trampoline called by C++ library
 extern "C" void subscriber_trampoline(const char* topic, const char* message);
@@ -23,84 +173,422 @@ extern "C" void subscriber_trampoline(const char* topic, const char* message);
 // Python-facing subscriber class
 class PySubscriber {
 public:
-    PySubscriber(const std::string& topic_, py::function callback_)
-        : topic(topic_), callback(callback_), running(true)
+    PySubscriber(const std::string& topic_, py::function callback_, size_t maxPending_, size_t batchSize_)
+        : queue(std::make_shared<SubscriberQueue>())
     {
-        // Register in global map
-        g_instanceMap[topic] = this;
+        queue->topic = topic_;
+        queue->callback = callback_;
+        queue->maxPending = maxPending_;
+        queue->batchSize = batchSize_;
+        PyDispatcher::instance();
 
-        // Start Python worker thread
-        workerThread = std::thread(&PySubscriber::processQueue, this);
+        // Register in global map
+        {
+            std::lock_guard<std::mutex> lock(g_instanceMutex);
+            g_instanceMap[queue->topic] = queue;
+        }
 
-        // Create C++ subscriber
-        mmw_create_subscriber(topic.c_str(), &subscriber_trampoline);
+        // Create C++ subscriber, the receive thread it starts needs the GIL for the callback
+        MmwResult result;
+        {
+            py::gil_scoped_release release;
+            result = mmw_create_subscriber(queue->topic.c_str(), &subscriber_trampoline);
+        }
+        if (result != MMW_OK) {
+            // The destructor does not run for a failed constructor, so unregister here
+            {
+                std::lock_guard<std::mutex> lock(g_instanceMutex);
+                auto it = g_instanceMap.find(queue->topic);
+                if (it != g_instanceMap.end() && it->second == queue) {
+                    g_instanceMap.erase(it);
+                }
+            }
+            queue->callback = py::function();
+            throw std::runtime_error("Failed to create subscriber for topic " + queue->topic);
+        }
     }
 
     ~PySubscriber() {
-        running = false;
-        cv.notify_all();
-        if (workerThread.joinable())
-            workerThread.join();
+        {
+            std::lock_guard<std::mutex> lock(queue->mtx);
+            queue->open = false;
+        }
+        queue->notFullCv.notify_all();
 
         // Remove from global map
-        g_instanceMap.erase(topic);
+        {
+            std::lock_guard<std::mutex> lock(g_instanceMutex);
+            auto it = g_instanceMap.find(queue->topic);
+            if (it != g_instanceMap.end() && it->second == queue) {
+                g_instanceMap.erase(it);
+            }
+        }
+
+        // Drop the callback while the GIL is held, the queue itself may outlive us on another thread
+        queue->callback = py::function();
 
         // Optional: clean up library if desired
         // mmw_cleanup();  // Don't do this if you have multiple subscribers
     }
 
-    // Enqueue message from C++ subscriber thread
-    void enqueueMessage(const std::string& msg) {
-        {
-            std::lock_guard<std::mutex> lock(queueMutex);
-            msgQueue.push(msg);
+private:
+    std::shared_ptr<SubscriberQueue> queue;
+};
+
+// Enqueue message from C++ subscriber thread. When the queue is bounded this
+// blocks the receive thread, which stops credit flowing back to the broker.
+static void enqueueMessage(const std::shared_ptr<SubscriberQueue>& queue, const char* message) {
+    bool wake = false;
+    {
+        std::unique_lock<std::mutex> lock(queue->mtx);
+        if (queue->maxPending > 0) {
+            queue->notFullCv.wait(lock, [&queue] { return queue->pending < queue->maxPending || !queue->open; });
+        }
+        if (!queue->open) {
+            return;
+        }
+        queue->messages.push_back(message);
+        queue->pending++;
+        if (!queue->scheduled) {
+            queue->scheduled = true;
+            wake = true;
         }
-        cv.notify_one();
     }
+    if (wake) {
+        PyDispatcher::instance().schedule(queue);
+    }
+}
 
-private:
-    std::string topic;
+// Trampoline called by C++ library
+extern "C" void subscriber_trampoline(const char* topic, const char* message) {
+    std::shared_ptr<SubscriberQueue> queue;
+    {
+        std::lock_guard<std::mutex> lock(g_instanceMutex);
+        auto it = g_instanceMap.find(topic);
+        if (it != g_instanceMap.end()) {
+            queue = it->second;
+        }
+    }
+    if (queue) {
+        enqueueMessage(queue, message ? message : "");
+    }
+}
+
+// Publish any contiguous buffer (bytes, bytearray, memoryview, numpy arrays) straight from its memory
+static MmwResult publishRaw(const std::string& topic, py::buffer message, MmwReliability reliability) {
+    Py_buffer view;
+    if (PyObject_GetBuffer(message.ptr(), &view, PyBUF_SIMPLE) != 0) {
+        throw py::error_already_set();
+    }
+
+    // The export keeps the buffer alive and unresizable while other Python threads run
+    MmwResult result;
+    {
+        py::gil_scoped_release release;
+        result = mmw_publish_raw(topic.c_str(), view.buf, (size_t)view.len, reliability);
+    }
+    PyBuffer_Release(&view);
+    return result;
+}
+
+// Python callback of a raw subscriber, owned by the library and freed once the subscriber is gone
+struct PyRawSubscriber {
     py::function callback;
-    std::thread workerThread;
-    std::atomic<bool> running;
+};
 
-    std::mutex queueMutex;
-    std::condition_variable cv;
-    std::queue<std::string> msgQueue;
-
-    void processQueue() {
-        while (running) {
-            std::unique_lock<std::mutex> lock(queueMutex);
-            cv.wait(lock, [this] { return !msgQueue.empty() || !running; });
-
-            while (!msgQueue.empty()) {
-                std::string msg = std::move(msgQueue.front());
-                msgQueue.pop();
-                lock.unlock();
-
-                try {
-                    py::gil_scoped_acquire gil;
-                    callback(topic, msg);
-                } catch (const std::exception &e) {
-                    py::print("[PySubscriber] Exception in callback:", e.what());
-                }
+static void releaseRawSubscriber(void* userData) {
+    if (!Py_IsInitialized()) {
+        return;
+    }
+    py::gil_scoped_acquire gil;
+    delete static_cast<PyRawSubscriber*>(userData);
+}
+
+// Runs on the receive thread, the memoryview points into the receive buffer and is released on return
+static void rawSubscriberTrampoline(const char* topic, const void* message, size_t size, void* userData) {
+    if (!Py_IsInitialized()) {
+        return;
+    }
+    py::gil_scoped_acquire gil;
+    PyRawSubscriber* subscriber = static_cast<PyRawSubscriber*>(userData);
+    py::memoryview payload = py::memoryview::from_memory(message, (py::ssize_t)size);
+    try {
+        subscriber->callback(topic, payload);
+    } catch (const std::exception& e) {
+        py::print("[PySubscriber] Exception in raw callback:", e.what());
+    }
 
-                lock.lock();
+    // Views kept past the callback must fail loudly instead of reading a reused buffer
+    try {
+        payload.attr("release")();
+    } catch (const py::error_already_set& e) {
+        py::print("[PySubscriber] Raw payload still exported after the callback, copy it with bytes() to keep it:", e.what());
+    }
+}
+
+static MmwResult createSubscriberRaw(const std::string& topic, py::function callback) {
+    MmwSubscriberOptions options = {};
+    options.alignment = 1; // hand the payload over in place, never realign it
+    options.userData = new PyRawSubscriber{callback};
+    options.releaseUserData = releaseRawSubscriber;
+
+    py::gil_scoped_release release;
+    return mmw_create_subscriber_sized(topic.c_str(), rawSubscriberTrampoline, &options);
+}
+
+// Readable file descriptor an asyncio loop watches, raised while there is something to drain
+class EventSignal {
+public:
+    EventSignal() {
+#if defined(__linux__)
+        readFd = writeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (readFd < 0) {
+            throw std::runtime_error("eventfd failed");
+        }
+#elif !defined(_WIN32)
+        int fds[2];
+        if (pipe(fds) != 0) {
+            throw std::runtime_error("pipe failed");
+        }
+        for (int fd : fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        readFd = fds[0];
+        writeFd = fds[1];
+#else
+        throw std::runtime_error("asyncio integration needs a selector event loop, which Windows does not provide");
+#endif
+    }
+
+    ~EventSignal() {
+#if !defined(_WIN32)
+        close(readFd);
+        if (writeFd != readFd) {
+            close(writeFd);
+        }
+#endif
+    }
+
+    int fileno() const { return readFd; }
+
+    void raise() {
+#if !defined(_WIN32)
+        uint64_t one = 1;
+        ssize_t n = write(writeFd, &one, writeFd == readFd ? sizeof(one) : 1);
+        (void)n;
+#endif
+    }
+
+    void clear() {
+#if !defined(_WIN32)
+        char buf[64];
+        while (read(readFd, buf, sizeof(buf)) > 0) {
+        }
+#endif
+    }
+
+private:
+    int readFd = -1;
+    int writeFd = -1;
+};
+
+// Messages of one asyncio subscription, filled by the receive thread and drained by the event loop
+struct AsyncInbox {
+    EventSignal signal;
+    size_t maxPending;
+
+    std::mutex mtx;
+    std::condition_variable notFullCv;
+    std::deque<std::string> messages;
+    bool closed = false;
+};
+
+static void releaseAsyncInbox(void* userData) {
+    delete static_cast<std::shared_ptr<AsyncInbox>*>(userData);
+}
+
+// Runs on the receive thread without the GIL, only the first message after a drain wakes the loop
+static void asyncSubscriberTrampoline(const char*, const void* message, size_t size, void* userData) {
+    AsyncInbox& inbox = **static_cast<std::shared_ptr<AsyncInbox>*>(userData);
+    std::unique_lock<std::mutex> lock(inbox.mtx);
+    if (inbox.maxPending > 0) {
+        inbox.notFullCv.wait(lock, [&inbox] { return inbox.messages.size() < inbox.maxPending || inbox.closed; });
+    }
+    if (inbox.closed) {
+        return;
+    }
+    inbox.messages.push_back(std::string(static_cast<const char*>(message), size));
+    if (inbox.messages.size() == 1) {
+        inbox.signal.raise();
+    }
+}
+
+// Subscription behind mmw.subscribe(), the asyncio side lives in mmw/__init__.py
+class PyAsyncSubscription {
+public:
+    PyAsyncSubscription(const std::string& topic_, bool raw_, size_t maxPending_)
+        : topic(topic_), raw(raw_), inbox(std::make_shared<AsyncInbox>())
+    {
+        inbox->maxPending = maxPending_;
+
+        MmwSubscriberOptions options = {};
+        options.alignment = 1;
+        options.userData = new std::shared_ptr<AsyncInbox>(inbox);
+        options.releaseUserData = releaseAsyncInbox;
+        options.handle = &handle;
+
+        MmwResult result;
+        {
+            py::gil_scoped_release release;
+            result = mmw_create_subscriber_sized(topic.c_str(), asyncSubscriberTrampoline, &options);
+        }
+        if (result != MMW_OK) {
+            throw std::runtime_error("Failed to create subscriber for topic " + topic);
+        }
+    }
+
+    ~PyAsyncSubscription() {
+        if (!isClosed()) {
+            close();
+        }
+    }
+
+    int fileno() const { return inbox->signal.fileno(); }
+
+    // Up to maxMessages queued messages, the signal stays raised while any are left
+    py::list drain(size_t maxMessages) {
+        std::vector<std::string> batch;
+        {
+            std::lock_guard<std::mutex> lock(inbox->mtx);
+            while (!inbox->messages.empty() && (maxMessages == 0 || batch.size() < maxMessages)) {
+                batch.push_back(std::move(inbox->messages.front()));
+                inbox->messages.pop_front();
+            }
+            if (inbox->messages.empty() && !inbox->closed) {
+                inbox->signal.clear();
+            }
+        }
+        inbox->notFullCv.notify_all();
+
+        py::list out(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (raw) {
+                out[i] = py::bytes(batch[i]);
+            } else {
+                out[i] = py::str(batch[i]);
+            }
+        }
+        return out;
+    }
+
+    bool isClosed() {
+        std::lock_guard<std::mutex> lock(inbox->mtx);
+        return inbox->closed;
+    }
+
+    // Wakes any waiting iterator, which then finds the subscription closed
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(inbox->mtx);
+            if (inbox->closed) {
+                return;
             }
+            inbox->closed = true;
+            inbox->messages.clear();
+            inbox->signal.raise();
         }
+        inbox->notFullCv.notify_all();
+
+        // Only this subscription, others on the same topic keep running
+        py::gil_scoped_release release;
+        mmw_delete_subscriber_handle(handle);
     }
 
-    friend void subscriber_trampoline(const char* topic, const char* message);
+private:
+    std::string topic;
+    bool raw;
+    std::shared_ptr<AsyncInbox> inbox;
+    mmw_subscriber_t handle = nullptr;
 };
 
-// Trampoline called by C++ library
-extern "C" void subscriber_trampoline(const char* topic, const char* message) {
-    auto it = g_instanceMap.find(topic);
-    if (it != g_instanceMap.end()) {
-        it->second->enqueueMessage(message ? message : "");
+// Results of asynchronous publishes for one event loop, filled by the library's sender thread
+struct CompletionInbox {
+    EventSignal signal;
+    std::mutex mtx;
+    std::vector<std::pair<uint64_t, MmwResult>> results;
+};
+
+struct PendingCompletion {
+    std::shared_ptr<CompletionInbox> inbox;
+    uint64_t token;
+};
+
+static void publishCompleted(const char*, MmwResult result, void* userData) {
+    PendingCompletion* pending = static_cast<PendingCompletion*>(userData);
+    {
+        std::lock_guard<std::mutex> lock(pending->inbox->mtx);
+        pending->inbox->results.push_back(std::make_pair(pending->token, result));
+        if (pending->inbox->results.size() == 1) {
+            pending->inbox->signal.raise();
+        }
     }
+    delete pending;
 }
 
+class PyCompletionQueue {
+public:
+    PyCompletionQueue() : inbox(std::make_shared<CompletionInbox>()) {}
+
+    int fileno() const { return inbox->signal.fileno(); }
+
+    // (token, result) of every publish that finished since the last drain
+    py::list drain() {
+        std::vector<std::pair<uint64_t, MmwResult>> done;
+        {
+            std::lock_guard<std::mutex> lock(inbox->mtx);
+            done.swap(inbox->results);
+            inbox->signal.clear();
+        }
+        py::list out;
+        for (auto& entry : done) {
+            out.append(py::make_tuple(entry.first, entry.second));
+        }
+        return out;
+    }
+
+    // Queue a publish whose result is reported under token, str goes out as text and buffers as raw bytes
+    MmwResult publish(const std::string& topic, py::object message, MmwReliability reliability, uint64_t token) {
+        PendingCompletion* pending = new PendingCompletion{inbox, token};
+        MmwResult result;
+        if (py::isinstance<py::str>(message)) {
+            std::string text = message.cast<std::string>();
+            py::gil_scoped_release release;
+            result = mmw_publish_async(topic.c_str(), text.c_str(), reliability, publishCompleted, pending);
+        } else {
+            Py_buffer view;
+            if (PyObject_GetBuffer(message.ptr(), &view, PyBUF_SIMPLE) != 0) {
+                delete pending;
+                throw py::error_already_set();
+            }
+            {
+                py::gil_scoped_release release;
+                result = mmw_publish_raw_async(topic.c_str(), view.buf, (size_t)view.len, reliability, publishCompleted, pending);
+            }
+            PyBuffer_Release(&view);
+        }
+
+        // The completion callback only runs for messages that were queued
+        if (result != MMW_OK) {
+            delete pending;
+        }
+        return result;
+    }
+
+private:
+    std::shared_ptr<CompletionInbox> inbox;
+};
+
 // PYBIND11 MODULE
 PYBIND11_MODULE(_mmw, m) {
     m.doc() = "Python bindings for Minimal Middleware";
@@ -125,17 +613,57 @@ PYBIND11_MODULE(_mmw, m) {
         .value("MMW_LOG_LEVEL_TRACE", MMW_LOG_LEVEL_TRACE)
         .export_values();
 
+    py::enum_<MmwLogSubsystem>(m, "MmwLogSubsystem")
+        .value("MMW_LOG_GENERAL", MMW_LOG_GENERAL)
+        .value("MMW_LOG_CONNECTION", MMW_LOG_CONNECTION)
+        .value("MMW_LOG_PUBLISH", MMW_LOG_PUBLISH)
+        .value("MMW_LOG_SUBSCRIBE", MMW_LOG_SUBSCRIBE)
+        .value("MMW_LOG_RELIABILITY", MMW_LOG_RELIABILITY)
+        .value("MMW_LOG_HEARTBEAT", MMW_LOG_HEARTBEAT)
+        .value("MMW_LOG_PERSISTENCE", MMW_LOG_PERSISTENCE)
+        .export_values();
+
+    py::enum_<MmwSerializerFormat>(m, "MmwSerializerFormat")
+        .value("MMW_SERIALIZER_CEREAL", MMW_SERIALIZER_CEREAL)
+        .value("MMW_SERIALIZER_JSON", MMW_SERIALIZER_JSON)
+        .value("MMW_SERIALIZER_BINARY", MMW_SERIALIZER_BINARY)
+        .export_values();
+
     // Core API
     m.def("initialize", &mmw_initialize, py::arg("broker_ip"), py::arg("port"));
     m.def("create_publisher", &mmw_create_publisher, py::arg("topic"));
     m.def("publish", &mmw_publish, py::arg("topic"), py::arg("message"), py::arg("reliability"));
+    m.def("publish_raw", &publishRaw, py::arg("topic"), py::arg("message"), py::arg("reliability"));
+    m.def("create_subscriber_raw", &createSubscriberRaw, py::arg("topic"), py::arg("callback"));
     m.def("set_log_level", &mmw_set_log_level, py::arg("level"));
+    m.def("set_subsystem_log_level", &mmw_set_subsystem_log_level, py::arg("subsystem"), py::arg("level"));
+    m.def("set_log_async", &mmw_set_log_async, py::arg("queue_size"));
+    m.def("set_serializer", &mmw_set_serializer, py::arg("format"));
+    m.def("set_trace_sampling", &mmw_set_trace_sampling, py::arg("one_in"));
+    m.def("set_trace_file", &mmw_set_trace_file, py::arg("path"));
+    m.def("set_subscriber_credit", &mmw_set_subscriber_credit, py::arg("messages"), py::arg("bytes") = 0);
     m.def("delete_publisher", &mmw_delete_publisher, py::arg("topic"));
-    m.def("delete_subscriber", &mmw_delete_subscriber, py::arg("topic"));
-    m.def("cleanup", &mmw_cleanup);
+    // Raw subscribers take the GIL on their receive threads, which these calls stop
+    m.def("delete_subscriber", &mmw_delete_subscriber, py::arg("topic"), py::call_guard<py::gil_scoped_release>());
+    m.def("cleanup", &mmw_cleanup, py::call_guard<py::gil_scoped_release>());
 
     // Subscriber wrapper
     py::class_<PySubscriber>(m, "create_subscriber")
-        .def(py::init<const std::string&, py::function>(),
-             py::arg("topic"), py::arg("callback"));
+        .def(py::init<const std::string&, py::function, size_t, size_t>(),
+             py::arg("topic"), py::arg("callback"), py::arg("max_pending") = 0, py::arg("batch_size") = 0);
+
+    // Building blocks of mmw.subscribe() and mmw.publish_async()
+    py::class_<PyAsyncSubscription>(m, "_AsyncSubscription")
+        .def(py::init<const std::string&, bool, size_t>(), py::arg("topic"), py::arg("raw"), py::arg("max_pending"))
+        .def("fileno", &PyAsyncSubscription::fileno)
+        .def("drain", &PyAsyncSubscription::drain, py::arg("max_messages"))
+        .def("close", &PyAsyncSubscription::close)
+        .def_property_readonly("closed", &PyAsyncSubscription::isClosed);
+
+    py::class_<PyCompletionQueue>(m, "_CompletionQueue")
+        .def(py::init<>())
+        .def("fileno", &PyCompletionQueue::fileno)
+        .def("drain", &PyCompletionQueue::drain)
+        .def("publish", &PyCompletionQueue::publish,
+             py::arg("topic"), py::arg("message"), py::arg("reliability"), py::arg("token"));
 }
@@ -0,0 +1,24 @@
+#!/usr/bin/python3
+import asyncio
+import mmw
+
+
+async def main():
+    mmw.initialize("127.0.0.1", 5000)
+    mmw.create_publisher("Test Topic")
+
+    async with mmw.subscribe("Test Topic") as messages:
+        for i in range(10):
+            await mmw.publish_async("Test Topic", f"hello from asyncio {i}", mmw.MmwReliability.MMW_RELIABLE)
+
+        received = 0
+        async for msg in messages:
+            print(f"[asyncio] Received: {msg}")
+            received += 1
+            if received == 10:
+                break
+
+    mmw.cleanup()
+
+
+asyncio.run(main())
@@ -1 +1,123 @@
 from ._mmw import *
+from . import _mmw
+
+import asyncio
+import collections
+import itertools
+import weakref
+
+
+def _wake(future):
+    if not future.done():
+        future.set_result(None)
+
+
+class Subscription:
+    """Messages of one topic as an async iterator.
+
+    The library's receive thread queues messages and raises an eventfd that
+    the running event loop watches, so messages reach the loop without a
+    thread hop per message. Each wakeup drains up to ``batch_size`` messages.
+    """
+
+    def __init__(self, topic, raw=False, max_pending=0, batch_size=256):
+        self._sub = _mmw._AsyncSubscription(topic, raw, max_pending)
+        self._batch_size = batch_size
+        self._buffer = collections.deque()
+
+    def __aiter__(self):
+        return self
+
+    async def __anext__(self):
+        if not self._buffer:
+            self._buffer.extend(await self.next_batch())
+        return self._buffer.popleft()
+
+    async def next_batch(self):
+        """Every queued message up to ``batch_size``, waiting for one if there are none."""
+        while True:
+            batch = self._sub.drain(self._batch_size)
+            if batch:
+                return batch
+            if self._sub.closed:
+                raise StopAsyncIteration
+
+            # drain() found the queue empty and cleared the eventfd, the next message raises it again
+            loop = asyncio.get_running_loop()
+            ready = loop.create_future()
+            fd = self._sub.fileno()
+            loop.add_reader(fd, _wake, ready)
+            try:
+                await ready
+            finally:
+                loop.remove_reader(fd)
+
+    def close(self):
+        self._sub.close()
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, *exc):
+        self.close()
+
+
+def subscribe(topic, raw=False, max_pending=0, batch_size=256):
+    """Subscribe to a topic for ``async for msg in mmw.subscribe(topic)``.
+
+    Messages are str, or bytes with ``raw=True``. ``max_pending`` bounds the
+    queue in front of the loop, a full queue holds back the receive thread and
+    with it the subscriber's flow-control credit.
+    """
+    return Subscription(topic, raw, max_pending, batch_size)
+
+
+class _Completions:
+    """Routes the results of asynchronous publishes back to their futures on one loop."""
+
+    def __init__(self, loop):
+        self.queue = _mmw._CompletionQueue()
+        # Weak, the loop already holds us through add_reader and is the key in _completions
+        self.loop = weakref.ref(loop)
+        self.futures = {}
+        self.tokens = itertools.count(1)
+        loop.add_reader(self.queue.fileno(), self._drain)
+
+    def _drain(self):
+        for token, result in self.queue.drain():
+            future = self.futures.pop(token, None)
+            if future is not None and not future.done():
+                future.set_result(result)
+
+
+_completions = weakref.WeakKeyDictionary()
+
+
+def _completions_for(loop):
+    # A closed loop that is still referenced elsewhere would otherwise pin its queue and eventfd
+    for closed in [other for other in _completions if other.is_closed()]:
+        del _completions[closed]
+
+    completions = _completions.get(loop)
+    if completions is None:
+        completions = _completions[loop] = _Completions(loop)
+    return completions
+
+
+async def publish_async(topic, message, reliability=MmwReliability.MMW_BEST_EFFORT):
+    """Queue a publish and wait until the sender thread has written it to the broker.
+
+    ``message`` is a str, sent as text, or any contiguous buffer such as bytes
+    or a numpy array, sent as raw bytes. Returns the ``MmwResult`` of the send.
+    """
+    loop = asyncio.get_running_loop()
+    completions = _completions_for(loop)
+
+    token = next(completions.tokens)
+    future = loop.create_future()
+    completions.futures[token] = future
+    result = completions.queue.publish(topic, message, reliability, token)
+    if result != MmwResult.MMW_OK:
+        del completions.futures[token]
+        return result
+    return await future
@@ -1,9 +1,19 @@
 #include <cstring>
+#include <cstddef>
+#include <cstdio>
+#include <stdexcept>
 #include <thread>
 #include <atomic>
 #include <map>
+#include <set>
+#include <memory>
 #include <mutex>
 #include <vector>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <random>
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/basic_file_sink.h>
 #include <fcntl.h>
@@ -12,44 +22,226 @@
 #include "IMmwMessageSerializer.h"
 #include "SerializerAbstraction.h"
 #include "SocketAbstraction.h"
+#include "MpscQueue.h"
+#include "MmwRegistration.h"
+#include "BufferPool.h"
+#include "CodecAbstraction.h"
+#include "MmwTrace.h"
+#include "MmwLog.h"
 
 static std::string hostname = "127.0.0.1";
 static int brokerPort = 5000;
 static struct sockaddr_in server_addr;
 static std::atomic<bool> running{false};
-static std::map<std::string, int> publisherTopicToSocketFdMap;
-static std::map<std::string, int> subscriberTopicToSocketFdMap;
+struct PublisherConfirms;
+
+// A publisher connection, also handed out as mmw_publisher_t
+struct MmwPublisher {
+    std::string topic;
+    int sock_fd;
+    uint32_t topicId;             // interned by the broker at registration, 0 if unknown
+    PublisherConfirms* confirms;  // only set for confirm-mode publishers
+    IMmwCodec* codec;             // compression accepted by the broker, nullptr for none
+};
+static std::map<std::string, MmwPublisher*> publisherTopicMap;
+static std::vector<MmwPublisher*> publisherHandles;
+static std::map<std::string, MmwCodec> topicCodecs;
+static std::map<std::string, uint32_t> topicPartitions;
+
+// A subscriber connection, also handed out as mmw_subscriber_t. Its reader thread holds a
+// reference, so a callback that deletes its own subscriber does not free it underneath.
+struct MmwSubscriber {
+    std::string topic;
+    int sock_fd;
+    std::atomic<bool> running;
+    std::atomic<bool> closeOnExit; // the reader could not be joined and closes the socket itself
+    std::thread reader;
+    std::thread heartbeat;
+};
+static std::multimap<std::string, std::shared_ptr<MmwSubscriber>> subscriberTopicMap; // a topic may have several, e.g. queue group members
 static std::mutex socketListMutex;
-static std::vector<std::thread> subscriberThreads;
-static std::vector<std::atomic<bool>*> subscriberRunFlags;
 static IMmwMessageSerializer* g_serializer = nullptr;
+static MmwSerializerFormat g_serializerFormat = DefaultSerializerFormat();
 static std::map<int, std::mutex> socketSendMutexes;
 static std::mutex socketSendMutexMapLock;
 
+// Receive buffers and realigned payloads are recycled through the pool. Frames
+// up to RESIDENT_BUFFER_SIZE keep their buffer on the connection, larger ones
+// hand it back as soon as the message has been handled.
+static BufferPool bufferPool;
+static const size_t RESIDENT_BUFFER_SIZE = 64 * 1024;
+
+// A payload region handed to the application. The buffer leaves room in front
+// of the payload for the length prefix and header, and behind it for the
+// trailer, so the finished frame is contiguous and goes out in one send.
+struct MmwLoan {
+    PooledBuffer buffer;
+    std::string topic;
+    size_t size;
+};
+// Rounded up so the payload is as aligned as the buffer itself, the frame is written backwards from it
+static const size_t LOAN_PAYLOAD_OFFSET = (sizeof(uint32_t) + MmwRawFrame::MAX_HEADER + alignof(std::max_align_t) - 1) /
+                                          alignof(std::max_align_t) * alignof(std::max_align_t);
+static std::map<void*, MmwLoan> loans;
+static std::mutex loanMutex;
+
+// Compressed payloads start with the original length (4 bytes, little-endian)
+static const size_t COMPRESSED_PREFIX_SIZE = 4;
+static const size_t MIN_COMPRESS_SIZE = 64;
+static const size_t MAX_DECOMPRESSED_SIZE = 64 * 1024 * 1024;
+
+// Confirm-mode publisher state, confirmedSeq is advanced by a reader thread
+struct PublisherConfirms {
+    int sock_fd = -1;
+    size_t window = 0;
+    uint32_t nextSeq = 1;
+    uint32_t confirmedSeq = 0;
+    std::set<uint32_t> nacked; // rejected ids above confirmedSeq, a nack settles only its own message
+    bool failed = false;
+    bool closed = false;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::mutex sendMtx; // keeps sequence numbers in wire order
+    std::thread reader;
+};
+
+// Flow control window granted by subscribers created from now on, 0 means unlimited
+struct SubscriberCredit {
+    size_t messages;
+    size_t bytes;
+};
+static SubscriberCredit subscriberCredit{0, 0};
+
+// Asynchronous publish state
+struct AsyncPublishRequest {
+    std::string topic;
+    std::string payload;
+    bool raw = false;
+    MmwReliability reliability = MMW_BEST_EFFORT;
+    MmwPublishCallback callback = nullptr;
+    void* userData = nullptr;
+};
+static std::atomic<MpscQueue<AsyncPublishRequest>*> asyncQueue{nullptr};
+static size_t asyncQueueCapacity = 8192;
+static MmwQueueFullPolicy asyncQueueFullPolicy = MMW_QUEUE_FULL_BLOCK;
+static std::thread asyncSenderThread;
+static std::atomic<bool> asyncSenderIdle{false};
+static std::atomic<bool> asyncAccepting{false}; // producers may push, cleared before the queue is freed
+static std::atomic<int> asyncProducers{0};      // producers between checking asyncAccepting and finishing their push
+static std::atomic<int> asyncFlushWaiters{0};
+static bool asyncStopping = false;             // guarded by asyncStartMutex, set while the old sender drains
+static std::atomic<uint64_t> asyncEnqueued{0};
+static std::atomic<uint64_t> asyncCompleted{0};
+static std::mutex asyncStartMutex;              // creating and freeing the queue and its sender
+static std::mutex asyncMutex;
+static std::condition_variable asyncWakeCv;
+static std::condition_variable asyncFlushCv;
+
+// Request/reply: every request of the process goes out on one requester connection
+// and its reply comes back on it under the correlation id it was sent with
+typedef std::function<void(MmwResult, const char*, size_t)> ReplyHandler;
+struct PendingReply {
+    ReplyHandler handler;
+    std::chrono::steady_clock::time_point deadline;
+};
+static std::mutex requestMutex;
+static std::condition_variable requestTimerCv;
+static int requestSocket = -1;
+static uint32_t nextCorrelationId = 1;
+static std::map<uint32_t, PendingReply> pendingReplies;
+static std::multimap<std::chrono::steady_clock::time_point, uint32_t> replyDeadlines;
+static std::vector<std::thread> requestReaderThreads; // one per requester connection made so far
+static std::thread requestTimerThread;
+static bool requestTimerRunning = false;
+// A served service. Its requests share it, so a reply after mmw_stop_serving() fails
+// instead of writing to a socket that is closed or already reused.
+struct ServerConnection {
+    int sock_fd;
+    std::string service;
+    std::atomic<bool> running;
+    std::mutex mtx;
+    bool open;                      // cleared when stopping, replies are refused from then on
+    std::set<uint32_t> outstanding; // requests handed to the handler and not answered yet
+    std::thread reader;
+    std::thread heartbeat;
+};
+static std::map<std::string, std::shared_ptr<ServerConnection>> serverConnections;
+
+// A request delivered to a server's handler, freed by mmw_reply() or mmw_reply_error()
+struct MmwRequest {
+    std::shared_ptr<ServerConnection> server;
+    uint32_t requestId;
+};
+
+// Sampled tracing, one in traceInterval publishes carries a trace. Ids start
+// at a random base so traces from different publisher processes rarely collide.
+static std::atomic<uint32_t> traceInterval{0};
+static std::atomic<uint32_t> tracePublishCount{0};
+static std::atomic<uint64_t> nextTraceId{0};
+static std::mutex traceMutex;
+static std::deque<MmwTraceRecord> traceRecords;
+static const size_t MAX_TRACE_RECORDS = 4096;
+static FILE* traceFile = nullptr;
+static const char* const traceStageNames[MMW_TRACE_STAGE_COUNT] = {
+    "publish", "encode", "broker_received", "broker_parsed", "broker_persist_queued",
+    "broker_routed", "received", "decoded", "delivered"
+};
+
 #ifdef _WIN32
 #include <BaseTsd.h>
 typedef SSIZE_T ssize_t;
 #endif
 
+/**
+ * Per-socket send lock so frames from different threads never interleave
+ */
+inline std::mutex& socketSendMutex(int sock_fd) {
+    std::lock_guard<std::mutex> lock(socketSendMutexMapLock);
+    return socketSendMutexes[sock_fd];
+}
+
 /**
  * Helper function to send a length-prefixed message
  */
 inline MmwResult sendMessage(int sock_fd, const std::string& data) {
-    std::mutex* mtx;
-    {
-        std::lock_guard<std::mutex> lock(socketSendMutexMapLock);
-        mtx = &socketSendMutexes[sock_fd];
-    }
-
-    std::lock_guard<std::mutex> lock(*mtx);
+    std::lock_guard<std::mutex> lock(socketSendMutex(sock_fd));
 
+    // Length prefix and body go out in a single syscall
     uint32_t len = htonl(data.size());
+    SocketBuffer bufs[] = {
+        { &len, sizeof(len) },
+        { data.data(), data.size() }
+    };
+    int total = (int)(sizeof(len) + data.size());
 
-    if (SocketAbstraction::Send(sock_fd, &len, sizeof(len), 0) != sizeof(len)) {
+    if (SocketAbstraction::SendV(sock_fd, bufs, 2) != total) {
         return MMW_ERROR;
     }
 
-    if (SocketAbstraction::Send(sock_fd, data.data(), data.size(), 0) != (ssize_t)data.size()) {
+    return MMW_OK;
+}
+
+/**
+ * Helper function to send a raw message without copying its payload
+ */
+inline MmwResult sendRawMessage(int sock_fd, const MmwMessage& msg) {
+    // Header and trailer live on the stack, the payload goes out straight from the caller's buffer
+    MmwRawFrame frame;
+    if (!g_serializer->frame_raw(msg, frame)) {
+        return sendMessage(sock_fd, g_serializer->serialize_raw(msg));
+    }
+
+    size_t bodyLen = frame.headerLen + msg.size + frame.trailerLen;
+    uint32_t len = htonl(bodyLen);
+    SocketBuffer bufs[] = {
+        { &len, sizeof(len) },
+        { frame.header, frame.headerLen },
+        { msg.payload_raw, msg.size },
+        { frame.trailer, frame.trailerLen }
+    };
+
+    std::lock_guard<std::mutex> lock(socketSendMutex(sock_fd));
+    if (SocketAbstraction::SendV(sock_fd, bufs, 4) != (int)(sizeof(len) + bodyLen)) {
         return MMW_ERROR;
     }
 
@@ -57,174 +249,256 @@ inline MmwResult sendMessage(int sock_fd, const std::string& data) {
 }
 
 /**
- * Sets the log level for the library
+ * Helper function to send a loaned buffer, the frame is assembled around the payload in place
  */
-void mmw_set_log_level(MmwLogLevel level) {
-    switch (level) {
-        case MMW_LOG_LEVEL_ERROR:
-            spdlog::set_level(spdlog::level::err);
-            break;
-        case MMW_LOG_LEVEL_WARN:
-            spdlog::set_level(spdlog::level::warn);
-            break;
-        case MMW_LOG_LEVEL_INFO:
-            spdlog::set_level(spdlog::level::info);
-            break;
-        case MMW_LOG_LEVEL_DEBUG:
-            spdlog::set_level(spdlog::level::debug);
-            break;
-        case MMW_LOG_LEVEL_TRACE:
-            spdlog::set_level(spdlog::level::trace);
-            break;
-        default:
-            spdlog::set_level(spdlog::level::off);
-            break;
+inline MmwResult sendLoanedMessage(int sock_fd, const MmwMessage& msg, MmwLoan& loan) {
+    MmwRawFrame frame;
+    if (!g_serializer->frame_raw(msg, frame)) {
+        return sendRawMessage(sock_fd, msg);
+    }
+
+    char* payload = loan.buffer.data() + LOAN_PAYLOAD_OFFSET;
+    char* start = payload - frame.headerLen - sizeof(uint32_t);
+    size_t bodyLen = frame.headerLen + msg.size + frame.trailerLen;
+
+    uint32_t len = htonl(bodyLen);
+    memcpy(start, &len, sizeof(len));
+    memcpy(payload - frame.headerLen, frame.header, frame.headerLen);
+    memcpy(payload + msg.size, frame.trailer, frame.trailerLen);
+
+    SocketBuffer buf = { start, sizeof(len) + bodyLen };
+    std::lock_guard<std::mutex> lock(socketSendMutex(sock_fd));
+    if (SocketAbstraction::SendV(sock_fd, &buf, 1) != (int)(sizeof(len) + bodyLen)) {
+        return MMW_ERROR;
     }
+
+    return MMW_OK;
 }
 
 /**
- * Initialize library settings
+ * Compress a payload into out, returns 0 when it is too small or does not shrink
  */
-MmwResult mmw_initialize(const char* brokerIp, unsigned short port) {
+static size_t compressPayload(IMmwCodec* codec, const char* data, size_t len, PooledBuffer& out) {
+    if (len < MIN_COMPRESS_SIZE || len > 0xFFFFFFFFu) {
+        return 0;
+    }
 
-    if (!brokerIp || port == 0) {
-        return MMW_ERROR;
+    out = bufferPool.acquire(COMPRESSED_PREFIX_SIZE + codec->maxCompressedSize(len));
+    size_t n = codec->compress(data, len, out.data() + COMPRESSED_PREFIX_SIZE, out.capacity() - COMPRESSED_PREFIX_SIZE);
+    if (n == 0 || COMPRESSED_PREFIX_SIZE + n >= len) {
+        return 0;
     }
 
-    hostname = brokerIp;
-    brokerPort = port;
+    for (size_t i = 0; i < COMPRESSED_PREFIX_SIZE; ++i) {
+        out.data()[i] = static_cast<char>((len >> (8 * i)) & 0xFF);
+    }
+    return COMPRESSED_PREFIX_SIZE + n;
+}
 
-    g_serializer = CreateSerializer();
-    if (!g_serializer) {
-        spdlog::error("Failed to create serializer");
-        return MMW_ERROR;
+/**
+ * Decompress a received payload into out and point the view at it
+ */
+static void decompressPayload(MmwMessageView& msg, PooledBuffer& out) {
+    IMmwCodec* codec = GetCodec(msg.codec);
+    if (!codec) {
+        throw std::runtime_error("Unknown payload codec " + std::to_string(msg.codec));
+    }
+    if (msg.size < COMPRESSED_PREFIX_SIZE) {
+        throw std::runtime_error("Truncated compressed payload");
     }
 
-    SocketAbstraction::SocketStartup();
-    return MMW_OK;
+    size_t originalLen = 0;
+    for (size_t i = 0; i < COMPRESSED_PREFIX_SIZE; ++i) {
+        originalLen |= static_cast<size_t>(static_cast<unsigned char>(msg.payload[i])) << (8 * i);
+    }
+    if (originalLen > MAX_DECOMPRESSED_SIZE) {
+        throw std::runtime_error("Compressed payload too large: " + std::to_string(originalLen) + " bytes");
+    }
+
+    out = bufferPool.acquire(originalLen);
+    if (!codec->decompress(msg.payload + COMPRESSED_PREFIX_SIZE, msg.size - COMPRESSED_PREFIX_SIZE, out.data(), originalLen)) {
+        throw std::runtime_error(std::string("Corrupt ") + codec->name() + " payload");
+    }
+
+    msg.payload = out.data();
+    msg.size = originalLen;
+    msg.codec = MMW_CODEC_NONE;
 }
 
 /**
- * Create a publisher
+ * Helper function to receive a length-prefixed message into a reusable buffer
  */
-MmwResult mmw_create_publisher(const char* topic) {
-    SocketAbstraction::SocketStartup();
+inline bool recvMessage(int sock_fd, PooledBuffer& buf, uint32_t& msgLen) {
+    uint32_t netLen;
+    int n = SocketAbstraction::Recv(sock_fd, &netLen, sizeof(netLen), MSG_WAITALL);
+    if (n <= 0) {
+        return false; // Connection closed or error
+    }
 
-    int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock_fd == -1) {
-        perror("socket");
-        return MMW_ERROR;
+    msgLen = ntohl(netLen);
+    if (msgLen > 1024 * 1024) { // 1MB sanity limit
+        MMW_LOG_LIMITED(MMW_LOG_SUBSCRIBE, spdlog::level::err, 1000, "Received message too large: {} bytes", msgLen);
+        return false;
     }
 
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(brokerPort);
-    SocketAbstraction::InetPtonAbstraction(AF_INET, hostname.c_str(), &server_addr.sin_addr);
+    if (msgLen == 0) {
+        return true;
+    }
 
-    if (connect(sock_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        perror("connect");
-        SocketAbstraction::SocketClose(sock_fd);
-        return MMW_ERROR;
+    if (buf.capacity() < msgLen) {
+        buf = bufferPool.acquire(msgLen);
     }
 
-    // Registration message
-    MmwMessage msg{0, "register", topic, "publisher"};
+    n = SocketAbstraction::Recv(sock_fd, buf.data(), msgLen, MSG_WAITALL);
+    return n > 0;
+}
+
+/**
+ * Sets the log level for the library
+ */
+void mmw_set_log_level(MmwLogLevel level) {
+    MmwLog::setLevel(level);
+}
+
+void mmw_set_subsystem_log_level(MmwLogSubsystem subsystem, MmwLogLevel level) {
+    if (subsystem < 0 || subsystem >= MMW_LOG_SUBSYSTEM_COUNT) {
+        MMW_LOG_ERROR(MMW_LOG_GENERAL, "Unknown log subsystem {}", (int)subsystem);
+        return;
+    }
+    MmwLog::setSubsystemLevel(subsystem, level);
+}
+
+MmwResult mmw_set_log_async(size_t queueSize) {
     try {
-        if (sendMessage(sock_fd, g_serializer->serialize(msg)) == MMW_ERROR) {
-            spdlog::error("Failed to send registration for publisher: {}", topic);
-            SocketAbstraction::SocketClose(sock_fd);
-            return MMW_ERROR;
-        }
-    } catch (const std::exception& e) {
-        spdlog::error("Publisher serialization failed for {}: {}", topic, e.what());
-        SocketAbstraction::SocketClose(sock_fd);
+        MmwLog::setAsync(queueSize);
+    } catch (const spdlog::spdlog_ex& e) {
+        MMW_LOG_ERROR(MMW_LOG_GENERAL, "Failed to switch logging mode: {}", e.what());
         return MMW_ERROR;
     }
+    return MMW_OK;
+}
 
-    {
-        std::lock_guard<std::mutex> lock(socketListMutex);
-        publisherTopicToSocketFdMap[topic] = sock_fd;
+/**
+ * Choose the wire format, the broker picks it up from the registration frame
+ */
+MmwResult mmw_set_serializer(MmwSerializerFormat format) {
+    IMmwMessageSerializer* serializer = CreateSerializer(format);
+    if (!serializer) {
+        MMW_LOG_ERROR(MMW_LOG_GENERAL, "Unknown serializer format {}", (int)format);
+        return MMW_ERROR;
     }
 
-    spdlog::info("Publisher connected to broker at {}:{}", hostname, brokerPort);
+    std::lock_guard<std::mutex> lock(socketListMutex);
+    if (!publisherHandles.empty() || !subscriberTopicMap.empty()) {
+        MMW_LOG_ERROR(MMW_LOG_GENERAL, "Serializer must be chosen before creating publishers or subscribers");
+        delete serializer;
+        return MMW_ERROR;
+    }
+
+    delete g_serializer;
+    g_serializer = serializer;
+    g_serializerFormat = format;
+    MMW_LOG_INFO(MMW_LOG_GENERAL, "Using {} serializer", g_serializer->name());
     return MMW_OK;
 }
 
-typedef std::function<void(const MmwMessage&)> SubscriberCallback;
-void subscriberThreadFunc(int sock_fd, std::atomic<bool>* runningFlag, SubscriberCallback callback) {
-    while (*runningFlag) {
-        uint32_t netLen;
-        int n = SocketAbstraction::Recv(sock_fd, &netLen, sizeof(netLen), MSG_WAITALL);
-        if (n <= 0) {
-            break; // Connection closed or error
-        }
-
-        uint32_t msgLen = ntohl(netLen);
-        if (msgLen > 1024 * 1024) { // 1MB sanity limit
-            spdlog::error("Received message too large: {} bytes", msgLen);
-            break;
-        }
-        if (msgLen == 0) {
-            continue;
-        }
+/**
+ * Initialize library settings
+ */
+MmwResult mmw_initialize(const char* brokerIp, unsigned short port) {
 
-        std::vector<char> buf(msgLen);
-        n = SocketAbstraction::Recv(sock_fd, buf.data(), msgLen, MSG_WAITALL);
-        if (n <= 0) {
-            break;
-        }
+    if (!brokerIp || port == 0) {
+        return MMW_ERROR;
+    }
 
-        try {
-            MmwMessage msg = callback == nullptr
-                ? g_serializer->deserialize(std::string(buf.data(), msgLen))
-                : g_serializer->deserialize_raw(std::string(buf.data(), msgLen));
+    hostname = brokerIp;
+    brokerPort = port;
 
-            if (msg.type == "publish") {
-                
-                if (msg.reliability) {
-                    MmwMessage ackMsg;
-                    ackMsg.messageId = msg.messageId;
-                    ackMsg.type = "ack";
-                    ackMsg.topic = msg.topic;
-                    if(sendMessage(sock_fd, g_serializer->serialize(ackMsg)) == MMW_ERROR) {
-                        spdlog::error("Failed to send ACK for {}", ackMsg.messageId);
-                    } else {
-                        spdlog::info("ACK sent for {}", ackMsg.messageId);
-                    }
-                }
-                callback(msg);
-            }
-        } catch (const std::exception& e) {
-            spdlog::error("Subscriber failed to deserialize: {}", e.what());
-        }
+    if (!g_serializer) {
+        g_serializer = CreateSerializer(g_serializerFormat);
+    }
+    if (!g_serializer) {
+        MMW_LOG_ERROR(MMW_LOG_GENERAL, "Failed to create serializer");
+        return MMW_ERROR;
     }
 
-    SocketAbstraction::SocketClose(sock_fd);
-    spdlog::info("Subscriber listener thread exiting");
+    SocketAbstraction::SocketStartup();
+    return MMW_OK;
 }
 
-// Heartbeat thread
-void heartbeatThreadFunc(int sock_fd, std::atomic<bool>* runningFlag, int intervalMs) {
-    auto lastHeartbeatTime = std::chrono::steady_clock::now();
-    while (*runningFlag) {
-        auto now = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastHeartbeatTime);
-        if (elapsed.count() >= intervalMs) {
-            MmwMessage hbMsg;
-            hbMsg.type = "heartbeat";
-            if(sendMessage(sock_fd, g_serializer->serialize(hbMsg)) == MMW_ERROR) {
-                spdlog::error("Failed to send hearbeat");
+// Type fingerprints travel as fixed-width hex in the registration options
+static std::string typeFingerprintToString(uint64_t typeFingerprint) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)typeFingerprint);
+    return hex;
+}
+
+/**
+ * Wait for the broker's answer to a registration. Returns true only once the
+ * broker has accepted it: a rejection, an unreadable reply or no reply within
+ * the timeout all fail, since a broker that never answers cannot be told from
+ * one that ignored the registration.
+ */
+static bool awaitRegistered(int sock_fd, const char* topic, uint32_t& topicId, MmwRegistration& accepted) {
+    bool ok = false;
+    PooledBuffer buf;
+    uint32_t msgLen = 0;
+    topicId = 0;
+
+    SocketAbstraction::SetRecvTimeout(sock_fd, 2000);
+    try {
+        if (recvMessage(sock_fd, buf, msgLen) && msgLen > 0) {
+            MmwMessageView reply;
+            MmwMessage backing{};
+            g_serializer->deserialize_view(buf.data(), msgLen, false, reply, backing);
+            if (reply.isType("registered")) {
+                topicId = reply.topicId;
+                accepted = MmwRegistration::parse(std::string(reply.payload, reply.size));
+                ok = true;
+            } else if (reply.isType("rejected")) {
+                MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Broker rejected registration for {}: {}", topic, std::string(reply.payload, reply.size));
+            } else {
+                MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Unexpected {} reply to the registration for {}", std::string(reply.type, reply.typeLen), topic);
             }
-            lastHeartbeatTime = now;
+        } else {
+            MMW_LOG_ERROR(MMW_LOG_CONNECTION, "No registration reply from broker for {}", topic);
         }
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    } catch (const std::exception& e) {
+        MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Failed to read registration reply for {}: {}", topic, e.what());
     }
+    SocketAbstraction::SetRecvTimeout(sock_fd, 0);
+
+    if (ok && topicId == 0 && topic[0] != '\0') {
+        MMW_LOG_WARN(MMW_LOG_CONNECTION, "No topic id from broker for {}", topic);
+    }
+    return ok;
 }
 
-MmwResult createSubscriberInternal(const char* topic, std::function<void(const MmwMessage&)> callback) {
+/**
+ * Connect a publisher socket and register it with the broker
+ */
+static MmwPublisher* createPublisherInternal(const char* topic, MmwRegistration reg) {
     SocketAbstraction::SocketStartup();
 
+    // Ask for the topic's codec, the broker answers with the one it accepts
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        auto it = topicCodecs.find(topic);
+        IMmwCodec* codec = it == topicCodecs.end() ? nullptr : GetCodec((uint8_t)it->second);
+        if (codec) {
+            reg.options["codec"] = codec->name();
+        }
+        auto partitions = topicPartitions.find(topic);
+        if (partitions != topicPartitions.end()) {
+            reg.options["partitions"] = std::to_string(partitions->second);
+        }
+    }
+
     int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock_fd == -1) { perror("socket"); return MMW_ERROR; }
+    if (sock_fd == -1) {
+        perror("socket");
+        return nullptr;
+    }
 
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(brokerPort);
@@ -233,209 +507,1711 @@ MmwResult createSubscriberInternal(const char* topic, std::function<void(const M
     if (connect(sock_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         perror("connect");
         SocketAbstraction::SocketClose(sock_fd);
-        return MMW_ERROR;
+        return nullptr;
     }
 
-    MmwMessage msg{0, "register", topic, "subscriber"};
+    // Registration message
+    MmwMessage msg{0, "register", topic, reg.encode()};
     try {
         if (sendMessage(sock_fd, g_serializer->serialize(msg)) == MMW_ERROR) {
-            spdlog::error("Failed to send registration for subscriber: {}", topic);
+            MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Failed to send registration for publisher: {}", topic);
             SocketAbstraction::SocketClose(sock_fd);
-            return MMW_ERROR;
+            return nullptr;
         }
     } catch (const std::exception& e) {
-        spdlog::error("Subscriber serialization failed for {}: {}", topic, e.what());
+        MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Publisher serialization failed for {}: {}", topic, e.what());
         SocketAbstraction::SocketClose(sock_fd);
-        return MMW_ERROR;
+        return nullptr;
     }
 
-    auto runningFlag = new std::atomic<bool>(true);
+    SocketAbstraction::SetNoDelay(sock_fd);
 
-    {
-        std::lock_guard<std::mutex> lock(socketListMutex);
-        subscriberTopicToSocketFdMap[topic] = sock_fd;
+    MmwPublisher* publisher = new MmwPublisher();
+    publisher->topic = topic;
+    publisher->sock_fd = sock_fd;
+    publisher->topicId = 0;
+    publisher->confirms = nullptr;
+    publisher->codec = nullptr;
+
+    MmwRegistration accepted;
+    if (!awaitRegistered(sock_fd, topic, publisher->topicId, accepted)) {
+        SocketAbstraction::SocketClose(sock_fd);
+        delete publisher;
+        return nullptr;
     }
+    IMmwCodec* codec = GetCodec(accepted.option("codec", "none"));
+    publisher->codec = codec && codec->id() != MMW_CODEC_NONE ? codec : nullptr;
 
-    std::thread t(subscriberThreadFunc, sock_fd, runningFlag, callback);
-    subscriberThreads.push_back(std::move(t));
+    MMW_LOG_INFO(MMW_LOG_CONNECTION, "Publisher connected to broker at {}:{} (topic id {}, codec {})", hostname, brokerPort,
+                 publisher->topicId, publisher->codec ? publisher->codec->name() : "none");
+    return publisher;
+}
 
-    std::thread hbThread(heartbeatThreadFunc, sock_fd, runningFlag, 1000);
-    subscriberThreads.push_back(std::move(hbThread));
+/**
+ * Choose the payload codec for publishers created on a topic from now on
+ */
+MmwResult mmw_set_topic_codec(const char* topic, MmwCodec codec) {
+    if (!topic || !GetCodec((uint8_t)codec)) {
+        return MMW_ERROR;
+    }
 
-    subscriberRunFlags.push_back(runningFlag);
+    std::lock_guard<std::mutex> lock(socketListMutex);
+    topicCodecs[topic] = codec;
     return MMW_OK;
 }
 
 /**
- * Create subscriber
+ * Declare the partition count of a topic for publishers and subscribers created on it from now on
  */
-MmwResult mmw_create_subscriber(const char* topic, void (*cb)(const char*, const char*)) {
-    return createSubscriberInternal(topic, [cb, topic](const MmwMessage& msg) {
-        cb(topic, msg.payload.c_str());
-    });
+MmwResult mmw_set_topic_partitions(const char* topic, uint32_t partitions) {
+    if (!topic) {
+        return MMW_ERROR;
+    }
+
+    std::lock_guard<std::mutex> lock(socketListMutex);
+    if (partitions == 0) {
+        topicPartitions.erase(topic);
+    } else {
+        topicPartitions[topic] = partitions;
+    }
+    return MMW_OK;
 }
 
 /**
- * Create subscriber for raw payload
+ * Create a publisher
  */
-MmwResult mmw_create_subscriber_raw(const char* topic, void (*cb)(const char*, void*)) {
-    return createSubscriberInternal(topic, [cb, topic](const MmwMessage& msg) {
-        cb(topic, msg.payload_raw);
-    });
-}
+MmwResult mmw_create_publisher(const char* topic) {
+    MmwRegistration reg;
+    reg.role = "publisher";
 
-MmwResult mmw_publish(const char* topic, const char* payload, MmwReliability reliability) {
-    auto it = publisherTopicToSocketFdMap.find(topic);
-    if (it == publisherTopicToSocketFdMap.end()) {
+    MmwPublisher* publisher = createPublisherInternal(topic, reg);
+    if (!publisher) {
         return MMW_ERROR;
     }
 
-    int sock_fd = it->second;
-    MmwMessage msg{0, "publish", topic, payload};
-    msg.reliability = reliability;
-
-    try {
-        if (sendMessage(sock_fd, g_serializer->serialize(msg)) == MMW_ERROR) {
-            spdlog::error("Failed to send message on topic {}", topic);
-            return MMW_ERROR;
-        }
-    } catch (const std::exception& e) {
-        spdlog::error("Publish serialization failed on topic {}: {}", topic, e.what());
-        return MMW_ERROR;
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        publisherTopicMap[topic] = publisher;
     }
-
     return MMW_OK;
 }
 
-MmwResult mmw_publish_raw(const char* topic, void* payload, size_t size, MmwReliability reliability) {
-    auto it = publisherTopicToSocketFdMap.find(topic);
-    if (it == publisherTopicToSocketFdMap.end()) {
+/**
+ * Create a publisher and return a handle to it
+ */
+MmwResult mmw_create_publisher_handle(const char* topic, mmw_publisher_t* out) {
+    if (!topic || !out) {
         return MMW_ERROR;
     }
 
-    int sock_fd = it->second;
-    MmwMessage msg{0, "publish", topic, "", payload, size};
-    msg.reliability = reliability;
+    MmwRegistration reg;
+    reg.role = "publisher";
 
-    try {
-        if (sendMessage(sock_fd, g_serializer->serialize_raw(msg)) == MMW_ERROR) {
-            spdlog::error("Failed to send message on topic {}", topic);
-            return MMW_ERROR;
-        }
-    } catch (const std::exception& e) {
-        spdlog::error("Raw publish serialization failed on topic {}: {}", topic, e.what());
+    MmwPublisher* publisher = createPublisherInternal(topic, reg);
+    if (!publisher) {
         return MMW_ERROR;
     }
 
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        publisherHandles.push_back(publisher);
+    }
+    *out = publisher;
     return MMW_OK;
 }
 
 /**
- * Delete publisher
+ * Create a publisher handle whose payloads are checked against a type fingerprint
  */
-MmwResult mmw_delete_publisher(const char* topic) {
-    auto it = publisherTopicToSocketFdMap.find(topic);
-    if (it == publisherTopicToSocketFdMap.end()) {
+MmwResult mmw_create_publisher_typed(const char* topic, uint64_t typeFingerprint, mmw_publisher_t* out) {
+    if (!topic || !out) {
         return MMW_ERROR;
     }
 
-    int sock_fd = it->second;
+    MmwRegistration reg;
+    reg.role = "publisher";
+    if (typeFingerprint != 0) {
+        reg.options["type"] = typeFingerprintToString(typeFingerprint);
+    }
 
-    MmwMessage msg{0, "unregister", topic, ""};
-    if (sendMessage(sock_fd, g_serializer->serialize(msg)) == MMW_ERROR) {
-        spdlog::error("Failed to unregister publisher for topic {}", topic);
+    MmwPublisher* publisher = createPublisherInternal(topic, reg);
+    if (!publisher) {
+        return MMW_ERROR;
     }
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(20));
-    SocketAbstraction::SocketClose(sock_fd);
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        publisherHandles.push_back(publisher);
+    }
+    *out = publisher;
+    return MMW_OK;
+}
 
-    publisherTopicToSocketFdMap.erase(it);
+// Reads confirms from the broker for a confirm-mode publisher, acks are cumulative and a nack covers one message
+void confirmReaderThreadFunc(PublisherConfirms* confirms) {
+    PooledBuffer buf;
+    uint32_t msgLen = 0;
+    MmwMessageView msg;
+    MmwMessage backing{};
+    while (recvMessage(confirms->sock_fd, buf, msgLen)) {
+        if (msgLen == 0) {
+            continue;
+        }
 
-    spdlog::info("Publisher socket closed for topic: {}", topic);
-    return MMW_OK;
+        try {
+            g_serializer->deserialize_view(buf.data(), msgLen, false, msg, backing);
+            std::lock_guard<std::mutex> lock(confirms->mtx);
+            bool nack = msg.isType("nack");
+            if (nack || msg.isType("ack")) {
+                if (nack) {
+                    MMW_LOG_LIMITED(MMW_LOG_RELIABILITY, spdlog::level::err, 1000, "Broker rejected message {}", msg.messageId);
+                    confirms->failed = true;
+                    if (msg.messageId > confirms->confirmedSeq) {
+                        confirms->nacked.insert(msg.messageId);
+                    }
+                } else if (msg.messageId > confirms->confirmedSeq) {
+                    confirms->confirmedSeq = msg.messageId;
+                    confirms->nacked.erase(confirms->nacked.begin(), confirms->nacked.upper_bound(msg.messageId));
+                }
+
+                // Rejected ids right after the cumulative ack need no ack of their own
+                while (!confirms->nacked.empty() && *confirms->nacked.begin() == confirms->confirmedSeq + 1) {
+                    confirms->confirmedSeq++;
+                    confirms->nacked.erase(confirms->nacked.begin());
+                }
+                confirms->cv.notify_all();
+            }
+        } catch (const std::exception& e) {
+            MMW_LOG_LIMITED(MMW_LOG_RELIABILITY, spdlog::level::err, 1000, "Publisher failed to deserialize confirm: {}", e.what());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(confirms->mtx);
+    confirms->closed = true;
+    confirms->cv.notify_all();
 }
 
 /**
- * Delete subscriber
+ * Create a publisher with broker confirms
  */
-MmwResult mmw_delete_subscriber(const char* topic) {
-    auto it = subscriberTopicToSocketFdMap.find(topic);
-    if (it == subscriberTopicToSocketFdMap.end()) {
+MmwResult mmw_create_publisher_confirmed(const char* topic, MmwConfirmMode mode, size_t window) {
+    if (window == 0) {
         return MMW_ERROR;
     }
 
-    int sock_fd = it->second;
+    MmwRegistration reg;
+    reg.role = "publisher";
+    reg.options["confirm"] = mode == MMW_CONFIRM_PERSISTED ? "persisted" : "routed";
 
-    // Ask broker to unregister (best-effort)
-    MmwMessage msg{0, "unregister", topic, ""};
-    if (sendMessage(sock_fd, g_serializer->serialize(msg)) == MMW_ERROR) {
-        spdlog::error("Failed to unregister subscriber for topic {}", topic);
+    MmwPublisher* publisher = createPublisherInternal(topic, reg);
+    if (!publisher) {
+        return MMW_ERROR;
     }
 
-    // Give broker a moment, then force unblock recv()
-    std::this_thread::sleep_for(std::chrono::milliseconds(20));
-    SocketAbstraction::SocketClose(sock_fd);
+    PublisherConfirms* confirms = new PublisherConfirms();
+    confirms->sock_fd = publisher->sock_fd;
+    confirms->window = window;
+    confirms->reader = std::thread(confirmReaderThreadFunc, confirms);
+    publisher->confirms = confirms;
 
-    subscriberTopicToSocketFdMap.erase(it);
-
-    spdlog::info("Subscriber socket closed for topic: {}", topic);
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        publisherTopicMap[topic] = publisher;
+    }
     return MMW_OK;
 }
 
-/**
- * Clean up publishers/subscribers
- */
-MmwResult mmw_cleanup() {
-    // Cleanup publisher sockets
-    for (auto& pair : publisherTopicToSocketFdMap) {
-        int sock_fd = pair.second;
-        if (sock_fd != -1) {
-            MmwMessage msg{0, "unregister", pair.first, ""};
-            if (sendMessage(sock_fd, g_serializer->serialize(msg)) == MMW_ERROR) {
-                spdlog::error("Failed to unregister publisher for topic {}", pair.first);
-            }
-            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+static MmwPublisher* findPublisher(const char* topic) {
+    std::lock_guard<std::mutex> lock(socketListMutex);
+    auto it = publisherTopicMap.find(topic);
+    return it == publisherTopicMap.end() ? nullptr : it->second;
+}
+
+// Messages neither acked nor nacked yet
+static size_t outstandingConfirms(const PublisherConfirms* confirms) {
+    return confirms->nextSeq - 1 - confirms->confirmedSeq - confirms->nacked.size();
+}
+
+// Block until the confirm window has room, then number the message
+static bool acquireConfirmSlot(PublisherConfirms* confirms, MmwMessage& msg) {
+    std::unique_lock<std::mutex> lock(confirms->mtx);
+    confirms->cv.wait(lock, [confirms] {
+        return confirms->closed || outstandingConfirms(confirms) < confirms->window;
+    });
+    if (confirms->closed) {
+        return false;
+    }
+    msg.messageId = confirms->nextSeq++;
+    return true;
+}
+
+MmwResult mmw_wait_for_confirms(const char* topic, int timeoutMs) {
+    MmwPublisher* publisher = findPublisher(topic);
+    if (!publisher || !publisher->confirms) {
+        return MMW_ERROR;
+    }
+    PublisherConfirms* confirms = publisher->confirms;
+
+    std::unique_lock<std::mutex> lock(confirms->mtx);
+    auto settled = [confirms] {
+        return confirms->closed || confirms->failed || outstandingConfirms(confirms) == 0;
+    };
+    if (timeoutMs < 0) {
+        confirms->cv.wait(lock, settled);
+    } else if (!confirms->cv.wait_for(lock, std::chrono::milliseconds(timeoutMs), settled)) {
+        MMW_LOG_WARN(MMW_LOG_RELIABILITY, "Timed out waiting for confirms on topic {}", topic);
+        return MMW_ERROR;
+    }
+
+    // A nack is reported once, then the publisher carries on
+    if (confirms->failed) {
+        confirms->failed = false;
+        return MMW_ERROR;
+    }
+    return outstandingConfirms(confirms) == 0 ? MMW_OK : MMW_ERROR;
+}
+
+/**
+ * Unregister and close a publisher, then release it
+ */
+static void destroyPublisher(MmwPublisher* publisher) {
+    MmwMessage msg{0, "unregister", publisher->topic, ""};
+    if (sendMessage(publisher->sock_fd, g_serializer->serialize(msg)) == MMW_ERROR) {
+        MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Failed to unregister publisher for topic {}", publisher->topic);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    SocketAbstraction::SocketClose(publisher->sock_fd);
+
+    // Closing the socket unblocks the confirm reader
+    if (publisher->confirms) {
+        if (publisher->confirms->reader.joinable()) {
+            publisher->confirms->reader.join();
+        }
+        delete publisher->confirms;
+    }
+
+    MMW_LOG_INFO(MMW_LOG_CONNECTION, "Publisher socket closed for topic: {}", publisher->topic);
+    delete publisher;
+}
+
+/**
+ * Keep a trace that completed in a subscriber of this process, and append it to the trace file if one is open
+ */
+static void recordTrace(const std::string& topic, const MmwMessageView& msg) {
+    MmwTraceRecord record;
+    memset(&record, 0, sizeof(record));
+    record.traceId = msg.trace.id;
+    record.messageId = msg.messageId;
+    memcpy(record.topic, topic.data(), std::min(topic.size(), (size_t)MMW_TRACE_TOPIC_MAX - 1));
+    memcpy(record.stamps, msg.trace.stamps, sizeof(record.stamps));
+
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if (traceRecords.size() >= MAX_TRACE_RECORDS) {
+        traceRecords.pop_front();
+    }
+    traceRecords.push_back(record);
+
+    if (traceFile) {
+        fprintf(traceFile, "%llu,%s,%u", (unsigned long long)record.traceId, record.topic, record.messageId);
+        uint64_t start = record.stamps[MMW_TRACE_PUBLISH];
+        for (size_t i = 0; i < MMW_TRACE_STAGE_COUNT; ++i) {
+            if (record.stamps[i] != 0) {
+                fprintf(traceFile, ",%lld", (long long)(record.stamps[i] - start));
+            } else {
+                fputc(',', traceFile);
+            }
+        }
+        fputc('\n', traceFile);
+        fflush(traceFile);
+    }
+}
+
+// The view, and any payload pointer taken from it, is only valid during the callback
+typedef std::function<void(const MmwMessageView&)> SubscriberCallback;
+void subscriberThreadFunc(std::shared_ptr<MmwSubscriber> subscriber, SubscriberCallback callback, bool raw, size_t alignment, SubscriberCredit credit) {
+    int sock_fd = subscriber->sock_fd;
+    const std::string& topic = subscriber->topic;
+
+    // Consumption since the last credit grant
+    size_t consumedMessages = 0;
+    size_t consumedBytes = 0;
+
+    // Reused for every message on this connection
+    PooledBuffer buf;
+    MmwMessageView msg;
+    MmwMessage backing{};
+
+    while (subscriber->running) {
+        uint32_t msgLen = 0;
+        if (!recvMessage(sock_fd, buf, msgLen)) {
+            break; // Connection closed or error
+        }
+        if (msgLen == 0) {
+            continue;
+        }
+        uint64_t receivedNs = MmwTraceNow();
+
+        // The broker only charges credit for publishes, which is all a subscriber is sent once registered.
+        // Count the frame before decoding so one that fails to decode still hands its credit back.
+        if (credit.messages > 0 || credit.bytes > 0) {
+            consumedMessages++;
+            consumedBytes += msgLen;
+            if ((credit.messages > 0 && consumedMessages * 2 >= credit.messages) ||
+                (credit.bytes > 0 && consumedBytes * 2 >= credit.bytes)) {
+                MmwMessage creditMsg{(uint32_t)consumedMessages, "credit", topic, std::to_string(consumedBytes)};
+                if (sendMessage(sock_fd, g_serializer->serialize(creditMsg)) == MMW_ERROR) {
+                    MMW_LOG_LIMITED(MMW_LOG_SUBSCRIBE, spdlog::level::err, 1000, "Failed to send credit for topic {}", topic);
+                }
+                consumedMessages = 0;
+                consumedBytes = 0;
+            }
+        }
+
+        try {
+            g_serializer->deserialize_view(buf.data(), msgLen, raw, msg, backing);
+
+            if (msg.isType("publish")) {
+
+                // Compressed once by the publisher and forwarded as is by the broker
+                PooledBuffer decompressed;
+                if (msg.codec != MMW_CODEC_NONE) {
+                    decompressPayload(msg, decompressed);
+                }
+
+                if (msg.reliability) {
+                    MmwMessage ackMsg{};
+                    ackMsg.messageId = msg.messageId;
+                    ackMsg.type = "ack";
+                    ackMsg.topic.assign(msg.topic, msg.topicLen);
+                    if(sendMessage(sock_fd, g_serializer->serialize(ackMsg)) == MMW_ERROR) {
+                        MMW_LOG_LIMITED(MMW_LOG_RELIABILITY, spdlog::level::err, 1000, "Failed to send ACK for {}", ackMsg.messageId);
+                    } else {
+                        MMW_LOG_TRACE(MMW_LOG_RELIABILITY, "ACK sent for {}", ackMsg.messageId);
+                    }
+                }
+
+                // Raw payloads are cast to user structs, move them to suitably aligned memory if needed
+                PooledBuffer aligned;
+                if (raw && msg.size > 0 && reinterpret_cast<uintptr_t>(msg.payload) % alignment != 0) {
+                    aligned = bufferPool.acquire(msg.size);
+                    memcpy(aligned.data(), msg.payload, msg.size);
+                    msg.payload = aligned.data();
+                }
+
+                if (msg.trace.id != 0) {
+                    msg.trace.stamps[MMW_TRACE_RECEIVED] = receivedNs;
+                    msg.trace.stamps[MMW_TRACE_DECODED] = MmwTraceNow();
+                }
+
+                callback(msg);
+
+                if (msg.trace.id != 0) {
+                    msg.trace.stamps[MMW_TRACE_DELIVERED] = MmwTraceNow();
+                    recordTrace(topic, msg);
+                }
+            }
+        } catch (const std::exception& e) {
+            MMW_LOG_LIMITED(MMW_LOG_SUBSCRIBE, spdlog::level::err, 1000, "Subscriber failed to deserialize: {}", e.what());
+        }
+
+        // Don't let one large message pin a large buffer on this connection
+        if (buf.capacity() > RESIDENT_BUFFER_SIZE) {
+            buf.reset();
+        }
+    }
+
+    // Otherwise destroySubscriber closes it once this thread has been joined
+    if (subscriber->closeOnExit) {
+        SocketAbstraction::SocketClose(sock_fd);
+    }
+    MMW_LOG_INFO(MMW_LOG_CONNECTION, "Subscriber listener thread exiting");
+}
+
+// Heartbeat thread
+void heartbeatThreadFunc(int sock_fd, std::atomic<bool>* runningFlag, int intervalMs) {
+    auto lastHeartbeatTime = std::chrono::steady_clock::now();
+    while (*runningFlag) {
+        auto now = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastHeartbeatTime);
+        if (elapsed.count() >= intervalMs) {
+            MmwMessage hbMsg{};
+            hbMsg.type = "heartbeat";
+            if(sendMessage(sock_fd, g_serializer->serialize(hbMsg)) == MMW_ERROR) {
+                MMW_LOG_LIMITED(MMW_LOG_HEARTBEAT, spdlog::level::err, 1000, "Failed to send hearbeat");
+            }
+            lastHeartbeatTime = now;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+}
+
+MmwResult createSubscriberInternal(const char* topic, SubscriberCallback callback, bool raw,
+                                   uint64_t typeFingerprint = 0, size_t alignment = alignof(std::max_align_t),
+                                   const char* group = nullptr, MmwGroupBalance balance = MMW_BALANCE_ROUND_ROBIN,
+                                   const uint32_t* partitions = nullptr, size_t partitionCount = 0,
+                                   mmw_subscriber_t* handle = nullptr) {
+    SocketAbstraction::SocketStartup();
+
+    int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock_fd == -1) { perror("socket"); return MMW_ERROR; }
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(brokerPort);
+    SocketAbstraction::InetPtonAbstraction(AF_INET, hostname.c_str(), &server_addr.sin_addr);
+
+    if (connect(sock_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("connect");
+        SocketAbstraction::SocketClose(sock_fd);
+        return MMW_ERROR;
+    }
+
+    // Acks and credit grants are tiny and latency sensitive
+    SocketAbstraction::SetNoDelay(sock_fd);
+
+    MmwRegistration reg;
+    reg.role = "subscriber";
+    SubscriberCredit credit;
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        credit = subscriberCredit;
+        auto declared = topicPartitions.find(topic);
+        if (declared != topicPartitions.end()) {
+            reg.options["partitions"] = std::to_string(declared->second);
+        }
+    }
+    if (credit.messages > 0) {
+        reg.options["credit_msgs"] = std::to_string(credit.messages);
+    }
+    if (credit.bytes > 0) {
+        reg.options["credit_bytes"] = std::to_string(credit.bytes);
+    }
+    if (typeFingerprint != 0) {
+        reg.options["type"] = typeFingerprintToString(typeFingerprint);
+    }
+    if (group && group[0] != '\0') {
+        static const char* const balanceNames[] = { "round_robin", "least_outstanding", "key_hash" };
+        reg.options["group"] = group;
+        reg.options["balance"] = balanceNames[balance <= MMW_BALANCE_KEY_HASH ? balance : MMW_BALANCE_ROUND_ROBIN];
+    } else if (partitions && partitionCount > 0) {
+        std::string list;
+        for (size_t i = 0; i < partitionCount; ++i) {
+            list += (i == 0 ? "" : ",") + std::to_string(partitions[i]);
+        }
+        reg.options["partition_list"] = list;
+    }
+
+    MmwMessage msg{0, "register", topic, reg.encode()};
+    try {
+        if (sendMessage(sock_fd, g_serializer->serialize(msg)) == MMW_ERROR) {
+            MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Failed to send registration for subscriber: {}", topic);
             SocketAbstraction::SocketClose(sock_fd);
-            spdlog::info("Publisher socket closed for topic: {}", pair.first);
+            return MMW_ERROR;
+        }
+    } catch (const std::exception& e) {
+        MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Subscriber serialization failed for {}: {}", topic, e.what());
+        SocketAbstraction::SocketClose(sock_fd);
+        return MMW_ERROR;
+    }
+
+    uint32_t topicId;
+    MmwRegistration accepted;
+    if (!awaitRegistered(sock_fd, topic, topicId, accepted)) {
+        SocketAbstraction::SocketClose(sock_fd);
+        return MMW_ERROR;
+    }
+
+    std::shared_ptr<MmwSubscriber> subscriber = std::make_shared<MmwSubscriber>();
+    subscriber->topic = topic;
+    subscriber->sock_fd = sock_fd;
+    subscriber->running = true;
+    subscriber->closeOnExit = false;
+    subscriber->reader = std::thread(subscriberThreadFunc, subscriber, callback, raw, alignment, credit);
+    subscriber->heartbeat = std::thread(heartbeatThreadFunc, sock_fd, &subscriber->running, 1000);
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        subscriberTopicMap.insert(std::make_pair(std::string(topic), subscriber));
+    }
+    if (handle) {
+        *handle = subscriber.get();
+    }
+    return MMW_OK;
+}
+
+/**
+ * Unregister a subscriber and stop both its threads, then close the socket
+ */
+static void destroySubscriber(MmwSubscriber& subscriber) {
+    MmwMessage msg{0, "unregister", subscriber.topic, ""};
+    if (sendMessage(subscriber.sock_fd, g_serializer->serialize(msg)) == MMW_ERROR) {
+        MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Failed to unregister subscriber for topic {}", subscriber.topic);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    subscriber.running = false;
+    SocketAbstraction::ShutdownRead(subscriber.sock_fd);
+    if (subscriber.heartbeat.joinable()) {
+        subscriber.heartbeat.join();
+    }
+
+    // A callback deleting its own subscriber cannot wait for its thread, which closes the socket on its way out
+    if (subscriber.reader.get_id() == std::this_thread::get_id()) {
+        subscriber.closeOnExit = true;
+        subscriber.reader.detach();
+        return;
+    }
+    if (subscriber.reader.joinable()) {
+        subscriber.reader.join();
+    }
+    SocketAbstraction::SocketClose(subscriber.sock_fd);
+    MMW_LOG_INFO(MMW_LOG_CONNECTION, "Subscriber socket closed for topic: {}", subscriber.topic);
+}
+
+// Calls the application's release function once the last copy of a subscriber callback is gone
+struct SubscriberUserData {
+    void* userData;
+    void (*release)(void*);
+    ~SubscriberUserData() {
+        if (release) {
+            release(userData);
+        }
+    }
+};
+
+/**
+ * Create a subscriber that receives the payload size along with the payload
+ */
+MmwResult mmw_create_subscriber_sized(const char* topic, MmwSizedRawCallback cb, const MmwSubscriberOptions* options) {
+    MmwSubscriberOptions opts = {};
+    if (options) {
+        opts = *options;
+    }
+
+    // Reject bad arguments before anything takes ownership of userData, a zero alignment means the default
+    bool badAlignment = (opts.alignment & (opts.alignment - 1)) != 0;
+    bool badPartitions = opts.partitionCount != 0 && !opts.partitions;
+    if (!topic || !cb || badAlignment || badPartitions) {
+        if (opts.releaseUserData) {
+            opts.releaseUserData(opts.userData);
+        }
+        return MMW_ERROR;
+    }
+
+    std::shared_ptr<SubscriberUserData> userData(new SubscriberUserData{opts.userData, opts.releaseUserData});
+    std::string topicName = topic;
+    size_t expectedSize = opts.size;
+    SubscriberCallback callback = [cb, topicName, expectedSize, userData](const MmwMessageView& msg) {
+        if (expectedSize != 0 && msg.size != expectedSize) {
+            MMW_LOG_LIMITED(MMW_LOG_SUBSCRIBE, spdlog::level::err, 1000, "Dropping message {} on {}: {} bytes, expected {}", msg.messageId, topicName, msg.size, expectedSize);
+            return;
+        }
+        cb(topicName.c_str(), msg.payload, msg.size, userData->userData);
+    };
+
+    size_t alignment = opts.alignment != 0 ? opts.alignment : alignof(std::max_align_t);
+    return createSubscriberInternal(topic, callback, true, opts.typeFingerprint, alignment, opts.group, opts.balance,
+                                    opts.partitions, opts.partitionCount, opts.handle);
+}
+
+/**
+ * Set the flow control window for new subscribers
+ */
+MmwResult mmw_set_subscriber_credit(size_t messages, size_t bytes) {
+    std::lock_guard<std::mutex> lock(socketListMutex);
+    subscriberCredit.messages = messages;
+    subscriberCredit.bytes = bytes;
+    return MMW_OK;
+}
+
+/**
+ * Create subscriber
+ */
+MmwResult mmw_create_subscriber(const char* topic, void (*cb)(const char*, const char*)) {
+    // The payload is not NUL terminated in the frame, copy it into a string that keeps its capacity
+    std::string text;
+    return createSubscriberInternal(topic, [cb, topic, text](const MmwMessageView& msg) mutable {
+        text.assign(msg.payload, msg.size);
+        cb(topic, text.c_str());
+    }, false);
+}
+
+/**
+ * Create a subscriber that competes with the other members of its group
+ */
+MmwResult mmw_create_subscriber_group(const char* topic, const char* group, MmwGroupBalance balance, void (*cb)(const char*, const char*)) {
+    if (!group || group[0] == '\0') {
+        return MMW_ERROR;
+    }
+
+    std::string text;
+    return createSubscriberInternal(topic, [cb, topic, text](const MmwMessageView& msg) mutable {
+        text.assign(msg.payload, msg.size);
+        cb(topic, text.c_str());
+    }, false, 0, alignof(std::max_align_t), group, balance);
+}
+
+/**
+ * Create subscriber for raw payload
+ */
+MmwResult mmw_create_subscriber_raw(const char* topic, void (*cb)(const char*, void*)) {
+    return createSubscriberInternal(topic, [cb, topic](const MmwMessageView& msg) {
+        cb(topic, const_cast<char*>(msg.payload));
+    }, true);
+}
+
+/**
+ * Send a publish on a publisher connection, the topic travels as its interned id when known
+ */
+static MmwResult publishInternal(MmwPublisher* publisher, MmwMessage& msg, bool raw, MmwLoan* loan = nullptr) {
+    // Untraced publishes only pay for the relaxed load
+    uint32_t sampleEvery = traceInterval.load(std::memory_order_relaxed);
+    if (sampleEvery != 0 && tracePublishCount.fetch_add(1, std::memory_order_relaxed) % sampleEvery == 0) {
+        msg.trace.id = nextTraceId.fetch_add(1, std::memory_order_relaxed);
+        msg.trace.stamps[MMW_TRACE_PUBLISH] = MmwTraceNow();
+    }
+
+    msg.topicId = publisher->topicId;
+    if (msg.topicId == 0) {
+        msg.topic = publisher->topic;
+    }
+
+    // Compress once here, the broker forwards the payload untouched
+    PooledBuffer compressed;
+    if (publisher->codec) {
+        const char* data = raw ? static_cast<const char*>(msg.payload_raw) : msg.payload.data();
+        size_t len = raw ? msg.size : msg.payload.size();
+        size_t n = compressPayload(publisher->codec, data, len, compressed);
+        if (n > 0) {
+            msg.payload_raw = compressed.data();
+            msg.size = n;
+            msg.codec = publisher->codec->id();
+            raw = true;
+            loan = nullptr;
+        }
+    }
+    msg.rawPayload = raw;
+
+    PublisherConfirms* confirms = publisher->confirms;
+    std::unique_lock<std::mutex> orderLock;
+    if (confirms) {
+        orderLock = std::unique_lock<std::mutex>(confirms->sendMtx);
+        if (!acquireConfirmSlot(confirms, msg)) {
+            return MMW_ERROR;
+        }
+    }
+
+    if (msg.trace.id != 0) {
+        msg.trace.stamps[MMW_TRACE_ENCODE] = MmwTraceNow();
+    }
+
+    try {
+        MmwResult result = loan
+            ? sendLoanedMessage(publisher->sock_fd, msg, *loan)
+            : raw
+            ? sendRawMessage(publisher->sock_fd, msg)
+            : sendMessage(publisher->sock_fd, g_serializer->serialize(msg));
+        if (result == MMW_ERROR) {
+            MMW_LOG_LIMITED(MMW_LOG_PUBLISH, spdlog::level::err, 1000, "Failed to send message on topic {}", publisher->topic);
+            return MMW_ERROR;
+        }
+    } catch (const std::exception& e) {
+        MMW_LOG_LIMITED(MMW_LOG_PUBLISH, spdlog::level::err, 1000, "Publish serialization failed on topic {}: {}", publisher->topic, e.what());
+        return MMW_ERROR;
+    }
+
+    return MMW_OK;
+}
+
+MmwResult mmw_publish(const char* topic, const char* payload, MmwReliability reliability) {
+    MmwPublisher* publisher = findPublisher(topic);
+    if (!publisher) {
+        return MMW_ERROR;
+    }
+
+    MmwMessage msg{0, "publish", "", payload};
+    msg.reliability = reliability;
+    return publishInternal(publisher, msg, false);
+}
+
+MmwResult mmw_publish_raw(const char* topic, void* payload, size_t size, MmwReliability reliability) {
+    MmwPublisher* publisher = findPublisher(topic);
+    if (!publisher) {
+        return MMW_ERROR;
+    }
+
+    MmwMessage msg{0, "publish", "", "", payload, size};
+    msg.reliability = reliability;
+    return publishInternal(publisher, msg, true);
+}
+
+MmwResult mmw_publish_keyed(const char* topic, const char* key, const void* payload, size_t size, MmwReliability reliability) {
+    if (!key || strlen(key) > MMW_MAX_KEY_SIZE || (!payload && size > 0)) {
+        return MMW_ERROR;
+    }
+    MmwPublisher* publisher = findPublisher(topic);
+    if (!publisher) {
+        return MMW_ERROR;
+    }
+
+    MmwMessage msg{0, "publish", "", "", const_cast<void*>(payload), size};
+    msg.reliability = reliability;
+    msg.key = key;
+    return publishInternal(publisher, msg, true);
+}
+
+MmwResult mmw_publish_handle(mmw_publisher_t publisher, const char* payload, MmwReliability reliability) {
+    if (!publisher || !payload) {
+        return MMW_ERROR;
+    }
+
+    MmwMessage msg{0, "publish", "", payload};
+    msg.reliability = reliability;
+    return publishInternal(publisher, msg, false);
+}
+
+MmwResult mmw_publish_raw_handle(mmw_publisher_t publisher, void* payload, size_t size, MmwReliability reliability) {
+    if (!publisher) {
+        return MMW_ERROR;
+    }
+
+    MmwMessage msg{0, "publish", "", "", payload, size};
+    msg.reliability = reliability;
+    return publishInternal(publisher, msg, true);
+}
+
+/**
+ * Borrow a payload buffer that can be published without copying it
+ */
+void* mmw_loan(const char* topic, size_t size) {
+    if (!topic || !findPublisher(topic)) {
+        return nullptr;
+    }
+
+    MmwLoan loan;
+    loan.buffer = bufferPool.acquire(LOAN_PAYLOAD_OFFSET + size + MmwRawFrame::MAX_TRAILER);
+    loan.topic = topic;
+    loan.size = size;
+
+    void* payload = loan.buffer.data() + LOAN_PAYLOAD_OFFSET;
+    std::lock_guard<std::mutex> lock(loanMutex);
+    loans.insert(std::make_pair(payload, std::move(loan)));
+    return payload;
+}
+
+static bool takeLoan(void* payload, MmwLoan& loan) {
+    std::lock_guard<std::mutex> lock(loanMutex);
+    auto it = loans.find(payload);
+    if (it == loans.end()) {
+        return false;
+    }
+    loan = std::move(it->second);
+    loans.erase(it);
+    return true;
+}
+
+MmwResult mmw_publish_loaned(const char* topic, void* payload, MmwReliability reliability) {
+    if (!topic) {
+        return MMW_ERROR;
+    }
+
+    MmwLoan loan;
+    if (!takeLoan(payload, loan)) {
+        MMW_LOG_ERROR(MMW_LOG_PUBLISH, "Publish of unknown loan on topic {}", topic);
+        return MMW_ERROR;
+    }
+    if (loan.topic != topic) {
+        MMW_LOG_ERROR(MMW_LOG_PUBLISH, "Loan for topic {} published on topic {}", loan.topic, topic);
+        return MMW_ERROR;
+    }
+
+    MmwPublisher* publisher = findPublisher(topic);
+    if (!publisher) {
+        return MMW_ERROR;
+    }
+
+    MmwMessage msg{0, "publish", "", "", payload, loan.size};
+    msg.reliability = reliability;
+    return publishInternal(publisher, msg, true, &loan);
+}
+
+MmwResult mmw_release_loan(void* payload) {
+    MmwLoan loan;
+    return takeLoan(payload, loan) ? MMW_OK : MMW_ERROR;
+}
+
+/**
+ * Sender thread draining the asynchronous publish queue
+ */
+void asyncSenderThreadFunc(MpscQueue<AsyncPublishRequest>* queue) {
+    AsyncPublishRequest req;
+    while (true) {
+        if (!queue->tryPop(req)) {
+            // Once stopAsyncSender has retired the queue nothing more is pushed to it
+            if (asyncQueue.load() != queue) {
+                break;
+            }
+
+            // Announce we are about to sleep, then re-check so a concurrent push is not missed
+            asyncSenderIdle = true;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!queue->tryPop(req)) {
+                std::unique_lock<std::mutex> lock(asyncMutex);
+                asyncFlushCv.notify_all();
+                asyncWakeCv.wait_for(lock, std::chrono::milliseconds(10));
+                asyncSenderIdle = false;
+                continue;
+            }
+            asyncSenderIdle = false;
+        }
+
+        MmwResult result = req.raw
+            ? mmw_publish_raw(req.topic.c_str(), &req.payload[0], req.payload.size(), req.reliability)
+            : mmw_publish(req.topic.c_str(), req.payload.c_str(), req.reliability);
+
+        if (req.callback) {
+            req.callback(req.topic.c_str(), result, req.userData);
+        }
+        asyncCompleted++;
+
+        // Flushes wait for a target count, wake them as it is reached rather than when the queue runs dry
+        if (asyncFlushWaiters.load() != 0) {
+            std::lock_guard<std::mutex> lock(asyncMutex);
+            asyncFlushCv.notify_all();
+        }
+    }
+}
+
+MmwResult mmw_set_async_queue(size_t capacity, MmwQueueFullPolicy policy) {
+    std::lock_guard<std::mutex> lock(asyncStartMutex);
+    if (asyncQueue.load() || capacity == 0) {
+        return MMW_ERROR;
+    }
+    asyncQueueCapacity = capacity;
+    asyncQueueFullPolicy = policy;
+    return MMW_OK;
+}
+
+/**
+ * Create the queue and its sender on first use, or again after mmw_cleanup(),
+ * false while a shutdown is still draining
+ */
+static bool startAsyncSender() {
+    std::lock_guard<std::mutex> lock(asyncStartMutex);
+    if (asyncStopping) {
+        return false;
+    }
+    if (!asyncQueue.load()) {
+        MpscQueue<AsyncPublishRequest>* queue = new MpscQueue<AsyncPublishRequest>(asyncQueueCapacity);
+        asyncQueue.store(queue, std::memory_order_release);
+        asyncSenderThread = std::thread(asyncSenderThreadFunc, queue);
+        asyncAccepting = true;
+    }
+    return true;
+}
+
+static MmwResult enqueueAsyncPublish(AsyncPublishRequest& req) {
+    // Registering as a producer before checking the flag lets stopAsyncSender wait for
+    // every push that saw it set, the queue is only freed once none are left
+    asyncProducers.fetch_add(1);
+    while (!asyncAccepting.load()) {
+        asyncProducers.fetch_sub(1);
+        if (!startAsyncSender()) {
+            return MMW_ERROR;
+        }
+        asyncProducers.fetch_add(1);
+    }
+
+    MpscQueue<AsyncPublishRequest>* queue = asyncQueue.load(std::memory_order_acquire);
+    while (!queue->tryPush(req)) {
+        if (asyncQueueFullPolicy == MMW_QUEUE_FULL_REJECT) {
+            asyncProducers.fetch_sub(1);
+            MMW_LOG_LIMITED(MMW_LOG_PUBLISH, spdlog::level::warn, 1000, "Async publish queue full, rejecting message on topic {}", req.topic);
+            return MMW_ERROR;
+        }
+        std::this_thread::yield();
+    }
+    asyncEnqueued++;
+    asyncProducers.fetch_sub(1);
+
+    // Only pay for the wakeup when the sender is actually parked
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (asyncSenderIdle) {
+        std::lock_guard<std::mutex> lock(asyncMutex);
+        asyncWakeCv.notify_one();
+    }
+    return MMW_OK;
+}
+
+MmwResult mmw_publish_async(const char* topic, const char* payload, MmwReliability reliability,
+                            MmwPublishCallback callback, void* userData) {
+    if (!topic || !payload) {
+        return MMW_ERROR;
+    }
+
+    AsyncPublishRequest req;
+    req.topic = topic;
+    req.payload = payload;
+    req.reliability = reliability;
+    req.callback = callback;
+    req.userData = userData;
+    return enqueueAsyncPublish(req);
+}
+
+MmwResult mmw_publish_raw_async(const char* topic, const void* payload, size_t size, MmwReliability reliability,
+                                MmwPublishCallback callback, void* userData) {
+    if (!topic || (!payload && size > 0)) {
+        return MMW_ERROR;
+    }
+
+    AsyncPublishRequest req;
+    req.topic = topic;
+    req.payload.assign(static_cast<const char*>(payload), size);
+    req.raw = true;
+    req.reliability = reliability;
+    req.callback = callback;
+    req.userData = userData;
+    return enqueueAsyncPublish(req);
+}
+
+MmwResult mmw_flush(int timeoutMs) {
+    uint64_t target = asyncEnqueued;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs < 0 ? 0 : timeoutMs);
+
+    asyncFlushWaiters.fetch_add(1);
+    MmwResult result = MMW_OK;
+    {
+        std::unique_lock<std::mutex> lock(asyncMutex);
+        while (asyncCompleted < target) {
+            asyncWakeCv.notify_one();
+            if (timeoutMs < 0) {
+                asyncFlushCv.wait_for(lock, std::chrono::milliseconds(10));
+            } else if (asyncFlushCv.wait_until(lock, deadline) == std::cv_status::timeout && asyncCompleted < target) {
+                MMW_LOG_WARN(MMW_LOG_PUBLISH, "Timed out flushing async publish queue ({} pending)", target - asyncCompleted);
+                result = MMW_ERROR;
+                break;
+            }
+        }
+    }
+    asyncFlushWaiters.fetch_sub(1);
+    return result;
+}
+
+/**
+ * Stop the sender thread once the queue has drained
+ */
+static void stopAsyncSender() {
+    MpscQueue<AsyncPublishRequest>* queue;
+    std::thread sender;
+    {
+        std::lock_guard<std::mutex> startLock(asyncStartMutex);
+        if (!asyncQueue.load()) {
+            return;
+        }
+
+        // Turn new producers away and let the ones already pushing finish, the sender keeps draining meanwhile
+        asyncAccepting = false;
+        while (asyncProducers.load() != 0) {
+            std::this_thread::yield();
+        }
+        queue = asyncQueue.exchange(nullptr);
+        sender = std::move(asyncSenderThread);
+        asyncStopping = true;
+    }
+
+    // Joined without the start lock, a publish from a completion callback is rejected rather than deadlocking
+    {
+        std::lock_guard<std::mutex> lock(asyncMutex);
+        asyncWakeCv.notify_one();
+    }
+    if (sender.joinable()) {
+        sender.join();
+    }
+    delete queue;
+
+    std::lock_guard<std::mutex> startLock(asyncStartMutex);
+    asyncStopping = false;
+}
+
+/**
+ * Connect to the broker and register, -1 on failure
+ */
+static int connectAndRegister(const char* topic, const MmwRegistration& reg) {
+    SocketAbstraction::SocketStartup();
+
+    int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock_fd == -1) { perror("socket"); return -1; }
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(brokerPort);
+    SocketAbstraction::InetPtonAbstraction(AF_INET, hostname.c_str(), &server_addr.sin_addr);
+
+    if (connect(sock_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("connect");
+        SocketAbstraction::SocketClose(sock_fd);
+        return -1;
+    }
+
+    // Requests and replies are latency bound
+    SocketAbstraction::SetNoDelay(sock_fd);
+
+    MmwMessage msg{0, "register", topic, reg.encode()};
+    try {
+        if (sendMessage(sock_fd, g_serializer->serialize(msg)) == MMW_ERROR) {
+            MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Failed to send {} registration for {}", reg.role, topic);
+            SocketAbstraction::SocketClose(sock_fd);
+            return -1;
+        }
+    } catch (const std::exception& e) {
+        MMW_LOG_ERROR(MMW_LOG_CONNECTION, "{} serialization failed for {}: {}", reg.role, topic, e.what());
+        SocketAbstraction::SocketClose(sock_fd);
+        return -1;
+    }
+
+    uint32_t topicId;
+    MmwRegistration accepted;
+    if (!awaitRegistered(sock_fd, topic, topicId, accepted)) {
+        SocketAbstraction::SocketClose(sock_fd);
+        return -1;
+    }
+    return sock_fd;
+}
+
+/**
+ * Remove a request waiting for its reply, the caller holds requestMutex.
+ * Returns false if it was already completed.
+ */
+static bool takePendingReply(uint32_t correlationId, PendingReply& out) {
+    auto it = pendingReplies.find(correlationId);
+    if (it == pendingReplies.end()) {
+        return false;
+    }
+
+    auto range = replyDeadlines.equal_range(it->second.deadline);
+    for (auto d = range.first; d != range.second; ++d) {
+        if (d->second == correlationId) {
+            replyDeadlines.erase(d);
+            break;
+        }
+    }
+    out = std::move(it->second);
+    pendingReplies.erase(it);
+    return true;
+}
+
+static void failPendingReplies(std::map<uint32_t, PendingReply>& failed, const char* reason) {
+    for (auto& pair : failed) {
+        pair.second.handler(MMW_ERROR, reason, strlen(reason));
+    }
+}
+
+// Hands replies to their requests until the requester connection closes
+void requesterThreadFunc(int sock_fd) {
+    PooledBuffer buf;
+    MmwMessageView msg;
+    MmwMessage backing{};
+    uint32_t msgLen = 0;
+
+    while (recvMessage(sock_fd, buf, msgLen)) {
+        if (msgLen == 0) {
+            continue;
+        }
+
+        try {
+            g_serializer->deserialize_view(buf.data(), msgLen, false, msg, backing);
+            bool failed = msg.isType("reply_error");
+            if (failed || msg.isType("reply")) {
+                PendingReply pending;
+                bool found;
+                {
+                    std::lock_guard<std::mutex> lock(requestMutex);
+                    found = takePendingReply(msg.messageId, pending);
+                }
+                if (!found) {
+                    MMW_LOG_DEBUG(MMW_LOG_CONNECTION, "Dropping reply {}, the request already timed out", msg.messageId);
+                } else {
+                    pending.handler(failed ? MMW_ERROR : MMW_OK, msg.payload, msg.size);
+                }
+            }
+        } catch (const std::exception& e) {
+            MMW_LOG_LIMITED(MMW_LOG_CONNECTION, spdlog::level::err, 1000, "Requester failed to deserialize reply: {}", e.what());
+        }
+
+        // Don't let one large reply pin a large buffer on this connection
+        if (buf.capacity() > RESIDENT_BUFFER_SIZE) {
+            buf.reset();
+        }
+    }
+
+    // Unless mmw_cleanup() took the connection, everything still waiting on it fails
+    std::map<uint32_t, PendingReply> orphaned;
+    {
+        std::lock_guard<std::mutex> lock(requestMutex);
+        if (requestSocket != sock_fd) {
+            return;
+        }
+        requestSocket = -1;
+        orphaned.swap(pendingReplies);
+        replyDeadlines.clear();
+    }
+    SocketAbstraction::SocketClose(sock_fd);
+    MMW_LOG_WARN(MMW_LOG_CONNECTION, "Requester connection closed, failing {} outstanding requests", orphaned.size());
+    failPendingReplies(orphaned, "disconnected");
+}
+
+// Fails requests whose timeout has passed, sleeping until the earliest deadline
+void requestTimerThreadFunc() {
+    std::unique_lock<std::mutex> lock(requestMutex);
+    while (requestTimerRunning) {
+        auto now = std::chrono::steady_clock::now();
+        std::map<uint32_t, PendingReply> expired;
+        while (!replyDeadlines.empty() && replyDeadlines.begin()->first <= now) {
+            uint32_t correlationId = replyDeadlines.begin()->second;
+            takePendingReply(correlationId, expired[correlationId]);
         }
+
+        if (!expired.empty()) {
+            lock.unlock();
+            failPendingReplies(expired, "timeout");
+            lock.lock();
+        } else if (replyDeadlines.empty()) {
+            requestTimerCv.wait(lock);
+        } else {
+            requestTimerCv.wait_until(lock, replyDeadlines.begin()->first);
+        }
+    }
+}
+
+/**
+ * Connect the requester on first use, or again after the broker dropped it. The caller holds requestMutex.
+ */
+static bool ensureRequesterLocked() {
+    if (requestSocket != -1) {
+        return true;
+    }
+
+    // Replies are routed back to this connection, so it registers no topic
+    MmwRegistration reg;
+    reg.role = "requester";
+    int sock_fd = connectAndRegister("", reg);
+    if (sock_fd == -1) {
+        return false;
+    }
+
+    requestSocket = sock_fd;
+    requestReaderThreads.push_back(std::thread(requesterThreadFunc, sock_fd));
+    if (!requestTimerRunning) {
+        requestTimerRunning = true;
+        requestTimerThread = std::thread(requestTimerThreadFunc);
+    }
+    MMW_LOG_INFO(MMW_LOG_CONNECTION, "Requester connected to broker at {}:{}", hostname, brokerPort);
+    return true;
+}
+
+/**
+ * Send a request, the handler runs exactly once unless sending fails
+ */
+static MmwResult requestInternal(const char* service, const void* request, size_t size, int timeoutMs, ReplyHandler handler) {
+    if (!service || (!request && size > 0) || !g_serializer) {
+        return MMW_ERROR;
     }
-    publisherTopicToSocketFdMap.clear();
 
-    // Close subscriber sockets
-    for (auto& pair : subscriberTopicToSocketFdMap) {
-        int sock_fd = pair.second;
-        if (sock_fd != -1) {
-            MmwMessage msg{0, "unregister", pair.first, ""};
-            if (sendMessage(sock_fd, g_serializer->serialize(msg))) {
-                spdlog::error("Failed to unregister subscriber for topic {}", pair.first);
+    int sock_fd;
+    uint32_t correlationId;
+    {
+        std::lock_guard<std::mutex> lock(requestMutex);
+        if (!ensureRequesterLocked()) {
+            return MMW_ERROR;
+        }
+        sock_fd = requestSocket;
+
+        // Registered before sending, the reply may arrive before sendMessage returns
+        do {
+            correlationId = nextCorrelationId++;
+        } while (correlationId == 0 || pendingReplies.count(correlationId) != 0);
+        PendingReply& pending = pendingReplies[correlationId];
+        pending.handler = std::move(handler);
+        pending.deadline = std::chrono::steady_clock::time_point::max();
+        if (timeoutMs >= 0) {
+            pending.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+            bool earliest = replyDeadlines.empty() || pending.deadline < replyDeadlines.begin()->first;
+            replyDeadlines.emplace(pending.deadline, correlationId);
+            if (earliest) {
+                requestTimerCv.notify_one();
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(20));
-            SocketAbstraction::SocketClose(sock_fd);
-            spdlog::info("Subscriber socket closed for topic: {}", pair.first);
         }
     }
-    subscriberTopicToSocketFdMap.clear();
 
-    // Stop subscriber threads
+    MmwMessage msg{correlationId, "request", service, ""};
+    msg.payload_raw = const_cast<void*>(request);
+    msg.size = size;
+    msg.rawPayload = true;
+
+    MmwResult result;
+    try {
+        result = sendRawMessage(sock_fd, msg);
+    } catch (const std::exception& e) {
+        MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Request serialization failed for {}: {}", service, e.what());
+        result = MMW_ERROR;
+    }
+
+    // A lost connection may already have failed the request through its handler
+    if (result == MMW_ERROR) {
+        PendingReply dropped;
+        std::lock_guard<std::mutex> lock(requestMutex);
+        if (takePendingReply(correlationId, dropped)) {
+            return MMW_ERROR;
+        }
+    }
+    return MMW_OK;
+}
+
+MmwResult mmw_request(const char* service, const void* request, size_t size, void** reply, size_t* replySize, int timeoutMs) {
+    if (!reply || !replySize) {
+        return MMW_ERROR;
+    }
+    *reply = nullptr;
+    *replySize = 0;
+
+    struct Outcome {
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool done = false;
+        MmwResult result = MMW_ERROR;
+        std::string payload;
+    };
+    std::shared_ptr<Outcome> outcome = std::make_shared<Outcome>();
+
+    MmwResult sent = requestInternal(service, request, size, timeoutMs, [outcome](MmwResult result, const char* payload, size_t len) {
+        std::lock_guard<std::mutex> lock(outcome->mtx);
+        outcome->result = result;
+        outcome->payload.assign(payload, len);
+        outcome->done = true;
+        outcome->cv.notify_one();
+    });
+    if (sent != MMW_OK) {
+        return sent;
+    }
+
+    // The handler always runs, on a reply, a timeout or a lost connection
+    std::unique_lock<std::mutex> lock(outcome->mtx);
+    outcome->cv.wait(lock, [&outcome]() { return outcome->done; });
+    if (outcome->result != MMW_OK) {
+        MMW_LOG_DEBUG(MMW_LOG_CONNECTION, "Request to {} failed: {}", service, outcome->payload);
+        return MMW_ERROR;
+    }
+
+    *reply = malloc(outcome->payload.size() + 1);
+    if (!*reply) {
+        return MMW_ERROR;
+    }
+    memcpy(*reply, outcome->payload.data(), outcome->payload.size());
+    static_cast<char*>(*reply)[outcome->payload.size()] = '\0';
+    *replySize = outcome->payload.size();
+    return MMW_OK;
+}
+
+MmwResult mmw_request_async(const char* service, const void* request, size_t size, int timeoutMs,
+                            MmwReplyCallback callback, void* userData) {
+    if (!callback) {
+        return MMW_ERROR;
+    }
+    return requestInternal(service, request, size, timeoutMs, [callback, userData](MmwResult result, const char* payload, size_t len) {
+        callback(result, payload, len, userData);
+    });
+}
+
+void mmw_free_reply(void* reply) {
+    free(reply);
+}
+
+// Hands each request on a server connection to the application's handler, the socket is closed by stopServer
+void serverThreadFunc(std::shared_ptr<ServerConnection> server, MmwRequestHandler handler, void* userData) {
+    PooledBuffer buf;
+    MmwMessageView msg;
+    MmwMessage backing{};
+    uint32_t msgLen = 0;
+
+    while (server->running && recvMessage(server->sock_fd, buf, msgLen)) {
+        if (msgLen == 0) {
+            continue;
+        }
+
+        try {
+            g_serializer->deserialize_view(buf.data(), msgLen, false, msg, backing);
+            if (msg.isType("request")) {
+                {
+                    std::lock_guard<std::mutex> lock(server->mtx);
+                    server->outstanding.insert(msg.messageId);
+                }
+                handler(server->service.c_str(), msg.payload, msg.size, new MmwRequest{server, msg.messageId}, userData);
+            }
+        } catch (const std::exception& e) {
+            MMW_LOG_LIMITED(MMW_LOG_CONNECTION, spdlog::level::err, 1000, "Server for {} failed to deserialize request: {}", server->service, e.what());
+        }
+
+        if (buf.capacity() > RESIDENT_BUFFER_SIZE) {
+            buf.reset();
+        }
+    }
+
+    MMW_LOG_INFO(MMW_LOG_CONNECTION, "Server thread for {} exiting", server->service);
+}
+
+/**
+ * Fail the unanswered requests, unregister and stop both threads, then close the socket
+ */
+static void stopServer(ServerConnection& server) {
+    std::vector<uint32_t> abandoned;
+    {
+        std::lock_guard<std::mutex> lock(server.mtx);
+        server.open = false;
+        abandoned.assign(server.outstanding.begin(), server.outstanding.end());
+        server.outstanding.clear();
+    }
+
+    // Requesters hear about requests the handler still holds now rather than at their timeout
+    for (uint32_t requestId : abandoned) {
+        MmwMessage error{requestId, "reply_error", server.service, "server stopped"};
+        sendMessage(server.sock_fd, g_serializer->serialize(error));
+    }
+    MmwMessage msg{0, "unregister", server.service, ""};
+    if (sendMessage(server.sock_fd, g_serializer->serialize(msg)) == MMW_ERROR) {
+        MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Failed to unregister server for {}", server.service);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // A handler may stop its own service, its thread then leaves once the handler returns
+    server.running = false;
+    SocketAbstraction::ShutdownRead(server.sock_fd);
+    if (server.reader.get_id() == std::this_thread::get_id()) {
+        server.reader.detach();
+    } else if (server.reader.joinable()) {
+        server.reader.join();
+    }
+    if (server.heartbeat.joinable()) {
+        server.heartbeat.join();
+    }
+    SocketAbstraction::SocketClose(server.sock_fd);
+}
+
+MmwResult mmw_serve(const char* service, MmwRequestHandler handler, void* userData) {
+    if (!service || !handler) {
+        return MMW_ERROR;
+    }
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        if (serverConnections.count(service) != 0) {
+            MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Already serving {}", service);
+            return MMW_ERROR;
+        }
+    }
+
+    MmwRegistration reg;
+    reg.role = "server";
+    int sock_fd = connectAndRegister(service, reg);
+    if (sock_fd == -1) {
+        return MMW_ERROR;
+    }
+
+    std::shared_ptr<ServerConnection> server = std::make_shared<ServerConnection>();
+    server->sock_fd = sock_fd;
+    server->service = service;
+    server->running = true;
+    server->open = true;
+
+    // The broker drops servers that stop sending heartbeats, like subscribers
+    server->reader = std::thread(serverThreadFunc, server, handler, userData);
+    server->heartbeat = std::thread(heartbeatThreadFunc, sock_fd, &server->running, 1000);
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        serverConnections[service] = server;
+    }
+
+    MMW_LOG_INFO(MMW_LOG_CONNECTION, "Serving {} through broker at {}:{}", service, hostname, brokerPort);
+    return MMW_OK;
+}
+
+/**
+ * Send the answer to a request and free it
+ */
+static MmwResult replyInternal(mmw_request_t request, const char* type, const void* payload, size_t size) {
+    std::unique_ptr<MmwRequest> owned(request);
+    if (!owned || (!payload && size > 0)) {
+        return MMW_ERROR;
+    }
+
+    // Held across the send so the socket cannot be closed underneath it
+    ServerConnection& server = *owned->server;
+    std::lock_guard<std::mutex> lock(server.mtx);
+    if (!server.open || server.outstanding.erase(owned->requestId) == 0) {
+        MMW_LOG_DEBUG(MMW_LOG_CONNECTION, "Dropping reply {} for {}, the service was stopped", owned->requestId, server.service);
+        return MMW_ERROR;
+    }
+
+    MmwMessage msg{owned->requestId, type, server.service, ""};
+    msg.payload_raw = const_cast<void*>(payload);
+    msg.size = size;
+    msg.rawPayload = true;
+    try {
+        return sendRawMessage(server.sock_fd, msg);
+    } catch (const std::exception& e) {
+        MMW_LOG_ERROR(MMW_LOG_CONNECTION, "Reply serialization failed for {}: {}", server.service, e.what());
+        return MMW_ERROR;
+    }
+}
+
+MmwResult mmw_reply(mmw_request_t request, const void* reply, size_t size) {
+    return replyInternal(request, "reply", reply, size);
+}
+
+MmwResult mmw_reply_error(mmw_request_t request, const char* reason) {
+    return replyInternal(request, "reply_error", reason, reason ? strlen(reason) : 0);
+}
+
+MmwResult mmw_stop_serving(const char* service) {
+    if (!service) {
+        return MMW_ERROR;
+    }
+
+    std::shared_ptr<ServerConnection> server;
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        auto it = serverConnections.find(service);
+        if (it == serverConnections.end()) {
+            return MMW_ERROR;
+        }
+        server = it->second;
+        serverConnections.erase(it);
+    }
+
+    // Requests the broker already forwarded here fail once the connection is gone
+    stopServer(*server);
+
+    MMW_LOG_INFO(MMW_LOG_CONNECTION, "Stopped serving {}", service);
+    return MMW_OK;
+}
+
+/**
+ * Sample one in oneIn publishes for tracing
+ */
+MmwResult mmw_set_trace_sampling(uint32_t oneIn) {
+    uint64_t expected = 0;
+    uint64_t base = (static_cast<uint64_t>(std::random_device()()) << 32) | 1;
+    nextTraceId.compare_exchange_strong(expected, base);
+    traceInterval = oneIn;
+    return MMW_OK;
+}
+
+/**
+ * Append received traces to a CSV file
+ */
+MmwResult mmw_set_trace_file(const char* path) {
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if (traceFile) {
+        fclose(traceFile);
+        traceFile = nullptr;
+    }
+    if (!path) {
+        return MMW_OK;
+    }
+
+    traceFile = fopen(path, "a");
+    if (!traceFile) {
+        MMW_LOG_ERROR(MMW_LOG_GENERAL, "Failed to open trace file {}", path);
+        return MMW_ERROR;
+    }
+
+    // Stage columns are nanoseconds after the publish
+    fseek(traceFile, 0, SEEK_END);
+    if (ftell(traceFile) == 0) {
+        fprintf(traceFile, "trace_id,topic,message_id");
+        for (size_t i = 0; i < MMW_TRACE_STAGE_COUNT; ++i) {
+            fprintf(traceFile, ",%s_ns", traceStageNames[i]);
+        }
+        fputc('\n', traceFile);
+    }
+    return MMW_OK;
+}
+
+/**
+ * Hand out the traces collected so far, oldest first
+ */
+size_t mmw_read_traces(MmwTraceRecord* records, size_t max) {
+    if (!records) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(traceMutex);
+    size_t n = std::min(max, traceRecords.size());
+    std::copy(traceRecords.begin(), traceRecords.begin() + n, records);
+    traceRecords.erase(traceRecords.begin(), traceRecords.begin() + n);
+    return n;
+}
+
+/**
+ * Delete publisher
+ */
+MmwResult mmw_delete_publisher(const char* topic) {
+    MmwPublisher* publisher;
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        auto it = publisherTopicMap.find(topic);
+        if (it == publisherTopicMap.end()) {
+            return MMW_ERROR;
+        }
+        publisher = it->second;
+        publisherTopicMap.erase(it);
+    }
+
+    destroyPublisher(publisher);
+    return MMW_OK;
+}
+
+/**
+ * Delete publisher by handle
+ */
+MmwResult mmw_delete_publisher_handle(mmw_publisher_t publisher) {
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        auto it = std::find(publisherHandles.begin(), publisherHandles.end(), publisher);
+        if (it == publisherHandles.end()) {
+            return MMW_ERROR;
+        }
+        publisherHandles.erase(it);
+    }
+
+    destroyPublisher(publisher);
+    return MMW_OK;
+}
+
+/**
+ * Delete subscriber
+ */
+MmwResult mmw_delete_subscriber(const char* topic) {
+    if (!topic) {
+        return MMW_ERROR;
+    }
+
+    std::vector<std::shared_ptr<MmwSubscriber>> subscribers;
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        auto range = subscriberTopicMap.equal_range(topic);
+        for (auto it = range.first; it != range.second; ++it) {
+            subscribers.push_back(it->second);
+        }
+        subscriberTopicMap.erase(range.first, range.second);
+    }
+    if (subscribers.empty()) {
+        return MMW_ERROR;
+    }
+
+    for (auto& subscriber : subscribers) {
+        destroySubscriber(*subscriber);
+    }
+    return MMW_OK;
+}
+
+/**
+ * Delete one subscriber, leaving the others on its topic running
+ */
+MmwResult mmw_delete_subscriber_handle(mmw_subscriber_t handle) {
+    // Compared by address before it is dereferenced
+    std::shared_ptr<MmwSubscriber> subscriber;
     {
         std::lock_guard<std::mutex> lock(socketListMutex);
-        for (auto* flag : subscriberRunFlags) {
-            *flag = false;
+        for (auto it = subscriberTopicMap.begin(); it != subscriberTopicMap.end(); ++it) {
+            if (it->second.get() == handle) {
+                subscriber = it->second;
+                subscriberTopicMap.erase(it);
+                break;
+            }
         }
     }
+    if (!subscriber) {
+        return MMW_ERROR;
+    }
 
-    for (auto& t : subscriberThreads) {
+    destroySubscriber(*subscriber);
+    return MMW_OK;
+}
+
+/**
+ * Clean up publishers/subscribers
+ */
+MmwResult mmw_cleanup() {
+    // Send anything still sitting in the async queue before the sockets go away
+    stopAsyncSender();
+
+    // Cleanup publisher sockets
+    for (auto& pair : publisherTopicMap) {
+        destroyPublisher(pair.second);
+    }
+    publisherTopicMap.clear();
+
+    for (auto* publisher : publisherHandles) {
+        destroyPublisher(publisher);
+    }
+    publisherHandles.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(loanMutex);
+        loans.clear();
+    }
+
+    // Stop subscribers, each joins its threads before closing its socket
+    std::multimap<std::string, std::shared_ptr<MmwSubscriber>> subscribers;
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        subscribers.swap(subscriberTopicMap);
+    }
+    for (auto& pair : subscribers) {
+        destroySubscriber(*pair.second);
+    }
+
+    std::map<std::string, std::shared_ptr<ServerConnection>> servers;
+    {
+        std::lock_guard<std::mutex> lock(socketListMutex);
+        servers.swap(serverConnections);
+    }
+    for (auto& pair : servers) {
+        stopServer(*pair.second);
+        MMW_LOG_INFO(MMW_LOG_CONNECTION, "Server socket closed for service: {}", pair.first);
+    }
+
+    // Outstanding requests fail, blocked mmw_request() calls return
+    int requesterFd;
+    std::map<uint32_t, PendingReply> orphaned;
+    {
+        std::lock_guard<std::mutex> lock(requestMutex);
+        requesterFd = requestSocket;
+        requestSocket = -1;
+        orphaned.swap(pendingReplies);
+        replyDeadlines.clear();
+        requestTimerRunning = false;
+        requestTimerCv.notify_one();
+    }
+    if (requesterFd != -1) {
+        SocketAbstraction::SocketClose(requesterFd);
+    }
+    if (requestTimerThread.joinable()) {
+        requestTimerThread.join();
+    }
+    for (auto& t : requestReaderThreads) {
         if (t.joinable()) {
             t.join();
         }
     }
-    subscriberThreads.clear();
+    requestReaderThreads.clear();
+    failPendingReplies(orphaned, "closed");
 
-    // Cleanup running flags
-    for (auto* flag : subscriberRunFlags) {
-        delete flag;
+    {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        traceRecords.clear();
+        if (traceFile) {
+            fclose(traceFile);
+            traceFile = nullptr;
+        }
     }
-    subscriberRunFlags.clear();
 
     // Cleanup serializer
     if (g_serializer) {
@@ -444,6 +2220,7 @@ MmwResult mmw_cleanup() {
     }
 
     SocketAbstraction::SocketCleanup();
+    MmwLog::flush();
 
     return MMW_OK;
 }
@@ -0,0 +1,26 @@
+#include "CodecAbstraction.h"
+#include "NoneCodec.h"
+#include "Lz4Codec.h"
+
+static NoneCodec noneCodec;
+static Lz4Codec lz4Codec;
+
+static IMmwCodec* const codecs[] = { &noneCodec, &lz4Codec };
+
+IMmwCodec* GetCodec(uint8_t id) {
+    for (IMmwCodec* codec : codecs) {
+        if (codec->id() == id) {
+            return codec;
+        }
+    }
+    return nullptr;
+}
+
+IMmwCodec* GetCodec(const std::string& name) {
+    for (IMmwCodec* codec : codecs) {
+        if (name == codec->name()) {
+            return codec;
+        }
+    }
+    return nullptr;
+}
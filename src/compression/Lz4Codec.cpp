@@ -0,0 +1,152 @@
+#include "Lz4Codec.h"
+#include <cstring>
+
+// Format limits, see the class comment
+static const size_t MIN_MATCH = 4;
+static const size_t LAST_LITERALS = 5;
+static const size_t MF_LIMIT = 12;      // a match may not start in the last 12 bytes
+static const size_t MAX_OFFSET = 65535;
+static const int HASH_LOG = 12;
+
+static uint32_t read32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hashPosition(const char* p) {
+    return (read32(p) * 2654435761u) >> (32 - HASH_LOG);
+}
+
+// Write a length extension: runs of 255 followed by the remainder
+static bool putLength(char*& op, const char* end, size_t len) {
+    while (len >= 255) {
+        if (op >= end) return false;
+        *op++ = static_cast<char>(255);
+        len -= 255;
+    }
+    if (op >= end) return false;
+    *op++ = static_cast<char>(len);
+    return true;
+}
+
+static bool putSequence(char*& op, const char* end, const char* literals, size_t literalLen,
+                        size_t offset, size_t matchLen) {
+    if (op >= end) return false;
+    char* token = op++;
+    size_t matchCode = matchLen ? matchLen - MIN_MATCH : 0;
+
+    *token = static_cast<char>(((literalLen < 15 ? literalLen : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+    if (literalLen >= 15 && !putLength(op, end, literalLen - 15)) return false;
+
+    if (static_cast<size_t>(end - op) < literalLen) return false;
+    memcpy(op, literals, literalLen);
+    op += literalLen;
+
+    // The final sequence of a block is literals only
+    if (matchLen == 0) return true;
+
+    if (end - op < 2) return false;
+    *op++ = static_cast<char>(offset & 0xFF);
+    *op++ = static_cast<char>(offset >> 8);
+    if (matchCode >= 15 && !putLength(op, end, matchCode - 15)) return false;
+    return true;
+}
+
+size_t Lz4Codec::compress(const char* in, size_t len, char* out, size_t capacity) {
+    char* op = out;
+    const char* end = out + capacity;
+    size_t anchor = 0;
+
+    if (len >= MF_LIMIT + 1) {
+        // Last position seen for each hash, 0 doubles as "empty" and is verified by the compare
+        uint32_t table[1 << HASH_LOG];
+        memset(table, 0, sizeof(table));
+
+        const size_t matchLimit = len - LAST_LITERALS;
+        const size_t searchLimit = len - MF_LIMIT;
+        size_t ip = 0;
+        size_t misses = 0;
+
+        while (ip <= searchLimit) {
+            uint32_t h = hashPosition(in + ip);
+            size_t candidate = table[h];
+            table[h] = static_cast<uint32_t>(ip);
+
+            if (candidate < ip && ip - candidate <= MAX_OFFSET && read32(in + candidate) == read32(in + ip)) {
+                size_t matchLen = MIN_MATCH;
+                while (ip + matchLen < matchLimit && in[candidate + matchLen] == in[ip + matchLen]) {
+                    ++matchLen;
+                }
+
+                if (!putSequence(op, end, in + anchor, ip - anchor, ip - candidate, matchLen)) {
+                    return 0;
+                }
+                ip += matchLen;
+                anchor = ip;
+                misses = 0;
+            } else {
+                // Step faster through data that does not compress
+                ip += 1 + (misses++ >> 6);
+            }
+        }
+    }
+
+    if (!putSequence(op, end, in + anchor, len - anchor, 0, 0)) {
+        return 0;
+    }
+    return static_cast<size_t>(op - out);
+}
+
+bool Lz4Codec::decompress(const char* in, size_t len, char* out, size_t originalLen) {
+    size_t ip = 0;
+    size_t op = 0;
+
+    for (;;) {
+        if (ip >= len) return false;
+        unsigned char token = static_cast<unsigned char>(in[ip++]);
+
+        size_t literalLen = token >> 4;
+        if (literalLen == 15) {
+            unsigned char b;
+            do {
+                if (ip >= len) return false;
+                b = static_cast<unsigned char>(in[ip++]);
+                literalLen += b;
+            } while (b == 255);
+        }
+
+        if (literalLen > len - ip || literalLen > originalLen - op) return false;
+        memcpy(out + op, in + ip, literalLen);
+        ip += literalLen;
+        op += literalLen;
+
+        if (ip == len) break;
+
+        if (len - ip < 2) return false;
+        size_t offset = static_cast<unsigned char>(in[ip]) | (static_cast<unsigned char>(in[ip + 1]) << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) return false;
+
+        size_t matchLen = token & 0x0F;
+        if (matchLen == 15) {
+            unsigned char b;
+            do {
+                if (ip >= len) return false;
+                b = static_cast<unsigned char>(in[ip++]);
+                matchLen += b;
+            } while (b == 255);
+        }
+        matchLen += MIN_MATCH;
+        if (matchLen > originalLen - op) return false;
+
+        // Matches may overlap their own output, so copy forwards byte by byte
+        const char* match = out + op - offset;
+        for (size_t i = 0; i < matchLen; ++i) {
+            out[op + i] = match[i];
+        }
+        op += matchLen;
+    }
+
+    return op == originalLen;
+}
@@ -0,0 +1,18 @@
+#include "NoneCodec.h"
+#include <cstring>
+
+size_t NoneCodec::compress(const char* in, size_t len, char* out, size_t capacity) {
+    if (len > capacity) {
+        return 0;
+    }
+    memcpy(out, in, len);
+    return len;
+}
+
+bool NoneCodec::decompress(const char* in, size_t len, char* out, size_t originalLen) {
+    if (len != originalLen) {
+        return false;
+    }
+    memcpy(out, in, len);
+    return true;
+}
@@ -1,5 +1,9 @@
 #include "SocketAbstraction.h"
 
+#if defined(__linux__)
+#include <linux/sockios.h>
+#endif
+
 int SocketAbstraction::SocketStartup() {
 #if defined(_WIN32)
     WSADATA wsaData;
@@ -19,6 +23,15 @@ int SocketAbstraction::SocketClose(int s) {
 #endif
 }
 
+// Wakes a thread blocked receiving on the socket while leaving the descriptor to its owner
+int SocketAbstraction::ShutdownRead(int s) {
+#if defined(_WIN32)
+    return shutdown(s, SD_RECEIVE);
+#else
+    return shutdown(s, SHUT_RD);
+#endif
+}
+
 int SocketAbstraction::SocketCleanup() {
 #if defined(_WIN32)
     return WSACleanup();
@@ -51,6 +64,81 @@ int SocketAbstraction::Send(int s, const void* buf, int32_t len, int32_t flags)
     return totalSent;
 }
 
+int SocketAbstraction::SendV(int s, const SocketBuffer* bufs, int count) {
+    if (count <= 0 || count > MAX_SEND_BUFFERS) return -1;
+
+    // Gather every buffer into a single syscall, resuming after partial writes
+#if defined(_WIN32)
+    WSABUF wsaBufs[MAX_SEND_BUFFERS];
+    int64_t total = 0;
+    for (int i = 0; i < count; ++i) {
+        wsaBufs[i].buf = (char*)bufs[i].data;
+        wsaBufs[i].len = (ULONG)bufs[i].len;
+        total += bufs[i].len;
+    }
+
+    WSABUF* cur = wsaBufs;
+    DWORD remaining = (DWORD)count;
+    int64_t totalSent = 0;
+    while (totalSent < total) {
+        DWORD n = 0;
+        if (WSASend(s, cur, remaining, &n, 0, NULL, NULL) != 0 || n == 0) return -1;
+        totalSent += n;
+        while (n > 0 && remaining > 0) {
+            if (n >= cur->len) {
+                n -= cur->len;
+                ++cur;
+                --remaining;
+            } else {
+                cur->buf += n;
+                cur->len -= n;
+                n = 0;
+            }
+        }
+    }
+    return (int)totalSent;
+#else
+    struct iovec iov[MAX_SEND_BUFFERS];
+    int64_t total = 0;
+    for (int i = 0; i < count; ++i) {
+        iov[i].iov_base = (void*)bufs[i].data;
+        iov[i].iov_len = bufs[i].len;
+        total += bufs[i].len;
+    }
+
+#if defined(__APPLE__)
+    int set = 1;
+    setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, (void*)&set, sizeof(int));
+#endif
+
+    struct msghdr hdr = {};
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = count;
+    int64_t totalSent = 0;
+    while (totalSent < total) {
+    #if defined(__linux__)
+        ssize_t n = sendmsg(s, &hdr, MSG_NOSIGNAL);
+    #else
+        ssize_t n = sendmsg(s, &hdr, 0);
+    #endif
+        if (n <= 0) return (int)n;
+        totalSent += n;
+        while (n > 0 && hdr.msg_iovlen > 0) {
+            if ((size_t)n >= hdr.msg_iov->iov_len) {
+                n -= hdr.msg_iov->iov_len;
+                ++hdr.msg_iov;
+                --hdr.msg_iovlen;
+            } else {
+                hdr.msg_iov->iov_base = (char*)hdr.msg_iov->iov_base + n;
+                hdr.msg_iov->iov_len -= n;
+                n = 0;
+            }
+        }
+    }
+    return (int)totalSent;
+#endif
+}
+
 int SocketAbstraction::Recv(int s, void* buf, int32_t len, int32_t flags) {
     char* ptr = (char*)buf;
     int32_t totalRecv = 0;
@@ -75,3 +163,50 @@ int SocketAbstraction::SetSockOpt(int s, int level, int optname, const char* opt
     // Cast to (const char*) for Windows compatibility, (const void*) for POSIX
     return setsockopt(s, level, optname, (const char*)optval, optlen);
 }
+
+int SocketAbstraction::BytesAvailable(int s) {
+    // Number of bytes that can be read without blocking
+#if defined(_WIN32)
+    u_long available = 0;
+    if (ioctlsocket(s, FIONREAD, &available) != 0) return -1;
+#else
+    int available = 0;
+    if (ioctl(s, FIONREAD, &available) != 0) return -1;
+#endif
+    return (int)available;
+}
+
+int SocketAbstraction::BytesUnsent(int s) {
+    // Bytes written but not yet acknowledged by the peer, -1 where the platform cannot tell
+#if defined(__linux__)
+    int unsent = 0;
+    if (ioctl(s, SIOCOUTQ, &unsent) != 0) return -1;
+    return unsent;
+#elif defined(__APPLE__)
+    int unsent = 0;
+    socklen_t len = sizeof(unsent);
+    if (getsockopt(s, SOL_SOCKET, SO_NWRITE, &unsent, &len) != 0) return -1;
+    return unsent;
+#else
+    return -1;
+#endif
+}
+
+int SocketAbstraction::SetNoDelay(int s) {
+    // Disable Nagle so small control frames (acks, confirms) are not held back
+    int flag = 1;
+    return setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag));
+}
+
+int SocketAbstraction::SetRecvTimeout(int s, int timeoutMs) {
+    // A timeout of 0 makes receives block indefinitely again
+#if defined(_WIN32)
+    DWORD timeout = (DWORD)timeoutMs;
+    return setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+#else
+    struct timeval tv;
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+    return setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+#endif
+}
@@ -0,0 +1,310 @@
+#include "Base64.h"
+#include <cstdint>
+#include <stdexcept>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define MMW_BASE64_SIMD
+    #define MMW_TARGET(isa) __attribute__((target(isa)))
+    #include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #define MMW_BASE64_SIMD
+    #define MMW_TARGET(isa)
+    #include <immintrin.h>
+    #include <intrin.h>
+#endif
+
+static const char ENCODE_TABLE[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Bulk loops advance i and o over whole blocks and leave the tail to the scalar code
+typedef void (*EncodeBlocks)(const unsigned char* in, size_t len, char* out, size_t& i, size_t& o);
+typedef void (*DecodeBlocks)(const char* in, size_t len, char* out, size_t& i, size_t& o);
+
+struct Base64Impl {
+    const char* name;
+    EncodeBlocks encode;
+    DecodeBlocks decode;
+};
+
+struct DecodeTable {
+    int8_t values[256];
+
+    DecodeTable() {
+        for (int c = 0; c < 256; ++c) {
+            values[c] = -1;
+        }
+        for (int v = 0; v < 64; ++v) {
+            values[static_cast<unsigned char>(ENCODE_TABLE[v])] = static_cast<int8_t>(v);
+        }
+    }
+};
+
+static const DecodeTable decodeTable;
+
+static void encodeScalar(const unsigned char* in, size_t len, char* out, size_t& i, size_t& o) {
+    for (; len - i >= 3; i += 3, o += 4) {
+        uint32_t v = (uint32_t)in[i] << 16 | (uint32_t)in[i + 1] << 8 | in[i + 2];
+        out[o] = ENCODE_TABLE[v >> 18];
+        out[o + 1] = ENCODE_TABLE[(v >> 12) & 0x3F];
+        out[o + 2] = ENCODE_TABLE[(v >> 6) & 0x3F];
+        out[o + 3] = ENCODE_TABLE[v & 0x3F];
+    }
+}
+
+// Stops at the first quad that is not four alphabet characters, the caller reports it
+static void decodeScalar(const char* in, size_t len, char* out, size_t& i, size_t& o) {
+    for (; len - i >= 4; i += 4, o += 3) {
+        int a = decodeTable.values[static_cast<unsigned char>(in[i])];
+        int b = decodeTable.values[static_cast<unsigned char>(in[i + 1])];
+        int c = decodeTable.values[static_cast<unsigned char>(in[i + 2])];
+        int d = decodeTable.values[static_cast<unsigned char>(in[i + 3])];
+        if ((a | b | c | d) < 0) {
+            return;
+        }
+        uint32_t v = (uint32_t)a << 18 | (uint32_t)b << 12 | (uint32_t)c << 6 | (uint32_t)d;
+        out[o] = static_cast<char>(v >> 16);
+        out[o + 1] = static_cast<char>(v >> 8);
+        out[o + 2] = static_cast<char>(v);
+    }
+}
+
+#ifdef MMW_BASE64_SIMD
+
+// The vector loops follow the well known pshufb formulation: each 32-bit lane
+// holds three input bytes, and multiplies move the four 6-bit fields into
+// their own bytes (or back) without per-byte shifts. Character classes are
+// resolved with 16-entry shuffle tables indexed by nibble.
+
+MMW_TARGET("ssse3")
+static inline __m128i encodeTranslate128(__m128i indices) {
+    const __m128i offsets = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    __m128i cls = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    cls = _mm_sub_epi8(cls, _mm_cmpgt_epi8(indices, _mm_set1_epi8(25)));
+    return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, cls));
+}
+
+MMW_TARGET("ssse3")
+static void encodeSsse3(const unsigned char* in, size_t len, char* out, size_t& i, size_t& o) {
+    const __m128i spread = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+
+    // Each step reads 16 bytes and consumes 12
+    for (; len - i >= 16; i += 12, o += 16) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), spread);
+        __m128i hi = _mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        __m128i lo = _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + o), encodeTranslate128(_mm_or_si128(hi, lo)));
+    }
+}
+
+MMW_TARGET("ssse3")
+static void decodeSsse3(const char* in, size_t len, char* out, size_t& i, size_t& o) {
+    const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+
+    // Each step stores 16 bytes and produces 12, keeping 24 input characters in
+    // hand guarantees the extra 4 land inside the output and leaves padding to the scalar code
+    for (; len - i >= 24; i += 16, o += 12) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(v, 4), nibble);
+        __m128i loNibbles = _mm_and_si128(v, nibble);
+        __m128i invalid = _mm_and_si128(_mm_shuffle_epi8(lutLo, loNibbles), _mm_shuffle_epi8(lutHi, hiNibbles));
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(invalid, _mm_setzero_si128())) != 0) {
+            return;
+        }
+
+        __m128i isSlash = _mm_cmpeq_epi8(v, _mm_set1_epi8('/'));
+        v = _mm_add_epi8(v, _mm_shuffle_epi8(lutRoll, _mm_add_epi8(isSlash, hiNibbles)));
+
+        v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+        v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + o), _mm_shuffle_epi8(v, pack));
+    }
+}
+
+MMW_TARGET("avx2")
+static inline __m256i encodeTranslate256(__m256i indices) {
+    const __m256i offsets = _mm256_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+                                             65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    __m256i cls = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    cls = _mm256_sub_epi8(cls, _mm256_cmpgt_epi8(indices, _mm256_set1_epi8(25)));
+    return _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, cls));
+}
+
+MMW_TARGET("avx2")
+static void encodeAvx2(const unsigned char* in, size_t len, char* out, size_t& i, size_t& o) {
+    const __m256i spread = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+
+    // Two 12-byte groups, one per 128-bit lane, the second load reads 4 bytes past the 24 consumed
+    for (; len - i >= 28; i += 24, o += 32) {
+        __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+        v = _mm256_shuffle_epi8(v, spread);
+        __m256i hi = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)),
+                                        _mm256_set1_epi32(0x04000040));
+        __m256i lo = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)),
+                                        _mm256_set1_epi32(0x01000010));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + o), encodeTranslate256(_mm256_or_si256(hi, lo)));
+    }
+}
+
+MMW_TARGET("avx2")
+static void decodeAvx2(const char* in, size_t len, char* out, size_t& i, size_t& o) {
+    const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                           0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                           0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                           0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                           0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                             0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+    // Stores 32 bytes and produces 24, same reasoning as the SSSE3 loop
+    for (; len - i >= 48; i += 32, o += 24) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(v, 4), nibble);
+        __m256i loNibbles = _mm256_and_si256(v, nibble);
+        __m256i invalid = _mm256_and_si256(_mm256_shuffle_epi8(lutLo, loNibbles),
+                                           _mm256_shuffle_epi8(lutHi, hiNibbles));
+        if (_mm256_movemask_epi8(_mm256_cmpgt_epi8(invalid, _mm256_setzero_si256())) != 0) {
+            return;
+        }
+
+        __m256i isSlash = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/'));
+        v = _mm256_add_epi8(v, _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(isSlash, hiNibbles)));
+
+        v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+        v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, pack), gather);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + o), v);
+    }
+}
+
+static bool cpuHasAvx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osSavesYmm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5));
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static bool cpuHasSsse3() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+#endif // MMW_BASE64_SIMD
+
+static Base64Impl selectImpl() {
+#ifdef MMW_BASE64_SIMD
+    if (cpuHasAvx2()) {
+        Base64Impl impl = { "avx2", encodeAvx2, decodeAvx2 };
+        return impl;
+    }
+    if (cpuHasSsse3()) {
+        Base64Impl impl = { "ssse3", encodeSsse3, decodeSsse3 };
+        return impl;
+    }
+#endif
+    Base64Impl impl = { "scalar", encodeScalar, decodeScalar };
+    return impl;
+}
+
+static const Base64Impl& impl() {
+    static const Base64Impl selected = selectImpl();
+    return selected;
+}
+
+const char* Base64Implementation() {
+    return impl().name;
+}
+
+void Base64Encode(const void* data, size_t len, std::string& out) {
+    const unsigned char* in = static_cast<const unsigned char*>(data);
+    out.resize(Base64EncodedSize(len));
+    if (len == 0) {
+        return;
+    }
+
+    char* dst = &out[0];
+    size_t i = 0;
+    size_t o = 0;
+    impl().encode(in, len, dst, i, o);
+    encodeScalar(in, len, dst, i, o);
+
+    // One or two bytes left over are padded to a full quad
+    if (i < len) {
+        uint32_t v = (uint32_t)in[i] << 16;
+        if (i + 1 < len) {
+            v |= (uint32_t)in[i + 1] << 8;
+        }
+        dst[o] = ENCODE_TABLE[v >> 18];
+        dst[o + 1] = ENCODE_TABLE[(v >> 12) & 0x3F];
+        dst[o + 2] = i + 1 < len ? ENCODE_TABLE[(v >> 6) & 0x3F] : '=';
+        dst[o + 3] = '=';
+    }
+}
+
+void Base64Decode(const char* data, size_t len, std::string& out) {
+    if (len % 4 != 0) {
+        throw std::runtime_error("Invalid base64 length");
+    }
+    if (len == 0) {
+        out.clear();
+        return;
+    }
+
+    size_t padding = (data[len - 1] == '=') + (data[len - 2] == '=');
+    out.resize(len / 4 * 3 - padding);
+
+    // The bulk loops stop before the padded quad, or early on a bad character
+    char* dst = &out[0];
+    size_t body = len - (padding ? 4 : 0);
+    size_t i = 0;
+    size_t o = 0;
+    impl().decode(data, body, dst, i, o);
+    decodeScalar(data, body, dst, i, o);
+    if (i != body) {
+        throw std::runtime_error("Invalid base64 character");
+    }
+
+    if (padding) {
+        int a = decodeTable.values[static_cast<unsigned char>(data[i])];
+        int b = decodeTable.values[static_cast<unsigned char>(data[i + 1])];
+        int c = padding == 1 ? decodeTable.values[static_cast<unsigned char>(data[i + 2])] : 0;
+        if ((a | b | c) < 0) {
+            throw std::runtime_error("Invalid base64 character");
+        }
+        uint32_t v = (uint32_t)a << 18 | (uint32_t)b << 12 | (uint32_t)c << 6;
+        dst[o] = static_cast<char>(v >> 16);
+        if (padding == 1) {
+            dst[o + 1] = static_cast<char>(v >> 8);
+        }
+    }
+}
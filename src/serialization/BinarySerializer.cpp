@@ -0,0 +1,274 @@
+#include "BinarySerializer.h"
+#include <cstring>
+#include <stdexcept>
+
+// Explicit little-endian encoding keeps the format identical on every host
+static void putLE(char* out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+        out[i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+}
+
+static uint64_t getLE(const char* in, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+    }
+    return value;
+}
+
+static uint8_t typeToWire(const std::string& type) {
+    if (type == "publish") return BINARY_TYPE_PUBLISH;
+    if (type == "ack") return BINARY_TYPE_ACK;
+    if (type == "nack") return BINARY_TYPE_NACK;
+    if (type == "heartbeat") return BINARY_TYPE_HEARTBEAT;
+    if (type == "register") return BINARY_TYPE_REGISTER;
+    if (type == "unregister") return BINARY_TYPE_UNREGISTER;
+    if (type == "credit") return BINARY_TYPE_CREDIT;
+    if (type == "registered") return BINARY_TYPE_REGISTERED;
+    if (type == "rejected") return BINARY_TYPE_REJECTED;
+    if (type == "request") return BINARY_TYPE_REQUEST;
+    if (type == "reply") return BINARY_TYPE_REPLY;
+    if (type == "reply_error") return BINARY_TYPE_REPLY_ERROR;
+    throw std::runtime_error("Unknown message type: " + type);
+}
+
+static const char* typeFromWire(uint8_t type) {
+    switch (type) {
+        case BINARY_TYPE_PUBLISH: return "publish";
+        case BINARY_TYPE_ACK: return "ack";
+        case BINARY_TYPE_NACK: return "nack";
+        case BINARY_TYPE_HEARTBEAT: return "heartbeat";
+        case BINARY_TYPE_REGISTER: return "register";
+        case BINARY_TYPE_UNREGISTER: return "unregister";
+        case BINARY_TYPE_CREDIT: return "credit";
+        case BINARY_TYPE_REGISTERED: return "registered";
+        case BINARY_TYPE_REJECTED: return "rejected";
+        case BINARY_TYPE_REQUEST: return "request";
+        case BINARY_TYPE_REPLY: return "reply";
+        case BINARY_TYPE_REPLY_ERROR: return "reply_error";
+        default: throw std::runtime_error("Unknown message type on the wire");
+    }
+}
+
+// Fixed header, topic and the key block of keyed messages
+size_t BinarySerializer::headerSize(const MmwMessage& msg) {
+    return HEADER_SIZE + msg.topic.size() + (msg.key.empty() ? 0 : 2 + msg.key.size());
+}
+
+size_t BinarySerializer::writeHeader(char* out, const MmwMessage& msg, uint16_t flags, size_t payloadLen) {
+    if (msg.topic.size() > 0xFFFF || msg.key.size() > MMW_MAX_KEY_SIZE || payloadLen > 0xFFFFFFFFu) {
+        throw std::runtime_error("Message too large for binary frame");
+    }
+    if (msg.reliability) {
+        flags |= BINARY_FLAG_RELIABLE;
+    }
+    if (msg.rawPayload) {
+        flags |= BINARY_FLAG_RAW;
+    }
+    if (msg.trace.id != 0) {
+        flags |= BINARY_FLAG_TRACE;
+    }
+    if (!msg.key.empty()) {
+        flags |= BINARY_FLAG_KEY;
+    }
+    flags |= static_cast<uint16_t>(msg.codec) << BINARY_FLAG_CODEC_SHIFT;
+
+    out[0] = 'M';
+    out[1] = 'W';
+    out[2] = static_cast<char>(VERSION);
+    out[3] = static_cast<char>(typeToWire(msg.type));
+    putLE(out + 4, flags, 2);
+    putLE(out + 6, msg.topic.size(), 2);
+    putLE(out + 8, msg.messageId, 8);
+    putLE(out + 16, msg.topicId, 4);
+    putLE(out + 20, payloadLen, 4);
+    memcpy(out + HEADER_SIZE, msg.topic.data(), msg.topic.size());
+
+    size_t pos = HEADER_SIZE + msg.topic.size();
+    if (!msg.key.empty()) {
+        putLE(out + pos, msg.key.size(), 2);
+        memcpy(out + pos + 2, msg.key.data(), msg.key.size());
+        pos += 2 + msg.key.size();
+    }
+    return pos;
+}
+
+// Only the stages stamped before delivery travel, the subscriber adds the rest
+size_t BinarySerializer::writeTrace(char* out, const MmwTrace& trace) {
+    if (trace.id == 0) {
+        return 0;
+    }
+    putLE(out, trace.id, 8);
+    out[8] = static_cast<char>(MMW_TRACE_WIRE_STAGES);
+    for (size_t i = 0; i < MMW_TRACE_WIRE_STAGES; ++i) {
+        putLE(out + 9 + 8 * i, trace.stamps[i], 8);
+    }
+    return TRACE_SIZE;
+}
+
+void BinarySerializer::readTrace(const BinaryFrameView& view, MmwTrace& trace) {
+    if (!view.trace) {
+        trace.id = 0;
+        return;
+    }
+    memset(&trace, 0, sizeof(trace));
+    trace.id = getLE(view.trace, 8);
+    size_t count = static_cast<uint8_t>(view.trace[8]);
+    for (size_t i = 0; i < count && i < MMW_TRACE_WIRE_STAGES; ++i) {
+        trace.stamps[i] = getLE(view.trace + 9 + 8 * i, 8);
+    }
+}
+
+std::string BinarySerializer::serialize(const MmwMessage& msg) {
+    size_t traceLen = msg.trace.id != 0 ? TRACE_SIZE : 0;
+    std::string out(headerSize(msg) + msg.payload.size() + traceLen, '\0');
+    size_t pos = writeHeader(&out[0], msg, 0, msg.payload.size());
+    memcpy(&out[pos], msg.payload.data(), msg.payload.size());
+    writeTrace(&out[pos + msg.payload.size()], msg.trace);
+    return out;
+}
+
+std::string BinarySerializer::serialize_raw(const MmwMessage& msg) {
+    size_t traceLen = msg.trace.id != 0 ? TRACE_SIZE : 0;
+    std::string out(headerSize(msg) + msg.size + traceLen, '\0');
+    size_t pos = writeHeader(&out[0], msg, BINARY_FLAG_RAW, msg.size);
+    if (msg.size > 0) {
+        memcpy(&out[pos], msg.payload_raw, msg.size);
+    }
+    writeTrace(&out[pos + msg.size], msg.trace);
+    return out;
+}
+
+bool BinarySerializer::frame_raw(const MmwMessage& msg, MmwRawFrame& frame) {
+    if (headerSize(msg) > MmwRawFrame::MAX_HEADER) {
+        return false;
+    }
+    frame.headerLen = writeHeader(frame.header, msg, BINARY_FLAG_RAW, msg.size);
+    frame.trailerLen = writeTrace(frame.trailer, msg.trace);
+    return true;
+}
+
+bool BinarySerializer::parse(const char* data, size_t len, BinaryFrameView& view) {
+    if (len < HEADER_SIZE || data[0] != 'M' || data[1] != 'W' ||
+        static_cast<uint8_t>(data[2]) != VERSION) {
+        return false;
+    }
+
+    view.type = static_cast<uint8_t>(data[3]);
+    view.flags = static_cast<uint16_t>(getLE(data + 4, 2));
+    view.topicLen = static_cast<size_t>(getLE(data + 6, 2));
+    view.messageId = getLE(data + 8, 8);
+    view.topicId = static_cast<uint32_t>(getLE(data + 16, 4));
+    view.payloadLen = static_cast<size_t>(getLE(data + 20, 4));
+
+    // The key length sits right after the topic, the rest comes from the fixed header
+    size_t keyBlock = 0;
+    view.key = nullptr;
+    view.keyLen = 0;
+    if (view.flags & BINARY_FLAG_KEY) {
+        if (len < HEADER_SIZE + view.topicLen + 2) {
+            return false;
+        }
+        view.keyLen = static_cast<size_t>(getLE(data + HEADER_SIZE + view.topicLen, 2));
+        view.key = data + HEADER_SIZE + view.topicLen + 2;
+        keyBlock = 2 + view.keyLen;
+    }
+
+    // With every length known, one comparison validates the whole frame
+    size_t bodyLen = HEADER_SIZE + view.topicLen + keyBlock + view.payloadLen;
+    view.trace = nullptr;
+    if (view.flags & BINARY_FLAG_TRACE) {
+        if (len < bodyLen + 9 || len != bodyLen + 9 + 8 * static_cast<size_t>(static_cast<uint8_t>(data[bodyLen + 8]))) {
+            return false;
+        }
+        view.trace = data + bodyLen;
+    } else if (bodyLen != len) {
+        return false;
+    }
+
+    view.topic = data + HEADER_SIZE;
+    view.payload = view.topic + view.topicLen + keyBlock;
+    return true;
+}
+
+// The ids and stamps sit at fixed offsets, so only the lengths need checking
+bool BinarySerializer::restamp(char* data, size_t len, uint32_t messageId, uint32_t topicId, const MmwTrace& trace) {
+    BinaryFrameView view;
+    if (!parse(data, len, view)) {
+        return false;
+    }
+    putLE(data + 8, messageId, 8);
+    putLE(data + 16, topicId, 4);
+    if (view.trace) {
+        char* stamps = data + (view.trace - data) + 9;
+        size_t count = static_cast<uint8_t>(view.trace[8]);
+        for (size_t i = 0; i < count && i < MMW_TRACE_WIRE_STAGES; ++i) {
+            putLE(stamps + 8 * i, trace.stamps[i], 8);
+        }
+    }
+    return true;
+}
+
+// Name the version when a peer speaks another revision of the format
+static std::string frameError(const char* data, size_t len) {
+    if (len >= 3 && data[0] == 'M' && data[1] == 'W' && static_cast<uint8_t>(data[2]) != BinarySerializer::VERSION) {
+        return "Unsupported binary frame version " + std::to_string(static_cast<uint8_t>(data[2]));
+    }
+    return "Malformed binary frame";
+}
+
+MmwMessage BinarySerializer::toMessage(const BinaryFrameView& view) {
+    MmwMessage msg{};
+    msg.messageId = static_cast<uint32_t>(view.messageId);
+    msg.type = typeFromWire(view.type);
+    msg.topic.assign(view.topic, view.topicLen);
+    msg.payload.assign(view.payload, view.payloadLen);
+    msg.size = view.payloadLen;
+    msg.reliability = (view.flags & BINARY_FLAG_RELIABLE) != 0;
+    msg.topicId = view.topicId;
+    msg.codec = static_cast<uint8_t>(view.flags >> BINARY_FLAG_CODEC_SHIFT);
+    msg.rawPayload = (view.flags & BINARY_FLAG_RAW) != 0;
+    readTrace(view, msg.trace);
+    if (view.key) {
+        msg.key.assign(view.key, view.keyLen);
+    }
+    return msg;
+}
+
+MmwMessage BinarySerializer::deserialize(const std::string& data) {
+    BinaryFrameView view;
+    if (!parse(data.data(), data.size(), view)) {
+        throw std::runtime_error(frameError(data.data(), data.size()));
+    }
+
+    return toMessage(view);
+}
+
+MmwMessage BinarySerializer::deserialize_raw(const std::string& data) {
+    return deserialize(data);
+}
+
+void BinarySerializer::deserialize_view(const char* data, size_t len, bool raw,
+                                        MmwMessageView& view, MmwMessage& backing) {
+    BinaryFrameView frame;
+    if (!parse(data, len, frame)) {
+        throw std::runtime_error(frameError(data, len));
+    }
+
+    const char* type = typeFromWire(frame.type);
+    view.messageId = static_cast<uint32_t>(frame.messageId);
+    view.type = type;
+    view.typeLen = strlen(type);
+    view.topic = frame.topic;
+    view.topicLen = frame.topicLen;
+    view.payload = frame.payload;
+    view.size = frame.payloadLen;
+    view.reliability = (frame.flags & BINARY_FLAG_RELIABLE) != 0;
+    view.topicId = frame.topicId;
+    view.codec = static_cast<uint8_t>(frame.flags >> BINARY_FLAG_CODEC_SHIFT);
+    view.rawPayload = (frame.flags & BINARY_FLAG_RAW) != 0;
+    readTrace(frame, view.trace);
+    view.key = frame.key ? frame.key : "";
+    view.keyLen = frame.keyLen;
+}
@@ -4,17 +4,83 @@
 #include <cereal/types/vector.hpp>
 #include <sstream>
 #include <cstring>
+#include <stdexcept>
+
+// Traced messages append the trace id, a stamp count and the stamps after the last field
+template <class Archive>
+static void saveTrace(Archive& ar, const MmwTrace& trace) {
+    if (trace.id == 0) {
+        return;
+    }
+    ar(trace.id, static_cast<uint8_t>(MMW_TRACE_WIRE_STAGES));
+    for (size_t i = 0; i < MMW_TRACE_WIRE_STAGES; ++i) {
+        ar(trace.stamps[i]);
+    }
+}
+
+// The key follows the trace block, keyed messages that are not traced write an empty one
+template <class Archive>
+static void saveKey(Archive& ar, const MmwMessage& msg) {
+    if (msg.key.empty()) {
+        return;
+    }
+    if (msg.trace.id == 0) {
+        ar(static_cast<uint64_t>(0), static_cast<uint8_t>(0));
+    }
+    ar(msg.key);
+}
+
+template <class Archive>
+static void loadKey(Archive& ar, std::istream& in, std::string& key) {
+    if (in.peek() == std::char_traits<char>::eof()) {
+        key.clear();
+        return;
+    }
+    ar(key);
+}
+
+template <class Archive>
+static void loadTrace(Archive& ar, std::istream& in, MmwTrace& trace) {
+    if (in.peek() == std::char_traits<char>::eof()) {
+        trace.id = 0;
+        return;
+    }
+    memset(&trace, 0, sizeof(trace));
+    uint8_t count;
+    ar(trace.id, count);
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t stamp;
+        ar(stamp);
+        if (i < MMW_TRACE_WIRE_STAGES) {
+            trace.stamps[i] = stamp;
+        }
+    }
+}
 
 std::string CerealSerializer::serialize(const MmwMessage& msg) {
     std::ostringstream oss(std::ios::binary);
     {
         cereal::BinaryOutputArchive ar(oss);
-        ar(msg.messageId, msg.type, msg.topic, msg.payload, msg.reliability);
+        ar(msg.messageId, msg.type, msg.topic, msg.payload, msg.reliability, msg.topicId, msg.codec,
+           msg.rawPayload);
+        saveTrace(ar, msg.trace);
+        saveKey(ar, msg);
     }
     return oss.str();
 }
 
 std::string CerealSerializer::serialize_raw(const MmwMessage& msg) {
+    // Build the frame around the payload with a single copy of the user's bytes
+    MmwRawFrame frame;
+    if (frame_raw(msg, frame)) {
+        std::string out;
+        out.reserve(frame.headerLen + msg.size + frame.trailerLen);
+        out.append(frame.header, frame.headerLen);
+        out.append(static_cast<const char*>(msg.payload_raw), msg.size);
+        out.append(frame.trailer, frame.trailerLen);
+        return out;
+    }
+
     std::ostringstream oss(std::ios::binary);
     {
         cereal::BinaryOutputArchive ar(oss);
@@ -25,39 +91,201 @@ std::string CerealSerializer::serialize_raw(const MmwMessage& msg) {
             static_cast<const unsigned char*>(msg.payload_raw) + msg.size
         );
 
-        ar(msg.messageId, msg.type, msg.topic, bytes, msg.reliability);
+        ar(msg.messageId, msg.type, msg.topic, bytes, msg.reliability, msg.topicId, msg.codec, true);
+        saveTrace(ar, msg.trace);
+        saveKey(ar, msg);
     }
     return oss.str();
 }
 
+// Append a value the way cereal's BinaryOutputArchive writes it: raw native bytes
+template <typename T>
+static void putBinary(char* buf, size_t& pos, const T& value) {
+    memcpy(buf + pos, &value, sizeof(value));
+    pos += sizeof(value);
+}
+
+// Strings and byte vectors are a cereal size tag followed by the bytes
+static void putSized(char* buf, size_t& pos, const std::string& str) {
+    putBinary(buf, pos, static_cast<cereal::size_type>(str.size()));
+    memcpy(buf + pos, str.data(), str.size());
+    pos += str.size();
+}
+
+static_assert(sizeof(bool) + sizeof(uint32_t) + 2 * sizeof(uint8_t) + 9 + 8 * MMW_TRACE_WIRE_STAGES +
+              sizeof(cereal::size_type) + MMW_MAX_KEY_SIZE <= MmwRawFrame::MAX_TRAILER,
+              "trailer with a trace and a key does not fit in MmwRawFrame");
+
+bool CerealSerializer::frame_raw(const MmwMessage& msg, MmwRawFrame& frame) {
+    size_t fixed = sizeof(msg.messageId) + 3 * sizeof(cereal::size_type);
+    if (fixed + msg.type.size() + msg.topic.size() > MmwRawFrame::MAX_HEADER || msg.key.size() > MMW_MAX_KEY_SIZE) {
+        return false;
+    }
+
+    // Same field order as serialize_raw, the payload bytes sit between header and trailer
+    size_t pos = 0;
+    putBinary(frame.header, pos, msg.messageId);
+    putSized(frame.header, pos, msg.type);
+    putSized(frame.header, pos, msg.topic);
+    putBinary(frame.header, pos, static_cast<cereal::size_type>(msg.size));
+    frame.headerLen = pos;
+
+    pos = 0;
+    putBinary(frame.trailer, pos, msg.reliability);
+    putBinary(frame.trailer, pos, msg.topicId);
+    putBinary(frame.trailer, pos, msg.codec);
+    putBinary(frame.trailer, pos, true);
+    if (msg.trace.id != 0) {
+        putBinary(frame.trailer, pos, msg.trace.id);
+        putBinary(frame.trailer, pos, static_cast<uint8_t>(MMW_TRACE_WIRE_STAGES));
+        for (size_t i = 0; i < MMW_TRACE_WIRE_STAGES; ++i) {
+            putBinary(frame.trailer, pos, msg.trace.stamps[i]);
+        }
+    }
+    if (!msg.key.empty()) {
+        if (msg.trace.id == 0) {
+            putBinary(frame.trailer, pos, static_cast<uint64_t>(0));
+            putBinary(frame.trailer, pos, static_cast<uint8_t>(0));
+        }
+        putSized(frame.trailer, pos, msg.key);
+    }
+    frame.trailerLen = pos;
+    return true;
+}
+
 MmwMessage CerealSerializer::deserialize(const std::string& data) {
-    MmwMessage msg;
+    MmwMessage msg{};
     std::istringstream iss(data, std::ios::binary);
     {
         cereal::BinaryInputArchive ar(iss);
-        ar(msg.messageId, msg.type, msg.topic, msg.payload, msg.reliability);
+        ar(msg.messageId, msg.type, msg.topic, msg.payload, msg.reliability, msg.topicId, msg.codec,
+           msg.rawPayload);
+        loadTrace(ar, iss, msg.trace);
+        loadKey(ar, iss, msg.key);
     }
 
     msg.size = msg.payload.size();
-    msg.payload_raw = malloc(msg.size);
-    memcpy(msg.payload_raw, msg.payload.data(), msg.size);
-
     return msg;
 }
 
 MmwMessage CerealSerializer::deserialize_raw(const std::string& data) {
-    MmwMessage msg;
+    MmwMessage msg{};
     std::istringstream iss(data, std::ios::binary);
     {
         cereal::BinaryInputArchive ar(iss);
         std::vector<unsigned char> bytes;
-        ar(msg.messageId, msg.type, msg.topic, bytes, msg.reliability);
+        ar(msg.messageId, msg.type, msg.topic, bytes, msg.reliability, msg.topicId, msg.codec,
+           msg.rawPayload);
+        loadTrace(ar, iss, msg.trace);
+        loadKey(ar, iss, msg.key);
 
         msg.size = bytes.size();
-        msg.payload_raw = malloc(msg.size);
-        memcpy(msg.payload_raw, bytes.data(), msg.size);
-
         msg.payload.assign(reinterpret_cast<const char*>(bytes.data()), msg.size);
     }
     return msg;
 }
+
+// Read a value written by putBinary, fails instead of reading past the frame
+template <typename T>
+static bool getBinary(const char* data, size_t len, size_t& pos, T& value) {
+    if (len - pos < sizeof(value)) {
+        return false;
+    }
+    memcpy(&value, data + pos, sizeof(value));
+    pos += sizeof(value);
+    return true;
+}
+
+static bool getSized(const char* data, size_t len, size_t& pos, const char*& out, size_t& outLen) {
+    cereal::size_type size;
+    if (!getBinary(data, len, pos, size) || len - pos < size) {
+        return false;
+    }
+    out = data + pos;
+    outLen = static_cast<size_t>(size);
+    pos += outLen;
+    return true;
+}
+
+void CerealSerializer::deserialize_view(const char* data, size_t len, bool raw,
+                                        MmwMessageView& view, MmwMessage& backing) {
+    // A std::string and a byte vector share the same encoding, so raw makes no difference here
+    size_t pos = 0;
+    if (!getBinary(data, len, pos, view.messageId) ||
+        !getSized(data, len, pos, view.type, view.typeLen) ||
+        !getSized(data, len, pos, view.topic, view.topicLen) ||
+        !getSized(data, len, pos, view.payload, view.size) ||
+        !getBinary(data, len, pos, view.reliability) ||
+        !getBinary(data, len, pos, view.topicId) ||
+        !getBinary(data, len, pos, view.codec) ||
+        !getBinary(data, len, pos, view.rawPayload)) {
+        throw std::runtime_error("Malformed cereal frame");
+    }
+
+    view.trace.id = 0;
+    if (pos < len) {
+        memset(&view.trace, 0, sizeof(view.trace));
+        uint8_t count;
+        if (!getBinary(data, len, pos, view.trace.id) || !getBinary(data, len, pos, count)) {
+            throw std::runtime_error("Malformed cereal trace");
+        }
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t stamp;
+            if (!getBinary(data, len, pos, stamp)) {
+                throw std::runtime_error("Malformed cereal trace");
+            }
+            if (i < MMW_TRACE_WIRE_STAGES) {
+                view.trace.stamps[i] = stamp;
+            }
+        }
+    }
+
+    view.key = "";
+    view.keyLen = 0;
+    if (pos < len && !getSized(data, len, pos, view.key, view.keyLen)) {
+        throw std::runtime_error("Malformed cereal key");
+    }
+}
+
+// Walks the frame like deserialize_view and only writes once every field is known to be in bounds
+bool CerealSerializer::restamp(char* data, size_t len, uint32_t messageId, uint32_t topicId, const MmwTrace& trace) {
+    uint32_t id;
+    const char* skipped;
+    size_t skippedLen;
+    bool flag;
+    uint8_t codec;
+    size_t pos = 0;
+    if (!getBinary(data, len, pos, id) ||
+        !getSized(data, len, pos, skipped, skippedLen) ||
+        !getSized(data, len, pos, skipped, skippedLen) ||
+        !getSized(data, len, pos, skipped, skippedLen) ||
+        !getBinary(data, len, pos, flag)) {
+        return false;
+    }
+    size_t topicIdPos = pos;
+    if (!getBinary(data, len, pos, id) || !getBinary(data, len, pos, codec) || !getBinary(data, len, pos, flag)) {
+        return false;
+    }
+
+    // Keyed messages without a trace carry an empty trace block, its id is 0
+    size_t stampsPos = 0;
+    size_t count = 0;
+    if (pos < len) {
+        uint64_t traceId;
+        uint8_t stamps;
+        if (!getBinary(data, len, pos, traceId) || !getBinary(data, len, pos, stamps) || (len - pos) / 8 < stamps) {
+            return false;
+        }
+        if (traceId != 0) {
+            stampsPos = pos;
+            count = stamps < MMW_TRACE_WIRE_STAGES ? stamps : MMW_TRACE_WIRE_STAGES;
+        }
+    }
+
+    memcpy(data, &messageId, sizeof(messageId));
+    memcpy(data + topicIdPos, &topicId, sizeof(topicId));
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(data + stampsPos + 8 * i, &trace.stamps[i], sizeof(uint64_t));
+    }
+    return true;
+}
@@ -1,28 +1,108 @@
 #include <nlohmann/json.hpp>
-#include <sstream>
 #include "JsonSerializer.h"
+#include "Base64.h"
 #include <stdexcept>
 #include <cctype>
+#include <cstring>
 
-std::string to_hex(const void* data, size_t size) {
-    auto bytes = static_cast<const unsigned char*>(data);
-    std::ostringstream oss;
-    for (size_t i = 0; i < size; ++i)
-        oss << std::hex << std::setw(2) << std::setfill('0') << (int)bytes[i];
-    return oss.str();
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    throw std::runtime_error("Invalid hex digit");
 }
 
-std::vector<unsigned char> from_hex(const std::string& hex) {
+// Decode into out, reusing whatever capacity it already has
+void from_hex(const std::string& hex, std::string& out) {
     if (hex.size() % 2 != 0)
         throw std::runtime_error("Invalid hex length");
 
-    std::vector<unsigned char> bytes;
-    bytes.reserve(hex.size() / 2);
-    for (size_t i = 0; i < hex.size(); i += 2) {
-        unsigned char byte = (std::stoi(hex.substr(i, 2), nullptr, 16) & 0xFF);
-        bytes.push_back(byte);
+    out.resize(hex.size() / 2);
+    for (size_t i = 0; i < out.size(); ++i) {
+        out[i] = static_cast<char>((hex_value(hex[2 * i]) << 4) | hex_value(hex[2 * i + 1]));
+    }
+}
+
+// Binary payloads are written as base64 with "enc":"b64". Earlier versions wrote
+// hex, marked with "enc":"hex" or, before that, not marked at all.
+enum PayloadEncoding {
+    PAYLOAD_TEXT,
+    PAYLOAD_HEX,
+    PAYLOAD_BASE64
+};
+
+static PayloadEncoding payloadEncoding(const nlohmann::json& j, bool raw, uint8_t codec) {
+    auto enc = j.find("enc");
+    if (enc == j.end()) {
+        return raw || codec != 0 ? PAYLOAD_HEX : PAYLOAD_TEXT;
+    }
+
+    const std::string& name = enc->get_ref<const std::string&>();
+    if (name == "b64") return PAYLOAD_BASE64;
+    if (name == "hex") return PAYLOAD_HEX;
+    throw std::runtime_error("Unknown payload encoding: " + name);
+}
+
+static void decodePayload(PayloadEncoding encoding, const std::string& text, std::string& out) {
+    switch (encoding) {
+        case PAYLOAD_BASE64: Base64Decode(text.data(), text.size(), out); break;
+        case PAYLOAD_HEX: from_hex(text, out); break;
+        default: out.assign(text); break;
+    }
+}
+
+// Base64 never needs escaping, so the payload is appended to the dumped object
+// rather than run through the JSON writer character by character
+static std::string dumpWithBinaryPayload(nlohmann::json& j, const void* data, size_t size) {
+    j["enc"] = "b64";
+    std::string out = j.dump();
+    out.pop_back();
+
+    static const char key[] = ",\"payload\":\"";
+    size_t start = out.size() + sizeof(key) - 1;
+    out.reserve(start + Base64EncodedSize(size) + 2);
+    out.append(key);
+
+    std::string encoded;
+    Base64Encode(data, size, encoded);
+    out.append(encoded);
+    out.append("\"}");
+    return out;
+}
+
+// Traced messages carry "trace":{"id":"<decimal>","stamps":[...]}, the id is a string like messageId
+static void writeTrace(nlohmann::json& j, const MmwTrace& trace) {
+    if (trace.id == 0) {
+        return;
+    }
+    nlohmann::json stamps = nlohmann::json::array();
+    for (size_t i = 0; i < MMW_TRACE_WIRE_STAGES; ++i) {
+        stamps.push_back(trace.stamps[i]);
+    }
+    j["trace"] = {{"id", std::to_string(trace.id)}, {"stamps", stamps}};
+}
+
+static void readTrace(const nlohmann::json& j, MmwTrace& trace) {
+    auto it = j.find("trace");
+    if (it == j.end()) {
+        trace.id = 0;
+        return;
+    }
+    memset(&trace, 0, sizeof(trace));
+    trace.id = std::stoull(it->value("id", "0"));
+    auto stamps = it->find("stamps");
+    if (stamps != it->end()) {
+        for (size_t i = 0; i < stamps->size() && i < MMW_TRACE_WIRE_STAGES; ++i) {
+            trace.stamps[i] = (*stamps)[i].get<uint64_t>();
+        }
+    }
+}
+
+// Keys are only written when set, a missing "key" reads as an unkeyed message
+static void writeKey(nlohmann::json& j, const std::string& key) {
+    if (!key.empty()) {
+        j["key"] = key;
     }
-    return bytes;
 }
 
 std::string JsonSerializer::serialize(const MmwMessage& msg) {
@@ -30,8 +110,17 @@ std::string JsonSerializer::serialize(const MmwMessage& msg) {
     j["messageId"] = std::to_string(msg.messageId);
     j["type"] = msg.type;
     j["topic"] = msg.topic;
-    j["payload"] = msg.payload;
     j["reliability"] = msg.reliability;
+    j["topicId"] = msg.topicId;
+    j["codec"] = msg.codec;
+    writeTrace(j, msg.trace);
+    writeKey(j, msg.key);
+
+    // Binary and compressed payloads cannot go into a JSON string as they are
+    if (msg.rawPayload || msg.codec != 0) {
+        return dumpWithBinaryPayload(j, msg.payload.data(), msg.payload.size());
+    }
+    j["payload"] = msg.payload;
     return j.dump();
 }
 
@@ -40,41 +129,81 @@ std::string JsonSerializer::serialize_raw(const MmwMessage& msg) {
     j["messageId"] = std::to_string(msg.messageId);
     j["type"] = msg.type;
     j["topic"] = msg.topic;
-    j["payload"] = to_hex(msg.payload_raw, msg.size);
     j["reliability"] = msg.reliability;
-    return j.dump();
+    j["topicId"] = msg.topicId;
+    j["codec"] = msg.codec;
+    writeTrace(j, msg.trace);
+    writeKey(j, msg.key);
+    return dumpWithBinaryPayload(j, msg.payload_raw, msg.size);
 }
 
 MmwMessage JsonSerializer::deserialize(const std::string& data) {
-    MmwMessage msg;
+    MmwMessage msg{};
     auto j = nlohmann::json::parse(data);
     msg.messageId = std::stoul(j.value("messageId", ""));
     msg.type = j.value("type", "");
     msg.topic = j.value("topic", "");
-    msg.payload = j.value("payload", "");
     msg.reliability = j.value("reliability", false);
+    msg.topicId = j.value("topicId", 0u);
+    msg.codec = j.value("codec", (uint8_t)0);
+    PayloadEncoding encoding = payloadEncoding(j, false, msg.codec);
+    msg.rawPayload = encoding != PAYLOAD_TEXT;
+    decodePayload(encoding, j.value("payload", ""), msg.payload);
+    msg.size = msg.payload.size();
+    readTrace(j, msg.trace);
+    msg.key = j.value("key", "");
 
     return msg;
 }
 
 MmwMessage JsonSerializer::deserialize_raw(const std::string& data) {
-    MmwMessage msg;
+    MmwMessage msg{};
     auto j = nlohmann::json::parse(data);
 
     msg.messageId = std::stoul(j.value("messageId", ""));
     msg.type = j.value("type", "");
     msg.topic = j.value("topic", "");
     msg.reliability = j.value("reliability", false);
+    msg.topicId = j.value("topicId", 0u);
+    msg.codec = j.value("codec", (uint8_t)0);
+    PayloadEncoding encoding = payloadEncoding(j, true, msg.codec);
+    msg.rawPayload = encoding != PAYLOAD_TEXT;
+    decodePayload(encoding, j.value("payload", ""), msg.payload);
+    msg.size = msg.payload.size();
+    readTrace(j, msg.trace);
+    msg.key = j.value("key", "");
+
+    return msg;
+}
 
-    std::string payloadHex = j.value("payload", "");
-    std::vector<unsigned char> bytes = from_hex(payloadHex);
+void JsonSerializer::deserialize_view(const char* data, size_t len, bool raw,
+                                      MmwMessageView& view, MmwMessage& backing) {
+    // JSON has to be decoded, assign() into backing keeps its string capacity between messages
+    auto j = nlohmann::json::parse(data, data + len);
 
-    msg.size = bytes.size();
-    msg.payload_raw = malloc(msg.size);
-    memcpy(msg.payload_raw, bytes.data(), msg.size);
+    backing.messageId = std::stoul(j.value("messageId", ""));
+    backing.type.assign(j.value("type", ""));
+    backing.topic.assign(j.value("topic", ""));
+    backing.reliability = j.value("reliability", false);
+    backing.topicId = j.value("topicId", 0u);
+    backing.codec = j.value("codec", (uint8_t)0);
+    PayloadEncoding encoding = payloadEncoding(j, raw, backing.codec);
+    backing.rawPayload = encoding != PAYLOAD_TEXT;
 
-    // optional: also store as string
-    msg.payload.assign(reinterpret_cast<char*>(bytes.data()), msg.size);
+    auto payload = j.find("payload");
+    if (payload == j.end() || !payload->is_string()) {
+        backing.payload.clear();
+    } else {
+        decodePayload(encoding, payload->get_ref<const std::string&>(), backing.payload);
+    }
+    backing.size = backing.payload.size();
+    readTrace(j, backing.trace);
+    auto key = j.find("key");
+    if (key == j.end() || !key->is_string()) {
+        backing.key.clear();
+    } else {
+        backing.key.assign(key->get_ref<const std::string&>());
+    }
 
-    return msg;
+    view.assign(backing);
 }
@@ -1,17 +1,61 @@
-#include "IMmwMessageSerializer.h"
+#include "SerializerAbstraction.h"
+#include "CerealSerializer.h"
+#include "JsonSerializer.h"
+#include "BinarySerializer.h"
 
-#if defined(CEREAL_SERIALIZER)
-    #include "CerealSerializer.h"
-#elif defined(JSON_SERIALIZER)
-    #include "JsonSerializer.h"
-#else
+#if !defined(CEREAL_SERIALIZER) && !defined(JSON_SERIALIZER) && !defined(BINARY_SERIALIZER)
     #error "Invalid serializer provided"
 #endif
 
-IMmwMessageSerializer* CreateSerializer() {
+MmwSerializerFormat DefaultSerializerFormat() {
 #if defined(CEREAL_SERIALIZER)
-    return new CerealSerializer();
+    return MMW_SERIALIZER_CEREAL;
 #elif defined(JSON_SERIALIZER)
-    return new JsonSerializer();
+    return MMW_SERIALIZER_JSON;
+#elif defined(BINARY_SERIALIZER)
+    return MMW_SERIALIZER_BINARY;
 #endif
 }
+
+IMmwMessageSerializer* CreateSerializer() {
+    return CreateSerializer(DefaultSerializerFormat());
+}
+
+IMmwMessageSerializer* CreateSerializer(MmwSerializerFormat format) {
+    switch (format) {
+        case MMW_SERIALIZER_CEREAL: return new CerealSerializer();
+        case MMW_SERIALIZER_JSON: return new JsonSerializer();
+        case MMW_SERIALIZER_BINARY: return new BinarySerializer();
+        default: return nullptr;
+    }
+}
+
+bool DetectSerializerFormat(const char* data, size_t len, MmwSerializerFormat& format) {
+    if (len == 0) {
+        return false;
+    }
+
+    // Binary frames carry a magic and version
+    if (len >= BinarySerializer::HEADER_SIZE && data[0] == 'M' && data[1] == 'W' &&
+        static_cast<uint8_t>(data[2]) == BinarySerializer::VERSION) {
+        format = MMW_SERIALIZER_BINARY;
+        return true;
+    }
+
+    // JSON is an object
+    size_t i = 0;
+    while (i < len && (data[i] == ' ' || data[i] == '\t' || data[i] == '\r' || data[i] == '\n')) {
+        ++i;
+    }
+    if (i < len && data[i] == '{') {
+        format = MMW_SERIALIZER_JSON;
+        return true;
+    }
+
+    // Cereal has no marker, but a registration starts with message id 0
+    if (len >= sizeof(uint32_t) && data[0] == 0 && data[1] == 0 && data[2] == 0 && data[3] == 0) {
+        format = MMW_SERIALIZER_CEREAL;
+        return true;
+    }
+    return false;
+}
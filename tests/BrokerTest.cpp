@@ -0,0 +1,200 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <poll.h>
+#include "TestSupport.h"
+#include "LocalBroker.h"
+#include "MMW.h"
+#include "SerializerAbstraction.h"
+
+/**
+ * Broker behaviour that needs a running broker, started next to this test
+ * (Linux). Connections the client library would never open, such as a
+ * subscriber that stops reading or a publisher sending corrupt payloads, are
+ * raw sockets speaking the wire protocol.
+ */
+static const int TEST_PORT = 5790;
+
+static int connectRaw(int receiveBuffer = 0) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    // Set before connecting so the window stays small
+    if (receiveBuffer > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    }
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)TEST_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool sendFrame(int fd, const std::string& frame) {
+    uint32_t len = htonl((uint32_t)frame.size());
+    return send(fd, &len, sizeof(len), MSG_NOSIGNAL) == (ssize_t)sizeof(len) &&
+           send(fd, frame.data(), frame.size(), MSG_NOSIGNAL) == (ssize_t)frame.size();
+}
+
+// False when nothing arrives within timeoutMs or the connection is gone
+static bool recvFrame(int fd, std::string& frame, int timeoutMs) {
+    pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, timeoutMs) <= 0) {
+        return false;
+    }
+    uint32_t len;
+    if (recv(fd, &len, sizeof(len), MSG_WAITALL) != (ssize_t)sizeof(len)) {
+        return false;
+    }
+    frame.resize(ntohl(len));
+    return frame.empty() || recv(fd, &frame[0], frame.size(), MSG_WAITALL) == (ssize_t)frame.size();
+}
+
+static bool registerRaw(int fd, IMmwMessageSerializer& serializer, const std::string& topic, const std::string& registration) {
+    MmwMessage msg{0, "register", topic, registration};
+    std::string reply;
+    return sendFrame(fd, serializer.serialize(msg)) && recvFrame(fd, reply, 5000) &&
+           serializer.deserialize(reply).type == "registered";
+}
+
+// First key, in the order tried, that lands in the partition
+static std::string keyFor(uint32_t partition, uint32_t partitions) {
+    for (int i = 0;; ++i) {
+        std::string key = "key-" + std::to_string(i);
+        if (MmwKeyHash(key.data(), key.size()) % partitions == partition) {
+            return key;
+        }
+    }
+}
+
+static MmwMessage keyedPublish(uint32_t seq, const std::string& topic, const std::string& key, const std::string& payload) {
+    MmwMessage msg{seq, "publish", topic, payload};
+    msg.size = payload.size();
+    msg.key = key;
+    return msg;
+}
+
+// A confirm-mode publisher's ack never covers a message still queued in another partition.
+// Partition 0 is held up by a subscriber that stops reading, the publisher's first message
+// waits there while the rest go through partition 1.
+static void testConfirmOrderingAcrossPartitions() {
+    const std::string topic = "test/confirm_order";
+    const uint32_t count = 20;
+    const int fillerCount = 128;
+    std::unique_ptr<IMmwMessageSerializer> serializer(CreateSerializer());
+    std::string blocked = keyFor(0, 2);
+    std::string open = keyFor(1, 2);
+
+    int stuck = connectRaw(4096);
+    int filler = connectRaw();
+    int confirmed = connectRaw();
+    CHECK(stuck >= 0 && filler >= 0 && confirmed >= 0);
+    CHECK(registerRaw(stuck, *serializer, topic, "subscriber;partitions=2;partition_list=0"));
+    CHECK(registerRaw(filler, *serializer, topic, "publisher;partitions=2"));
+    CHECK(registerRaw(confirmed, *serializer, topic, "publisher;confirm=routed;partitions=2"));
+
+    // Far more than the socket buffers hold, the broker ends up blocked sending to the stuck subscriber
+    std::thread fill([&] {
+        std::string frame = serializer->serialize(keyedPublish(1, topic, blocked, std::string(256 * 1024, 'f')));
+        for (int i = 0; i < fillerCount; ++i) {
+            sendFrame(filler, frame);
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    sendFrame(confirmed, serializer->serialize(keyedPublish(1, topic, blocked, "first")));
+    for (uint32_t seq = 2; seq <= count; ++seq) {
+        sendFrame(confirmed, serializer->serialize(keyedPublish(seq, topic, open, "next")));
+    }
+
+    std::string frame;
+    bool early = recvFrame(confirmed, frame, 1000);
+    CHECK(!early);
+    if (early) {
+        MmwMessage reply = serializer->deserialize(frame);
+        fprintf(stderr, "confirm before the first message was routed: %s %u\n", reply.type.c_str(), reply.messageId);
+    }
+
+    // Once the subscriber reads again everything is confirmed at once
+    int delivered = 0;
+    while (delivered < fillerCount + 1 && recvFrame(stuck, frame, 5000)) {
+        ++delivered;
+    }
+    CHECK(delivered == fillerCount + 1);
+    MmwMessage ack{};
+    while (ack.messageId != count && recvFrame(confirmed, frame, 5000)) {
+        ack = serializer->deserialize(frame);
+        CHECK(ack.type == "ack");
+    }
+    CHECK(ack.messageId == count);
+
+    fill.join();
+    close(stuck);
+    close(filler);
+    close(confirmed);
+}
+
+static std::atomic<int> g_received{0};
+
+static void countMessage(const char*, const void*, size_t, void*) {
+    g_received++;
+}
+
+// A subscriber hands back the credit of frames it fails to decode, or a few bad
+// payloads would stall it for good
+static void testCreditAfterDecodeFailure() {
+    const std::string topic = "test/credit_decode";
+    const int count = 10;
+    std::unique_ptr<IMmwMessageSerializer> serializer(CreateSerializer());
+
+    CHECK(mmw_set_subscriber_credit(4, 0) == MMW_OK);
+    MmwSubscriberOptions options = {};
+    CHECK(mmw_create_subscriber_sized(topic.c_str(), countMessage, &options) == MMW_OK);
+
+    int publisher = connectRaw();
+    CHECK(publisher >= 0);
+    CHECK(registerRaw(publisher, *serializer, topic, "publisher"));
+
+    // Claims 100 bytes of LZ4 data, the literal run it starts runs past the end
+    char corrupt[] = "\x64\x00\x00\x00\xF0\xFF\xFF\x10" "abc";
+    char valid[8] = "payload";
+    for (int i = 0; i < 2 * count; ++i) {
+        bool bad = i < count;
+        MmwMessage msg{(uint32_t)i + 1, "publish", topic, ""};
+        msg.payload_raw = bad ? corrupt : valid;
+        msg.size = bad ? sizeof(corrupt) - 1 : sizeof(valid);
+        msg.codec = bad ? MMW_CODEC_LZ4 : MMW_CODEC_NONE;
+        CHECK(sendFrame(publisher, serializer->serialize_raw(msg)));
+    }
+
+    for (int i = 0; i < 50 && g_received < count; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    CHECK(g_received == count);
+
+    close(publisher);
+    mmw_delete_subscriber(topic.c_str());
+    mmw_set_subscriber_credit(0, 0);
+}
+
+int main(int argc, char* argv[]) {
+    LocalBroker broker;
+    if (!startLocalBroker(argc > 1 ? argv[1] : defaultBrokerPath(), TEST_PORT, broker)) {
+        return 1;
+    }
+    if (mmw_initialize("127.0.0.1", TEST_PORT) != MMW_OK) {
+        stopLocalBroker(broker);
+        return 1;
+    }
+
+    testConfirmOrderingAcrossPartitions();
+    testCreditAfterDecodeFailure();
+
+    mmw_cleanup();
+    stopLocalBroker(broker);
+    return testResult();
+}
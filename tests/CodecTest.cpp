@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include "TestSupport.h"
+#include "MMW.h"
+#include "CodecAbstraction.h"
+
+// Deterministic filler so a failure reproduces
+static std::string randomBytes(size_t len, unsigned seed) {
+    srand(seed);
+    std::string out(len, '\0');
+    for (size_t i = 0; i < len; ++i) {
+        out[i] = static_cast<char>(rand() & 0xFF);
+    }
+    return out;
+}
+
+static std::string repeatedText(size_t len) {
+    static const char text[] = "position=12.5,velocity=0.25,heading=270;";
+    std::string out;
+    while (out.size() < len) {
+        out.append(text, std::min(sizeof(text) - 1, len - out.size()));
+    }
+    return out;
+}
+
+static std::string compress(IMmwCodec& codec, const std::string& in) {
+    std::string out(codec.maxCompressedSize(in.size()), '\0');
+    size_t n = codec.compress(in.data(), in.size(), &out[0], out.size());
+    CHECK(n > 0);
+    out.resize(n);
+    return out;
+}
+
+static bool decompress(IMmwCodec& codec, const std::string& in, size_t originalLen, std::string& out) {
+    // One spare byte behind the output catches writes past originalLen
+    out.assign(originalLen + 1, '\x5A');
+    bool ok = codec.decompress(in.data(), in.size(), &out[0], originalLen);
+    CHECK(out[originalLen] == '\x5A');
+    out.resize(originalLen);
+    return ok;
+}
+
+static void testLookup() {
+    CHECK(GetCodec(MMW_CODEC_NONE) && GetCodec(MMW_CODEC_NONE)->id() == MMW_CODEC_NONE);
+    CHECK(GetCodec(MMW_CODEC_LZ4) && GetCodec(MMW_CODEC_LZ4)->id() == MMW_CODEC_LZ4);
+    CHECK(GetCodec("lz4") == GetCodec(MMW_CODEC_LZ4));
+    CHECK(GetCodec("zstd") == nullptr);
+    CHECK(GetCodec(static_cast<uint8_t>(200)) == nullptr);
+}
+
+static void testRoundTrips() {
+    IMmwCodec& lz4 = *GetCodec(MMW_CODEC_LZ4);
+    const size_t sizes[] = {0, 1, 4, 12, 13, 64, 1000, 70000, 1 << 20};
+    for (size_t len : sizes) {
+        std::vector<std::string> inputs;
+        inputs.push_back(std::string(len, '\0'));
+        inputs.push_back(repeatedText(len));
+        inputs.push_back(randomBytes(len, static_cast<unsigned>(len)));
+        for (const std::string& in : inputs) {
+            std::string packed = compress(lz4, in);
+            CHECK(packed.size() <= lz4.maxCompressedSize(in.size()));
+            std::string out;
+            CHECK(decompress(lz4, packed, in.size(), out));
+            CHECK(out == in);
+        }
+    }
+
+    // Repetitive data has to actually shrink
+    std::string text = repeatedText(64 * 1024);
+    CHECK(compress(lz4, text).size() < text.size() / 4);
+}
+
+static void testSmallOutputBuffer() {
+    IMmwCodec& lz4 = *GetCodec(MMW_CODEC_LZ4);
+    std::string in = randomBytes(4096, 7);
+    std::string out(in.size() / 2, '\0');
+    CHECK(lz4.compress(in.data(), in.size(), &out[0], out.size()) == 0);
+}
+
+// Corrupt input must be refused without writing outside the output buffer
+static void testCorruptInput() {
+    IMmwCodec& lz4 = *GetCodec(MMW_CODEC_LZ4);
+    std::string in = repeatedText(5000);
+    std::string packed = compress(lz4, in);
+    std::string out;
+
+    // Every truncation
+    for (size_t len = 0; len < packed.size(); ++len) {
+        CHECK(!decompress(lz4, packed.substr(0, len), in.size(), out));
+    }
+
+    // A declared size that does not match the data
+    CHECK(!decompress(lz4, packed, in.size() - 1, out));
+    CHECK(!decompress(lz4, packed, in.size() + 1, out));
+
+    // A match reaching back before the start of the output
+    std::string farOffset("\x40" "abcd" "\xFF\xFF", 7);
+    CHECK(!decompress(lz4, farOffset, 100, out));
+    std::string zeroOffset("\x40" "abcd" "\x00\x00", 7);
+    CHECK(!decompress(lz4, zeroOffset, 100, out));
+
+    // A literal run longer than the input
+    std::string longLiterals("\xF0\xFF\xFF\x10" "abc", 7);
+    CHECK(!decompress(lz4, longLiterals, 1000, out));
+
+    // Random garbage may happen to decode, but never past originalLen
+    for (unsigned seed = 1; seed <= 2000; ++seed) {
+        std::string garbage = randomBytes(1 + seed % 200, seed);
+        decompress(lz4, garbage, seed % 300, out);
+    }
+}
+
+int main() {
+    testLookup();
+    testRoundTrips();
+    testSmallOutputBuffer();
+    testCorruptInput();
+    return testResult();
+}
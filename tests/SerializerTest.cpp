@@ -0,0 +1,215 @@
+#include <string>
+#include <cstring>
+#include <memory>
+#include "TestSupport.h"
+#include "SerializerAbstraction.h"
+#include "BinarySerializer.h"
+
+// Every field a serializer carries, optionally with a key and a trace block
+static MmwMessage sampleMessage(bool keyed, bool traced) {
+    MmwMessage msg{};
+    msg.messageId = 4242;
+    msg.type = "publish";
+    msg.topic = "sensors/imu";
+    for (int i = 0; i < 256; ++i) {
+        msg.payload.push_back(static_cast<char>(i));
+    }
+    msg.size = msg.payload.size();
+    msg.reliability = true;
+    msg.topicId = 17;
+    msg.codec = MMW_CODEC_LZ4;
+    msg.rawPayload = true;
+    if (keyed) {
+        msg.key = "robot-7";
+    }
+    if (traced) {
+        msg.trace.id = 0x1122334455667788ull;
+        for (size_t i = 0; i < MMW_TRACE_WIRE_STAGES; ++i) {
+            msg.trace.stamps[i] = 1000 + i;
+        }
+    }
+    return msg;
+}
+
+static void checkSame(const MmwMessage& expected, const MmwMessage& actual) {
+    CHECK(actual.messageId == expected.messageId);
+    CHECK(actual.type == expected.type);
+    CHECK(actual.topic == expected.topic);
+    CHECK(actual.payload == expected.payload);
+    CHECK(actual.reliability == expected.reliability);
+    CHECK(actual.topicId == expected.topicId);
+    CHECK(actual.codec == expected.codec);
+    CHECK(actual.key == expected.key);
+    CHECK(actual.trace.id == expected.trace.id);
+    if (expected.trace.id != 0) {
+        CHECK(memcmp(actual.trace.stamps, expected.trace.stamps, MMW_TRACE_WIRE_STAGES * sizeof(uint64_t)) == 0);
+    }
+}
+
+static void checkView(const MmwMessage& expected, const MmwMessageView& view) {
+    MmwMessage copy = view.toMessage();
+    checkSame(expected, copy);
+}
+
+static void roundTrip(IMmwMessageSerializer& serializer, bool keyed, bool traced) {
+    MmwMessage msg = sampleMessage(keyed, traced);
+
+    std::string frame = serializer.serialize(msg);
+    checkSame(msg, serializer.deserialize(frame));
+
+    MmwMessageView view;
+    MmwMessage backing{};
+    serializer.deserialize_view(frame.data(), frame.size(), false, view, backing);
+    checkView(msg, view);
+
+    // The raw path takes the payload from payload_raw and must decode to the same message
+    MmwMessage raw = msg;
+    raw.payload_raw = &msg.payload[0];
+    raw.payload.clear();
+    std::string rawFrame = serializer.serialize_raw(raw);
+    MmwMessage decoded = serializer.deserialize_raw(rawFrame);
+    checkSame(msg, decoded);
+    CHECK(decoded.rawPayload);
+    serializer.deserialize_view(rawFrame.data(), rawFrame.size(), true, view, backing);
+    checkView(msg, view);
+}
+
+static void testRoundTrips() {
+    for (size_t f = 0; f < SERIALIZER_FORMAT_COUNT; ++f) {
+        std::unique_ptr<IMmwMessageSerializer> serializer(CreateSerializer(static_cast<MmwSerializerFormat>(f)));
+        for (int variant = 0; variant < 4; ++variant) {
+            roundTrip(*serializer, (variant & 1) != 0, (variant & 2) != 0);
+        }
+    }
+}
+
+// Control messages have no payload and text payloads are not raw. A registration
+// is a connection's first frame, the broker tells the format from it.
+static void testTextMessages() {
+    for (size_t f = 0; f < SERIALIZER_FORMAT_COUNT; ++f) {
+        MmwSerializerFormat format = static_cast<MmwSerializerFormat>(f);
+        std::unique_ptr<IMmwMessageSerializer> serializer(CreateSerializer(format));
+        MmwMessage msg{0, "register", "orders", "subscriber;credit_msgs=4"};
+        std::string frame = serializer->serialize(msg);
+        MmwSerializerFormat detected;
+        CHECK(DetectSerializerFormat(frame.data(), frame.size(), detected) && detected == format);
+
+        MmwMessage decoded = serializer->deserialize(frame);
+        CHECK(decoded.type == "register");
+        CHECK(decoded.payload == msg.payload);
+        CHECK(!decoded.rawPayload);
+
+        MmwMessage ack{99, "ack", "orders", ""};
+        decoded = serializer->deserialize(serializer->serialize(ack));
+        CHECK(decoded.messageId == 99);
+        CHECK(decoded.payload.empty());
+    }
+}
+
+// Every prefix of a valid frame and a frame with trailing bytes are rejected
+static void testTruncatedBinaryFrames() {
+    BinarySerializer serializer;
+    for (int variant = 0; variant < 4; ++variant) {
+        std::string frame = serializer.serialize(sampleMessage((variant & 1) != 0, (variant & 2) != 0));
+        BinaryFrameView view;
+        CHECK(BinarySerializer::parse(frame.data(), frame.size(), view));
+        for (size_t len = 0; len < frame.size(); ++len) {
+            CHECK(!BinarySerializer::parse(frame.data(), len, view));
+            CHECK_THROWS(serializer.deserialize(frame.substr(0, len)));
+        }
+        std::string longer = frame + '\0';
+        CHECK(!BinarySerializer::parse(longer.data(), longer.size(), view));
+    }
+}
+
+// Length fields that point past the end of the frame must not be followed
+static void testCorruptBinaryLengths() {
+    BinarySerializer serializer;
+    std::string frame = serializer.serialize(sampleMessage(true, true));
+    BinaryFrameView view;
+
+    std::string bigTopic = frame;
+    bigTopic[6] = static_cast<char>(0xFF);
+    bigTopic[7] = static_cast<char>(0xFF);
+    CHECK(!BinarySerializer::parse(bigTopic.data(), bigTopic.size(), view));
+
+    std::string bigPayload = frame;
+    bigPayload[23] = static_cast<char>(0x7F);
+    CHECK(!BinarySerializer::parse(bigPayload.data(), bigPayload.size(), view));
+
+    std::string manyStamps = frame;
+    manyStamps[manyStamps.size() - 8 * MMW_TRACE_WIRE_STAGES - 1] = static_cast<char>(200);
+    CHECK(!BinarySerializer::parse(manyStamps.data(), manyStamps.size(), view));
+}
+
+static void testUnsupportedBinaryVersion() {
+    BinarySerializer serializer;
+    std::string frame = serializer.serialize(sampleMessage(false, false));
+    frame[2] = static_cast<char>(BinarySerializer::VERSION + 1);
+    try {
+        serializer.deserialize(frame);
+        CHECK(!"a frame of another version was accepted");
+    } catch (const std::exception& e) {
+        CHECK(std::string(e.what()).find("Unsupported binary frame version") != std::string::npos);
+    }
+}
+
+static void testTruncatedCerealFrames() {
+    std::unique_ptr<IMmwMessageSerializer> serializer(CreateSerializer(MMW_SERIALIZER_CEREAL));
+    std::string frame = serializer->serialize(sampleMessage(false, false));
+    MmwMessageView view;
+    MmwMessage backing{};
+    for (size_t len = 0; len < frame.size(); ++len) {
+        CHECK_THROWS(serializer->deserialize_view(frame.data(), len, false, view, backing));
+    }
+}
+
+// The broker forwards frames restamped in place, everything but the ids and stamps must survive
+static void testRestamp() {
+    MmwTrace trace{};
+    for (size_t i = 0; i < MMW_TRACE_WIRE_STAGES; ++i) {
+        trace.stamps[i] = 5000 + i;
+    }
+    for (size_t f = 0; f < SERIALIZER_FORMAT_COUNT; ++f) {
+        MmwSerializerFormat format = static_cast<MmwSerializerFormat>(f);
+        std::unique_ptr<IMmwMessageSerializer> serializer(CreateSerializer(format));
+        for (int variant = 0; variant < 4; ++variant) {
+            MmwMessage msg = sampleMessage((variant & 1) != 0, (variant & 2) != 0);
+            std::string frame = serializer->serialize(msg);
+            std::string original = frame;
+            bool restamped = serializer->restamp(&frame[0], frame.size(), 77, 3, trace);
+            if (format == MMW_SERIALIZER_JSON) {
+                CHECK(!restamped);
+                CHECK(frame == original);
+                continue;
+            }
+            CHECK(restamped);
+            msg.messageId = 77;
+            msg.topicId = 3;
+            if (msg.trace.id != 0) {
+                memcpy(msg.trace.stamps, trace.stamps, MMW_TRACE_WIRE_STAGES * sizeof(uint64_t));
+            }
+            checkSame(msg, serializer->deserialize(frame));
+        }
+    }
+
+    // A frame that does not parse is left as it was
+    BinarySerializer binary;
+    std::string frame = binary.serialize(sampleMessage(true, true));
+    for (size_t len = 0; len < frame.size(); ++len) {
+        std::string prefix = frame.substr(0, len);
+        CHECK(!binary.restamp(&prefix[0], prefix.size(), 77, 3, trace));
+        CHECK(prefix == frame.substr(0, len));
+    }
+}
+
+int main() {
+    testRoundTrips();
+    testTextMessages();
+    testTruncatedBinaryFrames();
+    testCorruptBinaryLengths();
+    testUnsupportedBinaryVersion();
+    testTruncatedCerealFrames();
+    testRestamp();
+    return testResult();
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdio>
+#include <exception>
+
+/**
+ * Minimal checks for the test executables.
+ *
+ * A failed check is reported with its location and the test keeps going, so
+ * one run lists every failure. main() returns testResult(), which ctest takes
+ * as the verdict.
+ */
+static int g_testFailures = 0;
+
+#define CHECK(cond)                                                                    \
+    do {                                                                               \
+        if (!(cond)) {                                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);   \
+            ++g_testFailures;                                                          \
+        }                                                                              \
+    } while (0)
+
+#define CHECK_THROWS(expr)                                                             \
+    do {                                                                               \
+        bool threw = false;                                                            \
+        try {                                                                          \
+            (void)(expr);                                                              \
+        } catch (const std::exception&) {                                              \
+            threw = true;                                                              \
+        }                                                                              \
+        if (!threw) {                                                                  \
+            fprintf(stderr, "%s:%d: no exception from: %s\n", __FILE__, __LINE__, #expr); \
+            ++g_testFailures;                                                          \
+        }                                                                              \
+    } while (0)
+
+inline int testResult() {
+    if (g_testFailures != 0) {
+        fprintf(stderr, "%d check(s) failed\n", g_testFailures);
+        return 1;
+    }
+    return 0;
+}